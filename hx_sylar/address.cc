@@ -9,6 +9,7 @@
 #include <memory>
 #include <sstream>
 
+#include "dns.h"
 #include "endian.h"
 #include "log.h"
 
@@ -90,6 +91,31 @@ auto Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
   if (node.empty()) {
     node = host;
   }
+
+  // 数字端口的 IP 地址先交给内置解析器, 它处理不了的再走 getaddrinfo
+  bool numeric_service =
+      service == nullptr ||
+      (*service != '\0' && strspn(service, "0123456789") == strlen(service));
+  if (numeric_service &&
+      (family == AF_INET || family == AF_INET6 || family == AF_UNSPEC)) {
+    std::vector<IPAddress::ptr> addrs;
+    DnsResolver::Status status =
+        DnsMgr::GetInstance()->resolve(node, family, addrs);
+    if (status == DnsResolver::OK) {
+      uint16_t port = service ? std::atoi(service) : 0;
+      for (auto& addr : addrs) {
+        addr->setPort(port);
+        result.push_back(addr);
+      }
+      return true;
+    }
+    if (status == DnsResolver::NOT_FOUND) {
+      HX_LOG_DEBUG(g_logger) << "Address::Lookup(" << host << ", " << family
+                             << ") not found";
+      return false;
+    }
+  }
+
   int error = getaddrinfo(node.c_str(), service, &hints, &results);
   if (error != 0) {
     HX_LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", "
@@ -0,0 +1,139 @@
+#include "affinity.h"
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "log.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+auto Affinity::ParseCpuList(const std::string& str) -> std::vector<int> {
+  std::vector<int> cpus;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    int first = 0;
+    int last = 0;
+    char dash = 0;
+    std::stringstream range(item);
+    if (!(range >> first) || first < 0) {
+      continue;
+    }
+    last = first;
+    if (range >> dash && (dash != '-' || !(range >> last) || last < first)) {
+      continue;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+auto Affinity::FormatCpuList(const std::vector<int>& cpus) -> std::string {
+  std::stringstream ss;
+  for (size_t i = 0; i < cpus.size();) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      ++j;
+    }
+    if (i != 0) {
+      ss << ",";
+    }
+    ss << cpus[i];
+    if (j != i) {
+      ss << "-" << cpus[j];
+    }
+    i = j + 1;
+  }
+  return ss.str();
+}
+
+auto Affinity::NodeCount() -> int {
+  std::ifstream ifs("/sys/devices/system/node/online");
+  std::string line;
+  if (!std::getline(ifs, line)) {
+    return 1;
+  }
+  std::vector<int> nodes = ParseCpuList(line);
+  return nodes.empty() ? 1 : nodes.back() + 1;
+}
+
+auto Affinity::NodeCpus(int node) -> std::vector<int> {
+  std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) +
+                    "/cpulist");
+  std::string line;
+  if (std::getline(ifs, line)) {
+    return ParseCpuList(line);
+  }
+  // 没有 NUMA 支持时整机是节点 0
+  if (node == 0 && NodeCount() == 1) {
+    std::ifstream online("/sys/devices/system/cpu/online");
+    if (std::getline(online, line)) {
+      return ParseCpuList(line);
+    }
+  }
+  return {};
+}
+
+auto Affinity::CpuNode(int cpu) -> int {
+  int nodes = NodeCount();
+  for (int node = 0; node < nodes; ++node) {
+    std::vector<int> cpus = NodeCpus(node);
+    if (std::binary_search(cpus.begin(), cpus.end(), cpu)) {
+      return node;
+    }
+  }
+  return 0;
+}
+
+auto Affinity::BindThread(const std::vector<int>& cpus) -> bool {
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    HX_LOG_WARN(g_logger) << "sched_setaffinity(" << FormatCpuList(cpus)
+                          << ") errno=" << errno << " " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+auto Affinity::PreferNode(int node) -> bool {
+  if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8)) {
+    return false;
+  }
+  unsigned long mask = 1UL << node;
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) !=
+      0) {
+    // 内核没有编进 NUMA 时是 ENOSYS, 不算错误
+    if (errno != ENOSYS) {
+      HX_LOG_WARN(g_logger) << "set_mempolicy(node=" << node
+                            << ") errno=" << errno << " " << strerror(errno);
+    }
+    return false;
+  }
+  return true;
+}
+
+auto Affinity::CurrentCpu() -> int { return sched_getcpu(); }
+
+}  // namespace hx_sylar
@@ -0,0 +1,53 @@
+/**
+ * @file affinity.h
+ * @brief CPU 亲和性和 NUMA 节点
+ * @details 直接读 /sys/devices/system 并调用 sched_setaffinity、set_mempolicy,
+ *          不依赖 libnuma. 内核没有 NUMA 支持时整机视为节点 0
+ */
+#ifndef __HX_AFFINITY_H__
+#define __HX_AFFINITY_H__
+
+#include <string>
+#include <vector>
+
+namespace hx_sylar {
+
+class Affinity {
+ public:
+  /**
+   * @brief 解析 "0-3,8,10-11" 形式的 CPU 列表
+   * @details 与 /sys 下 cpulist 文件的格式相同, 格式错误的片段被忽略
+   */
+  static auto ParseCpuList(const std::string& str) -> std::vector<int>;
+
+  /// 把 CPU 列表格式化成 "0-3,8" 的形式
+  static auto FormatCpuList(const std::vector<int>& cpus) -> std::string;
+
+  /// NUMA 节点数, 至少为 1
+  static auto NodeCount() -> int;
+
+  /// 节点上在线的 CPU, 节点不存在时为空
+  static auto NodeCpus(int node) -> std::vector<int>;
+
+  /// CPU 所在的节点, 不知道时返回 0
+  static auto CpuNode(int cpu) -> int;
+
+  /**
+   * @brief 把当前线程绑到这些 CPU 上
+   * @return 列表为空或者系统调用失败时返回 false
+   */
+  static auto BindThread(const std::vector<int>& cpus) -> bool;
+
+  /**
+   * @brief 当前线程之后首次访问的内存优先从 node 上分配
+   * @details set_mempolicy(MPOL_PREFERRED), 节点内存不够时退回其他节点
+   */
+  static auto PreferNode(int node) -> bool;
+
+  /// 当前线程正在运行的 CPU
+  static auto CurrentCpu() -> int;
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -0,0 +1,104 @@
+#include "channel.h"
+
+#include <algorithm>
+
+#include "clock.h"
+
+namespace hx_sylar {
+
+void ChannelBase::close() {
+  Spinlock::Lock lock(m_mutex);
+  if (m_closed) {
+    return;
+  }
+  m_closed = true;
+  m_senders.notifyAll();
+  m_receivers.notifyAll();
+  notifyWatchers();
+}
+
+auto ChannelBase::isClosed() -> bool {
+  Spinlock::Lock lock(m_mutex);
+  return m_closed;
+}
+
+void ChannelBase::addWatcher(FiberSemaphore* sem) {
+  Spinlock::Lock lock(m_mutex);
+  m_watchers.push_back(sem);
+}
+
+void ChannelBase::delWatcher(FiberSemaphore* sem) {
+  Spinlock::Lock lock(m_mutex);
+  auto it = std::find(m_watchers.begin(), m_watchers.end(), sem);
+  if (it != m_watchers.end()) {
+    m_watchers.erase(it);
+  }
+}
+
+void ChannelBase::notifyWatchers() {
+  for (auto* sem : m_watchers) {
+    sem->notify();
+  }
+}
+
+auto ChannelBase::Deadline(uint64_t timeout_ms) -> uint64_t {
+  if (timeout_ms == ~0ull) {
+    return ~0ull;
+  }
+  return Clock::NowMS() + timeout_ms;
+}
+
+auto ChannelBase::Remaining(uint64_t deadline) -> uint64_t {
+  if (deadline == ~0ull) {
+    return ~0ull;
+  }
+  uint64_t now = Clock::NowMS();
+  return now >= deadline ? 0 : deadline - now;
+}
+
+auto ChannelSelect::tryOnce() -> int {
+  size_t n = m_cases.size();
+  for (size_t i = 0; i < n; ++i) {
+    size_t idx = (m_next + i) % n;
+    if (m_cases[idx].run()) {
+      m_next = idx + 1;
+      return static_cast<int>(idx);
+    }
+  }
+  return -1;
+}
+
+auto ChannelSelect::wait(uint64_t timeout_ms) -> int {
+  int idx = tryOnce();
+  if (idx >= 0 || timeout_ms == 0) {
+    return idx;
+  }
+  uint64_t deadline =
+      timeout_ms == ~0ull ? ~0ull : Clock::NowMS() + timeout_ms;
+  // 挂起期间其他线程会 notify, 共享栈协程的栈那时被别的协程占着, 不能放在栈上
+  auto sem = std::make_shared<FiberSemaphore>();
+  for (auto& c : m_cases) {
+    c.channel->addWatcher(sem.get());
+  }
+  // 先登记再重试, 登记之后的状态变化都会 notify sem
+  while ((idx = tryOnce()) < 0) {
+    uint64_t timeout = ~0ull;
+    if (deadline != ~0ull) {
+      uint64_t now = Clock::NowMS();
+      if (now >= deadline) {
+        break;
+      }
+      timeout = deadline - now;
+    }
+    if (!sem->waitFor(timeout)) {
+      idx = tryOnce();
+      break;
+    }
+  }
+  for (auto& c : m_cases) {
+    c.channel->delWatcher(sem.get());
+  }
+  return idx;
+}
+
+}  // namespace hx_sylar
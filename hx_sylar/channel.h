@@ -0,0 +1,322 @@
+/**
+ * @file channel.h
+ * @brief 协程间通信的 Channel
+ * @details 类似 Go 的 channel, 发送方在缓冲区满、接收方在缓冲区空时
+ *          只挂起当前协程. 关闭后仍可以读完缓冲区中剩余的数据.
+ *          缓冲区未满/非空时只持有一次 Spinlock, 没有等待者就不会触发调度.
+ *          ChannelSelect 可以同时等待多个 channel.
+ */
+#ifndef __HX_CHANNEL_H__
+#define __HX_CHANNEL_H__
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "fiber_mutex.h"
+#include "log.h"
+#include "macro.h"
+#include "noncopyable.h"
+#include "util.h"
+
+namespace hx_sylar {
+
+/**
+ * @brief Channel 中与元素类型无关的部分
+ */
+class ChannelBase : Noncopyable {
+ public:
+  /// 无界 channel 的容量
+  static const size_t kUnbounded = ~static_cast<size_t>(0);
+
+  explicit ChannelBase(size_t capacity)
+      : m_capacity(capacity), m_senders(m_mutex), m_receivers(m_mutex) {
+    HX_ASSERT1(capacity > 0, "channel capacity must be positive");
+  }
+
+  virtual ~ChannelBase() = default;
+
+  /**
+   * @brief 关闭 channel, 唤醒所有等待者
+   * @details 关闭后发送都失败, 接收在缓冲区读完后失败
+   */
+  void close();
+
+  /**
+   * @brief 是否已关闭
+   */
+  auto isClosed() -> bool;
+
+  /**
+   * @brief 缓冲区容量
+   */
+  auto getCapacity() const -> size_t { return m_capacity; }
+
+  /**
+   * @brief 登记一个 select 等待者, channel 状态变化时 notify
+   */
+  void addWatcher(FiberSemaphore* sem);
+
+  /**
+   * @brief 撤销 addWatcher
+   */
+  void delWatcher(FiberSemaphore* sem);
+
+ protected:
+  /// 发送/接收/关闭后通知 select 等待者, 需要持有 m_mutex
+  void notifyWatchers();
+
+  /// 计算剩余的等待时间, ~0ull 表示不超时
+  static auto Remaining(uint64_t deadline) -> uint64_t;
+
+  /// 超时时间转换为截止时间
+  static auto Deadline(uint64_t timeout_ms) -> uint64_t;
+
+ protected:
+  /// 容量
+  size_t m_capacity;
+  /// 是否已关闭
+  bool m_closed = false;
+  /// 保护所有状态
+  Spinlock m_mutex;
+  /// 等待缓冲区有空位的发送者
+  FiberWaitQueue m_senders;
+  /// 等待缓冲区有数据的接收者
+  FiberWaitQueue m_receivers;
+  /// select 等待者
+  std::vector<FiberSemaphore*> m_watchers;
+};
+
+/**
+ * @brief 协程 channel
+ * @details 默认无界, capacity 指定时缓冲区满后发送方挂起
+ */
+template <class T>
+class Channel : public ChannelBase {
+ public:
+  using ptr = std::shared_ptr<Channel>;
+  using value_type = T;
+
+  explicit Channel(size_t capacity = kUnbounded) : ChannelBase(capacity) {}
+
+  /**
+   * @brief 发送, 缓冲区满时挂起
+   * @param[in] timeout_ms 超时时间(毫秒), ~0ull 表示不超时
+   * @return 已关闭或者超时返回 false
+   */
+  auto send(const T& v, uint64_t timeout_ms = ~0ull) -> bool {
+    T tmp(v);
+    return send(std::move(tmp), timeout_ms);
+  }
+
+  auto send(T&& v, uint64_t timeout_ms = ~0ull) -> bool {
+    uint64_t deadline = Deadline(timeout_ms);
+    Spinlock::Lock lock(m_mutex);
+    while (true) {
+      if (m_closed) {
+        return false;
+      }
+      if (m_buffer.size() < m_capacity) {
+        pushLocked(std::move(v));
+        return true;
+      }
+      uint64_t remaining = Remaining(deadline);
+      if (remaining == 0) {
+        return false;
+      }
+      m_senders.prepare();
+      if (!m_senders.wait(lock, remaining)) {
+        return false;
+      }
+      lock.lock();
+    }
+  }
+
+  /**
+   * @brief 不挂起的发送, 失败时 v 保持不变
+   */
+  auto trySend(T&& v) -> bool {
+    Spinlock::Lock lock(m_mutex);
+    if (m_closed || m_buffer.size() >= m_capacity) {
+      return false;
+    }
+    pushLocked(std::move(v));
+    return true;
+  }
+
+  auto trySend(const T& v) -> bool {
+    Spinlock::Lock lock(m_mutex);
+    if (m_closed || m_buffer.size() >= m_capacity) {
+      return false;
+    }
+    pushLocked(T(v));
+    return true;
+  }
+
+  /**
+   * @brief 接收, 缓冲区空时挂起
+   * @param[out] v 收到的数据
+   * @param[in] timeout_ms 超时时间(毫秒), ~0ull 表示不超时
+   * @return 已关闭且缓冲区为空, 或者超时返回 false
+   */
+  auto recv(T& v, uint64_t timeout_ms = ~0ull) -> bool {
+    uint64_t deadline = Deadline(timeout_ms);
+    Spinlock::Lock lock(m_mutex);
+    while (true) {
+      if (!m_buffer.empty()) {
+        popLocked(v);
+        return true;
+      }
+      if (m_closed) {
+        return false;
+      }
+      uint64_t remaining = Remaining(deadline);
+      if (remaining == 0) {
+        return false;
+      }
+      m_receivers.prepare();
+      if (!m_receivers.wait(lock, remaining)) {
+        return false;
+      }
+      lock.lock();
+    }
+  }
+
+  /**
+   * @brief 不挂起的接收
+   */
+  auto tryRecv(T& v) -> bool {
+    Spinlock::Lock lock(m_mutex);
+    if (m_buffer.empty()) {
+      return false;
+    }
+    popLocked(v);
+    return true;
+  }
+
+  /**
+   * @brief 缓冲区中的元素数量
+   */
+  auto size() -> size_t {
+    Spinlock::Lock lock(m_mutex);
+    return m_buffer.size();
+  }
+
+ private:
+  void pushLocked(T&& v) {
+    m_buffer.push_back(std::move(v));
+    if (m_receivers.waiters() > 0) {
+      m_receivers.notify();
+    }
+    notifyWatchers();
+  }
+
+  void popLocked(T& v) {
+    v = std::move(m_buffer.front());
+    m_buffer.pop_front();
+    if (m_senders.waiters() > 0) {
+      m_senders.notify();
+    }
+    notifyWatchers();
+  }
+
+ private:
+  /// 缓冲区
+  std::deque<T> m_buffer;
+};
+
+/**
+ * @brief 同时等待多个 channel
+ * @details 用法:
+ *          ChannelSelect sel;
+ *          sel.recv(ch1, [](int& v, bool ok) { ... });
+ *          sel.send(ch2, 42, [](bool ok) { ... });
+ *          int idx = sel.wait(100);
+ *          已关闭的 channel 也视为就绪, 回调的 ok 为 false
+ */
+class ChannelSelect : Noncopyable {
+ public:
+  /**
+   * @brief 添加接收分支
+   * @param[in] cb 就绪时回调, channel 已关闭且为空时 ok 为 false
+   */
+  template <class T>
+  auto recv(Channel<T>& ch,
+            std::function<void(typename Channel<T>::value_type& v, bool ok)>
+                cb) -> ChannelSelect& {
+    Channel<T>* c = &ch;
+    m_cases.push_back({c, [c, cb]() {
+                         T v{};
+                         if (c->tryRecv(v)) {
+                           cb(v, true);
+                           return true;
+                         }
+                         // 关闭后不会再有新数据, 再读一次确认已经读空
+                         if (c->isClosed() && !c->tryRecv(v)) {
+                           cb(v, false);
+                           return true;
+                         }
+                         return false;
+                       }});
+    return *this;
+  }
+
+  /**
+   * @brief 添加发送分支
+   * @details 每次执行发送 v 的副本, 同一个 select 可以反复 wait
+   * @param[in] cb 就绪时回调, channel 已关闭时 ok 为 false
+   */
+  template <class T>
+  auto send(Channel<T>& ch, typename Channel<T>::value_type v,
+            std::function<void(bool ok)> cb = nullptr) -> ChannelSelect& {
+    Channel<T>* c = &ch;
+    auto value = std::make_shared<T>(std::move(v));
+    m_cases.push_back({c, [c, value, cb]() {
+                         if (c->trySend(static_cast<const T&>(*value))) {
+                           if (cb) {
+                             cb(true);
+                           }
+                           return true;
+                         }
+                         if (c->isClosed()) {
+                           if (cb) {
+                             cb(false);
+                           }
+                           return true;
+                         }
+                         return false;
+                       }});
+    return *this;
+  }
+
+  /**
+   * @brief 执行一个就绪的分支, 都未就绪时挂起
+   * @param[in] timeout_ms 超时时间(毫秒), ~0ull 表示不超时
+   * @return 执行的分支下标, 超时返回 -1
+   */
+  auto wait(uint64_t timeout_ms = ~0ull) -> int;
+
+  /**
+   * @brief 不挂起, 没有就绪分支时返回 -1
+   */
+  auto tryOnce() -> int;
+
+ private:
+  struct Case {
+    ChannelBase* channel;
+    /// 尝试执行, 未就绪返回 false
+    std::function<bool()> run;
+  };
+
+  /// 分支
+  std::vector<Case> m_cases;
+  /// 下一次从哪个分支开始尝试, 轮转避免前面的分支饿死后面的
+  size_t m_next = 0;
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -0,0 +1,150 @@
+#include "clock.h"
+
+#include <time.h>
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HX_HAVE_TSC 1
+#endif
+
+#include "config.h"
+#include "log.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+static ConfigVar<bool>::ptr g_clock_tsc = Config::Lookup<bool>(
+    "clock.tsc", false, "read the monotonic clock from the calibrated tsc");
+
+/// 本线程的缓存时间(微秒), 0 表示没有缓存
+static thread_local uint64_t t_cached_us = 0;
+
+static std::atomic<bool> s_use_tsc(false);
+
+static auto MonotonicNS() -> uint64_t {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HX_HAVE_TSC
+/// 校准结果, 只写一次, 之后 s_use_tsc 以 release 发布
+static uint64_t s_tsc_base = 0;
+static uint64_t s_tsc_base_ns = 0;
+/// 每个 tick 的纳秒数, 32 位定点
+static uint64_t s_tsc_mult = 0;
+static std::atomic<bool> s_tsc_ready(false);
+
+static auto HasInvariantTsc() -> bool {
+  unsigned int eax = 0;
+  unsigned int ebx = 0;
+  unsigned int ecx = 0;
+  unsigned int edx = 0;
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  return (edx & (1U << 8)) != 0U;
+}
+
+static void CalibrateTsc() {
+  uint64_t n0 = MonotonicNS();
+  uint64_t t0 = __rdtsc();
+  // 忙等而不是 sleep, sleep 可能被 hook 成协程切换
+  uint64_t n1 = n0;
+  while (n1 - n0 < 10 * 1000 * 1000) {
+    n1 = MonotonicNS();
+  }
+  uint64_t t1 = __rdtsc();
+  s_tsc_mult = ((n1 - n0) << 32) / (t1 - t0);
+  s_tsc_base = t1;
+  s_tsc_base_ns = n1;
+  HX_LOG_INFO(g_logger) << "tsc calibrated " << (t1 - t0) * 1000 / (n1 - n0)
+                        << " MHz";
+}
+#endif
+
+auto Clock::NowNS() -> uint64_t {
+#ifdef HX_HAVE_TSC
+  if (s_use_tsc.load(std::memory_order_acquire)) {
+    uint64_t tsc = __rdtsc();
+    // 其他核的 TSC 略慢于校准时的核时退回系统时钟
+    if (tsc >= s_tsc_base) {
+      return s_tsc_base_ns + static_cast<uint64_t>(
+                                 (static_cast<unsigned __int128>(
+                                      tsc - s_tsc_base) *
+                                  s_tsc_mult) >>
+                                 32);
+    }
+  }
+#endif
+  return MonotonicNS();
+}
+
+auto Clock::Update() -> uint64_t {
+  t_cached_us = NowUS();
+  return t_cached_us / 1000;
+}
+
+void Clock::Invalidate() { t_cached_us = 0; }
+
+auto Clock::IsCached() -> bool { return t_cached_us != 0; }
+
+auto Clock::CachedUS() -> uint64_t {
+  return t_cached_us != 0 ? t_cached_us : NowUS();
+}
+
+auto Clock::CachedMS() -> uint64_t { return CachedUS() / 1000; }
+
+auto Clock::ElapsedMS() -> uint64_t {
+  static const uint64_t s_start_ms = NowMS();
+  uint64_t now = CachedMS();
+  return now > s_start_ms ? now - s_start_ms : 0;
+}
+
+auto Clock::IsTsc() -> bool { return s_use_tsc; }
+
+auto Clock::EnableTsc(bool v) -> bool {
+  if (!v) {
+    s_use_tsc = false;
+    return true;
+  }
+#ifdef HX_HAVE_TSC
+  if (!HasInvariantTsc()) {
+    HX_LOG_WARN(g_logger) << "no invariant tsc, keep CLOCK_MONOTONIC";
+    return false;
+  }
+  static Mutex s_mutex;
+  Mutex::Lock lock(s_mutex);
+  if (!s_tsc_ready) {
+    CalibrateTsc();
+    s_tsc_ready = true;
+  }
+  s_use_tsc.store(true, std::memory_order_release);
+  return true;
+#else
+  HX_LOG_WARN(g_logger) << "tsc not supported on this arch";
+  return false;
+#endif
+}
+
+struct _ClockIniter {
+  _ClockIniter() {
+    Clock::ElapsedMS();
+    if (g_clock_tsc->getValue()) {
+      Clock::EnableTsc(true);
+    }
+    g_clock_tsc->addListener([](const bool& old_value, const bool& new_value) {
+      HX_LOG_INFO(g_logger) << "clock.tsc changed from " << old_value << " to "
+                            << new_value;
+      Clock::EnableTsc(new_value);
+    });
+  }
+};
+
+static _ClockIniter s_clock_initer;
+
+}  // namespace hx_sylar
@@ -0,0 +1,62 @@
+/**
+ * @file clock.h
+ * @brief 单调时钟和每线程缓存的当前时间
+ */
+#ifndef __HX_CLOCK_H__
+#define __HX_CLOCK_H__
+
+#include <stdint.h>
+
+namespace hx_sylar {
+
+/**
+ * @brief 单调时钟
+ * @details 从开机算起, 不受系统时间调整影响, 只用来算间隔和超时,
+ *          墙上时间仍然用 GetCurrentMS.
+ *          默认读 CLOCK_MONOTONIC(走 vDSO); clock.tsc 打开且 CPU 有不变 TSC 时
+ *          改为 rdtsc 按启动时校准的频率换算, 一次读取在几纳秒内.
+ *          IOManager 的调度线程每轮事件循环刷新一次线程局部的缓存,
+ *          定时器的创建和刷新用 CachedUS, 不再每次都读时钟.
+ */
+class Clock {
+ public:
+  /// 当前单调时间(纳秒)
+  static auto NowNS() -> uint64_t;
+  /// 当前单调时间(微秒)
+  static auto NowUS() -> uint64_t { return NowNS() / 1000; }
+  /// 当前单调时间(毫秒)
+  static auto NowMS() -> uint64_t { return NowNS() / 1000000; }
+
+  /**
+   * @brief 重新读时钟并缓存在本线程, 之后本线程的 CachedMS 返回缓存值
+   * @return 当前单调时间(毫秒)
+   */
+  static auto Update() -> uint64_t;
+
+  /// 本线程不再使用缓存, 离开事件循环时调用
+  static void Invalidate();
+
+  /// 本线程是否在使用缓存
+  static auto IsCached() -> bool;
+
+  /// 本线程缓存的单调时间(微秒), 本线程没有调用过 Update 时现读
+  static auto CachedUS() -> uint64_t;
+  /// 本线程缓存的单调时间(毫秒)
+  static auto CachedMS() -> uint64_t;
+
+  /// 进程启动以来的毫秒数
+  static auto ElapsedMS() -> uint64_t;
+
+  /// 是否正在使用 TSC
+  static auto IsTsc() -> bool;
+
+  /**
+   * @brief 打开或关闭 TSC 快速路径, 第一次打开时校准约 10ms
+   * @return CPU 没有不变 TSC 时返回 false, 继续使用 CLOCK_MONOTONIC
+   */
+  static auto EnableTsc(bool v) -> bool;
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -0,0 +1,170 @@
+#include "context.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+#include "macro.h"
+
+namespace hx_sylar {
+
+void UContext::make(void* stack, size_t size, void (*fn)()) {
+  if (getcontext(&m_ctx) != 0) {
+    HX_ASSERT1(false, "getcontext");
+  }
+  m_ctx.uc_link = nullptr;
+  m_ctx.uc_stack.ss_sp = stack;
+  m_ctx.uc_stack.ss_size = size;
+  makecontext(&m_ctx, fn, 0);
+}
+
+void UContext::Swap(UContext& from, UContext& to) {
+  if (swapcontext(&from.m_ctx, &to.m_ctx) != 0) {
+    HX_ASSERT1(false, "swap-context");
+  }
+}
+
+auto UContext::sp() const -> void* {
+#if defined(__x86_64__)
+  return reinterpret_cast<void*>(m_ctx.uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+  return reinterpret_cast<void*>(m_ctx.uc_mcontext.sp);
+#else
+  return nullptr;
+#endif
+}
+
+}  // namespace hx_sylar
+
+#ifdef HX_FIBER_HAS_ASM_CONTEXT
+
+extern "C" {
+/**
+ * @brief 保存 callee-saved 寄存器, 把栈顶写入 *from_sp, 再从 to_sp 恢复
+ */
+void hx_sylar_swap_context(void** from_sp, void* to_sp);
+/// 新上下文第一次被切入时的入口, 调用保存在寄存器里的入口函数
+void hx_sylar_context_entry();
+}
+
+#if defined(__x86_64__)
+// 栈帧(低->高): mxcsr/x87cw, r12, r13, r14, r15, rbx, rbp, 返回地址
+__asm__(
+    ".text\n"
+    ".globl hx_sylar_swap_context\n"
+    ".hidden hx_sylar_swap_context\n"
+    ".type hx_sylar_swap_context,@function\n"
+    ".align 16\n"
+    "hx_sylar_swap_context:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r15\n"
+    "  pushq %r14\n"
+    "  pushq %r13\n"
+    "  pushq %r12\n"
+    "  leaq -8(%rsp), %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  leaq 8(%rsp), %rsp\n"
+    "  popq %r12\n"
+    "  popq %r13\n"
+    "  popq %r14\n"
+    "  popq %r15\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".size hx_sylar_swap_context,.-hx_sylar_swap_context\n"
+    ".globl hx_sylar_context_entry\n"
+    ".hidden hx_sylar_context_entry\n"
+    ".type hx_sylar_context_entry,@function\n"
+    ".align 16\n"
+    "hx_sylar_context_entry:\n"
+    "  callq *%r12\n"
+    "  ud2\n"
+    ".size hx_sylar_context_entry,.-hx_sylar_context_entry\n");
+#elif defined(__aarch64__)
+// 栈帧(低->高): d8-d15, x19-x28, x29(fp), x30(lr)
+__asm__(
+    ".text\n"
+    ".globl hx_sylar_swap_context\n"
+    ".hidden hx_sylar_swap_context\n"
+    ".type hx_sylar_swap_context,%function\n"
+    ".align 4\n"
+    "hx_sylar_swap_context:\n"
+    "  sub sp, sp, #0xa0\n"
+    "  stp d8, d9, [sp, #0x00]\n"
+    "  stp d10, d11, [sp, #0x10]\n"
+    "  stp d12, d13, [sp, #0x20]\n"
+    "  stp d14, d15, [sp, #0x30]\n"
+    "  stp x19, x20, [sp, #0x40]\n"
+    "  stp x21, x22, [sp, #0x50]\n"
+    "  stp x23, x24, [sp, #0x60]\n"
+    "  stp x25, x26, [sp, #0x70]\n"
+    "  stp x27, x28, [sp, #0x80]\n"
+    "  stp x29, x30, [sp, #0x90]\n"
+    "  mov x9, sp\n"
+    "  str x9, [x0]\n"
+    "  mov sp, x1\n"
+    "  ldp d8, d9, [sp, #0x00]\n"
+    "  ldp d10, d11, [sp, #0x10]\n"
+    "  ldp d12, d13, [sp, #0x20]\n"
+    "  ldp d14, d15, [sp, #0x30]\n"
+    "  ldp x19, x20, [sp, #0x40]\n"
+    "  ldp x21, x22, [sp, #0x50]\n"
+    "  ldp x23, x24, [sp, #0x60]\n"
+    "  ldp x25, x26, [sp, #0x70]\n"
+    "  ldp x27, x28, [sp, #0x80]\n"
+    "  ldp x29, x30, [sp, #0x90]\n"
+    "  add sp, sp, #0xa0\n"
+    "  ret\n"
+    ".size hx_sylar_swap_context,.-hx_sylar_swap_context\n"
+    ".globl hx_sylar_context_entry\n"
+    ".hidden hx_sylar_context_entry\n"
+    ".type hx_sylar_context_entry,%function\n"
+    ".align 4\n"
+    "hx_sylar_context_entry:\n"
+    "  blr x19\n"
+    "  brk #0\n"
+    ".size hx_sylar_context_entry,.-hx_sylar_context_entry\n");
+#endif
+
+namespace hx_sylar {
+
+#if defined(__x86_64__)
+static const size_t kFrameSlots = 8;
+static const size_t kEntrySlot = 1;   // r12
+static const size_t kReturnSlot = 7;  // 返回地址
+#elif defined(__aarch64__)
+static const size_t kFrameSlots = 20;
+static const size_t kEntrySlot = 8;    // x19
+static const size_t kReturnSlot = 19;  // x30
+#endif
+
+void AsmContext::make(void* stack, size_t size, void (*fn)()) {
+  uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) &
+                  ~static_cast<uintptr_t>(15);
+  void** frame = reinterpret_cast<void**>(top) - kFrameSlots;
+  memset(frame, 0, kFrameSlots * sizeof(void*));
+#if defined(__x86_64__)
+  // ABI 规定的初始 MXCSR 与 x87 控制字
+  uint32_t mxcsr = 0x1F80;
+  uint16_t fpucw = 0x037F;
+  memcpy(frame, &mxcsr, sizeof(mxcsr));
+  memcpy(reinterpret_cast<char*>(frame) + 4, &fpucw, sizeof(fpucw));
+#endif
+  frame[kEntrySlot] = reinterpret_cast<void*>(fn);
+  frame[kReturnSlot] = reinterpret_cast<void*>(&hx_sylar_context_entry);
+  m_sp = frame;
+}
+
+void AsmContext::Swap(AsmContext& from, AsmContext& to) {
+  hx_sylar_swap_context(&from.m_sp, to.m_sp);
+}
+
+}  // namespace hx_sylar
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file context.h
+ * @brief 协程上下文切换后端
+ *
+ * 默认在 x86-64/aarch64 上使用手写汇编切换, 只保存 callee-saved 寄存器,
+ * 不像 swapcontext 那样每次切换都调用 rt_sigprocmask.
+ * 编译时定义 HX_FIBER_USE_UCONTEXT 可退回 ucontext 实现.
+ */
+#ifndef __HX_CONTEXT_H__
+#define __HX_CONTEXT_H__
+
+#include <ucontext.h>
+
+#include <cstddef>
+
+#if !defined(HX_FIBER_USE_UCONTEXT) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define HX_FIBER_HAS_ASM_CONTEXT 1
+#endif
+
+/// 能取得挂起时的栈指针, 共享栈模式依赖它
+#if defined(__x86_64__) || defined(__aarch64__)
+#define HX_FIBER_CONTEXT_HAS_SP 1
+#endif
+
+namespace hx_sylar {
+
+/**
+ * @brief 基于 glibc ucontext 的上下文
+ */
+class UContext {
+ public:
+  /**
+   * @brief 在给定栈上初始化上下文, 切入时从 fn 开始执行
+   * @param[in] stack 栈底地址
+   * @param[in] size 栈大小
+   * @param[in] fn 入口函数, 不允许返回
+   */
+  void make(void* stack, size_t size, void (*fn)());
+
+  /**
+   * @brief 保存当前上下文到 from, 切换到 to
+   */
+  static void Swap(UContext& from, UContext& to);
+
+  /**
+   * @brief 挂起时的栈指针, 不支持的架构返回 nullptr
+   */
+  auto sp() const -> void*;
+
+  static auto Name() -> const char* { return "ucontext"; }
+
+ private:
+  ucontext_t m_ctx;
+};
+
+#ifdef HX_FIBER_HAS_ASM_CONTEXT
+/**
+ * @brief 手写汇编实现的上下文, 只保存栈指针
+ */
+class AsmContext {
+ public:
+  /**
+   * @brief 在给定栈上初始化上下文, 切入时从 fn 开始执行
+   * @param[in] stack 栈底地址
+   * @param[in] size 栈大小
+   * @param[in] fn 入口函数, 不允许返回
+   */
+  void make(void* stack, size_t size, void (*fn)());
+
+  /**
+   * @brief 保存当前上下文到 from, 切换到 to
+   */
+  static void Swap(AsmContext& from, AsmContext& to);
+
+  /**
+   * @brief 挂起时的栈指针
+   */
+  auto sp() const -> void* { return m_sp; }
+
+  static auto Name() -> const char* { return "asm"; }
+
+ private:
+  /// 挂起时保存的栈顶, callee-saved 寄存器压在栈上
+  void* m_sp = nullptr;
+};
+
+using Context = AsmContext;
+#else
+using Context = UContext;
+#endif
+
+}  // namespace hx_sylar
+
+#endif
@@ -0,0 +1,174 @@
+#include "datagram.h"
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+
+#include "log.h"
+#include "macro.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace hx_sylar {
+
+/// UDP_GRO 收到的是 int, UDP_SEGMENT 发送的是 uint16_t, 按大的留空间
+static const size_t kControlLen = CMSG_SPACE(sizeof(int));
+static const size_t kControlStride =
+    (kControlLen + sizeof(cmsghdr) - 1) / sizeof(cmsghdr);
+
+DatagramBatch::DatagramBatch(size_t count, size_t size)
+    : m_capacity(count),
+      m_bufferSize(size),
+      m_buffer(count * size),
+      m_slots(count),
+      m_msgs(count),
+      m_addrs(count),
+      m_control(count * kControlStride) {
+  HX_ASSERT(count > 0 && size > 0);
+  m_iovs.reserve(count);
+}
+
+void DatagramBatch::clear() {
+  for (size_t i = 0; i < m_size; ++i) {
+    m_slots[i].ba.reset();
+  }
+  m_size = 0;
+  m_iovs.clear();
+}
+
+auto DatagramBatch::push(Address::ptr to, uint16_t segment_size) -> Slot& {
+  Slot& slot = m_slots[m_size];
+  slot.segment = segment_size;
+  slot.truncated = false;
+  slot.iovBegin = m_iovs.size();
+  slot.addrLen = 0;
+  if (to) {
+    slot.addrLen = to->getAddrLen();
+    memcpy(&m_addrs[m_size], to->getAddr(), slot.addrLen);
+  }
+  ++m_size;
+  return slot;
+}
+
+auto DatagramBatch::add(const void* buffer, size_t length, Address::ptr to,
+                        uint16_t segment_size) -> bool {
+  if (m_size >= m_capacity || length > m_bufferSize) {
+    return false;
+  }
+  char* dst = &m_buffer[m_size * m_bufferSize];
+  memcpy(dst, buffer, length);
+  Slot& slot = push(to, segment_size);
+  slot.length = length;
+  slot.iovCount = 1;
+  m_iovs.push_back(iovec{dst, length});
+  return true;
+}
+
+auto DatagramBatch::add(ByteArray::ptr ba, Address::ptr to,
+                        uint16_t segment_size) -> bool {
+  if (m_size >= m_capacity) {
+    return false;
+  }
+  size_t begin = m_iovs.size();
+  size_t length = ba->getReadBuffers(m_iovs);
+  Slot& slot = push(to, segment_size);
+  slot.length = length;
+  slot.iovBegin = begin;
+  slot.iovCount = m_iovs.size() - begin;
+  slot.ba = std::move(ba);
+  return true;
+}
+
+auto DatagramBatch::segments(size_t i) const -> size_t {
+  const Slot& slot = m_slots[i];
+  if (slot.segment == 0) {
+    return slot.length > 0 ? 1 : 0;
+  }
+  return (slot.length + slot.segment - 1) / slot.segment;
+}
+
+auto DatagramBatch::address(size_t i) const -> Address::ptr {
+  if (m_slots[i].addrLen == 0) {
+    return nullptr;
+  }
+  return Address::Create(reinterpret_cast<const sockaddr*>(&m_addrs[i]),
+                         m_slots[i].addrLen);
+}
+
+void DatagramBatch::read(size_t i, ByteArray::ptr ba) const {
+  ba->write(data(i), length(i));
+}
+
+auto DatagramBatch::prepareRecv() -> mmsghdr* {
+  clear();
+  m_iovs.resize(m_capacity);
+  for (size_t i = 0; i < m_capacity; ++i) {
+    m_iovs[i] = iovec{&m_buffer[i * m_bufferSize], m_bufferSize};
+    msghdr& hdr = m_msgs[i].msg_hdr;
+    hdr.msg_name = &m_addrs[i];
+    hdr.msg_namelen = sizeof(sockaddr_storage);
+    hdr.msg_iov = &m_iovs[i];
+    hdr.msg_iovlen = 1;
+    // 内核会改写 msg_controllen, 每次都要重置
+    hdr.msg_control = &m_control[i * kControlStride];
+    hdr.msg_controllen = kControlLen;
+    hdr.msg_flags = 0;
+    m_msgs[i].msg_len = 0;
+  }
+  return m_msgs.data();
+}
+
+void DatagramBatch::finishRecv(int n) {
+  m_iovs.clear();
+  m_size = n > 0 ? n : 0;
+  for (size_t i = 0; i < m_size; ++i) {
+    msghdr& hdr = m_msgs[i].msg_hdr;
+    Slot& slot = m_slots[i];
+    slot.length = m_msgs[i].msg_len;
+    slot.addrLen = hdr.msg_namelen;
+    slot.segment = 0;
+    slot.truncated = (hdr.msg_flags & MSG_TRUNC) != 0;
+    slot.iovCount = 0;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        int segment = 0;
+        memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+        // 只有一段时内核也可能带上, 统一成 0
+        slot.segment = segment < static_cast<int>(slot.length) ? segment : 0;
+      }
+    }
+  }
+}
+
+auto DatagramBatch::prepareSend() -> mmsghdr* {
+  for (size_t i = 0; i < m_size; ++i) {
+    const Slot& slot = m_slots[i];
+    msghdr& hdr = m_msgs[i].msg_hdr;
+    hdr.msg_name = slot.addrLen != 0 ? &m_addrs[i] : nullptr;
+    hdr.msg_namelen = slot.addrLen;
+    hdr.msg_iov = m_iovs.data() + slot.iovBegin;
+    hdr.msg_iovlen = slot.iovCount;
+    hdr.msg_flags = 0;
+    hdr.msg_control = nullptr;
+    hdr.msg_controllen = 0;
+    if (slot.segment != 0) {
+      hdr.msg_control = &m_control[i * kControlStride];
+      hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      memcpy(CMSG_DATA(cmsg), &slot.segment, sizeof(uint16_t));
+    }
+    m_msgs[i].msg_len = 0;
+  }
+  return m_msgs.data();
+}
+
+}  // namespace hx_sylar
@@ -0,0 +1,110 @@
+/**
+ * @file datagram.h
+ * @brief 批量收发 UDP 数据报用的缓冲区
+ * @details 预先分配 count 个 size 字节的缓冲区以及对应的 mmsghdr、地址和
+ *          控制消息空间, Socket::recvBatch/sendBatch 用一次 recvmmsg/sendmmsg
+ *          处理整批数据报, 收发过程中不再分配内存
+ */
+#ifndef __HX_DATAGRAM_H__
+#define __HX_DATAGRAM_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <memory>
+#include <vector>
+
+#include "address.h"
+#include "bytearray.h"
+#include "noncopyable.h"
+
+namespace hx_sylar {
+
+class DatagramBatch : Noncopyable {
+ public:
+  using ptr = std::shared_ptr<DatagramBatch>;
+
+  /**
+   * @param[in] count 一批最多多少个数据报
+   * @param[in] size 每个缓冲区的大小; 打开 GRO 时合并后的数据也要放得下,
+   *                 最大 64KB
+   */
+  DatagramBatch(size_t count, size_t size);
+
+  auto capacity() const -> size_t { return m_capacity; }
+  auto bufferSize() const -> size_t { return m_bufferSize; }
+  /// 收到的或者待发送的数据报个数
+  auto size() const -> size_t { return m_size; }
+  auto empty() const -> bool { return m_size == 0; }
+  void clear();
+
+  /**
+   * @brief 追加一个待发送的数据报, 数据拷贝进预分配的缓冲区
+   * @param[in] to 目的地址, 已经 connect 的 socket 可以为空
+   * @param[in] segment_size 非 0 时按这个长度切成多个数据报发送(UDP GSO),
+   *                         由内核或者网卡完成切分
+   * @return 批满了或者缓冲区放不下时返回 false
+   */
+  auto add(const void* buffer, size_t length, Address::ptr to = nullptr,
+           uint16_t segment_size = 0) -> bool;
+  /**
+   * @brief 追加 ba 当前位置之后的数据, 不拷贝也不移动 ba 的位置
+   * @details 发送完成之前不能修改 ba
+   */
+  auto add(ByteArray::ptr ba, Address::ptr to = nullptr,
+           uint16_t segment_size = 0) -> bool;
+
+  /// 第 i 个数据报的内容, 只对收到的和经 add(buffer) 加入的有效
+  auto data(size_t i) const -> const char* {
+    return &m_buffer[i * m_bufferSize];
+  }
+  auto length(size_t i) const -> size_t { return m_slots[i].length; }
+  /// 打开 GRO 时内核合并了多个数据报, 每段的长度(最后一段可能更短); 0 表示没有合并
+  auto segmentSize(size_t i) const -> uint16_t { return m_slots[i].segment; }
+  /// 第 i 个数据报里合并了多少个原始数据报
+  auto segments(size_t i) const -> size_t;
+  /// 缓冲区放不下, 内核截掉了后面的部分 (MSG_TRUNC), length 只是收到的长度
+  auto truncated(size_t i) const -> bool { return m_slots[i].truncated; }
+  /// 收到的数据报的来源地址
+  auto address(size_t i) const -> Address::ptr;
+  /// 把第 i 个数据报写到 ba 的当前位置, 位置随之后移
+  void read(size_t i, ByteArray::ptr ba) const;
+
+ private:
+  friend class Socket;
+
+  struct Slot {
+    size_t length = 0;
+    uint16_t segment = 0;
+    bool truncated = false;
+    /// 在 m_iovs 中的位置, 经 add(ByteArray) 加入的数据报可能有多个 iovec
+    size_t iovBegin = 0;
+    size_t iovCount = 0;
+    socklen_t addrLen = 0;
+    ByteArray::ptr ba;
+  };
+
+  /// 为 recvmmsg 填好全部 capacity 个消息头
+  auto prepareRecv() -> mmsghdr*;
+  /// recvmmsg 返回后取出长度、地址、截断标志和 GRO 段长
+  void finishRecv(int n);
+  /// 为 sendmmsg 填好 size 个消息头
+  auto prepareSend() -> mmsghdr*;
+  auto push(Address::ptr to, uint16_t segment_size) -> Slot&;
+
+ private:
+  size_t m_capacity;
+  size_t m_bufferSize;
+  size_t m_size = 0;
+  std::vector<char> m_buffer;
+  std::vector<Slot> m_slots;
+  std::vector<iovec> m_iovs;
+  std::vector<mmsghdr> m_msgs;
+  std::vector<sockaddr_storage> m_addrs;
+  /// 每个消息一段, 放 UDP_SEGMENT/UDP_GRO 控制消息
+  std::vector<cmsghdr> m_control;
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -0,0 +1,691 @@
+#include "dns.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "clock.h"
+#include "config.h"
+#include "fiber_mutex.h"
+#include "log.h"
+#include "socket.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+static ConfigVar<bool>::ptr g_dns_builtin = Config::Lookup(
+    "dns.builtin", true, "resolve names in Address::Lookup without getaddrinfo");
+static ConfigVar<std::string>::ptr g_dns_hosts_file = Config::Lookup<std::string>(
+    "dns.hosts_file", "/etc/hosts", "hosts file of the builtin resolver");
+static ConfigVar<std::string>::ptr g_dns_resolv_conf =
+    Config::Lookup<std::string>("dns.resolv_conf", "/etc/resolv.conf",
+                                "resolv.conf of the builtin resolver");
+static ConfigVar<std::vector<std::string> >::ptr g_dns_nameservers =
+    Config::Lookup("dns.nameservers", std::vector<std::string>(),
+                   "ip[:port] list overriding the nameservers in resolv.conf");
+static ConfigVar<uint32_t>::ptr g_dns_max_ttl = Config::Lookup<uint32_t>(
+    "dns.cache.max_ttl", 3600, "cap of the positive cache ttl in seconds");
+static ConfigVar<uint32_t>::ptr g_dns_negative_ttl = Config::Lookup<uint32_t>(
+    "dns.cache.negative_ttl", 30,
+    "seconds to cache a missing name when the reply carries no SOA");
+static ConfigVar<uint32_t>::ptr g_dns_cache_size = Config::Lookup<uint32_t>(
+    "dns.cache.size", 10000, "max cached name/type pairs");
+
+static const uint16_t kTypeA = 1;
+static const uint16_t kTypeCNAME = 5;
+static const uint16_t kTypeSOA = 6;
+static const uint16_t kTypeAAAA = 28;
+static const uint16_t kClassIN = 1;
+static const int kRcodeNxDomain = 3;
+
+struct DnsResolver::Conf {
+  std::vector<Address::ptr> servers;
+  std::vector<std::string> search;
+  int ndots = 1;
+  uint64_t timeoutMs = 5000;
+  int attempts = 2;
+  /// 小写名字 -> 地址
+  std::map<std::string, std::vector<IPAddress::ptr> > hosts;
+
+  /// 下面这些变了就重新加载
+  std::string hostsFile;
+  std::string resolvConf;
+  std::vector<std::string> nameservers;
+  time_t hostsMtime = 0;
+  time_t resolvMtime = 0;
+};
+
+struct DnsResolver::Entry {
+  Status status = UNAVAILABLE;
+  std::vector<IPAddress::ptr> addrs;
+  uint64_t expireMs = 0;
+};
+
+/// 正在进行的查询, 同名的调用方等在 cond 上
+struct DnsResolver::Inflight {
+  FiberMutex mutex;
+  FiberCondition cond;
+  bool done = false;
+  std::shared_ptr<const Entry> entry;
+};
+
+static auto ToLower(std::string str) -> std::string {
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+static auto MtimeOf(const std::string& path) -> time_t {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return st.st_mtime;
+}
+
+static auto FromBytes(int family, const void* bytes) -> IPAddress::ptr {
+  if (family == AF_INET) {
+    sockaddr_in sin{};
+    sin.sin_family = AF_INET;
+    memcpy(&sin.sin_addr, bytes, sizeof(sin.sin_addr));
+    return std::dynamic_pointer_cast<IPAddress>(
+        Address::Create(reinterpret_cast<sockaddr*>(&sin), sizeof(sin)));
+  }
+  sockaddr_in6 sin6{};
+  sin6.sin6_family = AF_INET6;
+  memcpy(&sin6.sin6_addr, bytes, sizeof(sin6.sin6_addr));
+  return std::dynamic_pointer_cast<IPAddress>(
+      Address::Create(reinterpret_cast<sockaddr*>(&sin6), sizeof(sin6)));
+}
+
+/// 数字形式的地址, 不是时返回 nullptr
+static auto ParseNumeric(const std::string& str) -> IPAddress::ptr {
+  in6_addr buf;
+  if (inet_pton(AF_INET, str.c_str(), &buf) == 1) {
+    return FromBytes(AF_INET, &buf);
+  }
+  if (inet_pton(AF_INET6, str.c_str(), &buf) == 1) {
+    return FromBytes(AF_INET6, &buf);
+  }
+  return nullptr;
+}
+
+/// "ip", "ip:port" 或 "[ipv6]:port"
+static auto ParseServer(const std::string& str) -> Address::ptr {
+  std::string host = str;
+  uint16_t port = 53;
+  if (!str.empty() && str[0] == '[') {
+    size_t end = str.find(']');
+    if (end == std::string::npos) {
+      return nullptr;
+    }
+    host = str.substr(1, end - 1);
+    if (end + 2 < str.size() && str[end + 1] == ':') {
+      port = std::atoi(str.c_str() + end + 2);
+    }
+  } else if (std::count(str.begin(), str.end(), ':') == 1) {
+    size_t pos = str.find(':');
+    host = str.substr(0, pos);
+    port = std::atoi(str.c_str() + pos + 1);
+  }
+  IPAddress::ptr addr = ParseNumeric(host);
+  if (addr) {
+    addr->setPort(port);
+  }
+  return addr;
+}
+
+static void ReadHosts(const std::string& path,
+                      std::map<std::string, std::vector<IPAddress::ptr> >& hosts) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    line = line.substr(0, line.find('#'));
+    std::stringstream ss(line);
+    std::string ip;
+    std::string name;
+    if (!(ss >> ip)) {
+      continue;
+    }
+    IPAddress::ptr addr = ParseNumeric(ip);
+    if (!addr) {
+      continue;
+    }
+    while (ss >> name) {
+      hosts[ToLower(name)].push_back(addr);
+    }
+  }
+}
+
+static void ReadResolvConf(const std::string& path,
+                           std::vector<std::string>& servers,
+                           std::vector<std::string>& search, int& ndots,
+                           uint64_t& timeout_ms, int& attempts) {
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::stringstream ss(line);
+    std::string key;
+    std::string value;
+    if (!(ss >> key) || key[0] == '#' || key[0] == ';') {
+      continue;
+    }
+    if (key == "nameserver" && ss >> value) {
+      servers.push_back(value);
+    } else if (key == "search" || key == "domain") {
+      // 后出现的 search/domain 覆盖前面的
+      search.clear();
+      while (ss >> value) {
+        search.push_back(ToLower(value));
+      }
+    } else if (key == "options") {
+      while (ss >> value) {
+        if (value.compare(0, 6, "ndots:") == 0) {
+          ndots = std::atoi(value.c_str() + 6);
+        } else if (value.compare(0, 8, "timeout:") == 0) {
+          timeout_ms = std::max(1, std::atoi(value.c_str() + 8)) * 1000ULL;
+        } else if (value.compare(0, 9, "attempts:") == 0) {
+          attempts = std::max(1, std::atoi(value.c_str() + 9));
+        }
+      }
+    }
+  }
+}
+
+static void PutU16(std::string& out, uint16_t v) {
+  out.push_back(static_cast<char>(v >> 8));
+  out.push_back(static_cast<char>(v & 0xff));
+}
+
+static auto GetU16(const uint8_t* p) -> uint16_t {
+  return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+static auto GetU32(const uint8_t* p) -> uint32_t {
+  return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/// 递归查询请求, 名字不合法时返回 false
+static auto BuildQuery(uint16_t id, const std::string& fqdn, uint16_t qtype,
+                       std::string& out) -> bool {
+  if (fqdn.empty() || fqdn.size() > 253) {
+    return false;
+  }
+  PutU16(out, id);
+  PutU16(out, 0x0100);  // RD
+  PutU16(out, 1);
+  PutU16(out, 0);
+  PutU16(out, 0);
+  PutU16(out, 0);
+  size_t begin = 0;
+  while (begin <= fqdn.size()) {
+    size_t end = fqdn.find('.', begin);
+    if (end == std::string::npos) {
+      end = fqdn.size();
+    }
+    size_t len = end - begin;
+    if (len == 0 || len > 63) {
+      return false;
+    }
+    out.push_back(static_cast<char>(len));
+    out.append(fqdn, begin, len);
+    begin = end + 1;
+  }
+  out.push_back(0);
+  PutU16(out, qtype);
+  PutU16(out, kClassIN);
+  return true;
+}
+
+/// 跳过报文中的一个名字, 越界时返回 false
+static auto SkipName(const uint8_t* buf, size_t len, size_t& pos) -> bool {
+  while (pos < len) {
+    uint8_t label = buf[pos];
+    if ((label & 0xc0) == 0xc0) {
+      pos += 2;
+      return pos <= len;
+    }
+    if (label == 0) {
+      ++pos;
+      return true;
+    }
+    pos += label + 1;
+  }
+  return false;
+}
+
+/**
+ * @brief 解析应答
+ * @param[out] addrs qtype 类型的地址
+ * @param[out] ttl 回答部分和 SOA 中最小的 TTL, 都没有时为 -1
+ * @return rcode, 报文不对时返回 -1
+ */
+static auto ParseReply(const uint8_t* buf, size_t len, uint16_t id,
+                       uint16_t qtype, std::vector<IPAddress::ptr>& addrs,
+                       int64_t& ttl, bool& truncated) -> int {
+  if (len < 12 || GetU16(buf) != id || (buf[2] & 0x80) == 0) {
+    return -1;
+  }
+  truncated = (buf[2] & 0x02) != 0;
+  int rcode = buf[3] & 0x0f;
+  uint16_t qdcount = GetU16(buf + 4);
+  uint16_t ancount = GetU16(buf + 6);
+  uint16_t nscount = GetU16(buf + 8);
+  size_t pos = 12;
+  for (uint16_t i = 0; i < qdcount; ++i) {
+    if (!SkipName(buf, len, pos) || pos + 4 > len) {
+      return -1;
+    }
+    pos += 4;
+  }
+  ttl = -1;
+  auto take_ttl = [&ttl](int64_t v) { ttl = ttl < 0 ? v : std::min(ttl, v); };
+  for (uint32_t i = 0; i < ancount + nscount; ++i) {
+    if (!SkipName(buf, len, pos) || pos + 10 > len) {
+      return -1;
+    }
+    uint16_t type = GetU16(buf + pos);
+    uint16_t klass = GetU16(buf + pos + 2);
+    int64_t rttl = GetU32(buf + pos + 4);
+    uint16_t rdlen = GetU16(buf + pos + 8);
+    pos += 10;
+    if (pos + rdlen > len) {
+      return -1;
+    }
+    const uint8_t* rdata = buf + pos;
+    pos += rdlen;
+    if (klass != kClassIN) {
+      continue;
+    }
+    if (i < ancount) {
+      if (type == qtype && type == kTypeA && rdlen == 4) {
+        addrs.push_back(FromBytes(AF_INET, rdata));
+      } else if (type == qtype && type == kTypeAAAA && rdlen == 16) {
+        addrs.push_back(FromBytes(AF_INET6, rdata));
+      }
+      // CNAME 链上任何一环过期, 结果都要重新查
+      if (type == qtype || type == kTypeCNAME) {
+        take_ttl(rttl);
+      }
+    } else if (type == kTypeSOA && rdlen >= 20) {
+      // 否定缓存时间取 SOA 自身的 TTL 和 MINIMUM 中较小的 (RFC 2308)
+      take_ttl(std::min<int64_t>(rttl, GetU32(rdata + rdlen - 4)));
+    }
+  }
+  return rcode;
+}
+
+DnsResolver::DnsResolver() = default;
+
+auto DnsResolver::loadConf() -> std::shared_ptr<const Conf> {
+  uint64_t now = Clock::NowMS();
+  {
+    RWMutex::ReadLock lock(m_mutex);
+    if (m_conf && now < m_confCheckMs + 1000) {
+      return m_conf;
+    }
+  }
+  std::string hosts_file = g_dns_hosts_file->getValue();
+  std::string resolv_conf = g_dns_resolv_conf->getValue();
+  std::vector<std::string> nameservers = g_dns_nameservers->getValue();
+  time_t hosts_mtime = MtimeOf(hosts_file);
+  time_t resolv_mtime = MtimeOf(resolv_conf);
+  {
+    RWMutex::WriteLock lock(m_mutex);
+    m_confCheckMs = now;
+    if (m_conf && m_conf->hostsFile == hosts_file &&
+        m_conf->resolvConf == resolv_conf &&
+        m_conf->nameservers == nameservers &&
+        m_conf->hostsMtime == hosts_mtime &&
+        m_conf->resolvMtime == resolv_mtime) {
+      return m_conf;
+    }
+  }
+
+  auto conf = std::make_shared<Conf>();
+  conf->hostsFile = hosts_file;
+  conf->resolvConf = resolv_conf;
+  conf->nameservers = nameservers;
+  conf->hostsMtime = hosts_mtime;
+  conf->resolvMtime = resolv_mtime;
+  ReadHosts(hosts_file, conf->hosts);
+  std::vector<std::string> servers;
+  ReadResolvConf(resolv_conf, servers, conf->search, conf->ndots,
+                 conf->timeoutMs, conf->attempts);
+  if (!nameservers.empty()) {
+    servers = nameservers;
+  }
+  for (auto& str : servers) {
+    Address::ptr addr = ParseServer(str);
+    if (addr) {
+      conf->servers.push_back(addr);
+    } else {
+      HX_LOG_WARN(g_logger) << "dns: invalid nameserver " << str;
+    }
+  }
+  HX_LOG_INFO(g_logger) << "dns: loaded " << conf->hosts.size()
+                        << " hosts names, " << conf->servers.size()
+                        << " nameservers";
+
+  RWMutex::WriteLock lock(m_mutex);
+  // 配置变了, 旧的结果可能来自别的 nameserver
+  if (m_conf) {
+    m_cache.clear();
+  }
+  m_conf = conf;
+  return conf;
+}
+
+auto DnsResolver::resolve(const std::string& name, int family,
+                          std::vector<IPAddress::ptr>& result) -> Status {
+  if (!g_dns_builtin->getValue() || name.empty()) {
+    return UNAVAILABLE;
+  }
+  IPAddress::ptr numeric = ParseNumeric(name);
+  if (numeric) {
+    if (family != AF_UNSPEC && numeric->getFamily() != family) {
+      return NOT_FOUND;
+    }
+    result.push_back(numeric);
+    return OK;
+  }
+
+  std::shared_ptr<const Conf> conf = loadConf();
+  std::string lower = ToLower(name);
+  bool absolute = lower.back() == '.';
+  if (absolute) {
+    lower.pop_back();
+  }
+
+  size_t before = result.size();
+  auto it = conf->hosts.find(lower);
+  if (it != conf->hosts.end()) {
+    for (auto& addr : it->second) {
+      if (family == AF_UNSPEC || addr->getFamily() == family) {
+        result.push_back(std::dynamic_pointer_cast<IPAddress>(
+            Address::Create(addr->getAddr(), addr->getAddrLen())));
+      }
+    }
+    if (result.size() > before) {
+      return OK;
+    }
+  }
+  if (conf->servers.empty()) {
+    return UNAVAILABLE;
+  }
+
+  // 点数不够 ndots 的名字先试 search 域
+  std::vector<std::string> candidates;
+  bool dotted = std::count(lower.begin(), lower.end(), '.') >= conf->ndots;
+  if (absolute || dotted) {
+    candidates.push_back(lower);
+  }
+  if (!absolute) {
+    for (auto& domain : conf->search) {
+      candidates.push_back(lower + "." + domain);
+    }
+    if (!dotted) {
+      candidates.push_back(lower);
+    }
+  }
+  std::vector<uint16_t> qtypes;
+  if (family != AF_INET6) {
+    qtypes.push_back(kTypeA);
+  }
+  if (family != AF_INET) {
+    qtypes.push_back(kTypeAAAA);
+  }
+
+  bool unavailable = false;
+  for (auto& fqdn : candidates) {
+    if (query(*conf, fqdn, qtypes, result) == UNAVAILABLE) {
+      unavailable = true;
+    }
+    if (result.size() > before) {
+      return OK;
+    }
+  }
+  return unavailable ? UNAVAILABLE : NOT_FOUND;
+}
+
+auto DnsResolver::query(const Conf& conf, const std::string& fqdn,
+                        const std::vector<uint16_t>& qtypes,
+                        std::vector<IPAddress::ptr>& result) -> Status {
+  size_t count = qtypes.size();
+  std::vector<std::string> keys(count);
+  std::vector<std::shared_ptr<const Entry> > entries(count);
+  std::vector<std::shared_ptr<Inflight> > inflights(count);
+  /// 要由本调用方发出去的查询下标
+  std::vector<size_t> owned;
+  for (size_t i = 0; i < count; ++i) {
+    keys[i] = fqdn + "/" + std::to_string(qtypes[i]);
+    {
+      RWMutex::ReadLock lock(m_mutex);
+      auto it = m_cache.find(keys[i]);
+      if (it != m_cache.end() && it->second->expireMs > Clock::NowMS()) {
+        entries[i] = it->second;
+      }
+    }
+    if (entries[i]) {
+      ++m_cacheHits;
+      if (entries[i]->status == NOT_FOUND) {
+        ++m_negativeHits;
+      }
+      continue;
+    }
+    RWMutex::WriteLock lock(m_mutex);
+    auto it = m_inflight.find(keys[i]);
+    if (it != m_inflight.end()) {
+      inflights[i] = it->second;
+      ++m_collapsed;
+    } else {
+      inflights[i] = std::make_shared<Inflight>();
+      m_inflight[keys[i]] = inflights[i];
+      owned.push_back(i);
+    }
+  }
+
+  if (!owned.empty()) {
+    std::vector<uint16_t> types;
+    std::vector<std::shared_ptr<Entry> > fresh;
+    for (size_t i : owned) {
+      types.push_back(qtypes[i]);
+      fresh.push_back(std::make_shared<Entry>());
+    }
+    exchange(conf, fqdn, types, fresh);
+    {
+      RWMutex::WriteLock lock(m_mutex);
+      for (size_t j = 0; j < owned.size(); ++j) {
+        m_inflight.erase(keys[owned[j]]);
+        // 网络错误不缓存, 下次重新查
+        if (fresh[j]->status != UNAVAILABLE &&
+            fresh[j]->expireMs > Clock::NowMS()) {
+          insertCache(keys[owned[j]], fresh[j]);
+        }
+      }
+    }
+    for (size_t j = 0; j < owned.size(); ++j) {
+      Inflight& inflight = *inflights[owned[j]];
+      FiberMutex::Lock lock(inflight.mutex);
+      inflight.entry = fresh[j];
+      inflight.done = true;
+      inflight.cond.notifyAll();
+      entries[owned[j]] = fresh[j];
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (entries[i]) {
+      continue;
+    }
+    Inflight& inflight = *inflights[i];
+    FiberMutex::Lock lock(inflight.mutex);
+    while (!inflight.done) {
+      inflight.cond.wait(inflight.mutex);
+    }
+    entries[i] = inflight.entry;
+  }
+
+  Status status = NOT_FOUND;
+  for (auto& entry : entries) {
+    // 调用方会改端口, 缓存里的地址不能直接交出去
+    for (auto& addr : entry->addrs) {
+      result.push_back(std::dynamic_pointer_cast<IPAddress>(
+          Address::Create(addr->getAddr(), addr->getAddrLen())));
+    }
+    if (entry->status == UNAVAILABLE) {
+      status = UNAVAILABLE;
+    } else if (entry->status == OK && status == NOT_FOUND) {
+      status = OK;
+    }
+  }
+  return status;
+}
+
+void DnsResolver::insertCache(const std::string& key,
+                              std::shared_ptr<const Entry> entry) {
+  if (m_cache.size() >= g_dns_cache_size->getValue()) {
+    uint64_t now = Clock::NowMS();
+    for (auto i = m_cache.begin(); i != m_cache.end();) {
+      if (i->second->expireMs <= now) {
+        i = m_cache.erase(i);
+      } else {
+        ++i;
+      }
+    }
+    if (m_cache.size() >= g_dns_cache_size->getValue()) {
+      m_cache.erase(m_cache.begin());
+    }
+  }
+  m_cache[key] = std::move(entry);
+}
+
+void DnsResolver::exchange(const Conf& conf, const std::string& fqdn,
+                           const std::vector<uint16_t>& qtypes,
+                           std::vector<std::shared_ptr<Entry> >& entries) {
+  static thread_local std::mt19937 t_rng(std::random_device{}());
+  size_t count = qtypes.size();
+  std::vector<uint16_t> ids(count);
+  std::vector<std::string> requests(count);
+  /// 还没有结果的查询
+  std::vector<bool> pending(count, true);
+  size_t left = count;
+  for (size_t i = 0; i < count; ++i) {
+    // 同一个 socket 上按 id 分辨是哪个查询的应答
+    do {
+      ids[i] = static_cast<uint16_t>(t_rng());
+    } while (std::find(ids.begin(), ids.begin() + i, ids[i]) !=
+             ids.begin() + i);
+    if (!BuildQuery(ids[i], fqdn, qtypes[i], requests[i])) {
+      entries[i]->status = NOT_FOUND;
+      entries[i]->expireMs =
+          Clock::NowMS() + g_dns_negative_ttl->getValue() * 1000ULL;
+      pending[i] = false;
+      --left;
+    }
+  }
+
+  uint8_t buf[1500];
+  for (int attempt = 0; attempt < conf.attempts && left > 0; ++attempt) {
+    for (auto& server : conf.servers) {
+      if (left == 0) {
+        break;
+      }
+      Socket::ptr sock = Socket::CreateUDP(server);
+      // 连接后内核只收这个 nameserver 发来的包
+      if (!sock->connect(server)) {
+        continue;
+      }
+      sock->setRecvTimeout(conf.timeoutMs);
+      // A 和 AAAA 一起发出去, 两个应答共用等待时间
+      std::vector<bool> waiting(count, false);
+      size_t waits = 0;
+      for (size_t i = 0; i < count; ++i) {
+        if (!pending[i]) {
+          continue;
+        }
+        ++m_queries;
+        if (sock->send(requests[i].data(), requests[i].size()) ==
+            static_cast<int>(requests[i].size())) {
+          waiting[i] = true;
+          ++waits;
+        }
+      }
+      while (waits > 0) {
+        int n = sock->recv(buf, sizeof(buf));
+        if (n <= 0) {
+          ++m_timeouts;
+          HX_LOG_DEBUG(g_logger) << "dns: " << fqdn << " query "
+                                 << server->toString() << " timeout";
+          break;
+        }
+        size_t i = 0;
+        while (i < count && !(waiting[i] && n >= 2 && GetU16(buf) == ids[i])) {
+          ++i;
+        }
+        std::vector<IPAddress::ptr> addrs;
+        int64_t ttl = -1;
+        bool truncated = false;
+        int rcode = i == count ? -1
+                               : ParseReply(buf, n, ids[i], qtypes[i], addrs,
+                                            ttl, truncated);
+        if (rcode < 0) {
+          // 迟到的旧应答或者伪造的包, 接着等
+          continue;
+        }
+        waiting[i] = false;
+        --waits;
+        if (rcode != 0 && rcode != kRcodeNxDomain) {
+          // SERVFAIL、REFUSED 之类, 留给下一个 nameserver
+          continue;
+        }
+        pending[i] = false;
+        --left;
+        Entry& entry = *entries[i];
+        if (truncated && addrs.empty()) {
+          // 没有实现 TCP 重试, 交给 getaddrinfo
+          entry.status = UNAVAILABLE;
+          continue;
+        }
+        if (ttl < 0) {
+          ttl = addrs.empty() ? g_dns_negative_ttl->getValue()
+                              : g_dns_max_ttl->getValue();
+        }
+        ttl = std::min<int64_t>(ttl, g_dns_max_ttl->getValue());
+        entry.expireMs = Clock::NowMS() + ttl * 1000;
+        entry.addrs.swap(addrs);
+        entry.status = entry.addrs.empty() ? NOT_FOUND : OK;
+      }
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (pending[i]) {
+      entries[i]->status = UNAVAILABLE;
+      HX_LOG_WARN(g_logger) << "dns: " << fqdn << " type=" << qtypes[i]
+                            << " no nameserver answered";
+    }
+  }
+}
+
+void DnsResolver::clearCache() {
+  RWMutex::WriteLock lock(m_mutex);
+  m_cache.clear();
+  m_conf.reset();
+  m_confCheckMs = 0;
+}
+
+auto DnsResolver::getStats() const -> Stats {
+  Stats stats;
+  stats.queries = m_queries;
+  stats.cacheHits = m_cacheHits;
+  stats.negativeHits = m_negativeHits;
+  stats.collapsed = m_collapsed;
+  stats.timeouts = m_timeouts;
+  return stats;
+}
+
+}  // namespace hx_sylar
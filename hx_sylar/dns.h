@@ -0,0 +1,105 @@
+/**
+ * @file dns.h
+ * @brief 协程里使用的 DNS 解析器
+ * @details 先查 hosts 文件, 再按 resolv.conf 里的 nameserver 发 UDP 查询.
+ *          查询经过 hook 的 socket, 在协程里等待应答时只挂起当前协程.
+ *          结果按 TTL 缓存, 查不到的名字也缓存一段时间;
+ *          同一个名字同时只有一个查询在路上, 其他调用方等它的结果
+ */
+#ifndef __HX_DNS_H__
+#define __HX_DNS_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "address.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "singleton.h"
+
+namespace hx_sylar {
+
+class DnsResolver : Noncopyable {
+ public:
+  enum Status {
+    /// 解析成功
+    OK = 0,
+    /// 名字不存在或者没有这一族的地址
+    NOT_FOUND = 1,
+    /// 关闭了内置解析器、没有可用的 nameserver 或者应答被截断, 调用方退回 getaddrinfo
+    UNAVAILABLE = 2,
+  };
+
+  struct Stats {
+    /// 发出的 UDP 查询数
+    uint64_t queries = 0;
+    /// 命中缓存的次数, 含否定缓存
+    uint64_t cacheHits = 0;
+    /// 命中否定缓存的次数
+    uint64_t negativeHits = 0;
+    /// 等别人正在进行的同名查询的次数
+    uint64_t collapsed = 0;
+    /// 查询超时的次数
+    uint64_t timeouts = 0;
+  };
+
+  DnsResolver();
+
+  /**
+   * @brief 解析主机名
+   * @param[in] name 主机名或者数字形式的 IP
+   * @param[in] family AF_INET、AF_INET6 或 AF_UNSPEC
+   * @param[out] result 追加解析到的地址, 端口为 0, 调用方可以直接修改
+   */
+  auto resolve(const std::string& name, int family,
+               std::vector<IPAddress::ptr>& result) -> Status;
+
+  /// 清空缓存, 下次解析重新读 hosts 和 resolv.conf
+  void clearCache();
+
+  auto getStats() const -> Stats;
+
+ private:
+  struct Conf;
+  struct Entry;
+  struct Inflight;
+
+  /// 文件变了就重新加载, 每秒最多检查一次
+  auto loadConf() -> std::shared_ptr<const Conf>;
+  /// 查一个完整的域名的几种记录, 走缓存和合并, 缓存里没有的一起查
+  auto query(const Conf& conf, const std::string& fqdn,
+             const std::vector<uint16_t>& qtypes,
+             std::vector<IPAddress::ptr>& result) -> Status;
+  /// 调用方持有 m_mutex 写锁, 满了先淘汰过期的
+  void insertCache(const std::string& key, std::shared_ptr<const Entry> entry);
+  /// 依次向各个 nameserver 发查询, 每个 nameserver 上几种记录同时查
+  void exchange(const Conf& conf, const std::string& fqdn,
+                const std::vector<uint16_t>& qtypes,
+                std::vector<std::shared_ptr<Entry> >& entries);
+
+ private:
+  RWMutex m_mutex;
+  std::shared_ptr<const Conf> m_conf;
+  uint64_t m_confCheckMs = 0;
+  /// "域名/类型" -> 缓存项
+  std::map<std::string, std::shared_ptr<const Entry> > m_cache;
+  std::map<std::string, std::shared_ptr<Inflight> > m_inflight;
+
+  std::atomic<uint64_t> m_queries{0};
+  std::atomic<uint64_t> m_cacheHits{0};
+  std::atomic<uint64_t> m_negativeHits{0};
+  std::atomic<uint64_t> m_collapsed{0};
+  std::atomic<uint64_t> m_timeouts{0};
+};
+
+/// Address::Lookup 使用的全局解析器
+using DnsMgr = Singleton<DnsResolver>;
+
+}  // namespace hx_sylar
+
+#endif
@@ -4,53 +4,59 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include <memory>
-
 #include "hook.h"
+#include "iomanager.h"
 
 namespace hx_sylar {
 FdCtx::FdCtx(int fd)
-    : m_isInit(false),
-      m_isSocket(false),
-      m_sysNonblock(false),
-      m_userNonblock(false),
-      m_isClosed(false),
+    : m_flags(0),
+      m_generation(0),
       m_fd(fd),
       m_recvTimeout(-1),
-      m_sendTimeout(-2) {
-  init();
-}
+      m_sendTimeout(-1),
+      m_ioArmed{{0}, {0}} {}
 FdCtx::~FdCtx() = default;
 auto FdCtx::init() -> bool {
-  if (m_isInit) {
+  if (isInit()) {
     return true;
   }
   m_recvTimeout = -1;
   m_sendTimeout = -1;
 
   struct stat fd_stat {};
-  if (-1 == fstat(m_fd, &fd_stat)) {
-    m_isInit = false;
-    m_isSocket = false;
-  } else {
-    m_isInit = true;
-    m_isSocket = true;
+  bool is_socket = false;
+  bool is_regular = false;
+  bool is_pipe = false;
+  if (-1 != fstat(m_fd, &fd_stat)) {
+    setFlag(kInit, true);
+    is_socket = S_ISSOCK(fd_stat.st_mode);
+    is_regular = S_ISREG(fd_stat.st_mode);
+    is_pipe = S_ISFIFO(fd_stat.st_mode);
   }
+  setFlag(kSocket, is_socket);
+  setFlag(kRegularFile, is_regular);
+  setFlag(kPipe, is_pipe);
 
-  if (m_isSocket) {
+  if (is_socket || is_pipe) {
     int flags = fcntl_f(m_fd, F_GETFL, 0);
-    if ((flags & O_NONBLOCK) != 0) {
+    if ((flags & O_NONBLOCK) == 0) {
       fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
     }
-    m_sysNonblock = true;
-  } else {
-    m_sysNonblock = false;
   }
-  m_userNonblock = false;
-  m_isClosed = false;
-  return m_isInit;
+  setFlag(kSysNonblock, is_socket || is_pipe);
+  setFlag(kUserNonblock, false);
+  return isInit();
+}
+
+void FdCtx::open() {
+  m_flags.store(0, std::memory_order_relaxed);
+  init();
+  // 状态写完再发布, 其他线程看到奇数时读到的是新 fd 的状态
+  m_generation.fetch_add(1, std::memory_order_release);
 }
 
+void FdCtx::close() { m_generation.fetch_add(1, std::memory_order_release); }
+
 void FdCtx::setTimeout(int type, uint64_t v) {
   if (type == SO_RCVTIMEO) {
     m_recvTimeout = v;
@@ -65,30 +71,87 @@ auto FdCtx::getTimeout(int type) -> uint64_t {
   }
   return m_sendTimeout;
 }
+
+/**
+ * 全局唯一的等待序号. 每个线程一次领 4096 个, 平时只是线程局部的自增;
+ * 超时回调拿序号比对, fd 关闭后被复用也不会错认
+ */
+static auto NextIoSeq() -> uint64_t {
+  static std::atomic<uint64_t> s_seq(1);
+  static thread_local uint64_t t_next = 0;
+  static thread_local uint64_t t_end = 0;
+  if (t_next == t_end) {
+    t_next = s_seq.fetch_add(4096, std::memory_order_relaxed);
+    t_end = t_next + 4096;
+  }
+  return t_next++;
+}
+
+auto FdCtx::armTimeout(IOManager* iom, uint32_t event, uint64_t ms,
+                       uint64_t slack_ms) -> uint64_t {
+  int dir = event == IOManager::WRITE ? 1 : 0;
+  uint64_t seq = NextIoSeq();
+  m_ioArmed[dir].store(seq, std::memory_order_release);
+  // 只捕获 fd 和序号, 正好放进 std::function 的内部缓冲
+  int fd = m_fd;
+  uint64_t tag = seq << 1 | dir;
+  iom->armTimer(
+      &m_ioTimers[dir], ms, [fd, tag]() { OnTimeout(fd, tag); }, slack_ms);
+  return seq;
+}
+
+auto FdCtx::disarmTimeout(uint32_t event, uint64_t seq) -> bool {
+  int dir = event == IOManager::WRITE ? 1 : 0;
+  if (!m_ioArmed[dir].compare_exchange_strong(seq, 0)) {
+    // 超时回调已经清零, 定时器也已经摘下; 序号被 fd 复用后的新等待换掉时,
+    // 定时器属于新的等待, 不能取消
+    return true;
+  }
+  m_ioTimers[dir].cancel();
+  return false;
+}
+
+void FdCtx::OnTimeout(int fd, uint64_t tag) {
+  FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+  if (!ctx) {
+    return;
+  }
+  int dir = static_cast<int>(tag & 1);
+  uint64_t seq = tag >> 1;
+  if (!ctx->m_ioArmed[dir].compare_exchange_strong(seq, 0)) {
+    return;
+  }
+  // 回调由挂定时器的 IOManager 调度执行, 事件也注册在它上面
+  IOManager::GetThis()->cancelEvent(
+      fd, dir != 0 ? IOManager::WRITE : IOManager::READ);
+}
 auto FdManager::get(int fd, bool auto_create) -> FdCtx::ptr {
-  RwMutexType ::ReadLock lock(m_mutex);
-  if (static_cast<int>(m_datas.size()) <= fd) {
-    if (!auto_create) {
-      return nullptr;
-    }
-  } else {
-    if (m_datas[fd] || !auto_create) {
-      return m_datas[fd];
-    }
+  FdCtx* ctx = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+  if (ctx == nullptr) {
+    return nullptr;
+  }
+  if (!ctx->isClose()) {
+    return ctx;
+  }
+  if (!auto_create) {
+    return nullptr;
+  }
+  MutexType::Lock lock(m_mutex);
+  if (ctx->isClose()) {
+    ctx->open();
   }
-  lock.unlock();
-  RwMutexType ::WriteLock lock2(m_mutex);
-  auto ctx = std::make_shared<FdCtx>(fd);
-  m_datas[fd] = ctx;
   return ctx;
 }
 void FdManager::del(int fd) {
-  RwMutexType ::WriteLock lock(m_mutex);
-  if (static_cast<int>(m_datas.size()) <= fd) {
+  FdCtx* ctx = m_datas.get(fd);
+  if (ctx == nullptr) {
     return;
   }
-  m_datas[fd].reset();
+  MutexType::Lock lock(m_mutex);
+  if (!ctx->isClose()) {
+    ctx->close();
+  }
 }
-FdManager::FdManager() { m_datas.resize(64); }
+FdManager::FdManager() = default;
 
 }  // namespace hx_sylar
@@ -5,50 +5,123 @@
 #ifndef hx_sylar_FD_MANAGER_H
 #define hx_sylar_FD_MANAGER_H
 #include "thread.h"
-#include <memory>
-#include <vector>
+#include <atomic>
+#include "fd_table.h"
 #include "singleton.h"
+#include "timer.h"
 namespace hx_sylar{
-class FdCtx:public std::enable_shared_from_this<FdCtx>{
+class IOManager;
+/**
+ * @brief 一个 fd 的状态
+ * @details 常驻在 FdManager 的表里, fd 关闭后槽留着给下一个同号的 fd 复用,
+ *          所以直接用裸指针, 查找时没有引用计数操作
+ */
+class FdCtx{
 public :
-  using ptr = std::shared_ptr<FdCtx>;
-  FdCtx(int fd);
+  using ptr = FdCtx*;
+  explicit FdCtx(int fd);
   ~FdCtx();
 
   auto init()->bool;
-  auto isInit() const ->bool {return m_isInit;}
-  auto isSocket()const ->bool {return m_isSocket;}
-  auto isClose()->bool{return  m_isClosed;}
+  auto isInit() const ->bool {return hasFlag(kInit);}
+  auto isSocket()const ->bool {return hasFlag(kSocket);}
+  /// 普通磁盘文件, hook 把读写交给 OffloadPool
+  auto isRegularFile()const ->bool {return hasFlag(kRegularFile);}
+  /// 管道和 FIFO, 与 socket 一样切成非阻塞后按事件等待
+  auto isPipe()const ->bool {return hasFlag(kPipe);}
+  auto isClose()const ->bool{return (getGeneration() & 1) == 0;}
+  /**
+   * @brief 打开和关闭都会加一, 奇数表示打开
+   * @details 挂起前后比较, 能发现这期间 fd 被关闭甚至被同号的新 fd 复用
+   */
+  auto getGeneration()const ->uint32_t{
+    return m_generation.load(std::memory_order_acquire);
+  }
 
-  void setUserNonblock(bool v) {m_userNonblock = v;}
-  auto getUserNonblock()const ->bool{return m_userNonblock;}
-  void setSysNonblock(bool v) {m_sysNonblock = v;}
-  auto getSysNonblock()const ->bool {return m_sysNonblock;}
+  void setUserNonblock(bool v) {setFlag(kUserNonblock, v);}
+  auto getUserNonblock()const ->bool{return hasFlag(kUserNonblock);}
+  void setSysNonblock(bool v) {setFlag(kSysNonblock, v);}
+  auto getSysNonblock()const ->bool {return hasFlag(kSysNonblock);}
 
   void setTimeout(int type ,  uint64_t v);
   auto  getTimeout(int type)->uint64_t;
+
+  /**
+   * @brief 给一次读或写的等待挂上超时
+   * @details 定时器内嵌在 FdCtx 里, 每次等待只是重新挂到时间轮上,
+   *          不分配内存, 也没有 shared_ptr 的引用计数操作
+   * @param[in] iom 等待事件的 IOManager
+   * @param[in] event IOManager::READ 或 IOManager::WRITE
+   * @param[in] ms 超时时间(毫秒)
+   * @param[in] slack_ms 允许晚到的毫秒数
+   * @return 这次等待的序号, 交给 disarmTimeout
+   */
+  auto armTimeout(IOManager* iom, uint32_t event, uint64_t ms,
+                  uint64_t slack_ms) -> uint64_t;
+  /**
+   * @brief 等待结束后撤掉超时
+   * @return 超时已经触发时返回 true
+   */
+  auto disarmTimeout(uint32_t event, uint64_t seq) -> bool;
+private:
+  friend class FdManager;
+  enum Flag : uint8_t {
+    kInit = 0x1,
+    kSocket = 0x2,
+    kSysNonblock = 0x4,
+    kUserNonblock = 0x8,
+    kRegularFile = 0x10,
+    kPipe = 0x20,
+  };
+  auto hasFlag(Flag f) const -> bool {
+    return (m_flags.load(std::memory_order_relaxed) & f) != 0;
+  }
+  void setFlag(Flag f, bool v) {
+    if (v) {
+      m_flags.fetch_or(f, std::memory_order_relaxed);
+    } else {
+      m_flags.fetch_and(static_cast<uint8_t>(~f), std::memory_order_relaxed);
+    }
+  }
+  /// 新的 fd 占用这个槽, 由 FdManager 持锁调用
+  void open();
+  /// fd 关闭, 由 FdManager 持锁调用
+  void close();
+  /// 超时回调, 序号还对得上时取消 fd 上的事件
+  static void OnTimeout(int fd, uint64_t tag);
 private:
-  bool m_isInit:1;
-  bool m_isSocket:1;
-  bool m_sysNonblock:1;
-  bool m_userNonblock:1;
-  bool m_isClosed:1;
+  /// Flag 的组合, 原子读写, 不同线程设置不同的位不会互相覆盖
+  std::atomic<uint8_t> m_flags;
+  std::atomic<uint32_t> m_generation;
   int m_fd;
-  uint64_t m_recvTimeout;
-  uint64_t m_sendTimeout;
+  std::atomic<uint64_t> m_recvTimeout;
+  std::atomic<uint64_t> m_sendTimeout;
+  /// 读写两个方向的超时定时器, 0 读 1 写
+  Timer m_ioTimers[2];
+  /// 正在等待的序号, 0 表示没有挂超时; 超时回调和等待方谁先清零算谁的
+  std::atomic<uint64_t> m_ioArmed[2];
 };
+/**
+ * @brief fd 管理器
+ * @details 查找不加锁; 只有打开和关闭一个 fd 时持锁, 保证同一个槽
+ *          不会被并发初始化
+ */
 class FdManager{
 public:
-using RwMutexType=RWMutex;
+using MutexType=Mutex;
 FdManager();
+/**
+ * @brief 获取 fd 的状态
+ * @param[in] auto_create fd 没有打开过或者已经关闭时是否新建
+ */
 auto get(int fd,bool auto_create = false)->FdCtx::ptr;
 void del(int fd);
 private:
-  RwMutexType  m_mutex;
-  std::vector<FdCtx::ptr> m_datas;
+  MutexType  m_mutex;
+  FdTable<FdCtx> m_datas;
 };
 
-using FdMgr = Singleton<FdManager>;
+using FdMgr = SingletonRef<FdManager>;
 }
 
 #endif // hx_sylar_FD_MANAGER_H
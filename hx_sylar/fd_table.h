@@ -0,0 +1,130 @@
+/**
+ * @file fd_table.h
+ * @brief 按 fd 下标的两级表, 查找不加锁
+ * @details FdManager 和 IOManager 共用. 第一级是固定大小的段指针数组,
+ *          第二级每段 256 个按缓存行对齐的槽, 段在第一次用到时分配,
+ *          之后直到表析构都不移动也不释放, 拿到的指针一直有效.
+ *          查找只是两次加载; 扩容时只有新段用 CAS 发布, 不会像
+ *          vector 那样整体搬家, 也就不需要读写锁保护.
+ */
+#ifndef __HX_FD_TABLE_H__
+#define __HX_FD_TABLE_H__
+
+#include <stddef.h>
+
+#include <atomic>
+#include <new>
+
+#include "noncopyable.h"
+
+namespace hx_sylar {
+
+/**
+ * @brief fd 表
+ * @details T 需要有 explicit T(int fd) 构造函数. 槽在段分配时一次构造好,
+ *          表本身不区分 fd 是否打开, 由 T 自己记录状态
+ */
+template <class T>
+class FdTable : Noncopyable {
+ public:
+  /// 每段槽数的位数
+  static const int kSegmentBits = 8;
+  static const int kSegmentSize = 1 << kSegmentBits;
+  /// 段数, 共覆盖 2^20 个 fd, 与 Linux 默认的 nr_open 上限相同
+  static const int kSegments = 4096;
+  static const int kMaxFd = kSegments * kSegmentSize;
+
+  FdTable() = default;
+
+  ~FdTable() {
+    for (auto& seg : m_segments) {
+      delete seg.load(std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief 查找 fd 对应的槽, 不加锁
+   * @return 所在的段还没分配或者 fd 超出范围时返回 nullptr
+   */
+  auto get(int fd) const -> T* {
+    if (fd < 0 || fd >= kMaxFd) {
+      return nullptr;
+    }
+    Segment* seg =
+        m_segments[fd >> kSegmentBits].load(std::memory_order_acquire);
+    if (seg == nullptr) {
+      return nullptr;
+    }
+    return seg->at(fd & (kSegmentSize - 1));
+  }
+
+  /**
+   * @brief 查找 fd 对应的槽, 所在的段不存在时分配
+   * @return fd 超出范围时返回 nullptr
+   */
+  auto getOrCreate(int fd) -> T* {
+    T* rt = get(fd);
+    if (rt != nullptr || fd < 0 || fd >= kMaxFd) {
+      return rt;
+    }
+    std::atomic<Segment*>& slot = m_segments[fd >> kSegmentBits];
+    auto* seg = new Segment(fd & ~(kSegmentSize - 1));
+    Segment* expected = nullptr;
+    // 并发分配同一段时只有一个能发布, 其余的丢掉自己的
+    if (!slot.compare_exchange_strong(expected, seg,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+      delete seg;
+      seg = expected;
+    }
+    return seg->at(fd & (kSegmentSize - 1));
+  }
+
+  /**
+   * @brief 依次访问所有已经分配的槽
+   */
+  template <class Func>
+  void forEach(Func func) const {
+    for (auto& s : m_segments) {
+      Segment* seg = s.load(std::memory_order_acquire);
+      if (seg == nullptr) {
+        continue;
+      }
+      for (int i = 0; i < kSegmentSize; ++i) {
+        func(seg->at(i));
+      }
+    }
+  }
+
+ private:
+  /// 独占缓存行, 相邻 fd 在不同线程上读写时不会互相失效
+  struct alignas(64) Slot {
+    explicit Slot(int fd) : value(fd) {}
+    T value;
+  };
+
+  /// 一段连续的槽, 每个槽用自己的 fd 构造
+  struct Segment {
+    explicit Segment(int base) {
+      for (int i = 0; i < kSegmentSize; ++i) {
+        new (&slots()[i]) Slot(base + i);
+      }
+    }
+    ~Segment() {
+      for (int i = 0; i < kSegmentSize; ++i) {
+        slots()[i].~Slot();
+      }
+    }
+    auto slots() -> Slot* { return reinterpret_cast<Slot*>(storage); }
+    auto at(int idx) -> T* { return &slots()[idx].value; }
+
+    alignas(Slot) unsigned char storage[sizeof(Slot) * kSegmentSize];
+  };
+
+ private:
+  std::atomic<Segment*> m_segments[kSegments] = {};
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "hx_sylar.h"
 #include "scheduler.h"
+#include "stack_pool.h"
 #include "util.h"
 
 namespace hx_sylar {
@@ -16,14 +17,39 @@ static thread_local Fiber* t_fiber = nullptr;
 static thread_local Fiber::ptr t_thread_fiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>(
     "fiber.stack_size", 1024 * 1024, "fiber stack size");
-class MallocStackAllocator {
- public:
-  static auto Alloc(size_t size) -> void* { return malloc(size); }
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 8 * 1024 * 1024,
+                             "per thread shared fiber stack size");
 
-  static void Dealloc(void* vp) { return free(vp); }
+using StackAllocator = StackPool;
+
+/**
+ * @brief 线程共享栈, 共享栈模式的协程都在这块栈上运行
+ */
+struct SharedStack {
+  ~SharedStack() {
+    if (stack != nullptr) {
+      StackAllocator::Dealloc(stack, size);
+    }
+  }
+
+  auto top() const -> char* { return static_cast<char*>(stack) + size; }
+
+  void* stack = nullptr;
+  size_t size = 0;
+  /// 当前栈上内容属于哪个协程
+  Fiber* occupant = nullptr;
 };
 
-using StackAllocator = MallocStackAllocator;
+static auto GetSharedStack() -> SharedStack& {
+  static thread_local SharedStack t_shared_stack;
+  if (t_shared_stack.stack == nullptr) {
+    t_shared_stack.size =
+        StackAllocator::RoundSize(g_fiber_shared_stack_size->getValue());
+    t_shared_stack.stack = StackAllocator::Alloc(t_shared_stack.size);
+  }
+  return t_shared_stack;
+}
 
 auto Fiber::GetFiberId() -> uint64_t {
   if (t_fiber != nullptr) {
@@ -34,32 +60,31 @@ auto Fiber::GetFiberId() -> uint64_t {
 Fiber::Fiber() {
   m_state = EXEC;
   SetThis(this);
-  if (getcontext(&m_ctx) != 0) {
-    HX_ASSERT1(false, "getcontext");
-  }
 
   ++s_fiber_count;
 
   HX_LOG_DEBUG(g_logger) << " Fiber create ";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller,
+             bool shared_stack)
     : m_id(++s_fiber_id), m_cb(std::move(cb)) {
   ++s_fiber_count;
-  m_stacksize = stacksize != 0U ? stacksize : g_fiber_stack_size->getValue();
-
-  m_stack = StackAllocator::Alloc(m_stacksize);
-  if (getcontext(&m_ctx) != 0) {
-    HX_ASSERT1(false, "getContext");
+#ifdef HX_FIBER_CONTEXT_HAS_SP
+  if (shared_stack) {
+    // 上下文在第一次切入时才在运行线程的共享栈上建立
+    m_sharedStack = true;
+    return;
   }
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
+#endif
+  m_stacksize = StackAllocator::RoundSize(
+      stacksize != 0U ? stacksize : g_fiber_stack_size->getValue());
 
+  m_stack = StackAllocator::Alloc(m_stacksize);
   if (!use_caller) {
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
   } else {
-    makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+    m_ctx.make(m_stack, m_stacksize, &Fiber::CallerMainFunc);
   }
 
   HX_LOG_INFO(g_logger) << "create fiber ";
@@ -67,10 +92,13 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 
 Fiber::~Fiber() {
   --s_fiber_count;
-  if (m_stack != nullptr) {
+  if (m_stack != nullptr || m_sharedStack) {
     HX_ASSERT1(m_state == TERM || m_state == INIT || m_state == EXCEPT,
                "state : ");
-    StackAllocator::Dealloc(m_stack);
+    if (m_stack != nullptr) {
+      StackAllocator::Dealloc(m_stack, m_stacksize);
+    }
+    free(m_saveBuf);
   } else {
     HX_ASSERT(nullptr == m_cb);
     HX_ASSERT(m_state == EXEC);
@@ -84,48 +112,93 @@ Fiber::~Fiber() {
 }
 
 void Fiber::reset(std::function<void()> cb) {
-  HX_ASSERT(m_stack);
+  HX_ASSERT(m_stack || m_sharedStack);
   HX_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
   m_cb = std::move(cb);
-  if (getcontext(&m_ctx) != 0) {
-    HX_ASSERT1(false, "getcontext");
+  if (m_sharedStack) {
+    m_boundThread = -1;
+    m_saveSize = 0;
+  } else {
+    m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc);
   }
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
-  makecontext(&m_ctx, &Fiber::MainFunc, 0);
   m_state = INIT;
 }
 
+void Fiber::enterSharedStack(bool use_caller) {
+  SharedStack& ss = GetSharedStack();
+  if (m_boundThread == -1) {
+    m_boundThread = hx_sylar::GetThreadId();
+    m_ctx.make(ss.stack, ss.size,
+               use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc);
+    m_saveSize = 0;
+  }
+  HX_ASSERT1(m_boundThread == hx_sylar::GetThreadId(),
+             "shared stack fiber id=" << m_id << " bound to thread "
+                                      << m_boundThread);
+  if (ss.occupant == this) {
+    return;
+  }
+
+  Fiber* prev = ss.occupant;
+  if (prev != nullptr) {
+    char* sp = static_cast<char*>(prev->m_ctx.sp());
+    size_t used = ss.top() - sp;
+    // 只在容量不够或者明显偏大时重新分配, 保持缓冲区贴合实际用量
+    if (used > prev->m_saveCap || used * 2 < prev->m_saveCap) {
+      free(prev->m_saveBuf);
+      prev->m_saveBuf = static_cast<char*>(malloc(used));
+      prev->m_saveCap = used;
+    }
+    memcpy(prev->m_saveBuf, sp, used);
+    prev->m_saveSize = used;
+  }
+  if (m_saveSize != 0) {
+    memcpy(ss.top() - m_saveSize, m_saveBuf, m_saveSize);
+  }
+  ss.occupant = this;
+}
+
+void Fiber::leaveSharedStack() {
+  SharedStack& ss = GetSharedStack();
+  if (ss.occupant == this) {
+    ss.occupant = nullptr;
+  }
+  m_saveSize = 0;
+}
+
 void Fiber::call() {
   SetThis(this);
   m_state = EXEC;
-  if (swapcontext(&(t_thread_fiber->m_ctx), &m_ctx) != 0) {
-    HX_ASSERT1(false, "swap-context");
+  if (m_sharedStack) {
+    enterSharedStack(true);
   }
+  Context::Swap(t_thread_fiber->m_ctx, m_ctx);
 }
 
 void Fiber::back() {
   SetThis(t_thread_fiber.get());
-  if (swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)) != 0) {
-    HX_ASSERT1(false, "swap-context");
+  if (m_sharedStack && (m_state == TERM || m_state == EXCEPT)) {
+    leaveSharedStack();
   }
+  Context::Swap(m_ctx, t_thread_fiber->m_ctx);
 }
 
 void Fiber::swapIn() {
   SetThis(this);
   HX_ASSERT1(m_state != EXEC, "state error ");
   m_state = EXEC;
-  if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx) != 0) {
-    HX_ASSERT1(false, "swap-context");
+  if (m_sharedStack) {
+    enterSharedStack(false);
   }
+  Context::Swap(Scheduler::GetMainFiber()->m_ctx, m_ctx);
 }
 
 void Fiber::swapOut() {
   SetThis(Scheduler::GetMainFiber());
-  if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx) != 0) {
-    HX_ASSERT1(false, "swap-context");
+  if (m_sharedStack && (m_state == TERM || m_state == EXCEPT)) {
+    leaveSharedStack();
   }
+  Context::Swap(m_ctx, Scheduler::GetMainFiber()->m_ctx);
 }
 
 void Fiber::SetThis(Fiber* f) { t_fiber = f; }
@@ -1,10 +1,9 @@
 #ifndef __HX_FIBER_H__
 #define __HX_FIBER_H__
-#include <ucontext.h>
-
 #include <functional>
 #include <memory>
 
+#include "context.h"
 #include "hx_sylar.h"
 #include "thread.h"
 namespace hx_sylar {
@@ -27,7 +26,15 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   Fiber();
 
  public:
-  Fiber(std::function<void()> cb, size_t staksize = 0, bool use_caller = false);
+  /**
+   * @param[in] cb 协程函数
+   * @param[in] staksize 栈大小, 0 表示使用 fiber.stack_size
+   * @param[in] use_caller 是否是 use_caller 的调度协程
+   * @param[in] shared_stack 是否运行在线程共享栈上, 切出时只拷贝已用部分,
+   *            第一次运行后绑定在该线程上
+   */
+  Fiber(std::function<void()> cb, size_t staksize = 0, bool use_caller = false,
+        bool shared_stack = false);
   ~Fiber();
   // 重置协程函数
   void reset(std::function<void()> cb);
@@ -39,6 +46,13 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   void call();
   void back();
   uint64_t getId() const { return m_id; }
+  bool isSharedStack() const { return m_sharedStack; }
+  // 共享栈协程绑定的线程, -1 表示可以在任意线程运行
+  int getBoundThread() const { return m_boundThread; }
+  // 切出时保存的栈大小(共享栈模式)
+  size_t getSavedStackSize() const { return m_saveSize; }
+  // 调度优先级(Scheduler::Priority), 协程再次被调度时沿用
+  int getPriority() const { return m_priority; }
 
  public:
   // 设置当前协程
@@ -58,6 +72,14 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
 
   static auto GetFiberId() -> uint64_t;
 
+ private:
+  // 切入共享栈: 保存上一个占用者的栈, 恢复自己的栈
+  void enterSharedStack(bool use_caller);
+  // 协程结束时让出共享栈
+  void leaveSharedStack();
+
+ public:
+
   State getState() const { return m_state; }
   //  void back();
   void setState(State s);
@@ -66,9 +88,17 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
   uint64_t m_id = 0;
   uint32_t m_stacksize = 0;
   State m_state = INIT;
-  ucontext_t m_ctx;
+  Context m_ctx;
   void* m_stack = nullptr;
   std::function<void()> m_cb;
+  bool m_sharedStack = false;
+  int m_boundThread = -1;
+  // 最近一次被调度时的优先级, 由 Scheduler 设置, 默认 NORMAL
+  int m_priority = 1;
+  // 共享栈模式下切出时保存的栈内容
+  char* m_saveBuf = nullptr;
+  size_t m_saveSize = 0;
+  size_t m_saveCap = 0;
 };
 
 }  // namespace hx_sylar
@@ -0,0 +1,368 @@
+#include "fiber_mutex.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "fiber.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include "scheduler.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+/**
+ * @brief 一个挂起的协程或线程
+ */
+struct FiberWaitQueue::Waiter {
+  enum State {
+    WAITING,
+    WOKEN,
+    TIMEOUT,
+  };
+
+  /// 从 WAITING 切到 to, 唤醒和超时只有一方能成功
+  auto transit(int to) -> bool {
+    int expected = WAITING;
+    return state.compare_exchange_strong(expected, to);
+  }
+
+  void resume() {
+    if (fiber) {
+      scheduler->schedule(fiber);
+    } else {
+      std::lock_guard<std::mutex> lock(mutex);
+      cond.notify_one();
+    }
+  }
+
+  std::atomic<int> state = {WAITING};
+  Scheduler* scheduler = nullptr;
+  Fiber::ptr fiber;
+  /// 非协程环境下阻塞线程
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+// 当前是否运行在调度器的任务协程里, 否则只能阻塞线程
+static auto InSchedulerFiber() -> bool {
+  if (Scheduler::GetThis() == nullptr || Fiber::GetFiberId() == 0) {
+    return false;
+  }
+  return Fiber::GetThis().get() != Scheduler::GetMainFiber();
+}
+
+auto FiberWaitQueue::wait(Spinlock::Lock& lock, uint64_t timeout_ms) -> bool {
+  auto waiter = std::make_shared<Waiter>();
+  bool in_fiber = InSchedulerFiber();
+  if (in_fiber) {
+    waiter->scheduler = Scheduler::GetThis();
+    waiter->fiber = Fiber::GetThis();
+  }
+  m_queue.push_back(waiter);
+  lock.unlock();
+
+  if (!in_fiber) {
+    std::unique_lock<std::mutex> lk(waiter->mutex);
+    auto pred = [&waiter]() { return waiter->state != Waiter::WAITING; };
+    if (timeout_ms == ~0ull) {
+      waiter->cond.wait(lk, pred);
+      return true;
+    }
+    if (waiter->cond.wait_for(lk, std::chrono::milliseconds(timeout_ms),
+                              pred)) {
+      return true;
+    }
+    lk.unlock();
+    if (!waiter->transit(Waiter::TIMEOUT)) {
+      return true;
+    }
+    Spinlock::Lock lock2(m_mutex);
+    remove(waiter);
+    return false;
+  }
+
+  Timer::ptr timer;
+  if (timeout_ms != ~0ull) {
+    IOManager* iom = IOManager::GetThis();
+    HX_ASSERT1(iom != nullptr, "timed wait needs an IOManager");
+    // 超时回调抢到状态时协程还挂在队列上, 此时 this 一定有效
+    timer = iom->addTimer(timeout_ms, [this, waiter]() {
+      if (!waiter->transit(Waiter::TIMEOUT)) {
+        return;
+      }
+      {
+        Spinlock::Lock lock2(m_mutex);
+        remove(waiter);
+      }
+      waiter->resume();
+    });
+  }
+  Fiber::YieldToHold();
+  if (timer) {
+    timer->cancel();
+  }
+  return waiter->state == Waiter::WOKEN;
+}
+
+auto FiberWaitQueue::notify() -> bool {
+  while (!m_queue.empty()) {
+    std::shared_ptr<Waiter> waiter = m_queue.front();
+    m_queue.pop_front();
+    --m_waiters;
+    if (waiter->transit(Waiter::WOKEN)) {
+      waiter->resume();
+      return true;
+    }
+  }
+  return false;
+}
+
+auto FiberWaitQueue::notifyAll() -> size_t {
+  size_t count = 0;
+  while (notify()) {
+    ++count;
+  }
+  return count;
+}
+
+void FiberWaitQueue::remove(const std::shared_ptr<Waiter>& waiter) {
+  for (auto it = m_queue.begin(); it != m_queue.end(); ++it) {
+    if (*it == waiter) {
+      m_queue.erase(it);
+      --m_waiters;
+      return;
+    }
+  }
+}
+
+void FiberMutex::lock() {
+  if (tryLock()) {
+    return;
+  }
+  lockSlow(~0ull);
+}
+
+auto FiberMutex::tryLock() -> bool {
+  bool expected = false;
+  return m_locked.compare_exchange_strong(expected, true);
+}
+
+auto FiberMutex::tryLockFor(uint64_t timeout_ms) -> bool {
+  if (tryLock()) {
+    return true;
+  }
+  return lockSlow(timeout_ms);
+}
+
+auto FiberMutex::lockSlow(uint64_t timeout_ms) -> bool {
+  Spinlock::Lock lock(m_mutex);
+  m_queue.prepare();
+  if (tryLock()) {
+    m_queue.cancel();
+    return true;
+  }
+  // 被唤醒时 unlock 已经把锁交给了我们
+  return m_queue.wait(lock, timeout_ms);
+}
+
+void FiberMutex::unlock() {
+  m_locked = false;
+  if (m_queue.waiters() == 0) {
+    return;
+  }
+  Spinlock::Lock lock(m_mutex);
+  // 锁已经被别人抢到, 由它解锁时再唤醒
+  if (!tryLock()) {
+    return;
+  }
+  if (!m_queue.notify()) {
+    m_locked = false;
+  }
+}
+
+// 没有写者排队时直接增加读者计数
+static auto TryAddReader(std::atomic<int32_t>& state) -> bool {
+  int32_t s = state;
+  while (s >= 0) {
+    if (state.compare_exchange_weak(s, s + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FiberRWMutex::rdlock() {
+  if (m_writers.waiters() == 0 && TryAddReader(m_state)) {
+    return;
+  }
+  rdlockSlow(~0ull);
+}
+
+void FiberRWMutex::wrlock() {
+  int32_t expected = 0;
+  if (m_state.compare_exchange_strong(expected, -1)) {
+    return;
+  }
+  wrlockSlow(~0ull);
+}
+
+auto FiberRWMutex::tryRdlockFor(uint64_t timeout_ms) -> bool {
+  if (m_writers.waiters() == 0 && TryAddReader(m_state)) {
+    return true;
+  }
+  return rdlockSlow(timeout_ms);
+}
+
+auto FiberRWMutex::tryWrlockFor(uint64_t timeout_ms) -> bool {
+  int32_t expected = 0;
+  if (m_state.compare_exchange_strong(expected, -1)) {
+    return true;
+  }
+  return wrlockSlow(timeout_ms);
+}
+
+auto FiberRWMutex::rdlockSlow(uint64_t timeout_ms) -> bool {
+  Spinlock::Lock lock(m_mutex);
+  m_readers.prepare();
+  if (m_writers.waiters() == 0 && TryAddReader(m_state)) {
+    m_readers.cancel();
+    return true;
+  }
+  // 被唤醒时 dispatch 已经替我们加上了读者计数
+  return m_readers.wait(lock, timeout_ms);
+}
+
+auto FiberRWMutex::wrlockSlow(uint64_t timeout_ms) -> bool {
+  Spinlock::Lock lock(m_mutex);
+  m_writers.prepare();
+  int32_t expected = 0;
+  if (m_state.compare_exchange_strong(expected, -1)) {
+    m_writers.cancel();
+    return true;
+  }
+  if (m_writers.wait(lock, timeout_ms)) {
+    return true;
+  }
+  // 因为这个写者在排队的读者, 现在可以放行了
+  if (m_writers.waiters() == 0 && m_readers.waiters() > 0) {
+    dispatch();
+  }
+  return false;
+}
+
+void FiberRWMutex::unlock() {
+  int32_t s = m_state;
+  if (s == -1) {
+    m_state = 0;
+    s = 0;
+  } else {
+    s = m_state.fetch_sub(1) - 1;
+  }
+  if (s == 0 && m_readers.waiters() + m_writers.waiters() > 0) {
+    dispatch();
+  }
+}
+
+void FiberRWMutex::dispatch() {
+  Spinlock::Lock lock(m_mutex);
+  if (m_writers.waiters() > 0) {
+    int32_t expected = 0;
+    if (!m_state.compare_exchange_strong(expected, -1)) {
+      return;
+    }
+    if (m_writers.notify()) {
+      return;
+    }
+    m_state = 0;
+  }
+  // 先占好读者计数再唤醒, 避免被唤醒的读者先解锁
+  while (m_readers.waiters() > 0 && TryAddReader(m_state)) {
+    if (!m_readers.notify()) {
+      --m_state;
+      break;
+    }
+  }
+}
+
+void FiberCondition::wait(FiberMutex& mutex) { waitFor(mutex, ~0ull); }
+
+auto FiberCondition::waitFor(FiberMutex& mutex, uint64_t timeout_ms) -> bool {
+  Spinlock::Lock lock(m_mutex);
+  m_queue.prepare();
+  // 先登记再释放 mutex, 持锁 notify 的一方一定能看到这个等待者
+  mutex.unlock();
+  bool rt = m_queue.wait(lock, timeout_ms);
+  mutex.lock();
+  return rt;
+}
+
+void FiberCondition::notify() {
+  if (m_queue.waiters() == 0) {
+    return;
+  }
+  Spinlock::Lock lock(m_mutex);
+  m_queue.notify();
+}
+
+void FiberCondition::notifyAll() {
+  if (m_queue.waiters() == 0) {
+    return;
+  }
+  Spinlock::Lock lock(m_mutex);
+  m_queue.notifyAll();
+}
+
+void FiberSemaphore::wait() {
+  if (tryWait()) {
+    return;
+  }
+  waitSlow(~0ull);
+}
+
+auto FiberSemaphore::tryWait() -> bool {
+  int64_t c = m_count;
+  while (c > 0) {
+    if (m_count.compare_exchange_weak(c, c - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto FiberSemaphore::waitFor(uint64_t timeout_ms) -> bool {
+  if (tryWait()) {
+    return true;
+  }
+  return waitSlow(timeout_ms);
+}
+
+auto FiberSemaphore::waitSlow(uint64_t timeout_ms) -> bool {
+  Spinlock::Lock lock(m_mutex);
+  m_queue.prepare();
+  if (tryWait()) {
+    m_queue.cancel();
+    return true;
+  }
+  // 被唤醒时 notify 已经把计数交给了我们
+  return m_queue.wait(lock, timeout_ms);
+}
+
+void FiberSemaphore::notify() {
+  ++m_count;
+  if (m_queue.waiters() == 0) {
+    return;
+  }
+  Spinlock::Lock lock(m_mutex);
+  if (!tryWait()) {
+    return;
+  }
+  if (!m_queue.notify()) {
+    ++m_count;
+  }
+}
+
+}  // namespace hx_sylar
@@ -0,0 +1,269 @@
+/**
+ * @file fiber_mutex.h
+ * @brief 协程级别的同步原语
+ * @details mutex.h 中的锁会阻塞整个线程, 同一线程上的其他协程都无法运行.
+ *          这里的锁在竞争时只挂起当前协程, 被唤醒时通过 Scheduler::schedule
+ *          重新调度. 无竞争时只有一次原子操作.
+ *          在非协程环境(没有 Scheduler 的线程)中调用时退化为阻塞线程.
+ *          带超时的等待依赖当前线程的 IOManager 定时器.
+ */
+#ifndef __HX_FIBER_MUTEX_H__
+#define __HX_FIBER_MUTEX_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace hx_sylar {
+
+/**
+ * @brief 协程等待队列
+ * @details 所有接口都需要在持有构造时传入的 Spinlock 的情况下调用.
+ *          waiters() 可以不加锁读取, 用于解锁时判断是否需要走慢路径.
+ */
+class FiberWaitQueue : Noncopyable {
+ public:
+  struct Waiter;
+
+  explicit FiberWaitQueue(Spinlock& mutex) : m_mutex(mutex) {}
+
+  /**
+   * @brief 登记一个等待者, 之后要么调用 wait, 要么调用 cancel
+   * @details 先登记再重新检查条件, 保证解锁方能看到等待者
+   */
+  void prepare() { ++m_waiters; }
+
+  /**
+   * @brief 撤销 prepare
+   */
+  void cancel() { --m_waiters; }
+
+  /**
+   * @brief 入队并挂起, 返回前已经释放 lock
+   * @param[in] lock 已经持有的队列锁
+   * @param[in] timeout_ms 超时时间(毫秒), ~0ull 表示不超时
+   * @return 被唤醒返回 true, 超时返回 false
+   */
+  auto wait(Spinlock::Lock& lock, uint64_t timeout_ms = ~0ull) -> bool;
+
+  /**
+   * @brief 唤醒一个等待者
+   * @return 没有可唤醒的等待者时返回 false
+   */
+  auto notify() -> bool;
+
+  /**
+   * @brief 唤醒所有等待者
+   * @return 唤醒的数量
+   */
+  auto notifyAll() -> size_t;
+
+  /**
+   * @brief 已登记的等待者数量
+   */
+  auto waiters() const -> size_t { return m_waiters; }
+
+ private:
+  /**
+   * @brief 等待超时, 从队列中摘除
+   */
+  void remove(const std::shared_ptr<Waiter>& waiter);
+
+ private:
+  /// 队列锁
+  Spinlock& m_mutex;
+  /// 等待者
+  std::list<std::shared_ptr<Waiter> > m_queue;
+  /// 已登记的等待者数量
+  std::atomic<size_t> m_waiters = {0};
+};
+
+/**
+ * @brief 协程互斥量
+ */
+class FiberMutex : Noncopyable {
+ public:
+  /// 局部锁
+  using Lock = ScopedLockImpl<FiberMutex>;
+
+  FiberMutex() : m_queue(m_mutex) {}
+
+  /**
+   * @brief 加锁, 竞争时挂起当前协程
+   */
+  void lock();
+
+  /**
+   * @brief 尝试加锁, 不挂起
+   */
+  auto tryLock() -> bool;
+
+  /**
+   * @brief 加锁, 最多等待 timeout_ms 毫秒
+   * @return 是否加锁成功
+   */
+  auto tryLockFor(uint64_t timeout_ms) -> bool;
+
+  /**
+   * @brief 解锁, 有等待者时直接把锁交给队首
+   */
+  void unlock();
+
+ private:
+  auto lockSlow(uint64_t timeout_ms) -> bool;
+
+ private:
+  /// 是否已上锁
+  std::atomic<bool> m_locked = {false};
+  /// 保护等待队列
+  Spinlock m_mutex;
+  /// 等待队列
+  FiberWaitQueue m_queue;
+};
+
+/**
+ * @brief 协程读写锁, 有写者等待时新的读者会排队, 避免写者饿死
+ */
+class FiberRWMutex : Noncopyable {
+ public:
+  /// 局部读锁
+  using ReadLock = ReadScopedLockImpl<FiberRWMutex>;
+  /// 局部写锁
+  using WriteLock = WriteScopedLockImpl<FiberRWMutex>;
+
+  FiberRWMutex() : m_readers(m_mutex), m_writers(m_mutex) {}
+
+  /**
+   * @brief 上读锁
+   */
+  void rdlock();
+
+  /**
+   * @brief 上写锁
+   */
+  void wrlock();
+
+  /**
+   * @brief 上读锁, 最多等待 timeout_ms 毫秒
+   */
+  auto tryRdlockFor(uint64_t timeout_ms) -> bool;
+
+  /**
+   * @brief 上写锁, 最多等待 timeout_ms 毫秒
+   */
+  auto tryWrlockFor(uint64_t timeout_ms) -> bool;
+
+  /**
+   * @brief 解锁
+   */
+  void unlock();
+
+ private:
+  auto rdlockSlow(uint64_t timeout_ms) -> bool;
+  auto wrlockSlow(uint64_t timeout_ms) -> bool;
+  /// 锁空闲后唤醒等待者, 写者优先
+  void dispatch();
+
+ private:
+  /// >0 读者数量, -1 写者持有, 0 空闲
+  std::atomic<int32_t> m_state = {0};
+  /// 保护等待队列
+  Spinlock m_mutex;
+  /// 等待的读者
+  FiberWaitQueue m_readers;
+  /// 等待的写者
+  FiberWaitQueue m_writers;
+};
+
+/**
+ * @brief 协程条件变量, 配合 FiberMutex 使用
+ */
+class FiberCondition : Noncopyable {
+ public:
+  FiberCondition() : m_queue(m_mutex) {}
+
+  /**
+   * @brief 释放 mutex 并挂起, 被唤醒后重新加锁
+   */
+  void wait(FiberMutex& mutex);
+
+  /**
+   * @brief 释放 mutex 并挂起最多 timeout_ms 毫秒, 返回前重新加锁
+   * @return 被唤醒返回 true, 超时返回 false
+   */
+  auto waitFor(FiberMutex& mutex, uint64_t timeout_ms) -> bool;
+
+  /**
+   * @brief 唤醒一个等待者
+   */
+  void notify();
+
+  /**
+   * @brief 唤醒所有等待者
+   */
+  void notifyAll();
+
+ private:
+  /// 保护等待队列
+  Spinlock m_mutex;
+  /// 等待队列
+  FiberWaitQueue m_queue;
+};
+
+/**
+ * @brief 协程信号量
+ */
+class FiberSemaphore : Noncopyable {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] count 信号量值的大小
+   */
+  explicit FiberSemaphore(uint32_t count = 0)
+      : m_count(count), m_queue(m_mutex) {}
+
+  /**
+   * @brief 获取信号量, 为 0 时挂起
+   */
+  void wait();
+
+  /**
+   * @brief 尝试获取信号量, 不挂起
+   */
+  auto tryWait() -> bool;
+
+  /**
+   * @brief 获取信号量, 最多等待 timeout_ms 毫秒
+   */
+  auto waitFor(uint64_t timeout_ms) -> bool;
+
+  /**
+   * @brief 释放信号量
+   */
+  void notify();
+
+  /**
+   * @brief 当前信号量值
+   */
+  auto getCount() const -> int64_t { return m_count; }
+
+ private:
+  auto waitSlow(uint64_t timeout_ms) -> bool;
+
+ private:
+  /// 信号量值
+  std::atomic<int64_t> m_count;
+  /// 保护等待队列
+  Spinlock m_mutex;
+  /// 等待队列
+  FiberWaitQueue m_queue;
+};
+
+}  // namespace hx_sylar
+
+#endif
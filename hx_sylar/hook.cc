@@ -2,14 +2,18 @@
 
 #include <dlfcn.h>
 
+#include <map>
 #include <memory>
+#include <vector>
 
+#include "clock.h"
 #include "config.h"
 #include "fd_manager.h"
 #include "fiber.h"
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
+#include "offload_pool.h"
 
 hx_sylar::Logger::ptr g_logger = HX_LOG_NAME("system");
 namespace hx_sylar {
@@ -27,17 +31,34 @@ static thread_local bool t_hook_enable = false;
   XX(socket)         \
   XX(connect)        \
   XX(accept)         \
+  XX(accept4)        \
+  XX(socketpair)     \
+  XX(pipe)           \
+  XX(pipe2)          \
+  XX(dup)            \
+  XX(dup2)           \
+  XX(dup3)           \
+  XX(poll)           \
+  XX(select)         \
+  XX(epoll_wait)     \
   XX(read)           \
   XX(readv)          \
   XX(recv)           \
   XX(recvfrom)       \
   XX(recvmsg)        \
+  XX(recvmmsg)       \
   XX(write)          \
   XX(writev)         \
   XX(send)           \
   XX(sendto)         \
   XX(sendmsg)        \
+  XX(sendmmsg)       \
   XX(close)          \
+  XX(open)           \
+  XX(openat)         \
+  XX(fsync)          \
+  XX(fdatasync)      \
+  XX(getaddrinfo)    \
   XX(fcntl)          \
   XX(ioctl)          \
   XX(getsockopt)     \
@@ -76,10 +97,6 @@ void set_hook_enable(bool flag) { t_hook_enable = flag; }
 
 }  // namespace hx_sylar
 
-struct timer_info {
-  int cancelled = 0;
-};
-
 template <typename OriginFun, typename... Args>
 static auto do_io(int fd, OriginFun fun, const char *hook_fun_name,
                   uint32_t event, int timeout_so, Args &&...args) -> ssize_t {
@@ -97,12 +114,18 @@ static auto do_io(int fd, OriginFun fun, const char *hook_fun_name,
     return -1;
   }
 
-  if (!ctx->isSocket() || ctx->getUserNonblock()) {
+  if (ctx->isRegularFile()) {
+    // 磁盘文件总是"就绪", 只能在别的线程上阻塞
+    return hx_sylar::OffloadMgr::GetInstance()->call(
+        [&]() -> ssize_t { return fun(fd, args...); });
+  }
+
+  if (!(ctx->isSocket() || ctx->isPipe()) || ctx->getUserNonblock()) {
     return fun(fd, std::forward<Args>(args)...);
   }
 
   uint64_t to = ctx->getTimeout(timeout_so);
-  std::shared_ptr<timer_info> stinfo = std::make_shared<timer_info>();
+  uint32_t gen = ctx->getGeneration();
 
 retry:
   ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -111,38 +134,34 @@ retry:
   }
   if (n == -1 && errno == EAGAIN) {
     hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
-    hx_sylar::Timer::ptr timer;
-    std::weak_ptr<timer_info> winfo(stinfo);
-
-    if (to != (uint64_t)-1) {
-      timer = iom->addConditionTimer(
-          to,
-          [winfo, fd, iom, event]() {
-            auto t = winfo.lock();
-            if (!t || t->cancelled) {
-              return;
-            }
-            t->cancelled = ETIMEDOUT;
-            iom->cancelEvent(fd, (hx_sylar::IOManager::Event)(event));
-          },
-          winfo);
-    }
-
     int rt = iom->addEvent(fd, (hx_sylar::IOManager::Event)(event));
+    if (rt > 0) {
+      // 常驻注册模式下边沿已经到过, 直接重试
+      goto retry;
+    }
     if (SYLAR_UNLIKELY(rt)) {
       HX_LOG_ERROR(g_logger)
           << hook_fun_name << " addEvent(" << fd << ", " << event << ")";
-      if (timer) {
-        timer->cancel();
-      }
       return -1;
     } else {
+      uint64_t seq = 0;
+      if (to != (uint64_t)-1) {
+        // socket 超时不必精确, 允许晚 1/16, 大量连接的超时可以合并成一次唤醒
+        seq = ctx->armTimeout(iom, event, to, to / 16);
+      }
+      // close 已经在别的线程做完 cancelAll, 刚注册的事件不会再触发
+      if (ctx->getGeneration() != gen) {
+        iom->cancelEvent(fd, (hx_sylar::IOManager::Event)(event));
+      }
       hx_sylar::Fiber::YieldToHold();
-      if (timer) {
-        timer->cancel();
+      bool timed_out = seq != 0 && ctx->disarmTimeout(event, seq);
+      // 挂起期间被关闭, 这个号可能已经是别人的 fd 了, 不能再重试
+      if (ctx->getGeneration() != gen) {
+        errno = EBADF;
+        return -1;
       }
-      if (stinfo->cancelled) {
-        errno = stinfo->cancelled;
+      if (timed_out) {
+        errno = ETIMEDOUT;
         return -1;
       }
       goto retry;
@@ -152,53 +171,305 @@ retry:
   return n;
 }
 
+/**
+ * @brief 把请求交给当前线程的 io_uring 并挂起协程
+ * @return 不能走 io_uring 时返回 false, 调用方继续走 epoll 路径
+ */
+template <typename Prep>
+static auto uring_submit(hx_sylar::IOManager *iom, int fd, uint64_t timeout_ms,
+                         ssize_t *n, Prep prep) -> bool {
+  io_uring_sqe *sqe = iom->uringSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  prep(sqe);
+  bool timed_out = false;
+  int res = iom->uringWait(sqe, fd, timeout_ms, &timed_out);
+  if (res >= 0) {
+    *n = res;
+    return true;
+  }
+  *n = -1;
+  // 被超时或者 close 取消, 错误码与 epoll 路径保持一致
+  if (res == -ECANCELED) {
+    errno = timed_out ? ETIMEDOUT : EBADF;
+  } else {
+    errno = -res;
+  }
+  return true;
+}
+
+/**
+ * @brief io_uring 引擎下的 do_io, 请求直接提交而不是先试一次再等 epoll
+ */
+template <typename Prep>
+static auto uring_io(int fd, int timeout_so, ssize_t *n, Prep prep) -> bool {
+  if (!hx_sylar::t_hook_enable) {
+    return false;
+  }
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  if (iom == nullptr || !iom->isUring()) {
+    return false;
+  }
+  hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(fd);
+  if (!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+    return false;
+  }
+  return uring_submit(iom, fd, ctx->getTimeout(timeout_so), n, prep);
+}
+
+/**
+ * @brief 接管 hook 里新建的 fd
+ * @param[in] user_nonblock 用户创建时就要求非阻塞(SOCK_NONBLOCK/O_NONBLOCK)
+ */
+static void adopt_fd(int fd, bool user_nonblock) {
+  hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(fd, true);
+  if (ctx && user_nonblock) {
+    ctx->setUserNonblock(true);
+  }
+}
+
+/**
+ * @brief fd 即将被关闭或者被 dup2 覆盖
+ * @details 先把 FdCtx 标成关闭, 与 cancelAll 并发注册事件的协程比较代数能发现
+ */
+static void release_fd(int fd) {
+  hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(fd);
+  if (ctx) {
+    hx_sylar::FdMgr::GetInstance()->del(fd);
+    auto iom = hx_sylar::IOManager::GetThis();
+    if (iom) {
+      iom->uringClose(fd);
+      iom->cancelAll(fd);
+    }
+  }
+}
+
+/**
+ * @brief dup 出来的 fd 与原 fd 共用打开的文件, 也就共用 O_NONBLOCK
+ * @details 原 fd 没有被接管时新 fd 也不接管, 否则会把共享的文件切成非阻塞,
+ *          比如 dup(1) 会让 stdout 写满时返回 EAGAIN
+ */
+static void inherit_fd(int oldfd, int newfd) {
+  hx_sylar::FdCtx::ptr old = hx_sylar::FdMgr::GetInstance()->get(oldfd);
+  if (!old || old->isClose()) {
+    return;
+  }
+  hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(newfd, true);
+  if (ctx) {
+    ctx->setUserNonblock(old->getUserNonblock());
+    ctx->setTimeout(SO_RCVTIMEO, old->getTimeout(SO_RCVTIMEO));
+    ctx->setTimeout(SO_SNDTIMEO, old->getTimeout(SO_SNDTIMEO));
+  }
+}
+
+/**
+ * @brief 挂起当前协程, 直到 events 里任意一个 fd 就绪、超时或者被提前唤醒
+ * @details 建一个临时的 epoll 把这些 fd 加进去, 再让 IOManager 等这个 epoll
+ *          可读. 一个 fd 可以同时在多个 epoll 里, 所以不占用 IOManager 上这些
+ *          fd 的读写事件, 其他协程照样可以在上面 recv/send
+ * @param[in] events fd -> EPOLLIN 等事件
+ * @param[in] timeout_ms 超时(毫秒), 负数不超时
+ * @return 0 表示醒来了, 调用方再用零超时查一次实际状态; -1 表示有 fd
+ *         不能加进 epoll(比如普通文件), 调用方退回阻塞调用
+ */
+static auto wait_fds(hx_sylar::IOManager *iom,
+                     const std::map<int, uint32_t> &events, int timeout_ms)
+    -> int {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    return -1;
+  }
+  for (auto &i : events) {
+    epoll_event ev{};
+    ev.events = i.second;
+    ev.data.fd = i.first;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, i.first, &ev) != 0) {
+      close_f(epfd);
+      return -1;
+    }
+  }
+  // 登记到 FdMgr, 关闭时 cancelAll 能清掉常驻注册模式下的注册
+  hx_sylar::FdMgr::GetInstance()->get(epfd, true);
+
+  struct WaitState {
+    hx_sylar::Mutex mutex;
+    bool done = false;
+  };
+  auto state = std::make_shared<WaitState>();
+  int rt = iom->addEvent(epfd, hx_sylar::IOManager::READ);
+  if (rt == 0) {
+    hx_sylar::Timer::ptr timer;
+    if (timeout_ms >= 0) {
+      std::weak_ptr<WaitState> weak(state);
+      timer = iom->addTimer(timeout_ms, [weak, iom, epfd]() {
+        auto s = weak.lock();
+        if (!s) {
+          return;
+        }
+        // 持锁检查, 等待方关闭 epfd 之后不会再取消到复用这个号的 fd 上
+        hx_sylar::Mutex::Lock lock(s->mutex);
+        if (!s->done) {
+          iom->cancelEvent(epfd, hx_sylar::IOManager::READ);
+        }
+      });
+    }
+    hx_sylar::Fiber::YieldToHold();
+    if (timer) {
+      timer->cancel();
+    }
+    hx_sylar::Mutex::Lock lock(state->mutex);
+    state->done = true;
+  }
+  // rt > 0: 常驻注册模式下已经就绪
+  release_fd(epfd);
+  close_f(epfd);
+  return rt < 0 ? -1 : 0;
+}
+
+static auto poll_to_epoll(short events) -> uint32_t {
+  uint32_t ev = 0;
+  if ((events & (POLLIN | POLLRDNORM)) != 0) {
+    ev |= EPOLLIN;
+  }
+  if ((events & (POLLOUT | POLLWRNORM)) != 0) {
+    ev |= EPOLLOUT;
+  }
+  if ((events & POLLPRI) != 0) {
+    ev |= EPOLLPRI;
+  }
+  if ((events & POLLRDHUP) != 0) {
+    ev |= EPOLLRDHUP;
+  }
+  return ev;
+}
+
+/**
+ * @brief 协程版的 poll, 结果由零超时的 poll 给出, 与内核一致
+ */
+static auto hook_poll(struct pollfd *fds, nfds_t nfds, int timeout) -> int {
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  if (!hx_sylar::t_hook_enable || timeout == 0 || iom == nullptr) {
+    return poll_f(fds, nfds, timeout);
+  }
+  int n = poll_f(fds, nfds, 0);
+  if (n != 0) {
+    return n;
+  }
+  // 同一个 fd 可以在数组里出现多次, epoll 里只能加一次
+  std::map<int, uint32_t> events;
+  for (nfds_t i = 0; i < nfds; ++i) {
+    if (fds[i].fd >= 0) {
+      events[fds[i].fd] |= poll_to_epoll(fds[i].events);
+    }
+  }
+  uint64_t deadline = hx_sylar::Clock::NowMS() + (timeout > 0 ? timeout : 0);
+  while (true) {
+    int remain = -1;
+    if (timeout > 0) {
+      uint64_t now = hx_sylar::Clock::NowMS();
+      if (now >= deadline) {
+        return 0;
+      }
+      remain = static_cast<int>(deadline - now);
+    }
+    if (wait_fds(iom, events, remain) != 0) {
+      return poll_f(fds, nfds, remain);
+    }
+    n = poll_f(fds, nfds, 0);
+    if (n != 0) {
+      return n;
+    }
+  }
+}
+
+/**
+ * @brief 按时限等用户自己的 epoll, 把它当成一个普通的可读 fd
+ */
+static auto hook_epoll_wait(int epfd, struct epoll_event *events,
+                            int maxevents, int timeout) -> int {
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  if (!hx_sylar::t_hook_enable || timeout == 0 || iom == nullptr) {
+    return epoll_wait_f(epfd, events, maxevents, timeout);
+  }
+  int n = epoll_wait_f(epfd, events, maxevents, 0);
+  if (n != 0) {
+    return n;
+  }
+  std::map<int, uint32_t> wait{{epfd, EPOLLIN}};
+  uint64_t deadline = hx_sylar::Clock::NowMS() + (timeout > 0 ? timeout : 0);
+  while (true) {
+    int remain = -1;
+    if (timeout > 0) {
+      uint64_t now = hx_sylar::Clock::NowMS();
+      if (now >= deadline) {
+        return 0;
+      }
+      remain = static_cast<int>(deadline - now);
+    }
+    if (wait_fds(iom, wait, remain) != 0) {
+      return epoll_wait_f(epfd, events, maxevents, remain);
+    }
+    n = epoll_wait_f(epfd, events, maxevents, 0);
+    if (n != 0) {
+      return n;
+    }
+  }
+}
+
 extern "C" {
 #define XX(name) name##_fun name##_f = nullptr;
 HOOK_FUN(XX);
 #undef XX
 
 auto sleep(unsigned int seconds) -> unsigned int {
-  if (!hx_sylar::t_hook_enable) {
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  // 普通 Scheduler 里没有定时器, 只能阻塞线程
+  if (!hx_sylar::t_hook_enable || iom == nullptr) {
     return sleep_f(seconds);
   }
-
   hx_sylar::Fiber::ptr fiber = hx_sylar::Fiber::GetThis();
-  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
   iom->addTimer(seconds * 1000,
-                std::bind((void(hx_sylar::Scheduler::*)(hx_sylar::Fiber::ptr,
-                                                        int thread)) &
+                std::bind((void(hx_sylar::Scheduler::*)(
+                              hx_sylar::Fiber::ptr, int thread,
+                              hx_sylar::Scheduler::Priority)) &
                               hx_sylar::IOManager::schedule,
-                          iom, fiber, -1));
+                          iom, fiber, -1, hx_sylar::Scheduler::INHERIT));
   hx_sylar::Fiber::YieldToHold();
   return 0;
 }
 
 auto usleep(useconds_t usec) -> int {
-  if (!hx_sylar::t_hook_enable) {
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  // 普通 Scheduler 里没有定时器, 只能阻塞线程
+  if (!hx_sylar::t_hook_enable || iom == nullptr) {
     return usleep_f(usec);
   }
   hx_sylar::Fiber::ptr fiber = hx_sylar::Fiber::GetThis();
-  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
-  iom->addTimer(usec / 1000, std::bind((void(hx_sylar::Scheduler::*)(
-                                           hx_sylar::Fiber::ptr, int thread)) &
-                                           hx_sylar::IOManager::schedule,
-                                       iom, fiber, -1));
+  iom->addTimerUs(usec, std::bind((void(hx_sylar::Scheduler::*)(
+                                      hx_sylar::Fiber::ptr, int thread,
+                                      hx_sylar::Scheduler::Priority)) &
+                                      hx_sylar::IOManager::schedule,
+                                  iom, fiber, -1,
+                                  hx_sylar::Scheduler::INHERIT));
   hx_sylar::Fiber::YieldToHold();
   return 0;
 }
 
 auto nanosleep(const struct timespec *req, struct timespec *rem) -> int {
-  if (!hx_sylar::t_hook_enable) {
+  uint64_t timeout_us = req->tv_sec * 1000000ULL + req->tv_nsec / 1000;
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  // 普通 Scheduler 里没有定时器, 只能阻塞线程
+  if (!hx_sylar::t_hook_enable || iom == nullptr) {
     return nanosleep_f(req, rem);
   }
-
-  int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
   hx_sylar::Fiber::ptr fiber = hx_sylar::Fiber::GetThis();
-  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
-  iom->addTimer(timeout_ms, std::bind((void(hx_sylar::Scheduler::*)(
-                                          hx_sylar::Fiber::ptr, int thread)) &
-                                          hx_sylar::IOManager::schedule,
-                                      iom, fiber, -1));
+  iom->addTimerUs(timeout_us, std::bind((void(hx_sylar::Scheduler::*)(
+                                            hx_sylar::Fiber::ptr, int thread,
+                                            hx_sylar::Scheduler::Priority)) &
+                                            hx_sylar::IOManager::schedule,
+                                        iom, fiber, -1,
+                                        hx_sylar::Scheduler::INHERIT));
   hx_sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -225,6 +496,7 @@ auto connect_with_timeout(int fd, const struct sockaddr *addr,
     errno = EBADF;
     return -1;
   }
+  uint32_t gen = ctx->getGeneration();
 
   if (!ctx->isSocket()) {
     return connect_f(fd, addr, addrlen);
@@ -234,6 +506,15 @@ auto connect_with_timeout(int fd, const struct sockaddr *addr,
     return connect_f(fd, addr, addrlen);
   }
 
+  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
+  ssize_t rt = 0;
+  if (iom->isUring() &&
+      uring_submit(iom, fd, timeout_ms, &rt, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepConnect(sqe, fd, addr, addrlen);
+      })) {
+    return static_cast<int>(rt);
+  }
+
   int n = connect_f(fd, addr, addrlen);
   if (n == 0) {
     return 0;
@@ -242,41 +523,32 @@ auto connect_with_timeout(int fd, const struct sockaddr *addr,
     return n;
   }
 
-  hx_sylar::IOManager *iom = hx_sylar::IOManager::GetThis();
-  hx_sylar::Timer::ptr timer;
-  std::shared_ptr<timer_info> tinfo = std::make_shared<timer_info>();
-  std::weak_ptr<timer_info> winfo(tinfo);
-
-  if (timeout_ms != (uint64_t)-1) {
-    timer = iom->addConditionTimer(
-        timeout_ms,
-        [winfo, fd, iom]() {
-          auto t = winfo.lock();
-          if (!t || t->cancelled) {
-            return;
-          }
-          t->cancelled = ETIMEDOUT;
-          iom->cancelEvent(fd, hx_sylar::IOManager::WRITE);
-        },
-        winfo);
-  }
-
-  int rt = iom->addEvent(fd, hx_sylar::IOManager::WRITE);
+  rt = iom->addEvent(fd, hx_sylar::IOManager::WRITE);
   if (rt == 0) {
-    hx_sylar::Fiber::YieldToHold();
-    if (timer) {
-      timer->cancel();
+    uint64_t seq = 0;
+    if (timeout_ms != (uint64_t)-1) {
+      seq = ctx->armTimeout(iom, hx_sylar::IOManager::WRITE, timeout_ms,
+                            timeout_ms / 16);
     }
-    if (tinfo->cancelled) {
-      errno = tinfo->cancelled;
+    if (ctx->getGeneration() != gen) {
+      iom->cancelEvent(fd, hx_sylar::IOManager::WRITE);
+    }
+    hx_sylar::Fiber::YieldToHold();
+    bool timed_out =
+        seq != 0 && ctx->disarmTimeout(hx_sylar::IOManager::WRITE, seq);
+    // 挂起期间被关闭, 不能去查可能已经复用了这个号的 fd 的 SO_ERROR
+    if (ctx->getGeneration() != gen) {
+      errno = EBADF;
       return -1;
     }
-  } else {
-    if (timer) {
-      timer->cancel();
+    if (timed_out) {
+      errno = ETIMEDOUT;
+      return -1;
     }
+  } else if (rt < 0) {
     HX_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
   }
+  // rt > 0: 常驻注册模式下连接已经完成, 结果在 SO_ERROR 里
 
   int error = 0;
   socklen_t len = sizeof(int);
@@ -297,80 +569,397 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-  int fd = do_io(s, accept_f, "accept", hx_sylar::IOManager::READ, SO_RCVTIMEO,
-                 addr, addrlen);
+  ssize_t n = 0;
+  int fd = 0;
+  if (uring_io(s, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepAccept(sqe, s, addr, addrlen);
+      })) {
+    fd = static_cast<int>(n);
+  } else {
+    fd = do_io(s, accept_f, "accept", hx_sylar::IOManager::READ, SO_RCVTIMEO,
+               addr, addrlen);
+  }
   if (fd >= 0) {
     hx_sylar::FdMgr::GetInstance()->get(fd, true);
   }
   return fd;
 }
 
+auto accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags)
+    -> int {
+  ssize_t n = 0;
+  int fd = 0;
+  if (uring_io(s, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepAccept(sqe, s, addr, addrlen, flags);
+      })) {
+    fd = static_cast<int>(n);
+  } else {
+    fd = do_io(s, accept4_f, "accept4", hx_sylar::IOManager::READ,
+               SO_RCVTIMEO, addr, addrlen, flags);
+  }
+  if (fd >= 0 && hx_sylar::t_hook_enable) {
+    adopt_fd(fd, (flags & SOCK_NONBLOCK) != 0);
+  }
+  return fd;
+}
+
+auto socketpair(int domain, int type, int protocol, int sv[2]) -> int {
+  int rt = socketpair_f(domain, type, protocol, sv);
+  if (rt == 0 && hx_sylar::t_hook_enable) {
+    adopt_fd(sv[0], (type & SOCK_NONBLOCK) != 0);
+    adopt_fd(sv[1], (type & SOCK_NONBLOCK) != 0);
+  }
+  return rt;
+}
+
 auto read(int fd, void *buf, size_t count) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(fd, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepRead(sqe, fd, buf, count);
+      })) {
+    return n;
+  }
   return do_io(fd, read_f, "read", hx_sylar::IOManager::READ, SO_RCVTIMEO, buf,
                count);
 }
 
 auto readv(int fd, const struct iovec *iov, int iovcnt) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(fd, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepReadv(sqe, fd, iov, iovcnt);
+      })) {
+    return n;
+  }
   return do_io(fd, readv_f, "readv", hx_sylar::IOManager::READ, SO_RCVTIMEO,
                iov, iovcnt);
 }
 
 auto recv(int sockfd, void *buf, size_t len, int flags) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(sockfd, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepRecv(sqe, sockfd, buf, len, flags);
+      })) {
+    return n;
+  }
   return do_io(sockfd, recv_f, "recv", hx_sylar::IOManager::READ, SO_RCVTIMEO,
                buf, len, flags);
 }
 
 auto recvfrom(int sockfd, void *buf, size_t len, int flags,
               struct sockaddr *src_addr, socklen_t *addrlen) -> ssize_t {
+  // io_uring 没有 recvfrom, 包成 RECVMSG; 协程挂起到完成, 栈上的消息头一直有效
+  iovec iov{buf, len};
+  msghdr msg{};
+  msg.msg_name = src_addr;
+  msg.msg_namelen = src_addr != nullptr && addrlen != nullptr ? *addrlen : 0;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  ssize_t n = 0;
+  if (uring_io(sockfd, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepRecvmsg(sqe, sockfd, &msg, flags);
+      })) {
+    if (n >= 0 && src_addr != nullptr && addrlen != nullptr) {
+      *addrlen = msg.msg_namelen;
+    }
+    return n;
+  }
   return do_io(sockfd, recvfrom_f, "recvfrom", hx_sylar::IOManager::READ,
                SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
 }
 
 auto recvmsg(int sockfd, struct msghdr *msg, int flags) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(sockfd, SO_RCVTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepRecvmsg(sqe, sockfd, msg, flags);
+      })) {
+    return n;
+  }
   return do_io(sockfd, recvmsg_f, "recvmsg", hx_sylar::IOManager::READ,
                SO_RCVTIMEO, msg, flags);
 }
 
+// io_uring 没有对应的批量操作, 两个引擎都走 epoll 路径;
+// 非阻塞 fd 上有多少收多少, 效果相当于 MSG_WAITFORONE
+auto recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+              struct timespec *timeout) -> int {
+  return do_io(sockfd, recvmmsg_f, "recvmmsg", hx_sylar::IOManager::READ,
+               SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 auto write(int fd, const void *buf, size_t count) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(fd, SO_SNDTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepWrite(sqe, fd, buf, count);
+      })) {
+    return n;
+  }
   return do_io(fd, write_f, "write", hx_sylar::IOManager::WRITE, SO_SNDTIMEO,
                buf, count);
 }
 
 auto writev(int fd, const struct iovec *iov, int iovcnt) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(fd, SO_SNDTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepWritev(sqe, fd, iov, iovcnt);
+      })) {
+    return n;
+  }
   return do_io(fd, writev_f, "writev", hx_sylar::IOManager::WRITE, SO_SNDTIMEO,
                iov, iovcnt);
 }
 
 auto send(int s, const void *msg, size_t len, int flags) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(s, SO_SNDTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepSend(sqe, s, msg, len, flags);
+      })) {
+    return n;
+  }
   return do_io(s, send_f, "send", hx_sylar::IOManager::WRITE, SO_SNDTIMEO, msg,
                len, flags);
 }
 
 auto sendto(int s, const void *msg, size_t len, int flags,
             const struct sockaddr *to, socklen_t tolen) -> ssize_t {
+  // 同 recvfrom, 包成 SENDMSG
+  iovec iov{const_cast<void *>(msg), len};
+  msghdr hdr{};
+  hdr.msg_name = const_cast<sockaddr *>(to);
+  hdr.msg_namelen = to != nullptr ? tolen : 0;
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  ssize_t n = 0;
+  if (uring_io(s, SO_SNDTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepSendmsg(sqe, s, &hdr, flags);
+      })) {
+    return n;
+  }
   return do_io(s, sendto_f, "sendto", hx_sylar::IOManager::WRITE, SO_SNDTIMEO,
                msg, len, flags, to, tolen);
 }
 
 auto sendmsg(int s, const struct msghdr *msg, int flags) -> ssize_t {
+  ssize_t n = 0;
+  if (uring_io(s, SO_SNDTIMEO, &n, [&](io_uring_sqe *sqe) {
+        hx_sylar::IoUring::PrepSendmsg(sqe, s, msg, flags);
+      })) {
+    return n;
+  }
   return do_io(s, sendmsg_f, "sendmsg", hx_sylar::IOManager::WRITE, SO_SNDTIMEO,
                msg, flags);
 }
 
+auto sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+    -> int {
+  return do_io(s, sendmmsg_f, "sendmmsg", hx_sylar::IOManager::WRITE,
+               SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
 auto close(int fd) -> int {
   if (!hx_sylar::t_hook_enable) {
     return close_f(fd);
   }
+  release_fd(fd);
+  return close_f(fd);
+}
 
-  hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(fd);
-  if (ctx) {
-    auto iom = hx_sylar::IOManager::GetThis();
-    if (iom) {
-      iom->cancelAll(fd);
+auto pipe(int fds[2]) -> int {
+  int rt = pipe_f(fds);
+  if (rt == 0 && hx_sylar::t_hook_enable) {
+    adopt_fd(fds[0], false);
+    adopt_fd(fds[1], false);
+  }
+  return rt;
+}
+
+auto pipe2(int fds[2], int flags) -> int {
+  int rt = pipe2_f(fds, flags);
+  if (rt == 0 && hx_sylar::t_hook_enable) {
+    adopt_fd(fds[0], (flags & O_NONBLOCK) != 0);
+    adopt_fd(fds[1], (flags & O_NONBLOCK) != 0);
+  }
+  return rt;
+}
+
+auto dup(int oldfd) -> int {
+  int fd = dup_f(oldfd);
+  if (fd >= 0 && hx_sylar::t_hook_enable) {
+    inherit_fd(oldfd, fd);
+  }
+  return fd;
+}
+
+auto dup2(int oldfd, int newfd) -> int {
+  if (!hx_sylar::t_hook_enable || oldfd == newfd) {
+    return dup2_f(oldfd, newfd);
+  }
+  // newfd 原来打开着时会被内核悄悄关掉
+  release_fd(newfd);
+  int fd = dup2_f(oldfd, newfd);
+  if (fd >= 0) {
+    inherit_fd(oldfd, fd);
+  }
+  return fd;
+}
+
+auto dup3(int oldfd, int newfd, int flags) -> int {
+  if (!hx_sylar::t_hook_enable || oldfd == newfd) {
+    return dup3_f(oldfd, newfd, flags);
+  }
+  release_fd(newfd);
+  int fd = dup3_f(oldfd, newfd, flags);
+  if (fd >= 0) {
+    inherit_fd(oldfd, fd);
+  }
+  return fd;
+}
+
+auto poll(struct pollfd *fds, nfds_t nfds, int timeout) -> int {
+  return hook_poll(fds, nfds, timeout);
+}
+
+auto select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+            struct timeval *timeout) -> int {
+  if (!hx_sylar::t_hook_enable || hx_sylar::IOManager::GetThis() == nullptr ||
+      (timeout != nullptr && timeout->tv_sec == 0 && timeout->tv_usec == 0)) {
+    return select_f(nfds, readfds, writefds, exceptfds, timeout);
+  }
+  std::vector<pollfd> fds;
+  for (int fd = 0; fd < nfds; ++fd) {
+    short events = 0;
+    if (readfds != nullptr && FD_ISSET(fd, readfds)) {
+      events |= POLLIN;
+    }
+    if (writefds != nullptr && FD_ISSET(fd, writefds)) {
+      events |= POLLOUT;
+    }
+    if (exceptfds != nullptr && FD_ISSET(fd, exceptfds)) {
+      events |= POLLPRI;
+    }
+    if (events != 0) {
+      fds.push_back(pollfd{fd, events, 0});
     }
-    hx_sylar::FdMgr::GetInstance()->del(fd);
   }
-  return close_f(fd);
+  int timeout_ms = -1;
+  uint64_t start = hx_sylar::Clock::NowMS();
+  if (timeout != nullptr) {
+    timeout_ms = static_cast<int>(timeout->tv_sec * 1000 +
+                                  (timeout->tv_usec + 999) / 1000);
+  }
+  int n = hook_poll(fds.data(), fds.size(), timeout_ms);
+  if (n < 0) {
+    return n;
+  }
+  // 与 Linux 一样把剩余时间写回 timeout
+  if (timeout != nullptr) {
+    uint64_t used = hx_sylar::Clock::NowMS() - start;
+    uint64_t left =
+        used < static_cast<uint64_t>(timeout_ms) ? timeout_ms - used : 0;
+    timeout->tv_sec = left / 1000;
+    timeout->tv_usec = left % 1000 * 1000;
+  }
+  int count = 0;
+  for (auto &p : fds) {
+    if ((p.revents & POLLNVAL) != 0) {
+      errno = EBADF;
+      return -1;
+    }
+  }
+  for (auto &p : fds) {
+    if ((p.events & POLLIN) != 0) {
+      FD_CLR(p.fd, readfds);
+      if ((p.revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+        FD_SET(p.fd, readfds);
+        ++count;
+      }
+    }
+    if ((p.events & POLLOUT) != 0) {
+      FD_CLR(p.fd, writefds);
+      if ((p.revents & (POLLOUT | POLLERR)) != 0) {
+        FD_SET(p.fd, writefds);
+        ++count;
+      }
+    }
+    if ((p.events & POLLPRI) != 0) {
+      FD_CLR(p.fd, exceptfds);
+      if ((p.revents & POLLPRI) != 0) {
+        FD_SET(p.fd, exceptfds);
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+auto epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+                int timeout) -> int {
+  return hook_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+/// O_CREAT 和 O_TMPFILE 时才有第三个参数
+static auto open_mode(int flags, va_list va) -> mode_t {
+  if ((flags & O_CREAT) != 0 || (flags & O_TMPFILE) == O_TMPFILE) {
+    return va_arg(va, mode_t);
+  }
+  return 0;
+}
+
+auto open(const char *pathname, int flags, ...) -> int {
+  va_list va;
+  va_start(va, flags);
+  mode_t mode = open_mode(flags, va);
+  va_end(va);
+  if (!hx_sylar::t_hook_enable) {
+    return open_f(pathname, flags, mode);
+  }
+  int fd = hx_sylar::OffloadMgr::GetInstance()->call(
+      [&]() { return open_f(pathname, flags, mode); });
+  if (fd >= 0) {
+    hx_sylar::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+auto openat(int dirfd, const char *pathname, int flags, ...) -> int {
+  va_list va;
+  va_start(va, flags);
+  mode_t mode = open_mode(flags, va);
+  va_end(va);
+  if (!hx_sylar::t_hook_enable) {
+    return openat_f(dirfd, pathname, flags, mode);
+  }
+  int fd = hx_sylar::OffloadMgr::GetInstance()->call(
+      [&]() { return openat_f(dirfd, pathname, flags, mode); });
+  if (fd >= 0) {
+    hx_sylar::FdMgr::GetInstance()->get(fd, true);
+  }
+  return fd;
+}
+
+auto fsync(int fd) -> int {
+  if (!hx_sylar::t_hook_enable) {
+    return fsync_f(fd);
+  }
+  return hx_sylar::OffloadMgr::GetInstance()->call(
+      [fd]() { return fsync_f(fd); });
+}
+
+auto fdatasync(int fd) -> int {
+  if (!hx_sylar::t_hook_enable) {
+    return fdatasync_f(fd);
+  }
+  return hx_sylar::OffloadMgr::GetInstance()->call(
+      [fd]() { return fdatasync_f(fd); });
+}
+
+auto getaddrinfo(const char *node, const char *service,
+                 const struct addrinfo *hints, struct addrinfo **res) -> int {
+  if (!hx_sylar::t_hook_enable) {
+    return getaddrinfo_f(node, service, hints, res);
+  }
+  // 解析可能要等 DNS 服务器几秒, 线程池线程没有开 hook, 直接阻塞
+  return hx_sylar::OffloadMgr::GetInstance()->call(
+      [&]() { return getaddrinfo_f(node, service, hints, res); });
 }
 
 auto fcntl(int fd, int cmd, ... /* arg */) -> int {
@@ -381,7 +970,7 @@ auto fcntl(int fd, int cmd, ... /* arg */) -> int {
       int arg = va_arg(va, int);
       va_end(va);
       hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(fd);
-      if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+      if (!ctx || ctx->isClose() || !(ctx->isSocket() || ctx->isPipe())) {
         return fcntl_f(fd, cmd, arg);
       }
       ctx->setUserNonblock(arg & O_NONBLOCK);
@@ -396,7 +985,7 @@ auto fcntl(int fd, int cmd, ... /* arg */) -> int {
       va_end(va);
       int arg = fcntl_f(fd, cmd);
       hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(fd);
-      if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+      if (!ctx || ctx->isClose() || !(ctx->isSocket() || ctx->isPipe())) {
         return arg;
       }
       if (ctx->getUserNonblock()) {
@@ -459,7 +1048,7 @@ auto ioctl(int d, unsigned long int request, ...) -> int {
   if (FIONBIO == request) {
     bool user_nonblock = !!*(int *)arg;
     hx_sylar::FdCtx::ptr ctx = hx_sylar::FdMgr::GetInstance()->get(d);
-    if (!ctx || ctx->isClose() || !ctx->isSocket()) {
+    if (!ctx || ctx->isClose() || !(ctx->isSocket() || ctx->isPipe())) {
       return ioctl_f(d, request, arg);
     }
     ctx->setUserNonblock(user_nonblock);
@@ -6,6 +6,10 @@
 #define hx_sylar_HOOK_H
 
 #include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -38,6 +42,38 @@ extern connect_fun connect_f;
 using accept_fun = int (*)(int, struct sockaddr *, socklen_t *);
 extern accept_fun accept_f;
 
+using accept4_fun = int (*)(int, struct sockaddr *, socklen_t *, int);
+extern accept4_fun accept4_f;
+
+using socketpair_fun = int (*)(int, int, int, int *);
+extern socketpair_fun socketpair_f;
+
+//pipe, dup
+using pipe_fun = int (*)(int *);
+extern pipe_fun pipe_f;
+
+using pipe2_fun = int (*)(int *, int);
+extern pipe2_fun pipe2_f;
+
+using dup_fun = int (*)(int);
+extern dup_fun dup_f;
+
+using dup2_fun = int (*)(int, int);
+extern dup2_fun dup2_f;
+
+using dup3_fun = int (*)(int, int, int);
+extern dup3_fun dup3_f;
+
+//wait, 挂起协程直到 fd 就绪
+using poll_fun = int (*)(struct pollfd *, nfds_t, int);
+extern poll_fun poll_f;
+
+using select_fun = int (*)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+extern select_fun select_f;
+
+using epoll_wait_fun = int (*)(int, struct epoll_event *, int, int);
+extern epoll_wait_fun epoll_wait_f;
+
 //read
 using read_fun = ssize_t (*)(int, void *, size_t);
 extern read_fun read_f;
@@ -54,6 +90,10 @@ extern recvfrom_fun recvfrom_f;
 using recvmsg_fun = ssize_t (*)(int, struct msghdr *, int);
 extern recvmsg_fun recvmsg_f;
 
+using recvmmsg_fun = int (*)(int, struct mmsghdr *, unsigned int, int,
+                             struct timespec *);
+extern recvmmsg_fun recvmmsg_f;
+
 //write
 using write_fun = ssize_t (*)(int, const void *, size_t);
 extern write_fun write_f;
@@ -70,9 +110,28 @@ extern sendto_fun sendto_f;
 using sendmsg_fun = ssize_t (*)(int, const struct msghdr *, int);
 extern sendmsg_fun sendmsg_f;
 
+using sendmmsg_fun = int (*)(int, struct mmsghdr *, unsigned int, int);
+extern sendmmsg_fun sendmmsg_f;
+
 using close_fun = int (*)(int);
 extern close_fun close_f;
 
+//file, 交给 OffloadPool
+using open_fun = int (*)(const char *, int, ...);
+extern open_fun open_f;
+
+using openat_fun = int (*)(int, const char *, int, ...);
+extern openat_fun openat_f;
+
+using fsync_fun = int (*)(int);
+extern fsync_fun fsync_f;
+
+using fdatasync_fun = int (*)(int);
+extern fdatasync_fun fdatasync_f;
+
+using getaddrinfo_fun = int (*)(const char *, const char *, const struct addrinfo *, struct addrinfo **);
+extern getaddrinfo_fun getaddrinfo_f;
+
 //
 using fcntl_fun = int (*)(int, int, ...);
 extern fcntl_fun fcntl_f;
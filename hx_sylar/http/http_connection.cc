@@ -67,7 +67,7 @@ auto HttpConnection::recvResponse() -> HttpResponse::ptr {
         len = 0;
         int left = client_parser.content_len - len;
         while (left > 0) {
-          int rt = read(data, left > buffer_size ? buffer_size : left);
+          int rt = read(data, left > static_cast<int>(buffer_size) ? static_cast<int>(buffer_size) : left);
           if (rt <= 0) {
             return nullptr;
           }
@@ -0,0 +1,301 @@
+#include "udp_server.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "hx_sylar/config.h"
+#include "hx_sylar/datagram.h"
+#include "hx_sylar/fd_manager.h"
+#include "hx_sylar/log.h"
+
+namespace hx_sylar {
+
+static hx_sylar::ConfigVar<uint32_t>::ptr g_udp_server_batch =
+    hx_sylar::Config::Lookup("udp_server.batch", static_cast<uint32_t>(32),
+                             "udp server datagrams per recvmmsg");
+
+static hx_sylar::ConfigVar<uint32_t>::ptr g_udp_server_buffer_size =
+    hx_sylar::Config::Lookup("udp_server.buffer_size",
+                             static_cast<uint32_t>(2048),
+                             "udp server datagram buffer size");
+
+static hx_sylar::ConfigVar<uint32_t>::ptr g_udp_server_pool_size =
+    hx_sylar::Config::Lookup("udp_server.pool_size",
+                             static_cast<uint32_t>(1024),
+                             "udp server max cached datagram buffers");
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_NAME("system");
+
+/// GRO 合并后的数据最长 64KB
+static const size_t kGroBufferSize = 65536;
+
+/**
+ * 数据报缓冲区的缓冲池. 接收线程取, 处理完的协程还, 可能不在同一线程;
+ * 服务器先析构时还回来的缓冲区直接释放
+ */
+class UdpServer::BufferPool
+    : public std::enable_shared_from_this<UdpServer::BufferPool> {
+ public:
+  using MutexType = Mutex;
+
+  BufferPool(size_t buffer_size, size_t max_free)
+      : m_bufferSize(buffer_size), m_maxFree(max_free) {}
+  ~BufferPool() {
+    for (auto* d : m_free) {
+      delete d;
+    }
+  }
+
+  auto acquire() -> Datagram::ptr {
+    Datagram* dgram = nullptr;
+    {
+      MutexType::Lock lock(m_mutex);
+      if (!m_free.empty()) {
+        dgram = m_free.back();
+        m_free.pop_back();
+      }
+    }
+    if (dgram != nullptr) {
+      ++m_hits;
+    } else {
+      dgram = new Datagram(m_bufferSize);
+    }
+    std::weak_ptr<BufferPool> weak(shared_from_this());
+    return Datagram::ptr(dgram, [weak](Datagram* d) {
+      auto pool = weak.lock();
+      if (pool) {
+        pool->release(d);
+      } else {
+        delete d;
+      }
+    });
+  }
+
+  auto getHits() const -> uint64_t { return m_hits; }
+
+ private:
+  void release(Datagram* dgram) {
+    dgram->from.reset();
+    dgram->sock.reset();
+    dgram->length = 0;
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_free.size() < m_maxFree) {
+        m_free.push_back(dgram);
+        return;
+      }
+    }
+    delete dgram;
+  }
+
+ private:
+  size_t m_bufferSize;
+  size_t m_maxFree;
+  MutexType m_mutex;
+  std::vector<Datagram*> m_free;
+  std::atomic<uint64_t> m_hits{0};
+};
+
+UdpServer::UdpServer(hx_sylar::IOManager* worker,
+                     hx_sylar::IOManager* io_worker)
+    : m_worker(worker),
+      m_ioWorker(io_worker),
+      m_name("hx_sylar/1.0.0"),
+      m_batch(g_udp_server_batch->getValue()),
+      m_bufferSize(g_udp_server_buffer_size->getValue()) {}
+
+UdpServer::~UdpServer() {
+  for (auto& i : m_socks) {
+    i->close();
+  }
+  m_socks.clear();
+}
+
+void UdpServer::setConf(UdpServerConf::ptr v) {
+  m_conf = v;
+  if (!m_conf) {
+    return;
+  }
+  if (!m_conf->name.empty()) {
+    m_name = m_conf->name;
+  }
+  m_shards = std::max(m_conf->shards, 0);
+  if (m_conf->batch > 0) {
+    m_batch = m_conf->batch;
+  }
+  if (m_conf->buffer_size > 0) {
+    m_bufferSize = m_conf->buffer_size;
+  }
+  m_gro = m_conf->gro != 0;
+}
+
+void UdpServer::setConf(const UdpServerConf& v) {
+  setConf(std::make_shared<UdpServerConf>(v));
+}
+
+auto UdpServer::bind(hx_sylar::Address::ptr addr) -> bool {
+  std::vector<Address::ptr> addrs;
+  std::vector<Address::ptr> fails;
+  addrs.push_back(addr);
+  return bind(addrs, fails);
+}
+
+auto UdpServer::bind(const std::vector<Address::ptr>& addrs,
+                     std::vector<Address::ptr>& fails) -> bool {
+  size_t shards = m_shards;
+  if (shards == 0) {
+    shards = std::max<size_t>(m_ioWorker->getThreadIds().size(), 1);
+  }
+  std::vector<Socket::ptr> socks;
+  for (auto& addr : addrs) {
+    Address::ptr bound = addr;
+    for (size_t i = 0; i < shards; ++i) {
+      Socket::ptr sock = Socket::CreateUDP(bound);
+      int val = 1;
+      if (!sock->setOption(SOL_SOCKET, SO_REUSEPORT, val) ||
+          !sock->bind(bound)) {
+        HX_LOG_ERROR(g_logger)
+            << "bind fail errno=" << errno << " errstr=" << strerror(errno)
+            << " addr=[" << bound->toString() << "]";
+        fails.push_back(addr);
+        break;
+      }
+      // 端口为 0 时后面的分片要绑到第一个分到的端口上
+      bound = sock->getLocalAddress();
+      // 不在调度线程里创建的 socket 没有经过 hook, 接管过来切成非阻塞
+      FdMgr::GetInstance()->get(sock->getSocket(), true);
+      if (m_gro && !sock->setUdpGro(true)) {
+        HX_LOG_WARN(g_logger) << "udp gro not supported, addr=["
+                              << bound->toString() << "]";
+      }
+      socks.push_back(sock);
+    }
+  }
+
+  if (!fails.empty()) {
+    return false;
+  }
+  m_socks.insert(m_socks.end(), socks.begin(), socks.end());
+  for (auto& i : socks) {
+    HX_LOG_INFO(g_logger) << "type=" << m_type << " name=" << m_name
+                          << " server bind success: " << *i;
+  }
+  return true;
+}
+
+void UdpServer::startReceive(Socket::ptr sock) {
+  DatagramBatch batch(m_batch, m_gro ? kGroBufferSize : m_bufferSize);
+  auto self = shared_from_this();
+  while (!m_isStop) {
+    int n = sock->recvBatch(batch);
+    if (n <= 0) {
+      // stop 关闭 socket 后以 EBADF 返回
+      if (m_isStop || errno == EBADF) {
+        break;
+      }
+      HX_LOG_ERROR(g_logger) << "recvmmsg errno=" << errno
+                             << " errstr=" << strerror(errno);
+      continue;
+    }
+    ++m_batches;
+    for (int i = 0; i < n; ++i) {
+      Address::ptr from = batch.address(i);
+      size_t total = batch.length(i);
+      size_t segment = batch.segmentSize(i) != 0 ? batch.segmentSize(i) : total;
+      // 只收到一部分的数据报不交给 handleDatagram. 对端随便就能发超长包,
+      // 只计数, 日志用 DEBUG 免得刷屏
+      if (batch.truncated(i) || segment > m_bufferSize) {
+        ++m_truncated;
+        HX_LOG_DEBUG(g_logger) << "drop truncated datagram from "
+                              << (from ? from->toString() : "")
+                              << " length=" << total
+                              << " buffer_size=" << m_bufferSize;
+        continue;
+      }
+      size_t offset = 0;
+      do {
+        Datagram::ptr dgram = m_pool->acquire();
+        size_t length = std::min(segment, total - offset);
+        memcpy(dgram->buffer.data(), batch.data(i) + offset, length);
+        dgram->length = length;
+        dgram->from = from;
+        dgram->sock = sock;
+        ++m_datagrams;
+        m_worker->schedule(
+            std::bind(&UdpServer::handleDatagram, self, std::move(dgram)));
+        offset += segment;
+      } while (offset < total);
+    }
+  }
+}
+
+auto UdpServer::start() -> bool {
+  if (!m_isStop) {
+    return true;
+  }
+  m_isStop = false;
+  if (!m_pool) {
+    size_t pool_size = g_udp_server_pool_size->getValue();
+    if (m_conf && m_conf->pool_size > 0) {
+      pool_size = m_conf->pool_size;
+    }
+    m_pool = std::make_shared<BufferPool>(m_bufferSize, pool_size);
+  }
+  // 每个 socket 固定在 io_worker 的一个线程上, 同一个地址的分片分散开
+  const std::vector<int>& threads = m_ioWorker->getThreadIds();
+  for (size_t i = 0; i < m_socks.size(); ++i) {
+    int thread = threads.empty() ? -1 : threads[i % threads.size()];
+    m_ioWorker->schedule(
+        std::bind(&UdpServer::startReceive, shared_from_this(), m_socks[i]),
+        thread);
+  }
+  return true;
+}
+
+void UdpServer::stop() {
+  m_isStop = true;
+  // 在接收协程所在的线程上关闭, 关闭与协程重新注册事件不会交错
+  const std::vector<int>& threads = m_ioWorker->getThreadIds();
+  for (size_t i = 0; i < m_socks.size(); ++i) {
+    int thread = threads.empty() ? -1 : threads[i % threads.size()];
+    Socket::ptr sock = m_socks[i];
+    m_ioWorker->schedule([sock]() { sock->close(); }, thread);
+  }
+  m_socks.clear();
+}
+
+auto UdpServer::reply(const Datagram::ptr& dgram, const void* buffer,
+                      size_t length) -> int {
+  return dgram->sock->sendTo(buffer, length, dgram->from);
+}
+
+void UdpServer::handleDatagram(Datagram::ptr dgram) {
+  HX_LOG_INFO(g_logger) << "handleDatagram: " << dgram->size()
+                        << " bytes from " << *dgram->from;
+}
+
+auto UdpServer::getStats() const -> Stats {
+  Stats stats;
+  stats.datagrams = m_datagrams;
+  stats.batches = m_batches;
+  stats.poolHits = m_pool ? m_pool->getHits() : 0;
+  stats.truncated = m_truncated;
+  return stats;
+}
+
+auto UdpServer::toString(const std::string& prefix) -> std::string {
+  std::stringstream ss;
+  ss << prefix << "[type=" << m_type << " name=" << m_name
+     << " worker=" << (m_worker ? m_worker->getName() : "")
+     << " io_worker=" << (m_ioWorker ? m_ioWorker->getName() : "")
+     << " batch=" << m_batch << " buffer_size=" << m_bufferSize
+     << " gro=" << m_gro << "]" << std::endl;
+  std::string pfx = prefix.empty() ? "    " : prefix;
+  for (auto& i : m_socks) {
+    ss << pfx << pfx << *i << std::endl;
+  }
+  return ss.str();
+}
+
+}  // namespace hx_sylar
@@ -0,0 +1,211 @@
+/**
+ * @file udp_server.h
+ * @brief 数据报服务器
+ * @details 每个地址用 SO_REUSEPORT 绑定多个 socket, 内核按四元组把数据报
+ *          分到各个 socket 上, 每个 socket 由 io_worker 的一个线程批量接收.
+ *          收到的数据报拷进缓冲池里的 Datagram, 再交给 worker 上的
+ *          handleDatagram 处理
+ */
+#ifndef __HX_SYLAR_UDP_SERVER_H__
+#define __HX_SYLAR_UDP_SERVER_H__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../address.h"
+#include "../config.h"
+#include "../iomanager.h"
+#include "../mutex.h"
+#include "../socket.h"
+#include "hx_sylar/noncopyable.h"
+
+namespace hx_sylar {
+
+class UdpServerConf {
+ public:
+  using ptr = std::shared_ptr<UdpServerConf>;
+
+  std::vector<std::string> address;
+  std::string id;
+  std::string type = "udp";
+  std::string name;
+  /// 每个地址绑定几个 socket, 0 表示与 io_worker 的线程数相同
+  int shards = 0;
+  /// 一次 recvmmsg 最多收几个数据报, 0 使用 udp_server.batch
+  int batch = 0;
+  /// 单个数据报缓冲区大小, 0 使用 udp_server.buffer_size, 放不下的数据报丢弃
+  int buffer_size = 0;
+  /// 缓冲池最多缓存几个空闲缓冲区, 0 使用 udp_server.pool_size
+  int pool_size = 0;
+  /// 打开 UDP GRO, 合并的数据报拆开后逐个交给 handleDatagram
+  int gro = 0;
+  std::string io_worker;
+  std::string process_worker;
+  std::map<std::string, std::string> args;
+
+  auto isVaild() const -> bool { return !address.empty(); }
+
+  auto operator==(const UdpServerConf& oth) const -> bool {
+    return address == oth.address && id == oth.id && type == oth.type &&
+           name == oth.name && shards == oth.shards && batch == oth.batch &&
+           buffer_size == oth.buffer_size && pool_size == oth.pool_size &&
+           gro == oth.gro && io_worker == oth.io_worker &&
+           process_worker == oth.process_worker && args == oth.args;
+  }
+};
+
+template <>
+class LexicalCast<std::string, UdpServerConf> {
+ public:
+  auto operator()(const std::string& v) -> UdpServerConf {
+    YAML::Node node = YAML::Load(v);
+    UdpServerConf conf;
+    conf.id = node["id"].as<std::string>(conf.id);
+    conf.type = node["type"].as<std::string>(conf.type);
+    conf.name = node["name"].as<std::string>(conf.name);
+    conf.shards = node["shards"].as<int>(conf.shards);
+    conf.batch = node["batch"].as<int>(conf.batch);
+    conf.buffer_size = node["buffer_size"].as<int>(conf.buffer_size);
+    conf.pool_size = node["pool_size"].as<int>(conf.pool_size);
+    conf.gro = node["gro"].as<int>(conf.gro);
+    conf.io_worker = node["io_worker"].as<std::string>(conf.io_worker);
+    conf.process_worker =
+        node["process_worker"].as<std::string>(conf.process_worker);
+    conf.args = LexicalCast<std::string, std::map<std::string, std::string> >()(
+        node["args"].as<std::string>(""));
+    if (node["address"].IsDefined()) {
+      for (size_t i = 0; i < node["address"].size(); ++i) {
+        conf.address.push_back(node["address"][i].as<std::string>());
+      }
+    }
+    return conf;
+  }
+};
+
+template <>
+class LexicalCast<UdpServerConf, std::string> {
+ public:
+  auto operator()(const UdpServerConf& conf) -> std::string {
+    YAML::Node node;
+    node["id"] = conf.id;
+    node["type"] = conf.type;
+    node["name"] = conf.name;
+    node["shards"] = conf.shards;
+    node["batch"] = conf.batch;
+    node["buffer_size"] = conf.buffer_size;
+    node["pool_size"] = conf.pool_size;
+    node["gro"] = conf.gro;
+    node["io_worker"] = conf.io_worker;
+    node["process_worker"] = conf.process_worker;
+    node["args"] = YAML::Load(
+        LexicalCast<std::map<std::string, std::string>, std::string>()(
+            conf.args));
+    for (auto& i : conf.address) {
+      node["address"].push_back(i);
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+  }
+};
+
+class UdpServer : public std::enable_shared_from_this<UdpServer>, Noncopyable {
+ public:
+  using ptr = std::shared_ptr<UdpServer>;
+
+  /**
+   * @brief 收到的一个数据报
+   * @details 缓冲区来自缓冲池, 最后一个引用释放时归还
+   */
+  struct Datagram {
+    using ptr = std::shared_ptr<Datagram>;
+    explicit Datagram(size_t size) : buffer(size) {}
+
+    auto data() const -> const char* { return buffer.data(); }
+    auto size() const -> size_t { return length; }
+
+    std::vector<char> buffer;
+    size_t length = 0;
+    /// 来源地址
+    Address::ptr from;
+    /// 收到它的 socket, 用它回复时源端口不变
+    Socket::ptr sock;
+  };
+
+  struct Stats {
+    /// 收到的数据报数, GRO 合并的按拆开后计
+    uint64_t datagrams = 0;
+    /// recvmmsg 调用次数
+    uint64_t batches = 0;
+    /// 从缓冲池复用缓冲区的次数
+    uint64_t poolHits = 0;
+    /// 超过缓冲区大小被丢弃的数据报数
+    uint64_t truncated = 0;
+  };
+
+  /**
+   * @param[in] worker 执行 handleDatagram 的调度器
+   * @param[in] io_worker 接收数据报的调度器, 每个 socket 固定在它的一个线程上
+   */
+  explicit UdpServer(
+      hx_sylar::IOManager* worker = hx_sylar::IOManager::GetThis(),
+      hx_sylar::IOManager* io_worker = hx_sylar::IOManager::GetThis());
+  virtual ~UdpServer();
+
+  virtual auto bind(hx_sylar::Address::ptr addr) -> bool;
+  virtual auto bind(const std::vector<Address::ptr>& addrs,
+                    std::vector<Address::ptr>& fails) -> bool;
+
+  auto start() -> bool;
+  void stop();
+
+  /// 从收到 dgram 的 socket 回复给来源地址
+  auto reply(const Datagram::ptr& dgram, const void* buffer, size_t length)
+      -> int;
+
+  auto getName() const -> std::string { return m_name; }
+  void setName(const std::string& v) { m_name = v; }
+  auto isStop() const -> bool { return m_isStop; }
+
+  auto getSocks() const -> std::vector<Socket::ptr> { return m_socks; }
+  auto getStats() const -> Stats;
+  auto toString(const std::string& prefix) -> std::string;
+  auto getConf() const -> UdpServerConf::ptr { return m_conf; }
+  /// 在 bind 之前设置才对分片数等参数生效
+  void setConf(UdpServerConf::ptr v);
+  void setConf(const UdpServerConf& v);
+
+ protected:
+  /// 处理一个数据报, 在 worker 上执行
+  virtual void handleDatagram(Datagram::ptr dgram);
+  /// 一个 socket 的接收循环, 在 io_worker 上执行
+  virtual void startReceive(Socket::ptr sock);
+
+ private:
+  class BufferPool;
+
+ private:
+  std::vector<Socket::ptr> m_socks;
+  IOManager* m_worker;
+  IOManager* m_ioWorker;
+  std::string m_name;
+  std::string m_type = "udp";
+  std::atomic<bool> m_isStop{true};
+  size_t m_shards = 0;
+  size_t m_batch;
+  size_t m_bufferSize;
+  bool m_gro = false;
+  std::shared_ptr<BufferPool> m_pool;
+
+  std::atomic<uint64_t> m_datagrams{0};
+  std::atomic<uint64_t> m_batches{0};
+  std::atomic<uint64_t> m_truncated{0};
+
+  UdpServerConf::ptr m_conf;
+};
+
+}  // namespace hx_sylar
+#endif
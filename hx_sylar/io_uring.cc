@@ -0,0 +1,266 @@
+#include "io_uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "log.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+static auto Setup(uint32_t entries, io_uring_params* p) -> int {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static auto Enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                  uint32_t flags) -> int {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+static auto Register(int fd, uint32_t op, const void* arg, uint32_t nr_args)
+    -> int {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, op, arg, nr_args));
+}
+
+IoUring::IoUring(uint32_t entries) {
+  io_uring_params p{};
+  memset(&p, 0, sizeof(p));
+  int fd = Setup(entries, &p);
+  if (fd < 0) {
+    HX_LOG_WARN(g_logger) << "io_uring_setup(" << entries
+                          << ") errno=" << errno << " " << strerror(errno);
+    return;
+  }
+
+  m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0U;
+  if (single) {
+    m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+  }
+  m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (m_sqRing == MAP_FAILED) {
+    m_sqRing = nullptr;
+    close(fd);
+    return;
+  }
+  if (single) {
+    m_cqRing = m_sqRing;
+  } else {
+    m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (m_cqRing == MAP_FAILED) {
+      m_cqRing = nullptr;
+      munmap(m_sqRing, m_sqRingSize);
+      m_sqRing = nullptr;
+      close(fd);
+      return;
+    }
+  }
+  m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (m_cqRing != m_sqRing) {
+      munmap(m_cqRing, m_cqRingSize);
+    }
+    munmap(m_sqRing, m_sqRingSize);
+    m_sqRing = m_cqRing = nullptr;
+    close(fd);
+    return;
+  }
+  m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+  auto* sq = static_cast<char*>(m_sqRing);
+  m_sqHead = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+  m_sqTail = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+  m_sqMask = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+  m_sqEntries = p.sq_entries;
+  m_sqLocalTail = *m_sqTail;
+  // 提交项和数组下标一一对应, 之后不用再写 array
+  auto* array = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+  for (uint32_t i = 0; i < p.sq_entries; ++i) {
+    array[i] = i;
+  }
+
+  auto* cq = static_cast<char*>(m_cqRing);
+  m_cqHead = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+  m_cqTail = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+  m_cqMask = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+  m_cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+  m_fd = fd;
+}
+
+IoUring::~IoUring() {
+  if (m_fd < 0) {
+    return;
+  }
+  munmap(m_sqes, m_sqesSize);
+  if (m_cqRing != m_sqRing) {
+    munmap(m_cqRing, m_cqRingSize);
+  }
+  munmap(m_sqRing, m_sqRingSize);
+  close(m_fd);
+}
+
+auto IoUring::getSqe() -> io_uring_sqe* {
+  if (spaceLeft() == 0) {
+    return nullptr;
+  }
+  io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+  ++m_sqLocalTail;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+auto IoUring::pending() const -> uint32_t {
+  return m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+auto IoUring::spaceLeft() const -> uint32_t { return m_sqEntries - pending(); }
+
+auto IoUring::submit() -> int {
+  uint32_t n = pending();
+  if (n == 0) {
+    return 0;
+  }
+  __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+  int rt = Enter(m_fd, n, 0, 0);
+  ++m_enterCount;
+  if (rt < 0) {
+    return -errno;
+  }
+  m_submitCount += rt;
+  return rt;
+}
+
+auto IoUring::peekCqe() -> io_uring_cqe* {
+  uint32_t head = *m_cqHead;
+  if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+    return nullptr;
+  }
+  return &m_cqes[head & m_cqMask];
+}
+
+void IoUring::seenCqe() {
+  __atomic_store_n(m_cqHead, *m_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+auto IoUring::ready() const -> uint32_t {
+  return __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(m_cqHead, __ATOMIC_ACQUIRE);
+}
+
+auto IoUring::registerFiles(uint32_t count) -> bool {
+  // -1 表示空槽, 用到时再 updateFile
+  std::vector<int> fds(count, -1);
+  if (Register(m_fd, IORING_REGISTER_FILES, fds.data(), count) < 0) {
+    HX_LOG_WARN(g_logger) << "io_uring register " << count
+                          << " files errno=" << errno << " "
+                          << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+auto IoUring::updateFile(uint32_t slot, int fd) -> bool {
+  io_uring_files_update up{};
+  memset(&up, 0, sizeof(up));
+  up.offset = slot;
+  up.fds = reinterpret_cast<uint64_t>(&fd);
+  return Register(m_fd, IORING_REGISTER_FILES_UPDATE, &up, 1) == 1;
+}
+
+auto IoUring::cancelFd(int fd, bool fixed) -> int {
+  io_uring_sync_cancel_reg reg{};
+  memset(&reg, 0, sizeof(reg));
+  reg.fd = fd;
+  reg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  if (fixed) {
+    reg.flags |= IORING_ASYNC_CANCEL_FD_FIXED;
+  }
+  reg.timeout.tv_sec = -1;
+  reg.timeout.tv_nsec = -1;
+  int rt = Register(m_fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+  return rt < 0 ? -errno : rt;
+}
+
+void IoUring::PrepRw(io_uring_sqe* sqe, int op, int fd, const void* addr,
+                     uint32_t len, uint64_t offset) {
+  sqe->opcode = static_cast<uint8_t>(op);
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(addr);
+  sqe->len = len;
+  sqe->off = offset;
+}
+
+// 偏移 -1 表示使用并推进文件当前位置, 与 read/write 语义一致
+void IoUring::PrepRead(io_uring_sqe* sqe, int fd, void* buf, size_t len) {
+  PrepRw(sqe, IORING_OP_READ, fd, buf, len, -1);
+}
+
+void IoUring::PrepWrite(io_uring_sqe* sqe, int fd, const void* buf,
+                        size_t len) {
+  PrepRw(sqe, IORING_OP_WRITE, fd, buf, len, -1);
+}
+
+void IoUring::PrepReadv(io_uring_sqe* sqe, int fd, const iovec* iov,
+                        int iovcnt) {
+  PrepRw(sqe, IORING_OP_READV, fd, iov, iovcnt, -1);
+}
+
+void IoUring::PrepWritev(io_uring_sqe* sqe, int fd, const iovec* iov,
+                         int iovcnt) {
+  PrepRw(sqe, IORING_OP_WRITEV, fd, iov, iovcnt, -1);
+}
+
+void IoUring::PrepRecv(io_uring_sqe* sqe, int fd, void* buf, size_t len,
+                       int flags) {
+  PrepRw(sqe, IORING_OP_RECV, fd, buf, len, 0);
+  sqe->msg_flags = flags;
+}
+
+void IoUring::PrepSend(io_uring_sqe* sqe, int fd, const void* buf, size_t len,
+                       int flags) {
+  PrepRw(sqe, IORING_OP_SEND, fd, buf, len, 0);
+  sqe->msg_flags = flags;
+}
+
+void IoUring::PrepRecvmsg(io_uring_sqe* sqe, int fd, msghdr* msg, int flags) {
+  PrepRw(sqe, IORING_OP_RECVMSG, fd, msg, 1, 0);
+  sqe->msg_flags = flags;
+}
+
+void IoUring::PrepSendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg,
+                          int flags) {
+  PrepRw(sqe, IORING_OP_SENDMSG, fd, msg, 1, 0);
+  sqe->msg_flags = flags;
+}
+
+void IoUring::PrepAccept(io_uring_sqe* sqe, int fd, sockaddr* addr,
+                         socklen_t* addrlen, int flags) {
+  PrepRw(sqe, IORING_OP_ACCEPT, fd, addr, 0,
+         reinterpret_cast<uint64_t>(addrlen));
+  sqe->accept_flags = flags;
+}
+
+void IoUring::PrepConnect(io_uring_sqe* sqe, int fd, const sockaddr* addr,
+                          socklen_t addrlen) {
+  PrepRw(sqe, IORING_OP_CONNECT, fd, addr, 0, addrlen);
+}
+
+void IoUring::PrepLinkTimeout(io_uring_sqe* sqe, __kernel_timespec* ts) {
+  PrepRw(sqe, IORING_OP_LINK_TIMEOUT, -1, ts, 1, 0);
+}
+
+}  // namespace hx_sylar
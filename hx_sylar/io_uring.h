@@ -0,0 +1,138 @@
+/**
+ * @file io_uring.h
+ * @brief 基于原始系统调用的 io_uring 封装
+ */
+#ifndef __HX_IO_URING_H__
+#define __HX_IO_URING_H__
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <atomic>
+
+namespace hx_sylar {
+
+/**
+ * @brief 一个 io_uring 实例
+ * @details 不依赖 liburing, 直接 mmap 提交/完成队列.
+ *          提交端(getSqe/submit)只能由一个线程使用,
+ *          完成端(peekCqe/seenCqe)需要调用方自己串行化.
+ *          ring fd 可以注册进 epoll, 完成队列非空时可读.
+ */
+class IoUring {
+ public:
+  /**
+   * @brief 创建 io_uring
+   * @param[in] entries 提交队列长度, 内核会向上取整到 2 的幂
+   */
+  explicit IoUring(uint32_t entries);
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  auto operator=(const IoUring&) -> IoUring& = delete;
+
+  /// 是否创建成功, 内核不支持或被禁用时为 false
+  auto isValid() const -> bool { return m_fd >= 0; }
+  auto getFd() const -> int { return m_fd; }
+
+  /**
+   * @brief 取一个空闲的提交项, 队列满时返回 nullptr
+   * @details 返回的 sqe 已清零, 要在下一次 submit 之前填好
+   */
+  auto getSqe() -> io_uring_sqe*;
+
+  /// 已经填好但还没交给内核的提交项数量
+  auto pending() const -> uint32_t;
+  /// 提交队列剩余空位
+  auto spaceLeft() const -> uint32_t;
+
+  /**
+   * @brief 一次 io_uring_enter 把积攒的提交项全部交给内核
+   * @return 内核接收的数量, 失败返回 -errno
+   */
+  auto submit() -> int;
+
+  /// 完成队列中第一个未处理的完成项, 没有时返回 nullptr
+  auto peekCqe() -> io_uring_cqe*;
+  /// 标记 peekCqe 返回的完成项已处理
+  void seenCqe();
+  /// 未处理的完成项数量, 可以在任意线程读取
+  auto ready() const -> uint32_t;
+
+  /**
+   * @brief 注册 count 个空槽的固定文件表
+   */
+  auto registerFiles(uint32_t count) -> bool;
+
+  /**
+   * @brief 把 fd 放进固定文件表的 slot 位置, fd 为 -1 时清空该槽
+   */
+  auto updateFile(uint32_t slot, int fd) -> bool;
+
+  /**
+   * @brief 同步取消所有作用在 fd 上的请求
+   * @param[in] fixed fd 是否是固定文件表的下标
+   * @return 取消的数量, 失败返回 -errno
+   */
+  auto cancelFd(int fd, bool fixed) -> int;
+
+  /// 累计 io_uring_enter 调用次数
+  auto getEnterCount() const -> uint64_t { return m_enterCount; }
+  /// 累计提交给内核的请求数
+  auto getSubmitCount() const -> uint64_t { return m_submitCount; }
+
+  static void PrepRw(io_uring_sqe* sqe, int op, int fd, const void* addr,
+                     uint32_t len, uint64_t offset);
+  static void PrepRead(io_uring_sqe* sqe, int fd, void* buf, size_t len);
+  static void PrepWrite(io_uring_sqe* sqe, int fd, const void* buf,
+                        size_t len);
+  static void PrepReadv(io_uring_sqe* sqe, int fd, const iovec* iov,
+                        int iovcnt);
+  static void PrepWritev(io_uring_sqe* sqe, int fd, const iovec* iov,
+                         int iovcnt);
+  static void PrepRecv(io_uring_sqe* sqe, int fd, void* buf, size_t len,
+                       int flags);
+  static void PrepSend(io_uring_sqe* sqe, int fd, const void* buf, size_t len,
+                       int flags);
+  static void PrepRecvmsg(io_uring_sqe* sqe, int fd, msghdr* msg, int flags);
+  static void PrepSendmsg(io_uring_sqe* sqe, int fd, const msghdr* msg,
+                          int flags);
+  /// flags 同 accept4, 比如 SOCK_NONBLOCK/SOCK_CLOEXEC
+  static void PrepAccept(io_uring_sqe* sqe, int fd, sockaddr* addr,
+                         socklen_t* addrlen, int flags = 0);
+  static void PrepConnect(io_uring_sqe* sqe, int fd, const sockaddr* addr,
+                          socklen_t addrlen);
+  /// 链接在前一个提交项之后的超时, 前一项要带 IOSQE_IO_LINK
+  static void PrepLinkTimeout(io_uring_sqe* sqe, __kernel_timespec* ts);
+
+ private:
+  int m_fd = -1;
+  void* m_sqRing = nullptr;
+  size_t m_sqRingSize = 0;
+  void* m_cqRing = nullptr;
+  size_t m_cqRingSize = 0;
+  io_uring_sqe* m_sqes = nullptr;
+  size_t m_sqesSize = 0;
+
+  uint32_t* m_sqHead = nullptr;
+  uint32_t* m_sqTail = nullptr;
+  uint32_t m_sqMask = 0;
+  uint32_t m_sqEntries = 0;
+  /// 本地的尾指针, submit 时才发布给内核
+  uint32_t m_sqLocalTail = 0;
+
+  uint32_t* m_cqHead = nullptr;
+  uint32_t* m_cqTail = nullptr;
+  uint32_t m_cqMask = 0;
+  io_uring_cqe* m_cqes = nullptr;
+
+  /// 统计用, 其他线程可以读
+  std::atomic<uint64_t> m_enterCount = {0};
+  std::atomic<uint64_t> m_submitCount = {0};
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -4,8 +4,16 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include "clock.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "hook.h"
 #include "log.h"
 #include "macro.h"
 namespace hx_sylar {
@@ -26,74 +34,209 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
   ctx.fiber.reset();
   ctx.cb = nullptr;
 }
-void IOManager::FdContext::triggerEvent(Event event) {
+void IOManager::FdContext::triggerEvent(Event event, int thread) {
   HX_ASSERT(events & event);
   events = static_cast<Event>(events & ~event);
   EventContext& ctx = getContext(event);
   if (ctx.cb) {
-    ctx.scheduler->schedule(&ctx.cb);
+    ctx.scheduler->schedule(&ctx.cb, thread);
   } else {
-    ctx.scheduler->schedule(&ctx.fiber);
+    ctx.scheduler->schedule(&ctx.fiber, thread);
   }
   ctx.scheduler = nullptr;
 }
 
 static Logger::ptr g_logger = HX_LOG_NAME("root");
-IOManager::IOManager(size_t threads, bool user_call, const std::string& name)
-    : Scheduler(threads, user_call, name) {
-  m_epfd = epoll_create(5000);
-  HX_ASSERT(m_epfd > 0);
-  int rt = pipe(m_tickleFds);
-  HX_ASSERT(!rt);
-
-  epoll_event event{};
-  memset(&event, 0, sizeof(epoll_event));
-  event.events = EPOLLIN | EPOLLET;
-  event.data.fd = m_tickleFds[0];
-
-  rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-  HX_ASSERT(!rt);
-
-  rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
 
-  HX_ASSERT(!rt);
-  contextResize(32);
+static ConfigVar<bool>::ptr g_multi_reactor = Config::Lookup<bool>(
+    "iomanager.multi_reactor", false, "one epoll instance per worker thread");
+static ConfigVar<std::string>::ptr g_io_engine = Config::Lookup<std::string>(
+    "iomanager.io_engine", "epoll", "hooked socket io engine: epoll|io_uring");
+static ConfigVar<uint32_t>::ptr g_uring_entries = Config::Lookup<uint32_t>(
+    "iomanager.uring.entries", 256, "io_uring submission queue size");
+static ConfigVar<uint32_t>::ptr g_uring_batch = Config::Lookup<uint32_t>(
+    "iomanager.uring.batch", 32, "submit early once this many sqes queued");
+static ConfigVar<uint32_t>::ptr g_uring_fixed_files = Config::Lookup<uint32_t>(
+    "iomanager.uring.fixed_files", 1024,
+    "fixed file table size, fds below it use registered files");
+static ConfigVar<bool>::ptr g_persistent_et = Config::Lookup<bool>(
+    "iomanager.persistent_et", false,
+    "register each fd once for in|out edge triggered, track readiness in "
+    "user space");
+static ConfigVar<uint32_t>::ptr g_busy_poll_us = Config::Lookup<uint32_t>(
+    "iomanager.busy_poll_us", 0,
+    "max us to spin on run queue and epoll before blocking, 0 disables");
+
+static ConfigVar<std::string>::ptr g_timer_precision =
+    Config::Lookup<std::string>("iomanager.timer_precision", "ms",
+                                "idle wait precision: ms|us (epoll_pwait2)");
+
+/**
+ * @brief 一个挂起在 io_uring 请求上的协程, 放在协程栈上
+ */
+struct IOManager::UringOp {
+  Scheduler* scheduler = nullptr;
+  Fiber::ptr fiber;
+  int res = 0;
+  /// 还没收到的完成项, 带超时时请求和超时各一个
+  int pending = 1;
+  bool timedOut = false;
+};
 
+IOManager::IOManager(size_t threads, bool user_call, const std::string& name)
+    : Scheduler(threads, user_call, name) {
+  m_multiReactor = g_multi_reactor->getValue();
+  m_persistentEt = g_persistent_et->getValue();
+  setBusyPoll(g_busy_poll_us->getValue());
+  size_t fixed = m_thread_count_ + (user_call ? 1 : 0);
+  if (m_multiReactor && getWorkerCount() > fixed) {
+    // fd 绑定在线程上, 线程退出后它们就没人处理了
+    HX_LOG_WARN(g_logger) << name
+                          << " elastic threads disabled in multi reactor";
+    setElastic(0);
+  }
+  size_t count = m_multiReactor ? getWorkerCount() : 1;
+  for (size_t i = 0; i < count; ++i) {
+    std::unique_ptr<Reactor> reactor(new Reactor);
+    reactor->epfd = epoll_create(5000);
+    HX_ASSERT(reactor->epfd > 0);
+
+    // eventfd 的计数会累加, 多次唤醒一次 read 就能清空
+    reactor->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    HX_ASSERT(reactor->wakeFd >= 0);
+
+    epoll_event event{};
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = reactor.get();
+
+    int rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakeFd, &event);
+    HX_ASSERT(!rt);
+    m_reactors.push_back(std::move(reactor));
+  }
+  if (g_timer_precision->getValue() == "us") {
+    initPwait2();
+  } else if (g_timer_precision->getValue() != "ms") {
+    HX_LOG_WARN(g_logger) << "unknown iomanager.timer_precision "
+                          << g_timer_precision->getValue() << ", use ms";
+  }
+  if (g_io_engine->getValue() == "io_uring") {
+    initUring();
+  } else if (g_io_engine->getValue() != "epoll") {
+    HX_LOG_WARN(g_logger) << "unknown iomanager.io_engine "
+                          << g_io_engine->getValue() << ", use epoll";
+  }
   start();
 }
 
 IOManager::~IOManager() {
   stop();
-  close(m_epfd);
-  close(m_tickleFds[0]);
-  close(m_tickleFds[1]);
-  for (auto& m_fd_context : m_fdContexts) {
-    delete m_fd_context;
+  m_rings.clear();
+  for (auto& reactor : m_reactors) {
+    close(reactor->epfd);
+    close(reactor->wakeFd);
   }
 }
 
-void IOManager::contextResize(size_t size) {
-  m_fdContexts.resize(size);
+void IOManager::initPwait2() {
+#ifdef SYS_epoll_pwait2
+  // 零超时试探一次, 老内核返回 ENOSYS
+  epoll_event event{};
+  timespec ts{0, 0};
+  if (syscall(SYS_epoll_pwait2, m_reactors[0]->epfd, &event, 1, &ts, nullptr,
+              0) >= 0 ||
+      errno != ENOSYS) {
+    m_pwait2 = true;
+    return;
+  }
+#endif
+  HX_LOG_WARN(g_logger) << "epoll_pwait2 unavailable, timers keep ms precision";
+}
+
+auto IOManager::waitEvents(Reactor* reactor, epoll_event* events,
+                           int maxevents, uint64_t timeout_us) -> int {
+#ifdef SYS_epoll_pwait2
+  if (m_pwait2) {
+    timespec ts{};
+    ts.tv_sec = static_cast<time_t>(timeout_us / 1000000);
+    ts.tv_nsec = static_cast<long>(timeout_us % 1000000 * 1000);
+    return static_cast<int>(syscall(SYS_epoll_pwait2, reactor->epfd, events,
+                                    maxevents, &ts, nullptr, 0));
+  }
+#endif
+  // 向上取整, 不会在定时器到期前醒来空转; 不能走 hook, 那会挂起 idle 协程
+  return epoll_wait_f(reactor->epfd, events, maxevents,
+                    static_cast<int>((timeout_us + 999) / 1000));
+}
 
-  for (size_t i = 0; i < m_fdContexts.size(); ++i) {
-    if (m_fdContexts[i] == nullptr) {
-      m_fdContexts[i] = new FdContext;
-      m_fdContexts[i]->fd = i;
+void IOManager::initUring() {
+  for (size_t i = 0; i < getWorkerCount(); ++i) {
+    std::unique_ptr<Ring> ring(new Ring(g_uring_entries->getValue()));
+    if (!ring->uring.isValid()) {
+      HX_LOG_WARN(g_logger) << "io_uring unavailable, fall back to epoll";
+      m_rings.clear();
+      return;
+    }
+    uint32_t files = g_uring_fixed_files->getValue();
+    if (files > 0 && ring->uring.registerFiles(files)) {
+      ring->files.resize(files, false);
     }
+    epoll_event event{};
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = ring.get();
+    int epfd = m_reactors[m_multiReactor ? i : 0]->epfd;
+    int rt = epoll_ctl(epfd, EPOLL_CTL_ADD, ring->uring.getFd(), &event);
+    HX_ASSERT(!rt);
+    m_rings.push_back(std::move(ring));
+  }
+}
+
+auto IOManager::getFdContext(int fd, bool auto_create) -> FdContext* {
+  return auto_create ? m_fdContexts.getOrCreate(fd) : m_fdContexts.get(fd);
+}
+
+auto IOManager::persistFd(FdContext* fd_ctx) -> bool {
+  // fd 不经过 hook 关闭时没有 cancelAll, 靠 FdCtx 的代数发现槽被新 fd 复用
+  FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd_ctx->fd);
+  uint32_t generation = ctx ? ctx->getGeneration() : 0;
+  if (fd_ctx->registered && fd_ctx->generation == generation) {
+    return true;
+  }
+  if (!fd_ctx->registered) {
+    fd_ctx->reactor = pickReactor();
   }
+  int epfd = m_reactors[fd_ctx->reactor]->epfd;
+  epoll_event epevent{};
+  epevent.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  epevent.data.ptr = fd_ctx;
+  int op = EPOLL_CTL_ADD;
+  int rt = epoll_ctl(epfd, op, fd_ctx->fd, &epevent);
+  ++m_epollCtls;
+  if (rt != 0 && errno == EEXIST) {
+    op = EPOLL_CTL_MOD;
+    rt = epoll_ctl(epfd, op, fd_ctx->fd, &epevent);
+    ++m_epollCtls;
+  }
+  if (rt != 0) {
+    HX_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << op << ", "
+                           << fd_ctx->fd << ", persistent):" << rt << " ("
+                           << errno << ") (" << strerror(errno) << ")";
+    return false;
+  }
+  // 注册时已经就绪的方向会马上报一次边沿
+  fd_ctx->ready = NONE;
+  fd_ctx->registered = true;
+  fd_ctx->generation = generation;
+  return true;
 }
 
 auto IOManager::addEvent(int fd, Event event, std::function<void()> cb) -> int {
-  FdContext* fd_ctx = nullptr;
-  RWMutexType::ReadLock lock(m_mutex);
-  if (static_cast<int>(m_fdContexts.size()) > fd) {
-    fd_ctx = m_fdContexts[fd];
-    lock.unlock();
-  } else {
-    lock.unlock();
-    RWMutexType::WriteLock lock2(m_mutex);
-    contextResize(static_cast<size_t>(fd * 1.5));
-    fd_ctx = m_fdContexts[fd];
+  FdContext* fd_ctx = getFdContext(fd, true);
+  if (fd_ctx == nullptr) {
+    HX_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+    errno = EMFILE;
+    return -1;
   }
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
@@ -105,19 +248,40 @@ auto IOManager::addEvent(int fd, Event event, std::function<void()> cb) -> int {
     HX_ASSERT(!(fd_ctx->events & event));
   }
 
-  int op = fd_ctx->events != 0U ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-  epoll_event epevent{};
-  epevent.events = EPOLLET | fd_ctx->events | event;
-  epevent.data.ptr = fd_ctx;
-
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt != 0) {
-    HX_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd
-                           << ", " << static_cast<EPOLL_EVENTS>(epevent.events)
-                           << "):" << rt << " (" << errno << ") ("
-                           << strerror(errno) << ") fd_ctx->events="
-                           << static_cast<EPOLL_EVENTS>(fd_ctx->events);
-    return -1;
+  if (m_persistentEt) {
+    if (!persistFd(fd_ctx)) {
+      return -1;
+    }
+    // 边沿已经来过, 不用挂起等待
+    if ((fd_ctx->ready & event) != 0) {
+      fd_ctx->ready = static_cast<Event>(fd_ctx->ready & ~event);
+      if (!cb) {
+        return 1;
+      }
+      Scheduler* scheduler = Scheduler::GetThis();
+      (scheduler != nullptr ? scheduler : this)->schedule(&cb);
+      return 0;
+    }
+  } else {
+    if (fd_ctx->events == NONE) {
+      fd_ctx->reactor = pickReactor();
+    }
+    int epfd = m_reactors[fd_ctx->reactor]->epfd;
+    int op = fd_ctx->events != 0U ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    epoll_event epevent{};
+    epevent.events = EPOLLET | fd_ctx->events | event;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
+    ++m_epollCtls;
+    if (rt != 0) {
+      HX_LOG_ERROR(g_logger)
+          << "epoll_ctl(" << epfd << ", " << op << ", " << fd << ", "
+          << static_cast<EPOLL_EVENTS>(epevent.events) << "):" << rt << " ("
+          << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+          << static_cast<EPOLL_EVENTS>(fd_ctx->events);
+      return -1;
+    }
   }
 
   ++m_pendingEventCount;
@@ -137,30 +301,34 @@ auto IOManager::addEvent(int fd, Event event, std::function<void()> cb) -> int {
 }
 
 auto IOManager::delEvent(int fd, Event event) -> bool {
-  RWMutexType ::ReadLock lock(m_mutex);
-  if (m_fdContexts.size() <= fd) {
+  FdContext* fd_ctx = getFdContext(fd, false);
+  if (fd_ctx == nullptr) {
     return false;
   }
-  FdContext* fd_ctx = m_fdContexts[fd];
-  lock.unlock();
 
   FdContext::MutexType::Lock lock1(fd_ctx->mutex);
   if ((fd_ctx->events & event) == 0) {
     return false;
   }
   auto new_events = static_cast<Event>(fd_ctx->events & ~event);
-  int op = new_events != 0U ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epoll_event{};
-  epoll_event.events = EPOLLET | new_events;
-  epoll_event.data.ptr = fd_ctx;
-
-  int rt = epoll_ctl(m_epfd, op, fd, &epoll_event);
-
-  if (rt != 0) {
-    HX_LOG_ERROR(g_logger) << " epoll_ctl fd (: " << m_epfd << " " << op << " ,"
-                           << fd << epoll_event.events << "): " << rt << " ("
-                           << errno << " )( " << strerror(errno) << " )";
-    return false;
+  // 常驻注册时不动 epoll, 只撤掉用户态的等待
+  if (!m_persistentEt) {
+    int op = new_events != 0U ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epoll_event{};
+    epoll_event.events = EPOLLET | new_events;
+    epoll_event.data.ptr = fd_ctx;
+
+    int epfd = m_reactors[fd_ctx->reactor]->epfd;
+    int rt = epoll_ctl(epfd, op, fd, &epoll_event);
+    ++m_epollCtls;
+
+    if (rt != 0) {
+      HX_LOG_ERROR(g_logger) << " epoll_ctl fd (: " << epfd << " " << op
+                             << " ," << fd << epoll_event.events << "): " << rt
+                             << " (" << errno << " )( " << strerror(errno)
+                             << " )";
+      return false;
+    }
   }
   --m_pendingEventCount;
   fd_ctx->events = new_events;
@@ -170,50 +338,50 @@ auto IOManager::delEvent(int fd, Event event) -> bool {
 }
 
 auto IOManager::cancelEvent(int fd, Event event) -> bool {
-  RWMutexType::ReadLock lock(m_mutex);
-  if (static_cast<int>(m_fdContexts.size()) <= fd) {
+  FdContext* fd_ctx = getFdContext(fd, false);
+  if (fd_ctx == nullptr) {
     return false;
   }
-  FdContext* fd_ctx = m_fdContexts[fd];
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
   if (((fd_ctx->events & event) == 0)) {
     return false;
   }
 
-  auto new_events = static_cast<Event>(fd_ctx->events & ~event);
-  int op = new_events != 0U ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-  epoll_event epoll_event{};
-  epoll_event.events = EPOLLET | new_events;
-  epoll_event.data.ptr = fd_ctx;
-
-  int rt = epoll_ctl(m_epfd, op, fd, &epoll_event);
-  if (rt != 0) {
-    HX_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd
-                           << ", "
-                           << static_cast<EPOLL_EVENTS>(epoll_event.events)
-                           << "):" << rt << " (" << errno << ") ("
-                           << strerror(errno) << ")";
-    return false;
+  if (!m_persistentEt) {
+    auto new_events = static_cast<Event>(fd_ctx->events & ~event);
+    int op = new_events != 0U ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epoll_event{};
+    epoll_event.events = EPOLLET | new_events;
+    epoll_event.data.ptr = fd_ctx;
+
+    int epfd = m_reactors[fd_ctx->reactor]->epfd;
+    int rt = epoll_ctl(epfd, op, fd, &epoll_event);
+    ++m_epollCtls;
+    // fd 已经被关闭时内核自动移除了注册, 等待的协程仍然要唤醒
+    if (rt != 0 && errno != EBADF && errno != ENOENT) {
+      HX_LOG_ERROR(g_logger)
+          << "epoll_ctl(" << epfd << ", " << op << ", " << fd << ", "
+          << static_cast<EPOLL_EVENTS>(epoll_event.events) << "):" << rt
+          << " (" << errno << ") (" << strerror(errno) << ")";
+      return false;
+    }
   }
 
-  fd_ctx->triggerEvent(event);
+  fd_ctx->triggerEvent(event, reactorThread(fd_ctx));
   --m_pendingEventCount;
   return true;
 }
 
 auto IOManager::cancelAll(int fd) -> bool {
-  RWMutexType::ReadLock lock(m_mutex);
-  if (static_cast<int>(m_fdContexts.size()) <= fd) {
+  FdContext* fd_ctx = getFdContext(fd, false);
+  if (fd_ctx == nullptr) {
     return false;
   }
-  FdContext* fd_ctx = m_fdContexts[fd];
-
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-  if (fd_ctx->events == 0U) {
+  // 常驻注册的 fd 没有等待者也要摘掉, 同号的新 fd 重新注册
+  if (fd_ctx->events == 0U && !fd_ctx->registered) {
     return false;
   }
 
@@ -222,21 +390,26 @@ auto IOManager::cancelAll(int fd) -> bool {
   epevent.events = NONE;
   epevent.data.ptr = fd_ctx;
 
-  int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-  if (rt != 0) {
-    HX_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd
+  int epfd = m_reactors[fd_ctx->reactor]->epfd;
+  int rt = epoll_ctl(epfd, op, fd, &epevent);
+  ++m_epollCtls;
+  fd_ctx->registered = false;
+  fd_ctx->ready = NONE;
+  if (rt != 0 && errno != EBADF && errno != ENOENT) {
+    HX_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", " << op << ", " << fd
                            << ", " << static_cast<EPOLL_EVENTS>(epevent.events)
                            << "):" << rt << " (" << errno << ") ("
                            << strerror(errno) << ")";
     return false;
   }
 
+  int thread = reactorThread(fd_ctx);
   if ((fd_ctx->events & READ) != 0) {
-    fd_ctx->triggerEvent(READ);
+    fd_ctx->triggerEvent(READ, thread);
     --m_pendingEventCount;
   }
   if ((fd_ctx->events & WRITE) != 0) {
-    fd_ctx->triggerEvent(WRITE);
+    fd_ctx->triggerEvent(WRITE, thread);
     --m_pendingEventCount;
   }
 
@@ -247,16 +420,235 @@ auto IOManager::GetThis() -> IOManager* {
   return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
+auto IOManager::pickReactor() -> int {
+  if (!m_multiReactor) {
+    return 0;
+  }
+  int worker = getWorkerIndex();
+  if (worker >= 0) {
+    return worker;
+  }
+  // 调度线程之外注册的 fd 轮流分配, caller 线程要到 stop 时才进入 run, 跳过它
+  size_t count = m_thread_count_ > 0 ? m_thread_count_ : m_reactors.size();
+  return static_cast<int>(m_nextReactor++ % count);
+}
+
+auto IOManager::reactorThread(const FdContext* fd_ctx) const -> int {
+  if (!m_multiReactor || fd_ctx->reactor == getWorkerIndex()) {
+    return -1;
+  }
+  return getWorkerThreadId(fd_ctx->reactor);
+}
+
+auto IOManager::tickleReactor(Reactor* reactor) -> bool {
+  if (reactor->wakePending.exchange(true, std::memory_order_acq_rel)) {
+    ++m_ticklesSuppressed;
+    return false;
+  }
+  uint64_t one = 1;
+  ssize_t rt = write(reactor->wakeFd, &one, sizeof(one));
+  HX_ASSERT(rt == sizeof(one) || errno == EAGAIN);
+  ++m_ticklesSent;
+  return true;
+}
+
 void IOManager::tickle() {
-  if (hasIdleThreads()) {
+  // 只有阻塞在 epoll_wait 中的线程需要唤醒
+  if (!hasIdleThreads()) {
+    return;
+  }
+  if (!m_multiReactor) {
+    tickleReactor(m_reactors[0].get());
+    return;
+  }
+  // 唤醒一个还没被唤醒的空闲线程, 它会去窃取任务或者处理到期的定时器
+  size_t count = m_reactors.size();
+  size_t start = m_nextReactor++;
+  int self = getWorkerIndex();
+  bool pending = false;
+  for (size_t i = 0; i < count; ++i) {
+    size_t worker = (start + i) % count;
+    if (static_cast<int>(worker) == self || !isWorkerIdle(worker)) {
+      continue;
+    }
+    Reactor* reactor = m_reactors[worker].get();
+    if (reactor->wakePending.load(std::memory_order_acquire)) {
+      pending = true;
+      continue;
+    }
+    if (tickleReactor(reactor)) {
+      return;
+    }
+  }
+  if (pending) {
+    ++m_ticklesSuppressed;
+  }
+}
+
+void IOManager::tickleWorker(size_t worker) {
+  if (!m_multiReactor) {
+    tickle();
     return;
   }
-  ssize_t rt = write(m_tickleFds[1], "T", 1);
-  HX_ASSERT(rt == 1);
+  tickleReactor(m_reactors[worker].get());
+}
+
+auto IOManager::uringSqe() -> io_uring_sqe* {
+  int self = getWorkerIndex();
+  if (m_rings.empty() || self < 0) {
+    return nullptr;
+  }
+  // 内核异步读写缓冲区和 UringOp, 共享栈协程切出后这些地址会被别的协程覆盖
+  if (Fiber::GetThis()->isSharedStack()) {
+    return nullptr;
+  }
+  IoUring& uring = m_rings[self]->uring;
+  // 积攒太多时先提交一批; 留出链接超时项的位置
+  if (uring.pending() >= g_uring_batch->getValue() || uring.spaceLeft() < 2) {
+    uring.submit();
+  }
+  if (uring.spaceLeft() < 2) {
+    return nullptr;
+  }
+  return uring.getSqe();
+}
+
+auto IOManager::uringWait(io_uring_sqe* sqe, int fd, uint64_t timeout_ms,
+                          bool* timed_out) -> int {
+  Ring* ring = m_rings[getWorkerIndex()].get();
+  if (static_cast<size_t>(fd) < ring->files.size()) {
+    Mutex::Lock lock(ring->filesMutex);
+    if (!ring->files[fd] && ring->uring.updateFile(fd, fd)) {
+      ring->files[fd] = true;
+    }
+    if (ring->files[fd]) {
+      sqe->flags |= IOSQE_FIXED_FILE;
+    }
+  }
+
+  UringOp op;
+  op.scheduler = this;
+  op.fiber = Fiber::GetThis();
+  sqe->user_data = reinterpret_cast<uint64_t>(&op);
+  __kernel_timespec ts{};
+  if (timeout_ms != ~0ull) {
+    ts.tv_sec = static_cast<int64_t>(timeout_ms / 1000);
+    ts.tv_nsec = static_cast<int64_t>(timeout_ms % 1000) * 1000000;
+    sqe->flags |= IOSQE_IO_LINK;
+    io_uring_sqe* link = ring->uring.getSqe();
+    IoUring::PrepLinkTimeout(link, &ts);
+    // 最低位区分超时项, UringOp 至少按 8 字节对齐
+    link->user_data = reinterpret_cast<uint64_t>(&op) | 1;
+    op.pending = 2;
+  }
+
+  FdContext* fd_ctx = getFdContext(fd, true);
+  ++fd_ctx->uringOps;
+  ++m_pendingEventCount;
+  // 由调度循环的 flushPending 提交, 完成后 reapRing 把协程放回调度器
+  Fiber::YieldToHold();
+  --fd_ctx->uringOps;
+  *timed_out = op.timedOut;
+  return op.res;
+}
+
+void IOManager::uringClose(int fd) {
+  if (m_rings.empty()) {
+    return;
+  }
+  FdContext* fd_ctx = getFdContext(fd, false);
+  bool busy = fd_ctx != nullptr && fd_ctx->uringOps > 0;
+  for (auto& ring : m_rings) {
+    Mutex::Lock lock(ring->filesMutex);
+    bool fixed = static_cast<size_t>(fd) < ring->files.size() && ring->files[fd];
+    if (busy) {
+      ring->uring.cancelFd(fd, fixed);
+    }
+    // 固定文件表持有文件引用, 不移出的话 close 之后连接也不会真正关闭
+    if (fixed) {
+      ring->uring.updateFile(fd, -1);
+      ring->files[fd] = false;
+    }
+  }
+}
+
+auto IOManager::getUringStats() const -> std::pair<uint64_t, uint64_t> {
+  std::pair<uint64_t, uint64_t> rt(0, 0);
+  for (auto& ring : m_rings) {
+    rt.first += ring->uring.getEnterCount();
+    rt.second += ring->uring.getSubmitCount();
+  }
+  return rt;
+}
+
+auto IOManager::getEpollCtlCount() const -> uint64_t { return m_epollCtls; }
+
+auto IOManager::getTickleStats() const -> std::pair<uint64_t, uint64_t> {
+  return std::make_pair(m_ticklesSent.load(), m_ticklesSuppressed.load());
+}
+
+auto IOManager::getWakeupStats() const -> std::pair<uint64_t, uint64_t> {
+  return std::make_pair(m_wakeups.load(), m_timeoutWakeups.load());
+}
+
+auto IOManager::findRing(void* ptr) const -> Ring* {
+  for (auto& ring : m_rings) {
+    if (ring.get() == ptr) {
+      return ring.get();
+    }
+  }
+  return nullptr;
+}
+
+auto IOManager::reapRing(Ring* ring) -> int {
+  int count = 0;
+  Spinlock::Lock lock(ring->reapMutex);
+  while (io_uring_cqe* cqe = ring->uring.peekCqe()) {
+    uint64_t data = cqe->user_data;
+    int res = cqe->res;
+    ring->uring.seenCqe();
+    auto* op = reinterpret_cast<UringOp*>(data & ~1ULL);
+    if ((data & 1) != 0U) {
+      op->timedOut = res == -ETIME;
+    } else {
+      op->res = res;
+    }
+    if (--op->pending > 0) {
+      continue;
+    }
+    // schedule 之后协程可能马上在别的线程恢复, op 随栈失效
+    --m_pendingEventCount;
+    op->scheduler->schedule(&op->fiber);
+    ++count;
+  }
+  return count;
+}
+
+void IOManager::flushPending() {
+  // 一直有任务时不会回到 idle, 在这里刷新时间缓存, 免得定时器起点太旧
+  if (Clock::IsCached()) {
+    Clock::Update();
+  }
+  int self = getWorkerIndex();
+  if (m_rings.empty() || self < 0) {
+    return;
+  }
+  Ring* ring = m_rings[self].get();
+  if (ring->uring.pending() > 0) {
+    int rt = ring->uring.submit();
+    if (rt < 0 && rt != -EAGAIN && rt != -EBUSY && rt != -EINTR) {
+      HX_LOG_ERROR(g_logger) << "io_uring_enter errno=" << -rt << " "
+                             << strerror(-rt);
+    }
+  }
+  // 就地完成的请求不用等 epoll_wait
+  if (ring->uring.ready() > 0) {
+    reapRing(ring);
+  }
 }
 
 auto IOManager::stopping(uint64_t& timeout) -> bool {
-  timeout = getNextTimer();
+  timeout = getNextTimerUs();
   return timeout == ~0ULL && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 auto IOManager::stopping() -> bool {
@@ -264,37 +656,157 @@ auto IOManager::stopping() -> bool {
   return stopping(timeout);
 }
 
+void IOManager::dispatchEvents(Reactor* reactor, epoll_event* events,
+                               int count) {
+  for (int i = 0; i < count; ++i) {
+    epoll_event& event = events[i];
+    if (event.data.ptr == reactor) {
+      // 先清标记再读: 之后的 tickle 会重新写, 本线程醒着也会去看队列
+      reactor->wakePending.store(false, std::memory_order_release);
+      uint64_t dummy = 0;
+      while (read(reactor->wakeFd, &dummy, sizeof(dummy)) > 0) {
+        ;
+      }
+      continue;
+    }
+    if (Ring* ring = findRing(event.data.ptr)) {
+      reapRing(ring);
+      continue;
+    }
+
+    auto* fd_ctx = static_cast<FdContext*>(event.data.ptr);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if ((event.events & (EPOLLERR | EPOLLHUP)) != 0U) {
+      event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+      if (m_persistentEt) {
+        event.events |= EPOLLIN | EPOLLOUT;
+      }
+    }
+    // 对端关闭写, 读会返回 0
+    if ((event.events & EPOLLRDHUP) != 0U) {
+      event.events |= EPOLLIN;
+    }
+    int real_events = NONE;
+    if ((event.events & EPOLLIN) != NONE) {
+      real_events |= READ;
+    }
+    if ((event.events & EPOLLOUT) != NONE) {
+      real_events |= WRITE;
+    }
+
+    if (m_persistentEt) {
+      // 没有协程在等的方向记下来, 下次 addEvent 直接返回
+      int fired = fd_ctx->events & real_events;
+      fd_ctx->ready =
+          static_cast<Event>(fd_ctx->ready | (real_events & ~fired));
+      if ((fired & READ) != 0) {
+        fd_ctx->triggerEvent(READ);
+        --m_pendingEventCount;
+      }
+      if ((fired & WRITE) != 0) {
+        fd_ctx->triggerEvent(WRITE);
+        --m_pendingEventCount;
+      }
+      continue;
+    }
+
+    if ((fd_ctx->events & real_events) == NONE) {
+      continue;
+    }
+
+    int left_events = (fd_ctx->events & ~real_events);
+    int op = left_events != 0 ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    event.events = EPOLLET | left_events;
+
+    int rt2 = epoll_ctl(reactor->epfd, op, fd_ctx->fd, &event);
+    ++m_epollCtls;
+    if (rt2 != 0) {
+      HX_LOG_ERROR(g_logger)
+          << "epoll_ctl(" << reactor->epfd << ", " << op << ", " << fd_ctx->fd
+          << ", " << static_cast<EPOLL_EVENTS>(event.events) << "):" << rt2
+          << " (" << errno << ") (" << strerror(errno) << ")";
+      continue;
+    }
+
+    if ((real_events & READ) != 0) {
+      fd_ctx->triggerEvent(READ);
+      --m_pendingEventCount;
+    }
+    if ((real_events & WRITE) != 0) {
+      fd_ctx->triggerEvent(WRITE);
+      --m_pendingEventCount;
+    }
+  }
+}
+
+void IOManager::pollOnce(bool first) {
+  Reactor* reactor = m_reactors[m_multiReactor ? getWorkerIndex() : 0].get();
+  // 自旋时每次只收一小批, 剩下的下一次再收
+  epoll_event events[64];
+  int rt = waitEvents(reactor, events, 64, 0);
+  if (first) {
+    // 一直自旋等到任务就不会回到 idle, 定时器在这里处理
+    Clock::Update();
+    std::vector<std::function<void()> > cbs;
+    listExpiredCb(cbs);
+    if (!cbs.empty()) {
+      schedule(cbs.begin(), cbs.end());
+    }
+  }
+  if (rt > 0) {
+    dispatchEvents(reactor, events, rt);
+  }
+}
+
 void IOManager::idle() {
   const uint64_t maxevents = 256;
   auto* events = new epoll_event[maxevents]();
   std::shared_ptr<epoll_event> shared_events(
       events, [](epoll_event* ptr) { delete[] ptr; });
+  int self = getWorkerIndex();
+  Reactor* reactor = m_reactors[m_multiReactor ? self : 0].get();
 
   while (true) {
     uint64_t next_timeout = 0;
     if ((stopping(next_timeout))) {
       HX_LOG_INFO(g_logger) << "name= : " << getName() << " idle stopping exit";
+      Clock::Invalidate();
+      // 一次 tickle 只唤醒一个线程, 退出前把唤醒传给其他线程
+      if (!m_multiReactor) {
+        tickle();
+      } else {
+        for (size_t i = 0; i < m_reactors.size(); ++i) {
+          if (static_cast<int>(i) != self && isWorkerIdle(i)) {
+            tickleReactor(m_reactors[i].get());
+          }
+        }
+      }
+      break;
+    }
+
+    static const uint64_t MAX_TIMEOUT_US = 3000 * 1000;
+    next_timeout = std::min(next_timeout, MAX_TIMEOUT_US);
+    // 空闲够久的弹性线程退出, 没到期时等到冷却期满再看
+    if (shouldRetire(&next_timeout)) {
+      HX_LOG_DEBUG(g_logger) << getName() << " idle retire";
       break;
     }
 
     int rt = 0;
     do {
-      static const int MAX_TIMEOUT = 3000;
-      if (next_timeout != ~0ULL) {
-        next_timeout = static_cast<int>(next_timeout) > MAX_TIMEOUT
-                           ? MAX_TIMEOUT
-                           : next_timeout;
-      } else {
-        next_timeout = MAX_TIMEOUT;
-      }
-      rt =
-          epoll_wait(m_epfd, events, maxevents, static_cast<int>(next_timeout));
+      rt = waitEvents(reactor, events, maxevents, next_timeout);
       if (rt < 0 && errno == EINTR) {
       } else {
         break;
       }
     } while (true);
+    ++m_wakeups;
+    if (rt == 0) {
+      ++m_timeoutWakeups;
+    }
 
+    // 本轮之后创建的定时器都从这个时间算起
+    Clock::Update();
     std::vector<std::function<void()> > cbs;
     listExpiredCb(cbs);
     if (!cbs.empty()) {
@@ -302,55 +814,7 @@ void IOManager::idle() {
       cbs.clear();
     }
 
-    for (int i = 0; i < rt; ++i) {
-      epoll_event& event = events[i];
-      if (event.data.fd == m_tickleFds[0]) {
-        uint8_t dummy[256];
-        while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0) {
-          ;
-        }
-        continue;
-      }
-
-      auto* fd_ctx = static_cast<FdContext*>(event.data.ptr);
-      FdContext::MutexType::Lock lock(fd_ctx->mutex);
-      if ((event.events & (EPOLLERR | EPOLLHUP)) != 0U) {
-        event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
-      }
-      int real_events = NONE;
-      if ((event.events & EPOLLIN) != NONE) {
-        real_events |= READ;
-      }
-      if ((event.events & EPOLLOUT) != NONE) {
-        real_events |= WRITE;
-      }
-
-      if ((fd_ctx->events & real_events) == NONE) {
-        continue;
-      }
-
-      int left_events = (fd_ctx->events & ~real_events);
-      int op = left_events != 0 ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-      event.events = EPOLLET | left_events;
-
-      int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-      if (rt2 != 0) {
-        HX_LOG_ERROR(g_logger)
-            << "epoll_ctl(" << m_epfd << ", " << op << ", " << fd_ctx->fd
-            << ", " << static_cast<EPOLL_EVENTS>(event.events) << "):" << rt2
-            << " (" << errno << ") (" << strerror(errno) << ")";
-        continue;
-      }
-
-      if ((real_events & READ) != 0) {
-        fd_ctx->triggerEvent(READ);
-        --m_pendingEventCount;
-      }
-      if ((real_events & WRITE) != 0) {
-        fd_ctx->triggerEvent(WRITE);
-        --m_pendingEventCount;
-      }
-    }
+    dispatchEvents(reactor, events, rt);
 
     Fiber::ptr cur = Fiber::GetThis();
     auto raw_ptr = cur.get();
@@ -1,6 +1,10 @@
 #ifndef __HX_IOMANAGER_H__
 #define __HX_IOMANAGER_H__
 
+#include <sys/epoll.h>
+
+#include "fd_table.h"
+#include "io_uring.h"
 #include "scheduler.h"
 #include "timer.h"
 
@@ -20,6 +24,7 @@ class IOManager : public Scheduler, public TimerManager {
  private:
   struct FdContext {
     using MutexType = Mutex;
+    explicit FdContext(int fd_) : fd(fd_) {}
     struct EventContext {
       // 事件执行的调度器
       Scheduler* scheduler = nullptr;
@@ -32,44 +37,190 @@ class IOManager : public Scheduler, public TimerManager {
     // member function:
     auto getContext(Event event) -> EventContext&;
     void resetContext(EventContext& eventContext);
-    void triggerEvent(Event event);
+    /**
+     * @brief 触发事件, 把等待的协程或回调交给调度器
+     * @param[in] thread 指定执行线程, -1 不指定
+     */
+    void triggerEvent(Event event, int thread = -1);
     // member data
     EventContext read;
     EventContext write;
     int fd;
     Event events = NONE;
+    /// 注册在哪个 reactor 上, 没有事件时可以换绑
+    int reactor = 0;
+    /// 常驻注册时已经就绪、但当时没有协程在等的方向
+    Event ready = NONE;
+    /// 常驻注册时是否已经加进 epoll
+    bool registered = false;
+    /// 注册时 FdCtx 的代数, 对不上说明 fd 关闭后被复用了
+    uint32_t generation = 0;
+    /// io_uring 上还没完成的请求数, close 时据此决定要不要取消
+    std::atomic<int> uringOps = {0};
     MutexType mutex;
   };
 
+  /**
+   * @brief 一个 epoll 实例和它的唤醒 eventfd
+   * @details 默认所有线程共用一个; 多 reactor 模式下每个调度线程一个,
+   *          fd 绑定到第一次注册它的线程
+   */
+  struct Reactor {
+    int epfd = -1;
+    int wakeFd = -1;
+    /// 已经写过 wakeFd 但还没有线程读走, 这期间的 tickle 都是多余的
+    std::atomic<bool> wakePending = {false};
+  };
+
+  /**
+   * @brief 一个调度线程的 io_uring
+   * @details ring fd 注册在该线程等待的 epoll 上, 完成队列非空时唤醒 epoll_wait.
+   *          提交只在所属线程进行; 共享 reactor 时任何线程都可能收割完成队列
+   */
+  struct Ring {
+    explicit Ring(uint32_t entries) : uring(entries) {}
+    IoUring uring;
+    Spinlock reapMutex;
+    /// 固定文件表中已经放入的 fd, 槽位下标就是 fd
+    Mutex filesMutex;
+    std::vector<bool> files;
+  };
+
+  struct UringOp;
+
  public:
   explicit IOManager(size_t threads = 1, bool user_call = true,
                      const std::string& name = "");
   ~IOManager() override;
 
+  /**
+   * @brief 注册事件, 事件到来时唤醒当前协程或者执行 cb
+   * @return 0 成功, -1 失败; 常驻注册模式下事件已经就绪且没有 cb 时返回 1,
+   *         不挂起, 调用方直接重试 IO. 有 cb 时立即调度 cb 并返回 0
+   */
   auto addEvent(int fd, Event event, std::function<void()> cb = nullptr) -> int;
   auto delEvent(int fd, Event evnet) -> bool;
   auto cancelEvent(int fd, Event event) -> bool;
   bool cancelAll(int fd);
   static auto GetThis() -> IOManager*;
 
+  /// 是否每个调度线程一个 epoll, 由 iomanager.multi_reactor 配置决定
+  auto isMultiReactor() const -> bool { return m_multiReactor; }
+
+  /**
+   * @brief 是否使用 io_uring 引擎
+   * @details 由 iomanager.io_engine 配置决定, 内核不支持时回退到 epoll
+   */
+  auto isUring() const -> bool { return !m_rings.empty(); }
+
+  /**
+   * @brief 取当前线程 ring 上的一个提交项, 取到后必须紧接着调用 uringWait
+   * @details 不是 io_uring 引擎、不在调度线程或者当前协程运行在共享栈上时
+   *          返回 nullptr, 调用方回退到 epoll 路径
+   */
+  auto uringSqe() -> io_uring_sqe*;
+
+  /**
+   * @brief 提交 sqe 并挂起当前协程直到完成
+   * @param[in] sqe uringSqe 返回并填好的提交项
+   * @param[in] fd 操作的 fd, 在固定文件表范围内时换成固定文件
+   * @param[in] timeout_ms 超时时间, ~0ull 不超时
+   * @param[out] timed_out 是否因为超时被取消
+   * @return 内核返回的结果, 失败为 -errno
+   */
+  auto uringWait(io_uring_sqe* sqe, int fd, uint64_t timeout_ms,
+                 bool* timed_out) -> int;
+
+  /**
+   * @brief fd 关闭前取消它在各个 ring 上未完成的请求, 并移出固定文件表
+   */
+  void uringClose(int fd);
+
+  /// 是否每个 fd 只注册一次, 由 iomanager.persistent_et 配置决定
+  auto isPersistentEt() const -> bool { return m_persistentEt; }
+
+  /// 对 socket 等 fd 调用 epoll_ctl 的累计次数, 不含唤醒管道和 io_uring
+  auto getEpollCtlCount() const -> uint64_t;
+
+  /// io_uring_enter 的累计调用次数和提交的请求数
+  auto getUringStats() const -> std::pair<uint64_t, uint64_t>;
+
+  /**
+   * @brief tickle 的累计统计
+   * @return 实际写 eventfd 的次数, 以及因为已有未处理的唤醒而省掉的次数
+   */
+  auto getTickleStats() const -> std::pair<uint64_t, uint64_t>;
+
+  /**
+   * @brief idle 从 epoll 等待中醒来的累计次数
+   * @return 总次数, 以及其中没有任何事件(超时或定时器到期)的次数
+   */
+  auto getWakeupStats() const -> std::pair<uint64_t, uint64_t>;
+
  protected:
   void tickle() override;
+  void tickleWorker(size_t worker) override;
 
   auto stopping() -> bool override;
+  /// timeout 返回到下一个定时器的微秒数
   auto stopping(uint64_t& timeout) -> bool;
   void idle() override;
 
-  void contextResize(size_t size);
-
   void onTimerInsertedAtFront() override;
+  void flushPending() override;
+  void pollOnce(bool first) override;
   // bool stopping(uint64_t& timeout);
 
  private:
-  int m_epfd = 0;
-  int m_tickleFds[2]{};
+  /// 不加锁查找, fd 超出表的范围时返回 nullptr
+  auto getFdContext(int fd, bool auto_create) -> FdContext*;
+  /**
+   * @brief 常驻注册模式下把 fd 以 in|out 边沿触发加进 epoll, 已经注册过的跳过
+   * @details 持有 fd_ctx->mutex 时调用
+   */
+  auto persistFd(FdContext* fd_ctx) -> bool;
+  /// 新注册的 fd 应该绑定的 reactor
+  auto pickReactor() -> int;
+  /// fd 绑定的线程, 其他线程完成的事件交回给它; 共享模式或者就在该线程时为 -1
+  auto reactorThread(const FdContext* fd_ctx) const -> int;
+  /**
+   * @brief 唤醒等在这个 reactor 上的一个线程
+   * @details 上一次唤醒还没被读走时什么都不做, 醒来的线程会去检查所有队列
+   * @return 是否真的写了 eventfd
+   */
+  auto tickleReactor(Reactor* reactor) -> bool;
+  /// 处理 epoll 返回的事件: 唤醒 eventfd、io_uring 完成和 fd 读写
+  void dispatchEvents(Reactor* reactor, epoll_event* events, int count);
+  /// 内核支持 epoll_pwait2 时打开微秒精度的等待
+  void initPwait2();
+  /// 等待 reactor 上的事件, 最多 timeout_us 微秒
+  auto waitEvents(Reactor* reactor, epoll_event* events, int maxevents,
+                  uint64_t timeout_us) -> int;
+  /// 为每个调度线程创建 io_uring, 失败时保持 epoll 引擎
+  void initUring();
+  /// epoll 事件的 data.ptr 是否是某个 ring
+  auto findRing(void* ptr) const -> Ring*;
+  /// 收割完成队列, 返回唤醒的协程数
+  auto reapRing(Ring* ring) -> int;
+
+ private:
+  std::vector<std::unique_ptr<Reactor> > m_reactors;
+  bool m_multiReactor = false;
+  /// iomanager.persistent_et: fd 只注册一次 in|out 边沿触发, 就绪状态记在用户态
+  bool m_persistentEt = false;
+  /// iomanager.timer_precision 为 us 且内核支持时用 epoll_pwait2 等待
+  bool m_pwait2 = false;
+  std::atomic<size_t> m_nextReactor = {0};
+  /// io_uring 引擎下每个调度线程一个, 下标同 worker
+  std::vector<std::unique_ptr<Ring> > m_rings;
   std::atomic<size_t> m_pendingEventCount = {0};
-  RWMutexType m_mutex;
-  std::vector<FdContext*> m_fdContexts;
+  std::atomic<uint64_t> m_epollCtls = {0};
+  std::atomic<uint64_t> m_ticklesSent = {0};
+  std::atomic<uint64_t> m_ticklesSuppressed = {0};
+  std::atomic<uint64_t> m_wakeups = {0};
+  std::atomic<uint64_t> m_timeoutWakeups = {0};
+  /// 槽一经分配不再移动, epoll 的 data.ptr 可以直接指向它
+  FdTable<FdContext> m_fdContexts;
 };
 }  // namespace hx_sylar
 
@@ -11,6 +11,7 @@
 #include <string>
 #include <vector>
 
+#include "clock.h"
 #include "singleton.h"
 #include "thread.h"
 #include "util.h"
@@ -19,7 +20,8 @@
   if (logger->getLevel() <= level)                                        \
   hx_sylar::LogEventWrap(                                                 \
       hx_sylar::LogEvent::ptr(new hx_sylar::LogEvent(                     \
-          logger, level, __FILE__, __LINE__, 0, hx_sylar::GetThreadId(),  \
+          logger, level, __FILE__, __LINE__,                              \
+          hx_sylar::Clock::ElapsedMS(), hx_sylar::GetThreadId(),          \
           hx_sylar::GetFiberId(), time(0), hx_sylar::Thread::GetName()))) \
       .getSS()
 
@@ -37,7 +39,8 @@
   if (logger->getLevel() <= level)                                        \
   hx_sylar::LogEventWrap(                                                 \
       hx_sylar::LogEvent::ptr(new hx_sylar::LogEvent(                     \
-          logger, level, __FILE__, __LINE__, 0, hx_sylar::GetThreadId(),  \
+          logger, level, __FILE__, __LINE__,                              \
+          hx_sylar::Clock::ElapsedMS(), hx_sylar::GetThreadId(),          \
           hx_sylar::GetFiberId(), time(0), hx_sylar::Thread::GetName()))) \
       .getEvent()                                                         \
       ->format(fmt, __VA_ARGS__)
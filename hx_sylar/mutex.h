@@ -2,6 +2,7 @@
 #define __SYLAR_MUTEX_H__
 
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <stdint.h>
 
@@ -332,7 +333,15 @@ class Spinlock : Noncopyable {
   /**
    * @brief 上锁
    */
-  void lock() { pthread_spin_lock(&m_mutex); }
+  void lock() {
+    // 持有者可能被抢占(线程数多于核数), 自旋一段时间后让出 CPU
+    for (int i = 0; pthread_spin_trylock(&m_mutex) != 0; ++i) {
+      if (i >= kSpinLimit) {
+        sched_yield();
+        i = 0;
+      }
+    }
+  }
 
   /**
    * @brief 解锁
@@ -340,6 +349,8 @@ class Spinlock : Noncopyable {
   void unlock() { pthread_spin_unlock(&m_mutex); }
 
  private:
+  static constexpr int kSpinLimit = 128;
+
   /// 自旋锁
   pthread_spinlock_t m_mutex;
 };
@@ -0,0 +1,147 @@
+#include "offload_pool.h"
+
+#include <errno.h>
+
+#include "clock.h"
+#include "config.h"
+#include "fiber.h"
+#include "log.h"
+#include "scheduler.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_offload_threads = Config::Lookup<uint32_t>(
+    "offload.threads", 4,
+    "threads running blocking file io and getaddrinfo for fibers, 0 disables");
+
+/**
+ * 一次投递. 放在挂起协程的栈上, 协程恢复前不会被销毁;
+ * 共享栈协程切出后栈会被覆盖, 所以 CanOffload 排除了它们
+ */
+struct OffloadPool::Job {
+  const std::function<void()>* fn = nullptr;
+  Scheduler* scheduler = nullptr;
+  Fiber::ptr fiber;
+  uint64_t enqueueUs = 0;
+  int err = 0;
+};
+
+OffloadPool::OffloadPool(size_t threads) : m_threadCount(threads) {}
+
+OffloadPool::~OffloadPool() {
+  {
+    MutexType::Lock lock(m_mutex);
+    if (!m_started) {
+      return;
+    }
+    m_stopping = true;
+  }
+  for (size_t i = 0; i < m_threads.size(); ++i) {
+    m_semaphore.notify();
+  }
+  for (auto& thread : m_threads) {
+    thread->join();
+  }
+}
+
+auto OffloadPool::CanOffload() -> bool {
+  if (Scheduler::GetThis() == nullptr || Fiber::GetFiberId() == 0) {
+    return false;
+  }
+  Fiber::ptr cur = Fiber::GetThis();
+  return cur.get() != Scheduler::GetMainFiber() && !cur->isSharedStack();
+}
+
+void OffloadPool::start() {
+  if (m_threadCount == 0) {
+    m_threadCount = g_offload_threads->getValue();
+  }
+  m_threads.reserve(m_threadCount);
+  for (size_t i = 0; i < m_threadCount; ++i) {
+    m_threads.push_back(std::make_shared<Thread>([this]() { work(); },
+                                                 "offload_" + std::to_string(i)));
+  }
+  m_started = true;
+}
+
+void OffloadPool::run(const std::function<void()>& fn) {
+  if (!CanOffload()) {
+    ++m_inlined;
+    fn();
+    return;
+  }
+  Job job;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (!m_started) {
+      start();
+    }
+    if (m_threadCount == 0 || m_stopping) {
+      lock.unlock();
+      ++m_inlined;
+      fn();
+      return;
+    }
+    job.fn = &fn;
+    job.scheduler = Scheduler::GetThis();
+    job.fiber = Fiber::GetThis();
+    job.scheduler->holdExternal();
+    job.enqueueUs = Clock::NowUS();
+    m_jobs.push_back(&job);
+  }
+  m_semaphore.notify();
+  // 线程池可能在切出之前就把协程放回队列, Scheduler::run 会等它真正切出
+  Fiber::YieldToHold();
+  errno = job.err;
+}
+
+void OffloadPool::work() {
+  while (true) {
+    m_semaphore.wait();
+    Job* job = nullptr;
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_jobs.empty()) {
+        if (m_stopping) {
+          return;
+        }
+        continue;
+      }
+      job = m_jobs.front();
+      m_jobs.pop_front();
+    }
+    uint64_t queue_us = Clock::NowUS() - job->enqueueUs;
+    uint64_t max = m_maxQueueUs.load(std::memory_order_relaxed);
+    while (queue_us > max &&
+           !m_maxQueueUs.compare_exchange_weak(max, queue_us,
+                                               std::memory_order_relaxed)) {
+    }
+    try {
+      (*job->fn)();
+    } catch (std::exception& ex) {
+      HX_LOG_ERROR(g_logger) << "offload job except: " << ex.what();
+    } catch (...) {
+      HX_LOG_ERROR(g_logger) << "offload job except";
+    }
+    job->err = errno;
+    ++m_jobsDone;
+    // schedule 之后协程随时可能恢复并销毁 job, 先把需要的东西拿出来;
+    // releaseExternal 之后调度器可能停止并析构, 不能再碰它
+    Scheduler* scheduler = job->scheduler;
+    Fiber::ptr fiber = std::move(job->fiber);
+    scheduler->schedule(std::move(fiber));
+    scheduler->releaseExternal();
+  }
+}
+
+auto OffloadPool::getStats() const -> Stats {
+  Stats stats;
+  stats.jobs = m_jobsDone;
+  stats.inlined = m_inlined;
+  stats.maxQueueUs = m_maxQueueUs;
+  return stats;
+}
+
+}  // namespace hx_sylar
@@ -0,0 +1,91 @@
+/**
+ * @file offload_pool.h
+ * @brief 在普通线程上执行阻塞调用的线程池
+ * @details 磁盘文件的读写、fsync 和 getaddrinfo 没有就绪事件可等, 在调度线程上
+ *          调用会卡住同一线程上的所有协程. 协程把函数交给线程池后挂起,
+ *          函数返回后协程被重新放回原来的 Scheduler.
+ *          不在任务协程里(或者在共享栈协程里)时直接在当前线程执行
+ */
+#ifndef __HX_OFFLOAD_POOL_H__
+#define __HX_OFFLOAD_POOL_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "mutex.h"
+#include "noncopyable.h"
+#include "singleton.h"
+#include "thread.h"
+
+namespace hx_sylar {
+
+class OffloadPool : Noncopyable {
+ public:
+  using MutexType = Mutex;
+
+  struct Stats {
+    /// 交给线程池执行的次数
+    uint64_t jobs = 0;
+    /// 不满足条件、在调用线程上直接执行的次数
+    uint64_t inlined = 0;
+    /// 从入队到线程池开始执行的最长时间(微秒)
+    uint64_t maxQueueUs = 0;
+  };
+
+  /**
+   * @param[in] threads 线程数, 0 表示使用 offload.threads;
+   *            线程在第一次投递时才创建
+   */
+  explicit OffloadPool(size_t threads = 0);
+  ~OffloadPool();
+
+  /**
+   * @brief 在线程池里执行 fn, 当前协程挂起直到 fn 返回
+   * @details fn 里设置的 errno 会带回调用方. 线程数为 0 时总是直接执行
+   */
+  void run(const std::function<void()>& fn);
+
+  /**
+   * @brief run 的带返回值版本
+   */
+  template <class F>
+  auto call(F&& fn) -> decltype(fn()) {
+    decltype(fn()) result{};
+    run([&result, &fn]() { result = fn(); });
+    return result;
+  }
+
+  auto getStats() const -> Stats;
+
+  /// 当前是否能挂起协程等线程池, 否则 run 直接执行
+  static auto CanOffload() -> bool;
+
+ private:
+  struct Job;
+  void start();
+  void work();
+
+ private:
+  MutexType m_mutex;
+  Semaphore m_semaphore;
+  std::deque<Job*> m_jobs;
+  std::vector<Thread::ptr> m_threads;
+  size_t m_threadCount;
+  bool m_started = false;
+  bool m_stopping = false;
+  std::atomic<uint64_t> m_jobsDone{0};
+  std::atomic<uint64_t> m_inlined{0};
+  std::atomic<uint64_t> m_maxQueueUs{0};
+};
+
+/// hook 使用的全局线程池
+using OffloadMgr = Singleton<OffloadPool>;
+
+}  // namespace hx_sylar
+
+#endif
@@ -1,7 +1,13 @@
 #include "scheduler.h"
 
+#include <sched.h>
+
+#include <algorithm>
 #include <type_traits>
 
+#include "affinity.h"
+#include "clock.h"
+#include "config.h"
 #include "hook.h"
 #include "log.h"
 #include "macro.h"
@@ -10,8 +16,44 @@ namespace hx_sylar {
 
 static hx_sylar::Logger::ptr g_logger = HX_LOG_NAME("system");
 
+static ConfigVar<std::map<std::string, std::string> >::ptr g_scheduler_cpus =
+    Config::Lookup("scheduler.cpus", std::map<std::string, std::string>(),
+                   "scheduler name -> cpu list like 0-3,8, one cpu per thread");
+static ConfigVar<std::map<std::string, int> >::ptr g_scheduler_numa_node =
+    Config::Lookup("scheduler.numa_node", std::map<std::string, int>(),
+                   "scheduler name -> numa node for thread memory");
+static ConfigVar<std::map<std::string, uint32_t> >::ptr g_scheduler_max_threads =
+    Config::Lookup("scheduler.max_threads", std::map<std::string, uint32_t>(),
+                   "scheduler name -> max threads, grow from the ctor count");
+static ConfigVar<uint32_t>::ptr g_elastic_grow_wait_us = Config::Lookup<uint32_t>(
+    "scheduler.elastic.grow_wait_us", 5000,
+    "add a thread when a task waited longer than this in the run queue");
+static ConfigVar<uint32_t>::ptr g_elastic_cooldown_ms = Config::Lookup<uint32_t>(
+    "scheduler.elastic.cooldown_ms", 10000,
+    "retire an extra thread after it stayed idle this long");
+
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+/// 当前线程在 m_workers_ 中的下标, 不在 run 中时为 -1
+static thread_local int t_worker = -1;
+/// 本地队列一直不空时, 每取这么多个任务也调用一次 flushPending
+static const size_t kFlushRounds = 64;
+/// 一直有 HIGH 任务时, 每这么多次取任务让 NORMAL 先取一次
+static const size_t kNormalTurn = 4;
+/// 每这么多次取任务让 LOW 最先取一次, 低优先级至少分到这个比例
+static const size_t kLowTurn = 16;
+
+// 选择窃取对象用的随机数
+static auto NextRandom() -> uint32_t {
+  static thread_local uint32_t s_seed = 0;
+  if (s_seed == 0) {
+    s_seed = static_cast<uint32_t>(hx_sylar::GetThreadId()) * 2654435761U | 1;
+  }
+  s_seed ^= s_seed << 13;
+  s_seed ^= s_seed >> 17;
+  s_seed ^= s_seed << 5;
+  return s_seed;
+}
 
 Scheduler::Scheduler(size_t threads, bool use_caller, std::string name)
     : m_name_(std::move(name)) {
@@ -24,7 +66,12 @@ Scheduler::Scheduler(size_t threads, bool use_caller, std::string name)
     HX_ASSERT(GetThis() == nullptr);
     t_scheduler = this;
 
-    m_root_fiber_.reset(new Fiber([this] { this->run(); }, 0, true));
+    m_root_fiber_.reset(new Fiber(
+        [this] {
+          t_worker = static_cast<int>(m_workers_.size()) - 1;
+          this->run();
+        },
+        0, true));
     hx_sylar::Thread::SetName(m_name_);
 
     t_scheduler_fiber = m_root_fiber_.get();
@@ -34,6 +81,198 @@ Scheduler::Scheduler(size_t threads, bool use_caller, std::string name)
     m_root_thread_ = -1;
   }
   m_thread_count_ = threads;
+  size_t workers = threads + (use_caller ? 1 : 0);
+  for (size_t i = 0; i < workers; ++i) {
+    m_workers_.emplace_back(new Worker);
+  }
+
+  auto cpus = g_scheduler_cpus->getValue();
+  auto nodes = g_scheduler_numa_node->getValue();
+  auto cpu_it = cpus.find(m_name_);
+  auto node_it = nodes.find(m_name_);
+  setPlacement(cpu_it != cpus.end() ? Affinity::ParseCpuList(cpu_it->second)
+                                    : std::vector<int>(),
+               node_it != nodes.end() ? node_it->second : -1);
+
+  setElasticPolicy(g_elastic_grow_wait_us->getValue(),
+                   g_elastic_cooldown_ms->getValue());
+  auto max_threads = g_scheduler_max_threads->getValue();
+  auto max_it = max_threads.find(m_name_);
+  if (max_it != max_threads.end()) {
+    setElastic(max_it->second);
+  }
+}
+
+void Scheduler::setElastic(size_t max_threads) {
+  HX_ASSERT(m_threads_.empty());
+  size_t fixed = m_thread_count_ + (m_root_fiber_ ? 1 : 0);
+  size_t extra = max_threads > fixed ? max_threads - fixed : 0;
+  // 弹性槽位接在固定线程之后, caller 线程保持最后一个
+  std::unique_ptr<Worker> caller;
+  if (m_root_fiber_) {
+    caller = std::move(m_workers_.back());
+    m_workers_.pop_back();
+  }
+  m_workers_.resize(m_thread_count_);
+  for (size_t i = 0; i < extra; ++i) {
+    m_workers_.emplace_back(new Worker);
+    m_workers_.back()->elastic = true;
+  }
+  if (caller) {
+    m_workers_.push_back(std::move(caller));
+  }
+  m_elastic_ = extra > 0;
+}
+
+void Scheduler::setElasticPolicy(uint64_t grow_wait_us, uint64_t cooldown_ms) {
+  m_grow_wait_us_ = grow_wait_us;
+  m_cooldown_ms_ = cooldown_ms;
+}
+
+auto Scheduler::getElasticStats() const -> ElasticStats {
+  ElasticStats stats;
+  stats.threads = m_elastic_threads_;
+  stats.peak = m_elastic_peak_;
+  stats.grows = m_grows_;
+  stats.retires = m_retires_;
+  return stats;
+}
+
+auto Scheduler::spawnWorker(size_t worker) -> Thread::ptr {
+  return std::make_shared<Thread>(
+      [this, worker] {
+        t_worker = static_cast<int>(worker);
+        applyPlacement(worker);
+        this->run();
+      },
+      m_name_ + "_" + std::to_string(worker));
+}
+
+void Scheduler::maybeGrow(uint64_t wait_us) {
+  if (!m_elastic_ || wait_us < m_grow_wait_us_ || m_stopping_) {
+    return;
+  }
+  // 一个阈值时间内最多加一个线程, 给新线程时间消化队列
+  uint64_t now = Clock::NowUS();
+  uint64_t last = m_last_grow_us_;
+  if (now - last < m_grow_wait_us_ ||
+      !m_last_grow_us_.compare_exchange_strong(last, now)) {
+    return;
+  }
+  MutexType::Lock lock(m_mutex_);
+  if (m_stopping_) {
+    return;
+  }
+  for (size_t i = m_thread_count_; i < m_workers_.size(); ++i) {
+    Worker* w = m_workers_[i].get();
+    if (!w->elastic || w->running) {
+      continue;
+    }
+    // 上一个线程已经交回了任务, 只剩退出
+    if (w->thread) {
+      w->thread->join();
+    }
+    w->closed = false;
+    w->running = true;
+    w->thread = spawnWorker(i);
+    ++m_grows_;
+    uint64_t threads = ++m_elastic_threads_;
+    uint64_t peak = m_elastic_peak_;
+    while (threads > peak &&
+           !m_elastic_peak_.compare_exchange_weak(peak, threads)) {
+    }
+    HX_LOG_INFO(g_logger) << m_name_ << " grow worker " << i
+                          << " wait=" << wait_us << "us elastic=" << threads;
+    return;
+  }
+}
+
+auto Scheduler::shouldRetire(uint64_t* timeout_us) -> bool {
+  if (t_scheduler != this || t_worker < 0) {
+    return false;
+  }
+  Worker* self = m_workers_[t_worker].get();
+  if (!self->elastic || m_stopping_ || self->parked_ms == 0) {
+    return false;
+  }
+  uint64_t idle_ms = Clock::NowMS() - self->parked_ms;
+  uint64_t cooldown = m_cooldown_ms_;
+  if (idle_ms >= cooldown && self->inbox.size() == 0 && self->local.empty()) {
+    return true;
+  }
+  if (timeout_us != nullptr) {
+    uint64_t left = idle_ms < cooldown ? (cooldown - idle_ms) * 1000 : 1000;
+    *timeout_us = std::min(*timeout_us, left);
+  }
+  return false;
+}
+
+void Scheduler::retireWorker(Worker* self) {
+  {
+    // 之后还指定给本线程的任务在 takeGlobal 里取消指定
+    MutexType::Lock lock(m_mutex_);
+    m_retired_threads_.insert(self->thread_id);
+    self->thread_id = -1;
+  }
+  // 关闭 inbox 后等正在投递的线程放完, 再清空就不会有任务留在里面
+  self->closed = true;
+  while (self->delivering != 0) {
+    sched_yield();
+  }
+  // 判断空闲之后才投递进来的任务交给其他线程, 指定给本线程的不再指定
+  flushPending();
+  std::vector<FiberAndThread*> left;
+  while (FiberAndThread* ft = self->inbox.pop()) {
+    ft->thread_ = -1;
+    left.push_back(ft);
+  }
+  while (FiberAndThread* ft = self->local.pop()) {
+    left.push_back(ft);
+  }
+  if (!left.empty()) {
+    {
+      MutexType::Lock lock(m_mutex_);
+      m_global_.insert(m_global_.end(), left.begin(), left.end());
+      m_global_size_ += left.size();
+    }
+    tickle();
+  }
+  self->parked_ms = 0;
+  --m_elastic_threads_;
+  if (!m_stopping_) {
+    ++m_retires_;
+    HX_LOG_INFO(g_logger) << m_name_ << " retire worker " << t_worker
+                          << " handed back=" << left.size();
+  }
+  self->running = false;
+}
+
+void Scheduler::setPlacement(const std::vector<int>& cpus, int node) {
+  m_cpus_ = cpus;
+  m_node_ = node;
+}
+
+void Scheduler::applyPlacement(size_t worker) {
+  Worker* self = m_workers_[worker].get();
+  std::vector<int> cpus;
+  if (!m_cpus_.empty()) {
+    cpus.push_back(m_cpus_[worker % m_cpus_.size()]);
+  } else if (m_node_ >= 0) {
+    cpus = Affinity::NodeCpus(m_node_);
+  }
+  if (Affinity::BindThread(cpus)) {
+    self->cpus = Affinity::FormatCpuList(cpus);
+  }
+  // 只绑了 CPU 时内存跟着 CPU 所在的节点
+  int node = m_node_;
+  if (node < 0 && cpus.size() == 1) {
+    node = Affinity::CpuNode(cpus[0]);
+  }
+  if (node >= 0) {
+    Affinity::PreferNode(node);
+  }
+  self->cpu = Affinity::CurrentCpu();
+  self->node = Affinity::CpuNode(self->cpu);
 }
 
 Scheduler::~Scheduler() {
@@ -41,6 +280,22 @@ Scheduler::~Scheduler() {
   if (GetThis() == this) {
     t_scheduler = nullptr;
   }
+  for (auto* ft : m_global_) {
+    delete ft;
+  }
+  for (auto& cls : m_classes_) {
+    for (auto* ft : cls.queue) {
+      delete ft;
+    }
+  }
+  for (auto& w : m_workers_) {
+    while (FiberAndThread* ft = w->local.pop()) {
+      delete ft;
+    }
+    while (FiberAndThread* ft = w->inbox.pop()) {
+      delete ft;
+    }
+  }
 }
 
 auto Scheduler::GetThis() -> Scheduler* { return t_scheduler; }
@@ -57,8 +312,7 @@ void Scheduler::start() {
 
   m_threads_.resize(m_thread_count_);
   for (size_t i = 0; i < m_thread_count_; ++i) {
-    m_threads_[i].reset(
-        new Thread([this] { this->run(); }, m_name_ + "_" + std::to_string(i)));
+    m_threads_[i] = spawnWorker(i);
     m_thread_ids_.push_back(m_threads_[i]->getId());
   }
   // lock.unlock();
@@ -85,7 +339,7 @@ void Scheduler::stop() {
   }
 
   m_stopping_ = true;
-  for (size_t i = 0; i < m_thread_count_; ++i) {
+  for (size_t i = 0; i < m_thread_count_ + m_elastic_threads_; ++i) {
     tickle();
   }
 
@@ -112,6 +366,11 @@ void Scheduler::stop() {
   {
     MutexType::Lock lock(m_mutex_);
     thrs.swap(m_threads_);
+    for (auto& w : m_workers_) {
+      if (w->thread) {
+        thrs.push_back(std::move(w->thread));
+      }
+    }
   }
 
   for (auto& i : thrs) {
@@ -123,6 +382,302 @@ void Scheduler::stop() {
 
 void Scheduler::setThis() { t_scheduler = this; }
 
+auto Scheduler::getWorkerIndex() const -> int {
+  return t_scheduler == this ? t_worker : -1;
+}
+
+auto Scheduler::getWorkerThreadId(size_t worker) const -> int {
+  return m_workers_[worker]->thread_id;
+}
+
+auto Scheduler::isWorkerIdle(size_t worker) const -> bool {
+  return m_workers_[worker]->idle;
+}
+
+auto Scheduler::findWorker(int thread) -> int {
+  for (size_t i = 0; i < m_workers_.size(); ++i) {
+    if (m_workers_[i]->thread_id == thread) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+auto Scheduler::deliver(size_t worker, FiberAndThread* ft) -> bool {
+  Worker* target = m_workers_[worker].get();
+  // 与 retireWorker 中先置 closed 再等 delivering 归零配对
+  ++target->delivering;
+  if (target->closed) {
+    --target->delivering;
+    return false;
+  }
+  target->inbox.push(ft);
+  --target->delivering;
+  // 与 run 中先置 idle 再检查 inbox 配对, 两边至少有一方看到对方
+  if (target->idle && static_cast<int>(worker) != getWorkerIndex()) {
+    tickleWorker(worker);
+  }
+  return true;
+}
+
+auto Scheduler::enqueue(FiberAndThread* ft) -> bool {
+  // 共享栈协程只能回到它绑定的线程
+  if (ft->fiber_ && ft->thread_ == -1) {
+    ft->thread_ = ft->fiber_->getBoundThread();
+  }
+  if (ft->prio_ == INHERIT) {
+    ft->prio_ = ft->fiber_ ? static_cast<Priority>(ft->fiber_->m_priority)
+                           : NORMAL;
+  }
+  ft->enqueue_us_ = Clock::NowUS();
+  ++m_classes_[ft->prio_].depth;
+  ++m_task_count_;
+  int target = -1;
+  if (ft->thread_ != -1) {
+    target = findWorker(ft->thread_);
+  }
+  if (target != -1) {
+    if (deliver(target, ft)) {
+      return false;
+    }
+    // 目标线程正在退出, 按没有指定线程处理
+    ft->thread_ = -1;
+  }
+  if (ft->thread_ == -1 && ft->prio_ != NORMAL) {
+    PriorityClass& cls = m_classes_[ft->prio_];
+    MutexType::Lock lock(cls.mutex);
+    cls.queue.push_back(ft);
+    ++cls.size;
+  } else if (ft->thread_ == -1 && t_scheduler == this && t_worker >= 0) {
+    m_workers_[t_worker]->local.push(ft);
+  } else {
+    uint64_t head_wait = 0;
+    {
+      MutexType::Lock lock(m_mutex_);
+      m_global_.push_back(ft);
+      ++m_global_size_;
+      // 所有线程都忙时没有人出队, 看队头等了多久
+      if (m_elastic_ && m_idle_thread_count_ == 0) {
+        head_wait = ft->enqueue_us_ - m_global_.front()->enqueue_us_;
+      }
+    }
+    maybeGrow(head_wait);
+  }
+  return m_idle_thread_count_ > 0;
+}
+
+auto Scheduler::takeGlobal(Worker* self) -> FiberAndThread* {
+  if (m_global_size_ == 0) {
+    return nullptr;
+  }
+  FiberAndThread* rt = nullptr;
+  MutexType::Lock lock(m_mutex_);
+  // 按线程数平分, 一次拿一批减少全局锁竞争
+  size_t batch = m_global_.size() / m_workers_.size() + 1;
+  size_t n = m_global_.size();
+  for (size_t i = 0; i < n && batch > 0; ++i) {
+    FiberAndThread* ft = m_global_.front();
+    m_global_.pop_front();
+    if (ft->thread_ != -1 && ft->thread_ != self->thread_id) {
+      // 入队时目标线程还没启动, 现在转交给它
+      int target = findWorker(ft->thread_);
+      if (target != -1 && deliver(target, ft)) {
+        --m_global_size_;
+        continue;
+      }
+      if (target == -1 && !m_retired_threads_.count(ft->thread_)) {
+        m_global_.push_back(ft);
+        continue;
+      }
+      // 目标线程已经退出, 谁都可以执行
+      ft->thread_ = -1;
+    }
+    --m_global_size_;
+    --batch;
+    if (rt == nullptr) {
+      rt = ft;
+    } else if (ft->thread_ == -1) {
+      self->local.push(ft);
+    } else {
+      self->inbox.push(ft);
+    }
+  }
+  return rt;
+}
+
+auto Scheduler::stealOther(Worker* self) -> FiberAndThread* {
+  size_t n = m_workers_.size();
+  size_t start = NextRandom() % n;
+  for (size_t i = 0; i < n; ++i) {
+    Worker* w = m_workers_[(start + i) % n].get();
+    if (w == self) {
+      continue;
+    }
+    if (FiberAndThread* ft = w->local.steal()) {
+      return ft;
+    }
+  }
+  return nullptr;
+}
+
+auto Scheduler::takeClass(Priority prio) -> FiberAndThread* {
+  PriorityClass& cls = m_classes_[prio];
+  if (cls.size == 0) {
+    return nullptr;
+  }
+  MutexType::Lock lock(cls.mutex);
+  if (cls.queue.empty()) {
+    return nullptr;
+  }
+  FiberAndThread* ft = cls.queue.front();
+  cls.queue.pop_front();
+  --cls.size;
+  return ft;
+}
+
+auto Scheduler::takeUrgent(Worker* self) -> FiberAndThread* {
+  size_t picks = ++self->picks;
+  if (picks % kLowTurn == 0) {
+    if (FiberAndThread* ft = takeClass(LOW)) {
+      return ft;
+    }
+  }
+  if (picks % kNormalTurn == 0) {
+    return nullptr;
+  }
+  return takeClass(HIGH);
+}
+
+void Scheduler::onDequeue(FiberAndThread* ft) {
+  PriorityClass& cls = m_classes_[ft->prio_];
+  uint64_t now = Clock::NowUS();
+  uint64_t wait = now > ft->enqueue_us_ ? now - ft->enqueue_us_ : 0;
+  --cls.depth;
+  ++cls.run;
+  cls.waitUs += wait;
+  uint64_t max_wait = cls.maxWaitUs;
+  while (wait > max_wait &&
+         !cls.maxWaitUs.compare_exchange_weak(max_wait, wait)) {
+  }
+  maybeGrow(wait);
+}
+
+void Scheduler::requeue(FiberAndThread* ft) {
+  ++m_task_count_;
+  if (ft->thread_ == -1 && ft->prio_ != NORMAL) {
+    PriorityClass& cls = m_classes_[ft->prio_];
+    MutexType::Lock lock(cls.mutex);
+    cls.queue.push_back(ft);
+    ++cls.size;
+    return;
+  }
+  MutexType::Lock lock(m_mutex_);
+  m_global_.push_back(ft);
+  ++m_global_size_;
+}
+
+auto Scheduler::getPriorityStats(Priority prio) const -> PriorityStats {
+  const PriorityClass& cls = m_classes_[prio];
+  PriorityStats stats;
+  stats.depth = cls.depth;
+  stats.run = cls.run;
+  stats.waitUs = cls.waitUs;
+  stats.maxWaitUs = cls.maxWaitUs;
+  return stats;
+}
+
+auto Scheduler::nextTask(Worker* self) -> FiberAndThread* {
+  FiberAndThread* ft = self->inbox.pop();
+  if (ft == nullptr) {
+    ft = takeUrgent(self);
+  }
+  if (ft == nullptr) {
+    ft = self->local.pop();
+  }
+  if (ft == nullptr || ++self->rounds % kFlushRounds == 0) {
+    flushPending();
+    // 提交时收割到的完成会把协程放进本地队列
+    if (ft == nullptr) {
+      ft = self->local.pop();
+    }
+  }
+  if (ft == nullptr) {
+    ft = takeGlobal(self);
+  }
+  if (ft == nullptr) {
+    ft = stealOther(self);
+  }
+  // 没有 NORMAL 任务时不用等轮次
+  if (ft == nullptr) {
+    ft = takeClass(HIGH);
+  }
+  if (ft == nullptr) {
+    ft = takeClass(LOW);
+  }
+  if (ft != nullptr) {
+    ++m_active_thread_count_;
+    --m_task_count_;
+  }
+  return ft;
+}
+
+auto Scheduler::needTickle(Worker* self) -> bool {
+  if (m_idle_thread_count_ == 0) {
+    return false;
+  }
+  if (!self->local.empty() || m_global_size_ > 0 ||
+      m_classes_[HIGH].size > 0 || m_classes_[LOW].size > 0) {
+    return true;
+  }
+  // 指定给空闲线程的任务
+  for (auto& w : m_workers_) {
+    if (w.get() != self && w->idle && w->inbox.size() > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+auto Scheduler::busyPoll(Worker* self) -> FiberAndThread* {
+  uint64_t max_us = m_busy_poll_us_;
+  uint64_t start = Clock::NowUS();
+  if (self->idle_since == 0) {
+    self->idle_since = start;
+  }
+  // 任务来得比上限还稀, 自旋多半落空, 直接去睡
+  if (self->gap_us > max_us || m_stopping_) {
+    return nullptr;
+  }
+  uint64_t budget = std::min(max_us, self->gap_us * 2 + 1);
+  FiberAndThread* task = nullptr;
+  uint64_t now = start;
+  for (bool first = true;; first = false) {
+    pollOnce(first);
+    task = nextTask(self);
+    now = Clock::NowUS();
+    if (task != nullptr || now - start >= budget) {
+      break;
+    }
+    // 生产者可能和本线程挤在同一个核上, 让它先跑; 有空闲核时立即返回
+    sched_yield();
+  }
+  m_busy_spin_us_ += now - start;
+  if (task != nullptr) {
+    ++m_busy_hits_;
+  } else {
+    ++m_busy_misses_;
+  }
+  return task;
+}
+
+auto Scheduler::getBusyPollStats() const -> BusyPollStats {
+  BusyPollStats stats;
+  stats.hits = m_busy_hits_;
+  stats.misses = m_busy_misses_;
+  stats.spinUs = m_busy_spin_us_;
+  return stats;
+}
+
 void Scheduler::run() {
   HX_LOG_DEBUG(g_logger) << m_name_ << " run";
   hx_sylar::set_hook_enable(true);
@@ -130,65 +685,99 @@ void Scheduler::run() {
   if (hx_sylar::GetThreadId() != m_root_thread_) {
     t_scheduler_fiber = Fiber::GetThis().get();
   }
+  HX_ASSERT(t_worker >= 0 && t_worker < static_cast<int>(m_workers_.size()));
+  Worker* self = m_workers_[t_worker].get();
+  self->thread_id = hx_sylar::GetThreadId();
 
   Fiber::ptr idle_fiber = std::make_shared<Fiber>([this] { this->idle(); });
   Fiber::ptr cb_fiber;
+  // 弹性线程会退出, 绑在它上面的共享栈协程就回不来了
+  bool shared_stack = m_shared_stack_ && !self->elastic;
 
-  FiberAndThread ft;
   while (true) {
-    ft.reset();
-    bool tickle_me = false;
-    bool is_active = false;
-    {
-      MutexType::Lock lock(m_mutex_);
-      auto it = m_fibers_.begin();
-      while (it != m_fibers_.end()) {
-        if (it->thread_ != -1 && it->thread_ != hx_sylar::GetThreadId()) {
-          ++it;
-          tickle_me = true;
-          continue;
-        }
-
-        HX_ASSERT(it->fiber_ || it->cb_);
-        if (it->fiber_ && it->fiber_->getState() == Fiber::EXEC) {
-          ++it;
-          continue;
-        }
-
-        ft = *it;
-        m_fibers_.erase(it++);
-        ++m_active_thread_count_;
-        is_active = true;
+    FiberAndThread* task = nextTask(self);
+    if (task == nullptr && m_busy_poll_us_ > 0) {
+      task = busyPoll(self);
+    }
+    if (task != nullptr && self->idle_since != 0) {
+      // 封顶, 一次长时间的空闲不会让之后很久都不自旋
+      uint64_t gap = std::min(Clock::NowUS() - self->idle_since,
+                              2 * m_busy_poll_us_.load());
+      self->gap_us = (self->gap_us * 3 + gap) / 4;
+      self->idle_since = 0;
+    }
+    if (task == nullptr) {
+      // 先登记空闲再检查一次, 避免与 enqueue 的 tickle 判断错过
+      self->idle = true;
+      ++m_idle_thread_count_;
+      task = nextTask(self);
+      if (task != nullptr) {
+        --m_idle_thread_count_;
+        self->idle = false;
+      }
+    }
+    if (task != nullptr) {
+      self->parked_ms = 0;
+    }
+
+    if (task == nullptr) {
+      if (self->parked_ms == 0) {
+        self->parked_ms = Clock::NowMS();
+      }
+      if (idle_fiber->getState() == Fiber::TERM) {
+        --m_idle_thread_count_;
+        self->idle = false;
+        HX_LOG_INFO(g_logger) << "idle fiber_ term";
         break;
       }
-      tickle_me |= it != m_fibers_.end();
+      // tickle 可能唤醒了别的线程, 把它转给 inbox 里有任务的空闲线程
+      if (needTickle(self)) {
+        tickle();
+      }
+      idle_fiber->swapIn();
+      --m_idle_thread_count_;
+      self->idle = false;
+      if (idle_fiber->getState() != Fiber::TERM &&
+          idle_fiber->getState() != Fiber::EXCEPT) {
+        idle_fiber->m_state = Fiber::HOLD;
+      }
+      continue;
     }
 
-    if (tickle_me) {
+    if (needTickle(self)) {
       tickle();
     }
 
-    if (ft.fiber_ && (ft.fiber_->getState() != Fiber::TERM &&
-                      ft.fiber_->getState() != Fiber::EXCEPT)) {
-      ft.fiber_->swapIn();
+    std::unique_ptr<FiberAndThread> ft(task);
+    if (ft->fiber_ && ft->fiber_->getState() == Fiber::EXEC) {
+      // 还没开始执行, 等待时间等真正执行时再记
+      requeue(ft.release());
       --m_active_thread_count_;
-
-      if (ft.fiber_->getState() == Fiber::READY) {
-        schedule(ft.fiber_);
-      } else if (ft.fiber_->getState() != Fiber::TERM &&
-                 ft.fiber_->getState() != Fiber::EXCEPT) {
-        ft.fiber_->m_state = Fiber::HOLD;
+      continue;
+    }
+    onDequeue(ft.get());
+
+    if (ft->fiber_ && (ft->fiber_->getState() != Fiber::TERM &&
+                       ft->fiber_->getState() != Fiber::EXCEPT)) {
+      ft->fiber_->m_priority = ft->prio_;
+      ft->fiber_->swapIn();
+      if (ft->fiber_->getState() == Fiber::READY) {
+        schedule(ft->fiber_);
+      } else if (ft->fiber_->getState() != Fiber::TERM &&
+                 ft->fiber_->getState() != Fiber::EXCEPT) {
+        ft->fiber_->m_state = Fiber::HOLD;
       }
-      ft.reset();
-    } else if (ft.cb_) {
+      --m_active_thread_count_;
+    } else if (ft->cb_) {
       if (cb_fiber) {
-        cb_fiber->reset(ft.cb_);
+        cb_fiber->reset(ft->cb_);
       } else {
-        cb_fiber.reset(new Fiber(ft.cb_));
+        cb_fiber.reset(new Fiber(ft->cb_, 0, false, shared_stack));
       }
+      // 回调挂起后再被调度时沿用这个优先级
+      cb_fiber->m_priority = ft->prio_;
       ft.reset();
       cb_fiber->swapIn();
-      --m_active_thread_count_;
       if (cb_fiber->getState() == Fiber::READY) {
         schedule(cb_fiber);
         cb_fiber.reset();
@@ -199,38 +788,29 @@ void Scheduler::run() {
         cb_fiber->m_state = Fiber::HOLD;
         cb_fiber.reset();
       }
+      --m_active_thread_count_;
     } else {
-      if (is_active) {
-        --m_active_thread_count_;
-        continue;
-      }
-      if (idle_fiber->getState() == Fiber::TERM) {
-        HX_LOG_INFO(g_logger) << "idle fiber_ term";
-        break;
-      }
-
-      ++m_idle_thread_count_;
-      idle_fiber->swapIn();
-      --m_idle_thread_count_;
-      if (idle_fiber->getState() != Fiber::TERM &&
-          idle_fiber->getState() != Fiber::EXCEPT) {
-        idle_fiber->m_state = Fiber::HOLD;
-      }
+      --m_active_thread_count_;
     }
   }
+  if (self->elastic) {
+    retireWorker(self);
+  }
+  t_worker = -1;
+  // use_caller 时 run 结束后 caller 线程不再有 IOManager
+  hx_sylar::set_hook_enable(false);
 }
 
 void Scheduler::tickle() { HX_LOG_INFO(g_logger) << "tickle"; }
 
 auto Scheduler::stopping() -> bool {
-  MutexType::Lock lock(m_mutex_);
-  return m_auto_stop_ && m_stopping_ && m_fibers_.empty() &&
-         m_active_thread_count_ == 0;
+  return m_auto_stop_ && m_stopping_ && m_task_count_ == 0 &&
+         m_active_thread_count_ == 0 && m_external_count_ == 0;
 }
 
 void Scheduler::idle() {
   HX_LOG_INFO(g_logger) << "idle";
-  while (!stopping()) {
+  while (!stopping() && !shouldRetire(nullptr)) {
     hx_sylar::Fiber::YieldToHold();
   }
 }
@@ -238,7 +818,9 @@ void Scheduler::idle() {
 auto Scheduler::dump(std::ostream& os) -> std::ostream& {
   os << "[Scheduler name=" << m_name_ << " size=" << m_thread_count_
      << " active_count=" << m_active_thread_count_
-     << " idle_count=" << m_idle_thread_count_ << " stopping=" << m_stopping_
+     << " idle_count=" << m_idle_thread_count_ << " tasks=" << m_task_count_
+     << " global=" << m_global_size_ << " stopping=" << m_stopping_
+     << " shared_stack=" << m_shared_stack_
      << " ]" << '\n'
      << "    ";
   for (size_t i = 0; i < m_thread_ids_.size(); ++i) {
@@ -247,6 +829,16 @@ auto Scheduler::dump(std::ostream& os) -> std::ostream& {
     }
     os << m_thread_ids_[i];
   }
+  for (size_t i = 0; i < m_workers_.size(); ++i) {
+    Worker* w = m_workers_[i].get();
+    os << '\n'
+       << "    worker " << i << " thread=" << w->thread_id
+       << " cpus=" << (w->cpus.empty() ? "any" : w->cpus) << " cpu=" << w->cpu
+       << " node=" << w->node;
+    if (w->elastic) {
+      os << " elastic running=" << w->running;
+    }
+  }
   return os;
 }
 
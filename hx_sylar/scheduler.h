@@ -1,12 +1,16 @@
 #ifndef __HX_SCHEDULER_H__
 #define __HX_SCHEDULER_H__
+#include <atomic>
+#include <deque>
 #include <iostream>
-#include <list>
 #include <memory>
+#include <unordered_set>
 #include <vector>
 
 #include "fiber.h"
+#include "mutex.h"
 #include "thread.h"
+#include "work_queue.h"
 
 namespace hx_sylar {
 class Scheduler {
@@ -14,42 +18,142 @@ class Scheduler {
   using threadId = int;
   using ptr = std::shared_ptr<Scheduler>;
   using MutexType = Mutex;
+
+  /**
+   * @brief 任务的优先级
+   * @details 取任务时 HIGH 优先于 NORMAL 优先于 LOW, 按轮次给低优先级留出
+   *          份额, 不会被饿死. 指定线程的任务直接投递到该线程, 不参与排序
+   */
+  enum Priority {
+    /// 协程任务沿用它上次被调度时的优先级, 回调任务为 NORMAL
+    INHERIT = -1,
+    /// 健康检查、交互请求等对时延敏感的任务
+    HIGH = 0,
+    NORMAL = 1,
+    /// 批处理等后台任务
+    LOW = 2,
+  };
+  static const int kPriorities = 3;
+
+  /// 一个优先级的累计统计
+  struct PriorityStats {
+    /// 当前排队的任务数
+    uint64_t depth = 0;
+    /// 已经开始执行的任务数
+    uint64_t run = 0;
+    /// 从入队到开始执行的累计等待(微秒)
+    uint64_t waitUs = 0;
+    /// 最长的一次等待(微秒)
+    uint64_t maxWaitUs = 0;
+  };
+
   explicit Scheduler(size_t threads = 1, bool use_caller = true,
                      std::string name = "");
   virtual ~Scheduler();
   auto getName() const -> const std::string& { return m_name_; }
+  // 调度线程id, start 之后才完整
+  auto getThreadIds() const -> const std::vector<int>& { return m_thread_ids_; }
   static auto GetThis() -> Scheduler*;
   static auto GetMainFiber() -> Fiber*;
 
   void start();
   void stop();
+  /**
+   * @brief 调度协程或者回调
+   * @param[in] thread 指定执行线程, -1 不指定
+   * @param[in] prio 优先级
+   */
   template <class FiberOrCb>
-  void schedule(FiberOrCb cb, int thread = -1) {
-    bool need_tickle = false;
-    {
-      MutexType::Lock lock(m_mutex_);
-      need_tickle = scheduleNoLock(cb, thread);
-    }
-    if (need_tickle) {
+  void schedule(FiberOrCb cb, int thread = -1, Priority prio = INHERIT) {
+    if (scheduleNoLock(cb, thread, prio)) {
       tickle();
     }
   }
 
   template <class InputIterator>
-  void schedule(InputIterator begin, InputIterator end) {
+  void schedule(InputIterator begin, InputIterator end,
+                Priority prio = INHERIT) {
     bool need_tickle = false;
-    {
-      MutexType::Lock lock(m_mutex_);
-      while (begin != end) {
-        need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-        ++begin;
-      }
+    while (begin != end) {
+      need_tickle = scheduleNoLock(&*begin, -1, prio) || need_tickle;
+      ++begin;
     }
     if (need_tickle) {
       tickle();
     }
   }
 
+  /**
+   * @brief 登记一个挂在调度器之外、之后会被 schedule 回来的协程
+   * @details 比如交给 OffloadPool 的协程, 它不在任何队列里也没有定时器.
+   *          计数不为 0 时 stop 会等它回来; 先 schedule 再 releaseExternal
+   */
+  void holdExternal() { ++m_external_count_; }
+  void releaseExternal() { --m_external_count_; }
+
+  // 回调任务的协程是否使用共享栈, 需要在start之前设置
+  void setSharedStack(bool v) { m_shared_stack_ = v; }
+  auto isSharedStack() const -> bool { return m_shared_stack_; }
+
+  /**
+   * @brief 设置忙等的上限(微秒), 0 关闭
+   * @details 任务取空后先自旋检查队列和 IO 一小段时间再睡, 省掉睡下去又被
+   *          tickle 叫醒的两次切换. 自旋多久按本线程最近的任务到达间隔自适应,
+   *          间隔比上限还长时不自旋. 随时可以修改
+   */
+  void setBusyPoll(uint64_t max_us) { m_busy_poll_us_ = max_us; }
+  auto getBusyPoll() const -> uint64_t { return m_busy_poll_us_; }
+
+  /// 忙等的累计统计
+  struct BusyPollStats {
+    /// 自旋期间等到了任务
+    uint64_t hits = 0;
+    /// 自旋落空, 仍然进入 idle 睡眠
+    uint64_t misses = 0;
+    /// 自旋花掉的时间(微秒)
+    uint64_t spinUs = 0;
+  };
+  auto getBusyPollStats() const -> BusyPollStats;
+
+  auto getPriorityStats(Priority prio) const -> PriorityStats;
+
+  /**
+   * @brief 设置调度线程放在哪些 CPU 和哪个 NUMA 节点上, start 之前调用
+   * @details 构造时已经按名字从 scheduler.cpus / scheduler.numa_node 读过配置,
+   *          这里可以覆盖. 线程启动后先绑定再分配协程栈等线程局部的内存,
+   *          这些内存就落在所在节点上. use_caller 的 caller 线程不绑定
+   * @param[in] cpus 调度线程依次各绑一个 CPU, 为空时不逐个绑定
+   * @param[in] node 线程的内存优先从该节点分配; cpus 为空时线程绑到该节点
+   *            的全部 CPU 上. -1 不限制
+   */
+  void setPlacement(const std::vector<int>& cpus, int node = -1);
+
+  /**
+   * @brief 打开弹性模式, start 之前调用
+   * @details 构造时的线程数是下限, 最多扩到 max_threads(与构造参数同样计入
+   *          caller 线程). 任务排队超过 grow_wait_us 时加一个线程, 多出来的
+   *          线程空闲超过 cooldown_ms 后退出. 构造时已经按名字读过
+   *          scheduler.max_threads 配置. 弹性线程不使用共享栈, 也不在
+   *          getThreadIds 中; 退出时把还没执行的任务交回全局队列,
+   *          指定给它的任务不再指定线程. max_threads 不大于下限时关闭
+   */
+  void setElastic(size_t max_threads);
+  /// 扩容的排队阈值(微秒)和缩容的空闲冷却(毫秒), 随时可以修改
+  void setElasticPolicy(uint64_t grow_wait_us, uint64_t cooldown_ms);
+
+  /// 弹性模式的统计
+  struct ElasticStats {
+    /// 当前在运行的弹性线程数
+    uint64_t threads = 0;
+    /// 弹性线程数的峰值
+    uint64_t peak = 0;
+    /// 扩容次数
+    uint64_t grows = 0;
+    /// 缩容次数
+    uint64_t retires = 0;
+  };
+  auto getElasticStats() const -> ElasticStats;
+
   void swithcTo(int thread = -1);
   std::ostream& dump(std::ostream& os);
 
@@ -61,17 +165,141 @@ class Scheduler {
   void setThis();
   auto hasIdleThreads() -> bool { return m_idle_thread_count_ > 0; }
 
+  /**
+   * @brief 唤醒指定的调度线程, 默认等同于 tickle
+   * @param[in] worker 调度线程下标, 见 GetWorkerIndex
+   */
+  virtual void tickleWorker(size_t worker) { tickle(); }
+
+  /**
+   * @brief 本线程的任务跑完一轮后调用, 子类在这里批量提交积攒的 IO
+   * @details 本地队列取空时调用, 队列一直不空时也会定期调用
+   */
+  virtual void flushPending() {}
+
+  /**
+   * @brief 忙等时反复调用, 不阻塞地收集 IO 事件, 唤醒的任务通过 schedule 入队
+   * @param[in] first 本轮忙等的第一次, 子类顺带处理到期的定时器
+   */
+  virtual void pollOnce(bool first) {}
+
+  /**
+   * @brief idle 中调用, 当前线程是否是该退出的弹性线程
+   * @param[in,out] timeout_us 不为空时缩短到冷却期满, idle 按它等待
+   */
+  auto shouldRetire(uint64_t* timeout_us) -> bool;
+
+  /**
+   * @brief 当前线程在本调度器中的下标, 不是调度线程时返回 -1
+   * @details use_caller 时 caller 线程的下标是 getWorkerCount() - 1
+   */
+  auto getWorkerIndex() const -> int;
+  auto getWorkerCount() const -> size_t { return m_workers_.size(); }
+  /// 调度线程的线程id, 线程还没进入 run 时为 -1
+  auto getWorkerThreadId(size_t worker) const -> int;
+  /// 调度线程是否已经登记为空闲(可能正在进入 idle)
+  auto isWorkerIdle(size_t worker) const -> bool;
+
  private:
   template <class FiberOrCb>
-  auto scheduleNoLock(FiberOrCb fc, int thread) -> bool {
-    bool need_tickle = m_fibers_.empty();
-    FiberAndThread ft(fc, thread);
-    if (ft.fiber_ || ft.cb_) {
-      m_fibers_.push_back(ft);
+  auto scheduleNoLock(FiberOrCb fc, int thread, Priority prio) -> bool {
+    auto* ft = new FiberAndThread(fc, thread);
+    if (!ft->fiber_ && !ft->cb_) {
+      delete ft;
+      return false;
     }
-    return need_tickle;
+    ft->prio_ = prio;
+    return enqueue(ft);
   }
 
+  struct FiberAndThread;
+  struct Worker;
+
+  /**
+   * @brief 任务入队, 返回是否需要 tickle
+   * @details 指定线程的任务直接投递到该线程的 inbox,
+   *          工作线程自己产生的任务进入本线程的窃取队列,
+   *          其他线程提交的任务进入全局注入队列
+   */
+  auto enqueue(FiberAndThread* ft) -> bool;
+
+  /**
+   * @brief 取下一个任务: inbox -> 本地队列 -> 全局队列 -> 窃取其他线程
+   */
+  auto nextTask(Worker* self) -> FiberAndThread*;
+
+  /**
+   * @brief 从全局队列取一批任务, 多出来的放进本地队列
+   */
+  auto takeGlobal(Worker* self) -> FiberAndThread*;
+
+  /**
+   * @brief 从 HIGH 或 LOW 的队列取一个任务
+   */
+  auto takeClass(Priority prio) -> FiberAndThread*;
+
+  /**
+   * @brief 先于 NORMAL 取的任务: 通常是 HIGH, 按轮次让 LOW 或 NORMAL 先走
+   */
+  auto takeUrgent(Worker* self) -> FiberAndThread*;
+
+  /**
+   * @brief 任务开始执行, 记录它所在优先级的等待时间
+   */
+  void onDequeue(FiberAndThread* ft);
+
+  /**
+   * @brief 协程还没从其他线程切出来, 放回它所在优先级的队列稍后再试
+   */
+  void requeue(FiberAndThread* ft);
+
+  /**
+   * @brief 从其他线程的本地队列窃取
+   */
+  auto stealOther(Worker* self) -> FiberAndThread*;
+
+  /**
+   * @brief 线程id对应的 worker 下标, 线程还没启动时返回 -1
+   */
+  auto findWorker(int thread) -> int;
+
+  /**
+   * @brief 投递到指定线程的 inbox, 它空闲时唤醒它
+   * @return 目标线程正在退出时返回 false, 任务没有投递
+   */
+  auto deliver(size_t worker, FiberAndThread* ft) -> bool;
+
+  /**
+   * @brief 是否有空闲线程需要被唤醒去处理剩余任务
+   */
+  auto needTickle(Worker* self) -> bool;
+
+  /**
+   * @brief 排队时间超过阈值时启动一个弹性线程
+   */
+  void maybeGrow(uint64_t wait_us);
+
+  /**
+   * @brief 弹性线程退出 run 前把剩余任务交回全局队列
+   */
+  void retireWorker(Worker* self);
+
+  /**
+   * @brief 启动第 worker 个调度线程, 持有 m_mutex_ 时调用
+   */
+  auto spawnWorker(size_t worker) -> Thread::ptr;
+
+  /**
+   * @brief 调度线程启动时按 setPlacement 的设置绑定 CPU 和内存节点
+   */
+  void applyPlacement(size_t worker);
+
+  /**
+   * @brief 取不到任务时在睡眠前自旋一段时间
+   * @return 自旋期间等到的任务, 落空或者不值得自旋时返回 nullptr
+   */
+  auto busyPoll(Worker* self) -> FiberAndThread*;
+
  private:
   struct FiberAndThread {
     /// 协程
@@ -80,6 +308,12 @@ class Scheduler {
     std::function<void()> cb_;
     /// 线程id
     threadId thread_;
+    /// Mailbox 链表指针
+    FiberAndThread* next_ = nullptr;
+    /// 优先级, 入队时 INHERIT 已经换成具体的值
+    Priority prio_ = INHERIT;
+    /// 入队时刻(微秒)
+    uint64_t enqueue_us_ = 0;
 
     FiberAndThread(Fiber::ptr f, int thr)
         : fiber_(std::move(f)), thread_(thr) {}
@@ -99,20 +333,100 @@ class Scheduler {
     }
   };
 
+  /**
+   * @brief 每个调度线程的任务队列
+   */
+  struct Worker {
+    /// 本线程产生的任务, 其他线程可以窃取
+    WorkStealingQueue<FiberAndThread*> local;
+    /// 指定在本线程执行的任务, 不能被窃取, 其他线程无锁投递
+    Mailbox<FiberAndThread> inbox;
+    /// 线程id, 线程启动后才有效
+    std::atomic<int> thread_id = {-1};
+    /// 是否在 idle 中
+    std::atomic<bool> idle = {false};
+    /// 取任务的次数, 只有本线程访问
+    size_t rounds = 0;
+    /// 调用 nextTask 的次数, 决定轮到哪个优先级, 只有本线程访问
+    size_t picks = 0;
+    /// 任务到达间隔的滑动平均(微秒), 决定忙等多久, 只有本线程访问
+    uint64_t gap_us = 0;
+    /// 开始没有任务的时刻, 0 表示有任务在跑
+    uint64_t idle_since = 0;
+    /// 绑定的 CPU 列表, 空表示没有绑定
+    std::string cpus;
+    /// 启动时所在的 CPU 和节点, -1 表示还没启动
+    int cpu = -1;
+    int node = -1;
+    /// 是否是弹性线程的槽位
+    bool elastic = false;
+    /// 弹性槽位上是否有线程在跑, m_mutex_ 保护启动
+    std::atomic<bool> running = {false};
+    /// 弹性槽位上最近一个线程, 再次启动前 join
+    Thread::ptr thread;
+    /// 线程退出时置位, 之后 deliver 不再往 inbox 投递
+    std::atomic<bool> closed = {false};
+    /// 正在往 inbox 投递的线程数, 退出的线程等它归零再清空 inbox
+    std::atomic<int> delivering = {0};
+    /// 进入 idle 的时刻(毫秒), 0 表示不在 idle, 只有本线程访问
+    uint64_t parked_ms = 0;
+  };
+
  private:
   MutexType m_mutex_;
   std::vector<Thread::ptr> m_threads_;
-  std::list<FiberAndThread> m_fibers_;
+  /// 全局注入队列, m_mutex_ 保护
+  std::deque<FiberAndThread*> m_global_;
+  std::atomic<size_t> m_global_size_ = {0};
+  /// 退出过的弹性线程id, 指定给它们的任务不再指定, m_mutex_ 保护
+  std::unordered_set<int> m_retired_threads_;
+  /// 调度线程, use_caller 时最后一个是 caller 线程
+  std::vector<std::unique_ptr<Worker> > m_workers_;
+  /// 还未执行的任务总数
+  std::atomic<size_t> m_task_count_ = {0};
   Fiber::ptr m_root_fiber_;
   std::string m_name_;
+  /**
+   * @brief 一个优先级的队列和统计
+   * @details NORMAL 不用 queue, 走本地队列和全局队列
+   */
+  struct PriorityClass {
+    MutexType mutex;
+    std::deque<FiberAndThread*> queue;
+    std::atomic<size_t> size = {0};
+    std::atomic<uint64_t> depth = {0};
+    std::atomic<uint64_t> run = {0};
+    std::atomic<uint64_t> waitUs = {0};
+    std::atomic<uint64_t> maxWaitUs = {0};
+  };
+  PriorityClass m_classes_[kPriorities];
+  /// setPlacement 的参数
+  std::vector<int> m_cpus_;
+  int m_node_ = -1;
+  /// 是否有弹性槽位
+  bool m_elastic_ = false;
+  std::atomic<uint64_t> m_grow_wait_us_ = {0};
+  std::atomic<uint64_t> m_cooldown_ms_ = {0};
+  std::atomic<uint64_t> m_last_grow_us_ = {0};
+  std::atomic<uint64_t> m_elastic_threads_ = {0};
+  std::atomic<uint64_t> m_elastic_peak_ = {0};
+  std::atomic<uint64_t> m_grows_ = {0};
+  std::atomic<uint64_t> m_retires_ = {0};
+  std::atomic<uint64_t> m_busy_poll_us_ = {0};
+  std::atomic<uint64_t> m_busy_hits_ = {0};
+  std::atomic<uint64_t> m_busy_misses_ = {0};
+  std::atomic<uint64_t> m_busy_spin_us_ = {0};
 
  protected:
   std::vector<int> m_thread_ids_;
   size_t m_thread_count_ = 0;
   std::atomic<size_t> m_active_thread_count_ = {0};
   std::atomic<size_t> m_idle_thread_count_ = {0};
+  /// holdExternal 登记的协程数
+  std::atomic<size_t> m_external_count_ = {0};
   bool m_stopping_ = true;
   bool m_auto_stop_ = false;
+  bool m_shared_stack_ = false;
   int m_root_thread_ = 0;
 };
 
@@ -14,5 +14,21 @@ class Singleton {
  private:
   Singleton();
 };
+
+/**
+ * @brief 返回裸指针的单例
+ * @details 给每次系统调用都要取一次的 FdMgr 用, 没有引用计数的开销
+ */
+template <class T, class X = void, int N = 0>
+class SingletonRef {
+ public:
+  static auto GetInstance() -> T* {
+    static T v;
+    return &v;
+  }
+
+ private:
+  SingletonRef();
+};
 }  // namespace hx_sylar
 #endif
\ No newline at end of file
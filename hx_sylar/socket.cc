@@ -2,6 +2,7 @@
 
 #include <asm-generic/socket.h>
 #include <limits.h>
+#include <netinet/udp.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
@@ -116,6 +117,30 @@ auto Socket::init(int sock) -> bool {
   return false;
 }
 
+auto Socket::CreateTCPSocket() -> Socket::ptr {
+  Socket::ptr sock(new Socket(IPv4, TCP, 0));
+  return sock;
+}
+
+auto Socket::CreateUDPSocket() -> Socket::ptr {
+  Socket::ptr sock(new Socket(IPv4, UDP, 0));
+  sock->newSock();
+  sock->m_isConnected = true;
+  return sock;
+}
+
+auto Socket::CreateTCPSocket6() -> Socket::ptr {
+  Socket::ptr sock(new Socket(IPv6, TCP, 0));
+  return sock;
+}
+
+auto Socket::CreateUDPSocket6() -> Socket::ptr {
+  Socket::ptr sock(new Socket(IPv6, UDP, 0));
+  sock->newSock();
+  sock->m_isConnected = true;
+  return sock;
+}
+
 auto Socket::CreateUnixTCPSocket() -> Socket::ptr {
   Socket::ptr sock(new Socket(UNIX, TCP, 0));
   return sock;
@@ -185,9 +210,12 @@ auto Socket::connect(const Address::ptr addr, uint64_t timeout_ms) -> bool {
       HX_LOG_ERROR(g_logger)
           << "sock = " << m_sock << " connect ()" << addr->toString()
           << ") timeout = " << timeout_ms;
+      return false;
     }
   }
-
+  m_isConnected = true;
+  getRemoteAddress();
+  getLocalAddress();
   return true;
 }
 auto Socket::listen(int backlog) -> bool {
@@ -291,6 +319,44 @@ auto Socket::recvFrom(iovec* buffers, size_t length, Address::ptr from,
   }
   return -1;
 }
+auto Socket::recvBatch(DatagramBatch& batch, int flags) -> int {
+  if (!m_isConnected) {
+    return -1;
+  }
+  // 阻塞的 fd 上不带 MSG_WAITFORONE 会一直等到收满一批
+  int n = ::recvmmsg(m_sock, batch.prepareRecv(), batch.capacity(),
+                     flags | MSG_WAITFORONE, nullptr);
+  batch.finishRecv(n);
+  return n;
+}
+
+auto Socket::sendBatch(DatagramBatch& batch, int flags) -> int {
+  if (!m_isConnected) {
+    return -1;
+  }
+  mmsghdr* msgs = batch.prepareSend();
+  size_t sent = 0;
+  while (sent < batch.size()) {
+    int n = ::sendmmsg(m_sock, msgs + sent, batch.size() - sent, flags);
+    if (n <= 0) {
+      HX_LOG_DEBUG(g_logger) << "sendmmsg sock=" << m_sock << " errno=" << errno
+                             << " errstr=" << strerror(errno);
+      break;
+    }
+    sent += n;
+  }
+  return sent > 0 ? static_cast<int>(sent) : -1;
+}
+
+auto Socket::setUdpGro(bool on) -> bool {
+#ifdef UDP_GRO
+  int v = on ? 1 : 0;
+  return setOption(SOL_UDP, UDP_GRO, v);
+#else
+  return false;
+#endif
+}
+
 auto Socket::getRemoteAddress() -> Address::ptr {
   if (m_remoteAddress) {
     return m_remoteAddress;
@@ -359,6 +425,7 @@ auto Socket::getLocalAddress() -> Address::ptr {
 }
 
 auto Socket::isValid() const -> bool { return m_sock != -1; }
+auto Socket::getSocket() const -> int { return m_sock; }
 auto Socket::getError() -> int {
   int error = 0;
   size_t len = sizeof error;
@@ -388,7 +455,6 @@ auto Socket::toString() const -> std::string {
   dump(ss);
   return ss.str();
 }
-// auto Socket::getSocket() const -> int {}
 auto Socket::cancelRead() -> bool {
   return IOManager::GetThis()->cancelEvent(m_sock, IOManager::READ);
 }
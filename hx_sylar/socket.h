@@ -10,6 +10,7 @@
 #include <memory>
 
 #include "address.h"
+#include "datagram.h"
 #include "noncopyable.h"
 
 namespace hx_sylar {
@@ -112,6 +113,26 @@ class Socket : public std::enable_shared_from_this<Socket>, public Noncopyable {
   virtual auto recvFrom(iovec* buffers, size_t length, Address::ptr form,
                         int flags = 0) -> int;
 
+  /**
+   * @brief 一次 recvmmsg 接收多个数据报
+   * @details 至少收到一个才返回, 之后有多少收多少, 不等凑满一批;
+   *          结果留在 batch 里, 之前的内容被清掉
+   * @return 收到的数据报个数, 出错返回 -1
+   */
+  virtual auto recvBatch(DatagramBatch& batch, int flags = 0) -> int;
+  /**
+   * @brief 用 sendmmsg 发送 batch 里的全部数据报
+   * @details 发送缓冲区满时挂起协程等待, 直到全部发出或者出错
+   * @return 发出的数据报个数, 一个都没发出去时返回 -1
+   */
+  virtual auto sendBatch(DatagramBatch& batch, int flags = 0) -> int;
+  /**
+   * @brief 打开或关闭 UDP GRO
+   * @details 打开后内核把同一来源连续的数据报合并成一个交给 recvBatch,
+   *          用 DatagramBatch::segmentSize 拆分. 内核不支持时返回 false
+   */
+  auto setUdpGro(bool on) -> bool;
+
   auto getRemoteAddress() -> Address::ptr;
   auto getLocalAddress() -> Address::ptr;
 
@@ -0,0 +1,179 @@
+#include "stack_pool.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "config.h"
+#include "log.h"
+
+namespace hx_sylar {
+
+static Logger::ptr g_logger = HX_LOG_NAME("system");
+
+static ConfigVar<std::vector<uint32_t> >::ptr g_stack_size_classes =
+    Config::Lookup<std::vector<uint32_t> >(
+        "fiber.stack_pool.size_classes",
+        {64 * 1024, 128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024},
+        "fiber stack size classes");
+static ConfigVar<uint32_t>::ptr g_stack_max_cached = Config::Lookup<uint32_t>(
+    "fiber.stack_pool.max_cached", 256,
+    "max cached stacks per size class per thread");
+static ConfigVar<uint32_t>::ptr g_stack_trim_watermark =
+    Config::Lookup<uint32_t>("fiber.stack_pool.trim_watermark", 32,
+                             "cached stacks above this are MADV_DONTNEED");
+
+static std::atomic<uint32_t> s_max_cached(256);
+static std::atomic<uint32_t> s_trim_watermark(32);
+
+struct _StackPoolIniter {
+  _StackPoolIniter() {
+    s_max_cached = g_stack_max_cached->getValue();
+    s_trim_watermark = g_stack_trim_watermark->getValue();
+    g_stack_max_cached->addListener(
+        [](const uint32_t& old_value, const uint32_t& new_value) {
+          HX_LOG_INFO(g_logger) << "fiber.stack_pool.max_cached changed from "
+                                << old_value << " to " << new_value;
+          s_max_cached = new_value;
+        });
+    g_stack_trim_watermark->addListener(
+        [](const uint32_t& old_value, const uint32_t& new_value) {
+          HX_LOG_INFO(g_logger)
+              << "fiber.stack_pool.trim_watermark changed from " << old_value
+              << " to " << new_value;
+          s_trim_watermark = new_value;
+        });
+  }
+};
+
+static _StackPoolIniter s_stack_pool_initer;
+
+static auto PageSize() -> size_t {
+  static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+  return s_page_size;
+}
+
+static auto PageAlign(size_t size) -> size_t {
+  size_t page = PageSize();
+  return (size + page - 1) / page * page;
+}
+
+static void UnmapStack(void* vp, size_t size) {
+  char* base = static_cast<char*>(vp) - PageSize();
+  if (munmap(base, size + PageSize()) != 0) {
+    HX_LOG_ERROR(g_logger) << "munmap stack " << vp << " size=" << size
+                           << " errno=" << errno << " " << strerror(errno);
+  }
+}
+
+/**
+ * @brief 线程私有的空闲栈缓存
+ * @details 尺寸等级在线程第一次分配时读取, 修改配置只影响之后启动的线程
+ */
+struct ThreadStackCache {
+  ThreadStackCache() {
+    std::vector<uint32_t> classes = g_stack_size_classes->getValue();
+    for (auto& i : classes) {
+      sizes.push_back(PageAlign(i));
+    }
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    free_lists.resize(sizes.size());
+  }
+
+  ~ThreadStackCache() {
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      for (auto& vp : free_lists[i]) {
+        UnmapStack(vp, sizes[i]);
+      }
+    }
+  }
+
+  /// 大小恰好等于某个等级时返回下标, 否则返回 -1
+  auto classOf(size_t size) const -> int {
+    auto it = std::lower_bound(sizes.begin(), sizes.end(), size);
+    if (it == sizes.end() || *it != size) {
+      return -1;
+    }
+    return static_cast<int>(it - sizes.begin());
+  }
+
+  std::vector<size_t> sizes;
+  std::vector<std::vector<void*> > free_lists;
+};
+
+static auto GetCache() -> ThreadStackCache& {
+  static thread_local ThreadStackCache t_cache;
+  return t_cache;
+}
+
+auto StackPool::RoundSize(size_t size) -> size_t {
+  ThreadStackCache& cache = GetCache();
+  auto it = std::lower_bound(cache.sizes.begin(), cache.sizes.end(), size);
+  if (it != cache.sizes.end()) {
+    return *it;
+  }
+  return PageAlign(size);
+}
+
+auto StackPool::Alloc(size_t size) -> void* {
+  ThreadStackCache& cache = GetCache();
+  int idx = cache.classOf(size);
+  if (idx >= 0 && !cache.free_lists[idx].empty()) {
+    void* vp = cache.free_lists[idx].back();
+    cache.free_lists[idx].pop_back();
+    return vp;
+  }
+
+  size_t total = size + PageSize();
+  void* base = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (base == MAP_FAILED) {
+    HX_LOG_ERROR(g_logger) << "mmap stack size=" << size << " errno=" << errno
+                           << " " << strerror(errno);
+    throw std::bad_alloc();
+  }
+  if (mprotect(base, PageSize(), PROT_NONE) != 0) {
+    HX_LOG_ERROR(g_logger) << "mprotect guard page errno=" << errno << " "
+                           << strerror(errno);
+  }
+  return static_cast<char*>(base) + PageSize();
+}
+
+void StackPool::Dealloc(void* vp, size_t size) {
+  if (vp == nullptr) {
+    return;
+  }
+  ThreadStackCache& cache = GetCache();
+  int idx = cache.classOf(size);
+  if (idx < 0) {
+    UnmapStack(vp, size);
+    return;
+  }
+
+  std::vector<void*>& list = cache.free_lists[idx];
+  if (list.size() >= s_max_cached) {
+    UnmapStack(vp, size);
+    return;
+  }
+  if (list.size() >= s_trim_watermark) {
+    madvise(vp, size, MADV_DONTNEED);
+  }
+  list.push_back(vp);
+}
+
+auto StackPool::CachedCount() -> size_t {
+  ThreadStackCache& cache = GetCache();
+  size_t count = 0;
+  for (auto& i : cache.free_lists) {
+    count += i.size();
+  }
+  return count;
+}
+
+}  // namespace hx_sylar
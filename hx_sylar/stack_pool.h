@@ -0,0 +1,51 @@
+/**
+ * @file stack_pool.h
+ * @brief 基于 mmap 的协程栈池
+ */
+#ifndef __HX_STACK_POOL_H__
+#define __HX_STACK_POOL_H__
+
+#include <stddef.h>
+
+namespace hx_sylar {
+
+/**
+ * @brief 协程栈池
+ * @details 每个栈由 mmap 分配, 最低处有一页 PROT_NONE 保护页,
+ *          栈溢出直接触发 SIGSEGV 而不是悄悄踩坏堆.
+ *          栈按 fiber.stack_pool.size_classes 分级, 每个线程各自缓存空闲栈,
+ *          缓存数超过 fiber.stack_pool.trim_watermark 后归还的栈会被
+ *          MADV_DONTNEED, 超过 fiber.stack_pool.max_cached 则直接 munmap.
+ */
+class StackPool {
+ public:
+  /**
+   * @brief 实际分配的栈大小
+   * @details 向上取整到最小的尺寸等级, 大于所有等级时按页对齐且不进入缓存
+   */
+  static auto RoundSize(size_t size) -> size_t;
+
+  /**
+   * @brief 分配栈
+   * @param[in] size 栈大小, 应为 RoundSize 的返回值
+   * @return 可用区域的起始地址(保护页之上)
+   * @exception mmap 失败时抛出 std::bad_alloc
+   */
+  static auto Alloc(size_t size) -> void*;
+
+  /**
+   * @brief 归还栈, 可以在与 Alloc 不同的线程调用
+   * @param[in] vp Alloc 返回的地址
+   * @param[in] size Alloc 时的大小
+   */
+  static void Dealloc(void* vp, size_t size);
+
+  /**
+   * @brief 当前线程缓存的空闲栈数量
+   */
+  static auto CachedCount() -> size_t;
+};
+
+}  // namespace hx_sylar
+
+#endif
@@ -1,43 +1,69 @@
 #include "timer.h"
 
-#include "util.h"
+#include <algorithm>
+
+#include "clock.h"
+#include "config.h"
 
 namespace hx_sylar {
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs,
-                                   const Timer::ptr& rhs) const {
-  if (!lhs && !rhs) {
-    return false;
-  }
-  if (!lhs) {
-    return true;
-  }
-  if (!rhs) {
-    return false;
-  }
-  if (lhs->m_next < rhs->m_next) {
-    return true;
-  }
-  if (rhs->m_next < lhs->m_next) {
-    return false;
+static ConfigVar<uint64_t>::ptr g_timer_slack = Config::Lookup<uint64_t>(
+    "timer.slack_us", 0, "default timer slack in microseconds");
+
+/// 毫秒换成微秒, 溢出时取最大值, 相当于永不到期
+static auto MsToUs(uint64_t ms) -> uint64_t {
+  return ms > ~0ull / 1000 ? ~0ull : ms * 1000;
+}
+
+static auto Deadline(uint64_t start, uint64_t us) -> uint64_t {
+  return us > ~0ull - start ? ~0ull : start + us;
+}
+
+static auto SlackUs(uint64_t slack_us) -> uint64_t {
+  return slack_us == TimerManager::kDefaultSlack ? g_timer_slack->getValue()
+                                                 : slack_us;
+}
+
+/**
+ * 到期时间向上对齐到不超过 slack 的最大 2 的幂, 最多晚 slack 微秒.
+ * 相近的到期时间因此落在同一个刻度, 一次处理就能全部取出
+ */
+static auto Coalesce(uint64_t deadline, uint64_t slack) -> uint64_t {
+  if (slack < 2 || deadline == ~0ull) {
+    return deadline;
   }
-  return lhs.get() < rhs.get();
+  uint64_t grain = 1ULL << (63 - __builtin_clzll(slack));
+  uint64_t aligned = (deadline + grain - 1) & ~(grain - 1);
+  return aligned < deadline ? deadline : aligned;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
-             TimerManager* manager)
-    : m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) {
-  m_next = hx_sylar::GetCurrentMS() + m_ms;
+Timer::Timer(uint64_t us, std::function<void()> cb, bool recurring,
+             bool precise, uint64_t slack, TimerManager* manager)
+    : m_recurring(recurring),
+      m_precise(precise),
+      m_us(us),
+      m_slack(slack),
+      m_cb(cb),
+      m_manager(manager) {
+  m_next = Deadline(now(), m_us);
 }
 
-Timer::Timer(uint64_t next) : m_next(next) {}
+auto Timer::now() const -> uint64_t {
+  // 缓存可能落后一轮调度, 对毫秒定时器无所谓, 微秒定时器要现读
+  return m_precise ? Clock::NowUS() : Clock::CachedUS();
+}
 
 bool Timer::cancel() {
+  // 在锁外释放时间轮持有的引用
+  Timer::ptr self;
+  if (m_manager == nullptr) {
+    return false;
+  }
   TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
   if (m_cb) {
     m_cb = nullptr;
-    auto it = m_manager->m_timers.find(shared_from_this());
-    m_manager->m_timers.erase(it);
+    m_manager->unlink(this);
+    self.swap(m_self);
     return true;
   }
   return false;
@@ -48,49 +74,72 @@ bool Timer::refresh() {
   if (!m_cb) {
     return false;
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
+  if (m_slot < 0) {
     return false;
   }
-  m_manager->m_timers.erase(it);
-  m_next = hx_sylar::GetCurrentMS() + m_ms;
-  m_manager->m_timers.insert(shared_from_this());
+  m_manager->unlink(this);
+  m_next = Deadline(now(), m_us);
+  m_manager->link(this, m_manager->m_current + 1);
   return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now) {
-  if (ms == m_ms && !from_now) {
+  return resetUs(MsToUs(ms), from_now);
+}
+
+bool Timer::resetUs(uint64_t us, bool from_now) {
+  if (us == m_us && !from_now) {
     return true;
   }
   TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
   if (!m_cb) {
     return false;
   }
-  auto it = m_manager->m_timers.find(shared_from_this());
-  if (it == m_manager->m_timers.end()) {
+  if (m_slot < 0) {
     return false;
   }
-  m_manager->m_timers.erase(it);
+  m_manager->unlink(this);
   uint64_t start = 0;
   if (from_now) {
-    start = hx_sylar::GetCurrentMS();
+    start = now();
   } else {
-    start = m_next - m_ms;
+    start = m_next - m_us;
   }
-  m_ms = ms;
+  m_us = us;
 
-  m_next = start + m_ms;
+  m_next = Deadline(start, m_us);
   m_manager->addTimer(shared_from_this(), lock);
   return true;
 }
 
-TimerManager::TimerManager() { m_previouseTime = hx_sylar::GetCurrentMS(); }
+TimerManager::TimerManager() { m_current = Clock::NowUS(); }
 
-TimerManager::~TimerManager() {}
+TimerManager::~TimerManager() {
+  // 解开定时器对自己的引用, 否则还挂着的定时器永远不会释放
+  for (int i = 0; i <= kOverflowSlot; ++i) {
+    Timer* timer = takeSlot(i);
+    while (timer != nullptr) {
+      Timer* succ = timer->m_succ;
+      timer->m_self.reset();
+      timer = succ;
+    }
+  }
+}
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,
-                                  bool recurring) {
-  Timer::ptr timer(new Timer(ms, cb, recurring, this));
+                                  bool recurring, uint64_t slack_ms) {
+  uint64_t slack_us = slack_ms == kDefaultSlack ? slack_ms : MsToUs(slack_ms);
+  Timer::ptr timer(new Timer(MsToUs(ms), std::move(cb), recurring, false,
+                             SlackUs(slack_us), this));
+  RWMutexType::WriteLock lock(m_mutex);
+  addTimer(timer, lock);
+  return timer;
+}
+
+Timer::ptr TimerManager::addTimerUs(uint64_t us, std::function<void()> cb,
+                                    bool recurring, uint64_t slack_us) {
+  Timer::ptr timer(
+      new Timer(us, std::move(cb), recurring, true, SlackUs(slack_us), this));
   RWMutexType::WriteLock lock(m_mutex);
   addTimer(timer, lock);
   return timer;
@@ -106,70 +155,114 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
 Timer::ptr TimerManager::addConditionTimer(uint64_t ms,
                                            std::function<void()> cb,
                                            std::weak_ptr<void> weak_cond,
-                                           bool recurring) {
-  return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+                                           bool recurring, uint64_t slack_ms) {
+  return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, slack_ms);
+}
+
+Timer::ptr TimerManager::addConditionTimerUs(uint64_t us,
+                                             std::function<void()> cb,
+                                             std::weak_ptr<void> weak_cond,
+                                             bool recurring,
+                                             uint64_t slack_us) {
+  return addTimerUs(us, std::bind(&OnTimer, weak_cond, cb), recurring,
+                    slack_us);
 }
 
 uint64_t TimerManager::getNextTimer() {
+  uint64_t us = getNextTimerUs();
+  if (us == ~0ull) {
+    return ~0ull;
+  }
+  // 向上取整, 按毫秒等待时不会提前醒来空转
+  return (us + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUs() {
   RWMutexType::ReadLock lock(m_mutex);
   m_tickled = false;
-  if (m_timers.empty()) {
+  if (m_count == 0) {
     return ~0ull;
   }
 
-  const Timer::ptr& next = *m_timers.begin();
-  uint64_t now_ms = hx_sylar::GetCurrentMS();
-  if (now_ms >= next->m_next) {
+  // 高层槽给出的是下界, 到点后降级再算一次
+  uint64_t next = nextTick();
+  uint64_t now_us = Clock::NowUS();
+  if (now_us >= next) {
     return 0;
   } else {
-    return next->m_next - now_ms;
+    return next - now_us;
+  }
+}
+
+void TimerManager::armTimer(Timer* timer, uint64_t ms,
+                            std::function<void()> cb, uint64_t slack_ms) {
+  uint64_t slack_us = slack_ms == kDefaultSlack ? slack_ms : MsToUs(slack_ms);
+  RWMutexType::WriteLock lock(m_mutex);
+  if (timer->m_slot >= 0) {
+    unlink(timer);
   }
+  timer->m_manager = this;
+  timer->m_recurring = false;
+  timer->m_precise = false;
+  timer->m_cb = std::move(cb);
+  timer->m_us = MsToUs(ms);
+  timer->m_next = Deadline(timer->now(), timer->m_us);
+  timer->m_slack = SlackUs(slack_us);
+  insert(timer, lock);
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-  uint64_t now_ms = hx_sylar::GetCurrentMS();
-  std::vector<Timer::ptr> expired;
+  uint64_t now_us = Clock::NowUS();
+  std::vector<Timer*> expired;
+  // 时间轮对到期定时器的引用, 在锁外释放
+  std::vector<Timer::ptr> released;
   {
     RWMutexType::ReadLock lock(m_mutex);
-    if (m_timers.empty()) {
+    if (m_count == 0) {
       return;
     }
   }
   RWMutexType::WriteLock lock(m_mutex);
-  if (m_timers.empty()) {
-    return;
-  }
-  bool rollover = detectClockRollover(now_ms);
-  if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+  if (m_count == 0) {
     return;
   }
+  advance(now_us, expired);
+  cbs.reserve(cbs.size() + expired.size());
 
-  Timer::ptr now_timer(new Timer(now_ms));
-  auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-  while (it != m_timers.end() && (*it)->m_next == now_ms) {
-    ++it;
-  }
-  expired.insert(expired.begin(), m_timers.begin(), it);
-  m_timers.erase(m_timers.begin(), it);
-  cbs.reserve(expired.size());
-
-  for (auto& timer : expired) {
-    cbs.push_back(timer->m_cb);
+  for (Timer* timer : expired) {
     if (timer->m_recurring) {
-      timer->m_next = now_ms + timer->m_ms;
-      m_timers.insert(timer);
+      cbs.push_back(timer->m_cb);
+      timer->m_next = Deadline(now_us, timer->m_us);
+      link(timer, m_current + 1);
     } else {
+      cbs.push_back(std::move(timer->m_cb));
       timer->m_cb = nullptr;
+      if (timer->m_self) {
+        released.push_back(std::move(timer->m_self));
+      }
     }
   }
+  ++m_passes;
+  m_expired += expired.size();
+  m_expireUs += Clock::NowUS() - now_us;
 }
 
 void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-  auto it = m_timers.insert(val).first;
-  bool at_front = (it == m_timers.begin()) && !m_tickled;
+  val->m_self = val;
+  insert(val.get(), lock);
+}
+
+void TimerManager::insert(Timer* val, RWMutexType::WriteLock& lock) {
+  if (m_count == 0) {
+    // 空闲期间没有推进时间轮, 直接跳到定时器的起点
+    m_current = std::max(m_current, val->m_next - val->m_us);
+  }
+  bool at_front =
+      Coalesce(val->m_next, val->m_slack) < nextTick() && !m_tickled;
   if (at_front) {
     m_tickled = true;
   }
+  link(val, m_current + 1);
   lock.unlock();
 
   if (at_front) {
@@ -177,18 +270,145 @@ void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
   }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-  bool rollover = false;
-  if (now_ms < m_previouseTime && now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-    rollover = true;
+bool TimerManager::hasTimer() {
+  RWMutexType::ReadLock lock(m_mutex);
+  return m_count != 0;
+}
+
+auto TimerManager::getStats() const -> Stats {
+  Stats stats;
+  stats.passes = m_passes;
+  stats.expired = m_expired;
+  stats.expireUs = m_expireUs;
+  return stats;
+}
+
+/// words 中从 from 位开始第一个置位的下标, 没有返回 -1
+static auto FindBit(const uint64_t* words, int nwords, int from) -> int {
+  for (int w = from / 64; w < nwords; ++w) {
+    uint64_t bits = words[w];
+    if (w == from / 64) {
+      bits &= ~0ULL << (from % 64);
+    }
+    if (bits != 0U) {
+      return w * 64 + __builtin_ctzll(bits);
+    }
   }
-  m_previouseTime = now_ms;
-  return rollover;
+  return -1;
 }
 
-bool TimerManager::hasTimer() {
-  RWMutexType::ReadLock lock(m_mutex);
-  return !m_timers.empty();
+void TimerManager::link(Timer* timer, uint64_t min_tick) {
+  uint64_t tick = std::max(Coalesce(timer->m_next, timer->m_slack), min_tick);
+  int slot = kOverflowSlot;
+  for (int level = 0; level < kLevels; ++level) {
+    int shift = (level + 1) * kSlotBits;
+    if ((tick >> shift) == (m_current >> shift)) {
+      int idx = static_cast<int>((tick >> (level * kSlotBits)) & (kSlots - 1));
+      m_bitmap[level][idx / 64] |= 1ULL << (idx % 64);
+      slot = level * kSlots + idx;
+      break;
+    }
+  }
+  timer->m_slot = slot;
+  timer->m_prev = nullptr;
+  timer->m_succ = m_slots[slot];
+  if (timer->m_succ != nullptr) {
+    timer->m_succ->m_prev = timer;
+  }
+  m_slots[slot] = timer;
+  ++m_count;
+}
+
+void TimerManager::unlink(Timer* timer) {
+  int slot = timer->m_slot;
+  if (timer->m_prev != nullptr) {
+    timer->m_prev->m_succ = timer->m_succ;
+  } else {
+    m_slots[slot] = timer->m_succ;
+  }
+  if (timer->m_succ != nullptr) {
+    timer->m_succ->m_prev = timer->m_prev;
+  }
+  if (m_slots[slot] == nullptr && slot < kOverflowSlot) {
+    int idx = slot % kSlots;
+    m_bitmap[slot / kSlots][idx / 64] &= ~(1ULL << (idx % 64));
+  }
+  timer->m_slot = -1;
+  timer->m_prev = timer->m_succ = nullptr;
+  --m_count;
+}
+
+auto TimerManager::takeSlot(int slot) -> Timer* {
+  Timer* head = m_slots[slot];
+  if (head == nullptr) {
+    return nullptr;
+  }
+  m_slots[slot] = nullptr;
+  if (slot < kOverflowSlot) {
+    int idx = slot % kSlots;
+    m_bitmap[slot / kSlots][idx / 64] &= ~(1ULL << (idx % 64));
+  }
+  for (Timer* t = head; t != nullptr; t = t->m_succ) {
+    t->m_slot = -1;
+    --m_count;
+  }
+  return head;
+}
+
+auto TimerManager::nextTick() const -> uint64_t {
+  if (m_count == 0) {
+    return ~0ull;
+  }
+  // 当前槽之后的槽都在本层窗口内, 本层没有就看上一层
+  for (int level = 0; level < kLevels; ++level) {
+    int shift = level * kSlotBits;
+    int idx = static_cast<int>((m_current >> shift) & (kSlots - 1));
+    int found = FindBit(m_bitmap[level], kSlots / 64, idx + 1);
+    if (found >= 0) {
+      uint64_t base = (m_current >> (shift + kSlotBits)) << (shift + kSlotBits);
+      return base | (static_cast<uint64_t>(found) << shift);
+    }
+  }
+  if (m_slots[kOverflowSlot] != nullptr) {
+    return ((m_current >> (kLevels * kSlotBits)) + 1) << (kLevels * kSlotBits);
+  }
+  return ~0ull;
+}
+
+void TimerManager::advance(uint64_t now_us, std::vector<Timer*>& expired) {
+  // 只停在有定时器的槽上, 空闲很久也不用逐毫秒走
+  while (m_count != 0) {
+    uint64_t tick = nextTick();
+    if (tick > now_us) {
+      break;
+    }
+    m_current = tick;
+    // 先从高层往低层降级, 降到本刻度的定时器接着在第 0 层到期
+    for (int level = kLevels; level >= 1; --level) {
+      int shift = level * kSlotBits;
+      if ((tick & ((1ULL << shift) - 1)) != 0) {
+        continue;
+      }
+      int slot = level == kLevels
+                     ? kOverflowSlot
+                     : level * kSlots +
+                           static_cast<int>((tick >> shift) & (kSlots - 1));
+      Timer* t = takeSlot(slot);
+      while (t != nullptr) {
+        Timer* succ = t->m_succ;
+        link(t, m_current);
+        t = succ;
+      }
+    }
+    Timer* t = takeSlot(static_cast<int>(tick & (kSlots - 1)));
+    while (t != nullptr) {
+      Timer* succ = t->m_succ;
+      t->m_prev = t->m_succ = nullptr;
+      expired.push_back(t);
+      t = succ;
+    }
+  }
+  m_current = std::max(m_current, now_us);
 }
 
 }  // namespace hx_sylar
@@ -10,8 +10,11 @@
 #ifndef __hx_sylar_TIMER_H__
 #define __hx_sylar_TIMER_H__
 
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
 #include <memory>
-#include <set>
 #include <vector>
 
 #include "thread.h"
@@ -29,6 +32,12 @@ class Timer : public std::enable_shared_from_this<Timer> {
   /// 定时器的智能指针类型
   using ptr = std::shared_ptr<Timer>;
 
+  /**
+   * @brief 内嵌在其他对象里反复使用的定时器, 由 TimerManager::armTimer 挂上
+   * @details 不经过 shared_ptr, 所有者要保证它挂在时间轮上时不被析构
+   */
+  Timer() = default;
+
   /**
    * @brief 取消定时器
    */
@@ -46,46 +55,51 @@ class Timer : public std::enable_shared_from_this<Timer> {
    */
   bool reset(uint64_t ms, bool from_now);
 
+  /**
+   * @brief 重置定时器时间, 微秒精度
+   * @param[in] us 定时器执行间隔时间(微秒)
+   * @param[in] from_now 是否从当前时间开始计算
+   */
+  bool resetUs(uint64_t us, bool from_now);
+
  private:
   /**
    * @brief 构造函数
-   * @param[in] ms 定时器执行间隔时间
+   * @param[in] us 定时器执行间隔时间(微秒)
    * @param[in] cb 回调函数
    * @param[in] recurring 是否循环
+   * @param[in] precise 是否微秒定时器, 起点现读时钟而不用线程缓存
+   * @param[in] slack 允许晚到的微秒数
    * @param[in] manager 定时器管理器
    */
-  Timer(uint64_t ms, std::function<void()> cb, bool recurring,
-        TimerManager* manager);
-  /**
-   * @brief 构造函数
-   * @param[in] next 执行的时间戳(毫秒)
-   */
-  explicit Timer(uint64_t next);
+  Timer(uint64_t us, std::function<void()> cb, bool recurring, bool precise,
+        uint64_t slack, TimerManager* manager);
+
+  /// 计算到期时间的起点(微秒)
+  auto now() const -> uint64_t;
 
  private:
   /// 是否循环定时器
   bool m_recurring = false;
-  /// 执行周期
-  uint64_t m_ms = 0;
-  /// 精确的执行时间
+  /// 是否由 addTimerUs 创建
+  bool m_precise = false;
+  /// 执行周期(微秒)
+  uint64_t m_us = 0;
+  /// 精确的执行时间, Clock 的单调微秒
   uint64_t m_next = 0;
+  /// 允许晚到的微秒数, 挂到时间轮时到期刻度向上对齐到不超过它的 2 的幂
+  uint64_t m_slack = 0;
   /// 回调函数
   std::function<void()> m_cb;
   /// 定时器管理器
   TimerManager* m_manager = nullptr;
-
- private:
-  /**
-   * @brief 定时器比较仿函数
-   */
-  struct Comparator {
-    /**
-     * @brief 比较定时器的智能指针的大小(按执行时间排序)
-     * @param[in] lhs 定时器智能指针
-     * @param[in] rhs 定时器智能指针
-     */
-    bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-  };
+  /// 时间轮槽内的双向链表指针, 增删都是 O(1)
+  Timer* m_prev = nullptr;
+  Timer* m_succ = nullptr;
+  /// 所在的槽, -1 表示不在时间轮上
+  int m_slot = -1;
+  /// 挂在时间轮上时持有自己, 摘下时释放; 内嵌的定时器为空
+  Timer::ptr m_self;
 };
 
 /**
@@ -98,6 +112,21 @@ class TimerManager {
   /// 读写锁类型
   using RWMutexType = hx_sylar::RWMutex;
 
+  /// slack 取配置 timer.slack_us 的默认值
+  static const uint64_t kDefaultSlack = ~0ull;
+
+  /**
+   * @brief 到期处理的统计
+   */
+  struct Stats {
+    /// 实际推进时间轮的次数
+    uint64_t passes = 0;
+    /// 到期的定时器数
+    uint64_t expired = 0;
+    /// 推进时间轮、收集回调的累计耗时(微秒)
+    uint64_t expireUs = 0;
+  };
+
   /**
    * @brief 构造函数
    */
@@ -113,8 +142,23 @@ class TimerManager {
    * @param[in] ms 定时器执行间隔时间
    * @param[in] cb 定时器回调函数
    * @param[in] recurring 是否循环定时器
+   * @param[in] slack_ms 允许晚到的毫秒数, 到期时间相近的定时器会合并到同一次
+   *            处理, 减少唤醒
    */
-  auto addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false)
+  auto addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false,
+                uint64_t slack_ms = kDefaultSlack) -> Timer::ptr;
+
+  /**
+   * @brief 添加微秒精度的定时器
+   * @details 只有 iomanager.timer_precision 为 us 时 IOManager 才按微秒唤醒,
+   *          否则到期时间会向上取整到毫秒
+   * @param[in] us 定时器执行间隔时间(微秒)
+   * @param[in] cb 定时器回调函数
+   * @param[in] recurring 是否循环定时器
+   * @param[in] slack_us 允许晚到的微秒数
+   */
+  auto addTimerUs(uint64_t us, std::function<void()> cb,
+                  bool recurring = false, uint64_t slack_us = kDefaultSlack)
       -> Timer::ptr;
 
   /**
@@ -123,16 +167,48 @@ class TimerManager {
    * @param[in] cb 定时器回调函数
    * @param[in] weak_cond 条件
    * @param[in] recurring 是否循环
+   * @param[in] slack_ms 允许晚到的毫秒数
    */
   auto addConditionTimer(uint64_t ms, std::function<void()> cb,
-                         std::weak_ptr<void> weak_cond, bool recurring = false)
-      -> Timer::ptr;
+                         std::weak_ptr<void> weak_cond, bool recurring = false,
+                         uint64_t slack_ms = kDefaultSlack) -> Timer::ptr;
+
+  /**
+   * @brief 添加微秒精度的条件定时器
+   * @param[in] us 定时器执行间隔时间(微秒)
+   * @param[in] cb 定时器回调函数
+   * @param[in] weak_cond 条件
+   * @param[in] recurring 是否循环
+   * @param[in] slack_us 允许晚到的微秒数
+   */
+  auto addConditionTimerUs(uint64_t us, std::function<void()> cb,
+                           std::weak_ptr<void> weak_cond,
+                           bool recurring = false,
+                           uint64_t slack_us = kDefaultSlack) -> Timer::ptr;
 
   /**
-   * @brief 到最近一个定时器执行的时间间隔(毫秒)
+   * @brief 把内嵌的定时器挂到时间轮上, 已经挂着的先摘下再按新时间挂
+   * @details 给每次 IO 都要设超时的路径用, 回调能放进 std::function
+   *          的内部缓冲时整个过程不分配内存.
+   *          挂着的定时器只能由原来的管理器重新 arm
+   * @param[in] timer 用默认构造函数创建的定时器
+   * @param[in] ms 超时时间(毫秒)
+   * @param[in] cb 回调函数, 只执行一次
+   * @param[in] slack_ms 允许晚到的毫秒数
+   */
+  void armTimer(Timer* timer, uint64_t ms, std::function<void()> cb,
+                uint64_t slack_ms = kDefaultSlack);
+
+  /**
+   * @brief 到最近一个定时器执行的时间间隔(毫秒, 向上取整)
    */
   auto getNextTimer() -> uint64_t;
 
+  /**
+   * @brief 到最近一个定时器执行的时间间隔(微秒)
+   */
+  auto getNextTimerUs() -> uint64_t;
+
   /**
    * @brief 获取需要执行的定时器的回调函数列表
    * @param[out] cbs 回调函数数组
@@ -144,6 +220,9 @@ class TimerManager {
    */
   bool hasTimer();
 
+  /// 到期处理的累计统计, 可以在任意线程读取
+  auto getStats() const -> Stats;
+
  protected:
   /**
    * @brief 当有新的定时器插入到定时器的首部,执行该函数
@@ -156,20 +235,49 @@ class TimerManager {
   void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
 
  private:
+  /// 挂到时间轮上, 需要时通知 onTimerInsertedAtFront, 会释放锁
+  void insert(Timer* val, RWMutexType::WriteLock& lock);
+
+  /// 每层槽数的位数, 5 层共覆盖 2^40 微秒(约 12.7 天), 更远的放溢出链表
+  static const int kSlotBits = 8;
+  static const int kSlots = 1 << kSlotBits;
+  static const int kLevels = 5;
+  static const int kOverflowSlot = kLevels * kSlots;
+
   /**
-   * @brief 检测服务器时间是否被调后了
+   * @brief 按到期时间把定时器挂到对应的槽
+   * @param[in] min_tick 允许的最早刻度, 已经过期的定时器放在这一刻
    */
-  bool detectClockRollover(uint64_t now_ms);
+  void link(Timer* timer, uint64_t min_tick);
+  /// 从所在的槽摘下, 不释放 m_self
+  void unlink(Timer* timer);
+  /// 摘下整个槽, 返回链表头
+  auto takeSlot(int slot) -> Timer*;
+  /// 下一个有定时器的槽对应的刻度, 高层槽是该槽的起始时间; 没有时返回 ~0ull
+  auto nextTick() const -> uint64_t;
+  /// 把时间轮推进到 now_us, 到期的定时器放进 expired
+  void advance(uint64_t now_us, std::vector<Timer*>& expired);
 
  private:
   /// Mutex
   RWMutexType m_mutex;
-  /// 定时器集合
-  std::set<Timer::ptr, Timer::Comparator> m_timers;
+  /**
+   * 分层时间轮, 第 L 层一个槽跨 2^(8L) 微秒.
+   * 与当前刻度同属一个上层槽的定时器放在本层, 时间轮走到上层槽的边界时
+   * 再把那个槽里的定时器降到下层
+   */
+  Timer* m_slots[kOverflowSlot + 1] = {};
+  /// 每层哪些槽非空, 找下一个到期时间时按位扫描
+  uint64_t m_bitmap[kLevels][kSlots / 64] = {};
+  /// 时间轮已经处理到的刻度(微秒)
+  uint64_t m_current = 0;
+  /// 时间轮上的定时器数量
+  size_t m_count = 0;
+  std::atomic<uint64_t> m_passes = {0};
+  std::atomic<uint64_t> m_expired = {0};
+  std::atomic<uint64_t> m_expireUs = {0};
   /// 是否触发onTimerInsertedAtFront
   bool m_tickled = false;
-  /// 上次执行时间
-  uint64_t m_previouseTime = 0;
 };
 
 }  // namespace hx_sylar
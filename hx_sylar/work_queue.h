@@ -0,0 +1,232 @@
+/**
+ * @file work_queue.h
+ * @brief 调度器使用的无锁队列
+ * @details WorkStealingQueue: Chase-Lev 工作窃取队列, 只有拥有者线程可以
+ *          push/pop(后进先出, 缓存友好), 其他线程通过 steal 从另一端取走
+ *          最早的任务. 内存序参考 Lê et al. "Correct and Efficient
+ *          Work-Stealing for Weak Memory Models" (PPoPP 2013).
+ *          Mailbox: 多生产者单消费者的侵入式投递队列.
+ */
+#ifndef __HX_WORK_QUEUE_H__
+#define __HX_WORK_QUEUE_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <type_traits>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace hx_sylar {
+
+/**
+ * @brief 工作窃取队列, 元素必须是指针, 空队列返回 nullptr
+ */
+template <class T>
+class WorkStealingQueue : Noncopyable {
+  static_assert(std::is_pointer<T>::value, "WorkStealingQueue holds pointers");
+
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] capacity 初始容量, 会向上取整到 2 的幂, 满了自动扩容
+   */
+  explicit WorkStealingQueue(int64_t capacity = 256) {
+    int64_t cap = 1;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    m_array = new Array(cap);
+  }
+
+  ~WorkStealingQueue() {
+    delete m_array.load();
+    for (auto* a : m_garbage) {
+      delete a;
+    }
+  }
+
+  /**
+   * @brief 拥有者入队
+   */
+  void push(T item) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    Array* a = m_array.load(std::memory_order_relaxed);
+    if (b - t > a->capacity() - 1) {
+      Array* bigger = a->grow(b, t);
+      // 窃取者可能还在读旧数组, 延迟到析构时释放
+      m_garbage.push_back(a);
+      a = bigger;
+      m_array.store(a, std::memory_order_release);
+    }
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 拥有者出队(最新的任务)
+   */
+  auto pop() -> T {
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T item = a->get(b);
+    if (t == b) {
+      // 最后一个元素, 与窃取者竞争
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /**
+   * @brief 其他线程窃取(最早的任务)
+   */
+  auto steal() -> T {
+    while (true) {
+      int64_t t = m_top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t b = m_bottom.load(std::memory_order_acquire);
+      if (t >= b) {
+        return nullptr;
+      }
+      Array* a = m_array.load(std::memory_order_acquire);
+      T item = a->get(t);
+      if (m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        return item;
+      }
+    }
+  }
+
+  /**
+   * @brief 近似的元素数量
+   */
+  auto size() const -> size_t {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  auto empty() const -> bool { return size() == 0; }
+
+ private:
+  /**
+   * @brief 环形数组
+   */
+  class Array {
+   public:
+    explicit Array(int64_t capacity)
+        : m_mask(capacity - 1), m_buf(new std::atomic<T>[capacity]) {}
+
+    ~Array() { delete[] m_buf; }
+
+    auto capacity() const -> int64_t { return m_mask + 1; }
+
+    void put(int64_t i, T item) {
+      m_buf[i & m_mask].store(item, std::memory_order_relaxed);
+    }
+
+    auto get(int64_t i) const -> T {
+      return m_buf[i & m_mask].load(std::memory_order_relaxed);
+    }
+
+    auto grow(int64_t b, int64_t t) const -> Array* {
+      auto* a = new Array(capacity() * 2);
+      for (int64_t i = t; i < b; ++i) {
+        a->put(i, get(i));
+      }
+      return a;
+    }
+
+   private:
+    int64_t m_mask;
+    std::atomic<T>* m_buf;
+  };
+
+ private:
+  /// 窃取端
+  std::atomic<int64_t> m_top = {0};
+  /// 拥有者端
+  std::atomic<int64_t> m_bottom = {0};
+  /// 当前数组
+  std::atomic<Array*> m_array;
+  /// 扩容替换下来的旧数组, 只有拥有者访问
+  std::vector<Array*> m_garbage;
+};
+
+/**
+ * @brief 多生产者单消费者的无锁投递队列
+ * @details 侵入式, T 需要有 T* next_ 成员. 生产者 CAS 压栈,
+ *          消费者一次把整条链取走再反转, 不存在 ABA 问题
+ */
+template <class T>
+class Mailbox : Noncopyable {
+ public:
+  /**
+   * @brief 任意线程投递
+   */
+  void push(T* item) {
+    // 先加计数, 消费者取走之后才减, size 不会减到 0 以下
+    m_size.fetch_add(1, std::memory_order_seq_cst);
+    T* head = m_head.load(std::memory_order_relaxed);
+    do {
+      item->next_ = head;
+    } while (!m_head.compare_exchange_weak(head, item,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief 拥有者按投递顺序取出一个, 为空返回 nullptr
+   */
+  auto pop() -> T* {
+    if (m_local == nullptr) {
+      T* list = m_head.exchange(nullptr, std::memory_order_acquire);
+      T* prev = nullptr;
+      while (list != nullptr) {
+        T* next = list->next_;
+        list->next_ = prev;
+        prev = list;
+        list = next;
+      }
+      m_local = prev;
+    }
+    T* item = m_local;
+    if (item != nullptr) {
+      m_local = item->next_;
+      item->next_ = nullptr;
+      m_size.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /**
+   * @brief 近似的元素数量, 任意线程可读
+   * @details 投递过程中可能比实际多, 不会比实际少
+   */
+  auto size() const -> size_t { return m_size.load(std::memory_order_seq_cst); }
+
+ private:
+  /// 生产者压栈的链表头, 后进先出
+  std::atomic<T*> m_head = {nullptr};
+  /// 拥有者已取出、按投递顺序排好的部分
+  T* m_local = nullptr;
+  std::atomic<size_t> m_size = {0};
+};
+
+}  // namespace hx_sylar
+
+#endif
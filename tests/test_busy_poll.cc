@@ -0,0 +1,107 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/socket.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static auto CpuUS() -> uint64_t {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/**
+ * 外部线程用阻塞 socket 按固定间隔发 8 字节请求, IOManager 里的协程回显.
+ * 统计往返时延的 p50/p99 和整个进程的 CPU 占用, 对比不同的忙等上限
+ */
+static void BenchLatency(uint64_t busy_poll_us, uint64_t interval_us) {
+  const int kRequests = 2000;
+  std::atomic<int> port(0);
+  std::vector<uint64_t> lats;
+  lats.reserve(kRequests);
+  uint64_t wall = 0;
+  uint64_t cpu = 0;
+  hx_sylar::Scheduler::BusyPollStats stats;
+  {
+    hx_sylar::IOManager iom(1, false, "busy_poll");
+    iom.setBusyPoll(busy_poll_us);
+    iom.schedule([&port]() {
+      auto listener = hx_sylar::Socket::CreateTCPSocket();
+      HX_ASSERT(listener->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+      HX_ASSERT(listener->listen());
+      auto addr = std::dynamic_pointer_cast<hx_sylar::IPv4Address>(
+          listener->getLocalAddress());
+      port = addr->getPort();
+      auto client = listener->accept();
+      listener->close();
+      char buf[8];
+      while (client->recv(buf, sizeof(buf), MSG_WAITALL) == sizeof(buf)) {
+        HX_ASSERT(client->send(buf, sizeof(buf)) == sizeof(buf));
+      }
+      client->close();
+    });
+    while (port == 0) {
+      usleep(1000);
+    }
+
+    // 本线程不是调度线程, socket 调用不经过 hook, 一直阻塞
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in sin{};
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    HX_ASSERT(connect(fd, reinterpret_cast<sockaddr*>(&sin), sizeof(sin)) == 0);
+
+    uint64_t cpu_start = CpuUS();
+    uint64_t start = hx_sylar::Clock::NowUS();
+    for (int i = 0; i < kRequests; ++i) {
+      if (interval_us > 0) {
+        usleep(interval_us);
+      }
+      uint64_t t0 = hx_sylar::Clock::NowNS();
+      HX_ASSERT(send(fd, &t0, sizeof(t0), 0) == sizeof(t0));
+      uint64_t echo = 0;
+      HX_ASSERT(recv(fd, &echo, sizeof(echo), MSG_WAITALL) == sizeof(echo));
+      HX_ASSERT(echo == t0);
+      lats.push_back(hx_sylar::Clock::NowNS() - t0);
+    }
+    wall = hx_sylar::Clock::NowUS() - start;
+    cpu = CpuUS() - cpu_start;
+    stats = iom.getBusyPollStats();
+    close(fd);
+  }
+  std::sort(lats.begin(), lats.end());
+  HX_LOG_INFO(g_logger) << "busy_poll=" << busy_poll_us
+                        << "us interval=" << interval_us
+                        << "us p50=" << lats[kRequests / 2] / 1000
+                        << "us p99=" << lats[kRequests * 99 / 100] / 1000
+                        << "us cpu=" << cpu * 100 / (wall + 1) << "%"
+                        << " spin hits=" << stats.hits
+                        << " misses=" << stats.misses
+                        << " spin=" << stats.spinUs << "us";
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  for (uint64_t interval : {0, 50, 1000}) {
+    for (uint64_t busy_poll : {0, 50, 500}) {
+      BenchLatency(busy_poll, interval);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+#include <atomic>
+
+#include "../hx_sylar/channel.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+// 生产者 -> 有界 channel -> 多个消费者, 关闭后消费者读完剩余数据退出
+static void TestPipeline(size_t capacity, int threads) {
+  const int kProducers = 4;
+  const int kCount = 50000;
+  hx_sylar::Channel<int> ch(capacity);
+  std::atomic<int64_t> sum(0);
+  std::atomic<int> producers(kProducers);
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::IOManager iom(threads, false, "pipeline");
+    for (int i = 0; i < kProducers; ++i) {
+      iom.schedule([&]() {
+        for (int k = 0; k < kCount; ++k) {
+          HX_ASSERT(ch.send(k));
+        }
+        if (--producers == 0) {
+          ch.close();
+        }
+      });
+    }
+    for (int i = 0; i < 4; ++i) {
+      iom.schedule([&]() {
+        int v = 0;
+        while (ch.recv(v)) {
+          sum += v;
+        }
+      });
+    }
+  }
+  HX_ASSERT(sum == static_cast<int64_t>(kProducers) * kCount * (kCount - 1) / 2);
+  HX_ASSERT(!ch.send(1));
+  HX_LOG_INFO(g_logger) << "pipeline capacity=" << capacity
+                        << " threads=" << threads
+                        << " items=" << kProducers * kCount
+                        << " used=" << hx_sylar::GetCurrentUS() - start << "us";
+}
+
+static void TestSelect() {
+  hx_sylar::Channel<int> ints(1);
+  hx_sylar::Channel<std::string> strs;
+  hx_sylar::Channel<int> out(1);
+  hx_sylar::IOManager iom(2, false, "select");
+  iom.schedule([&]() {
+    int got_int = 0;
+    int got_str = 0;
+    bool closed = false;
+    while (!closed) {
+      hx_sylar::ChannelSelect sel;
+      sel.recv(ints, [&](int& v, bool ok) {
+        if (ok) {
+          ++got_int;
+        } else {
+          closed = true;
+        }
+      });
+      sel.recv(strs, [&](std::string& v, bool ok) { got_str += ok; });
+      HX_ASSERT(sel.wait() >= 0);
+    }
+    HX_LOG_INFO(g_logger) << "select ints=" << got_int << " strs=" << got_str;
+    HX_ASSERT(got_int == 100 && got_str == 100);
+
+    // 都未就绪时超时
+    hx_sylar::ChannelSelect sel;
+    sel.recv(strs, [](std::string& v, bool ok) {});
+    sel.send(out, 1);
+    HX_ASSERT(sel.wait(10) == 1);
+    uint64_t begin = hx_sylar::GetCurrentMS();
+    HX_ASSERT(sel.wait(30) == -1);
+    HX_LOG_INFO(g_logger) << "select timeout used="
+                          << hx_sylar::GetCurrentMS() - begin << "ms";
+  });
+  iom.schedule([&]() {
+    for (int i = 0; i < 100; ++i) {
+      ints.send(i);
+      strs.send(std::to_string(i));
+    }
+    // 等 select 把 strs 读完再关闭 ints
+    while (strs.size() > 0) {
+      hx_sylar::Fiber::YieldToReady();
+    }
+    ints.close();
+  });
+}
+
+static void TestTimeout() {
+  hx_sylar::Channel<int> ch(1);
+  hx_sylar::IOManager iom(1, false, "timeout");
+  iom.schedule([&]() {
+    int v = 0;
+    HX_ASSERT(!ch.recv(v, 20));
+    HX_ASSERT(ch.send(1, 20));
+    HX_ASSERT(!ch.send(2, 20));
+    HX_ASSERT(ch.recv(v, 20) && v == 1);
+    HX_LOG_INFO(g_logger) << "timeout ok";
+  });
+}
+
+// 共享栈协程反复 wait 同一个 select, 每次发出去的都是完整的值
+static void TestSelectReuse() {
+  const int kRounds = 100;
+  hx_sylar::Channel<std::string> words(1);
+  std::atomic<int> got(0);
+  {
+    hx_sylar::IOManager iom(1, false, "reuse");
+    iom.setSharedStack(true);
+    iom.schedule([&]() {
+      hx_sylar::ChannelSelect sel;
+      sel.send(words, std::string("payload"));
+      for (int i = 0; i < kRounds; ++i) {
+        HX_ASSERT(sel.wait() == 0);
+      }
+      words.close();
+    });
+    iom.schedule([&]() {
+      std::string v;
+      while (words.recv(v)) {
+        HX_ASSERT(v == "payload");
+        ++got;
+      }
+    });
+  }
+  HX_ASSERT(got == kRounds);
+  HX_LOG_INFO(g_logger) << "select reuse ok";
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestPipeline(hx_sylar::ChannelBase::kUnbounded, 1);
+  TestPipeline(64, 1);
+  TestPipeline(64, 4);
+  TestPipeline(1, 4);
+  TestSelect();
+  TestSelectReuse();
+  TestTimeout();
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include <time.h>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+/// 连续读 n 次, 返回每次读取的纳秒数, 同时检查不回退
+template <class F>
+auto bench_read(const char* name, F read, size_t n) -> double {
+  uint64_t last = 0;
+  uint64_t start = hx_sylar::Clock::NowNS();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t v = read();
+    HX_ASSERT(v >= last);
+    last = v;
+  }
+  double ns = (hx_sylar::Clock::NowNS() - start) * 1.0 / n;
+  HX_LOG_INFO(g_logger) << name << " " << ns << " ns/read";
+  return ns;
+}
+
+void test_reads() {
+  const size_t n = 10 * 1000 * 1000;
+  bench_read("gettimeofday", []() { return hx_sylar::GetCurrentUS(); }, n);
+  bench_read("monotonic", []() { return hx_sylar::Clock::NowNS(); }, n);
+  if (hx_sylar::Clock::EnableTsc(true)) {
+    // TSC 换算的结果与系统时钟相差应在 1ms 以内
+    uint64_t tsc = hx_sylar::Clock::NowNS();
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t mono = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    int64_t diff = static_cast<int64_t>(tsc - mono);
+    HX_ASSERT(diff < 1000000 && diff > -1000000);
+    bench_read("tsc", []() { return hx_sylar::Clock::NowNS(); }, n);
+    hx_sylar::Clock::EnableTsc(false);
+  }
+  hx_sylar::Clock::Update();
+  bench_read("cached", []() { return hx_sylar::Clock::CachedMS(); }, n);
+  hx_sylar::Clock::Invalidate();
+}
+
+void test_cache() {
+  HX_ASSERT(!hx_sylar::Clock::IsCached());
+  uint64_t v = hx_sylar::Clock::Update();
+  usleep(20 * 1000);
+  HX_ASSERT(hx_sylar::Clock::CachedMS() == v);
+  hx_sylar::Clock::Invalidate();
+  HX_ASSERT(hx_sylar::Clock::CachedMS() >= v + 20);
+
+  // 事件循环里的线程带着缓存, 定时器照常按时触发
+  hx_sylar::IOManager iom(2, false);
+  uint64_t start = hx_sylar::Clock::NowMS();
+  iom.schedule([start]() {
+    HX_ASSERT(hx_sylar::Clock::IsCached() ||
+              hx_sylar::Clock::NowMS() - start < 5);
+    hx_sylar::IOManager::GetThis()->addTimer(50, [start]() {
+      uint64_t elapsed = hx_sylar::Clock::NowMS() - start;
+      HX_LOG_INFO(g_logger) << "timer after " << elapsed << "ms";
+      HX_ASSERT(elapsed >= 45 && elapsed < 200);
+    });
+  });
+}
+
+auto main(int argc, char** argv) -> int {
+  test_cache();
+  test_reads();
+  return 0;
+}
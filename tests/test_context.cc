@@ -0,0 +1,62 @@
+#include <stdlib.h>
+
+#include <vector>
+
+#include "../hx_sylar/context.h"
+#include "../hx_sylar/hx_sylar.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+template <class Ctx>
+struct PingPong {
+  static Ctx s_main;
+  static Ctx s_co;
+  static uint64_t s_count;
+
+  static void Run() {
+    while (true) {
+      ++s_count;
+      Ctx::Swap(s_co, s_main);
+    }
+  }
+};
+
+template <class Ctx>
+Ctx PingPong<Ctx>::s_main;
+template <class Ctx>
+Ctx PingPong<Ctx>::s_co;
+template <class Ctx>
+uint64_t PingPong<Ctx>::s_count = 0;
+
+// 主协程与子协程来回切换 rounds 次, 统计每秒切换次数
+template <class Ctx>
+void Bench(uint64_t rounds) {
+  using PP = PingPong<Ctx>;
+  std::vector<char> stack(128 * 1024);
+  PP::s_co.make(stack.data(), stack.size(), &PP::Run);
+
+  uint64_t start = hx_sylar::GetCurrentUS();
+  for (uint64_t i = 0; i < rounds; ++i) {
+    Ctx::Swap(PP::s_main, PP::s_co);
+  }
+  uint64_t used = hx_sylar::GetCurrentUS() - start;
+  if (used == 0) {
+    used = 1;
+  }
+
+  uint64_t switches = rounds * 2;
+  HX_LOG_INFO(g_logger) << Ctx::Name() << " switches=" << switches
+                        << " used=" << used << "us"
+                        << " ns/switch=" << used * 1000.0 / switches
+                        << " switches/s=" << switches * 1000000.0 / used
+                        << " check=" << (PP::s_count == rounds);
+}
+
+auto main(int argc, char** argv) -> int {
+  uint64_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  Bench<hx_sylar::UContext>(rounds);
+#ifdef HX_FIBER_HAS_ASM_CONTEXT
+  Bench<hx_sylar::AsmContext>(rounds);
+#endif
+  return 0;
+}
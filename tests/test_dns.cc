@@ -0,0 +1,235 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "../hx_sylar/config.h"
+#include "../hx_sylar/dns.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/socket.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+/**
+ * 本地的 DNS 桩服务器
+ * a.test     A 10.0.0.1 TTL 1 秒, AAAA 没有记录 (SOA MINIMUM 60)
+ * cname.test CNAME a.test, A 10.0.0.2
+ * slow.test  A 10.0.0.3, 50ms 后才应答
+ * 其他名字   NXDOMAIN
+ */
+class StubDns {
+ public:
+  void start(hx_sylar::IOManager& iom) {
+    // socket 要在调度线程里创建, 才会经过 hook 变成非阻塞
+    iom.schedule([this]() {
+      m_sock = hx_sylar::Socket::CreateUDPSocket();
+      HX_ASSERT(m_sock->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+      m_sock->setRecvTimeout(100);
+      m_port = std::dynamic_pointer_cast<hx_sylar::IPv4Address>(
+                   m_sock->getLocalAddress())
+                   ->getPort();
+      serve();
+    });
+    while (m_port == 0) {
+      usleep(1000);
+    }
+  }
+  void stop() { m_stop = true; }
+  auto port() const -> uint16_t { return m_port; }
+  /// "名字/类型" 收到的查询数
+  auto count(const std::string& key) -> int { return m_counts[key]; }
+
+ private:
+  static void PutU16(std::string& out, uint16_t v) {
+    out.push_back(static_cast<char>(v >> 8));
+    out.push_back(static_cast<char>(v & 0xff));
+  }
+  static void PutU32(std::string& out, uint32_t v) {
+    PutU16(out, v >> 16);
+    PutU16(out, v & 0xffff);
+  }
+  static auto Encode(const std::string& name) -> std::string {
+    std::string out;
+    size_t begin = 0;
+    while (begin < name.size()) {
+      size_t end = name.find('.', begin);
+      end = end == std::string::npos ? name.size() : end;
+      out.push_back(static_cast<char>(end - begin));
+      out.append(name, begin, end - begin);
+      begin = end + 1;
+    }
+    out.push_back(0);
+    return out;
+  }
+  /// owner 可以是指向问题部分名字的压缩指针
+  static void PutRecord(std::string& out, const std::string& owner,
+                        uint16_t type, uint32_t ttl, const std::string& rdata) {
+    out += owner;
+    PutU16(out, type);
+    PutU16(out, 1);
+    PutU32(out, ttl);
+    PutU16(out, rdata.size());
+    out += rdata;
+  }
+
+  void serve() {
+    char buf[512];
+    auto from = std::make_shared<hx_sylar::IPv4Address>();
+    while (!m_stop) {
+      int n = m_sock->recvFrom(buf, sizeof(buf), from);
+      if (n <= 12) {
+        continue;
+      }
+      // 问题部分: 一个名字加类型和类
+      std::string name;
+      size_t pos = 12;
+      while (pos < static_cast<size_t>(n) && buf[pos] != 0) {
+        if (!name.empty()) {
+          name += ".";
+        }
+        name.append(buf + pos + 1, buf[pos]);
+        pos += buf[pos] + 1;
+      }
+      std::string question(buf + 12, pos + 5 - 12);
+      uint16_t qtype = static_cast<uint8_t>(buf[pos + 1]) << 8 |
+                       static_cast<uint8_t>(buf[pos + 2]);
+      ++m_counts[name + "/" + std::to_string(qtype)];
+
+      std::string ptr("\xc0\x0c", 2);
+      std::string answers;
+      std::string authority;
+      int an = 0;
+      int rcode = 0;
+      if (name == "a.test" && qtype == 1) {
+        PutRecord(answers, ptr, 1, 1, std::string("\x0a\x00\x00\x01", 4));
+        an = 1;
+      } else if (name == "cname.test" && qtype == 1) {
+        PutRecord(answers, ptr, 5, 100, Encode("a.test"));
+        PutRecord(answers, Encode("a.test"), 1, 50,
+                  std::string("\x0a\x00\x00\x02", 4));
+        an = 2;
+      } else if (name == "slow.test" && qtype == 1) {
+        usleep(50 * 1000);
+        PutRecord(answers, ptr, 1, 300, std::string("\x0a\x00\x00\x03", 4));
+        an = 1;
+      } else {
+        rcode = name == "a.test" ? 0 : 3;
+        std::string soa = std::string(2, '\0');
+        PutU32(soa, 1);
+        PutU32(soa, 3600);
+        PutU32(soa, 600);
+        PutU32(soa, 86400);
+        PutU32(soa, 60);
+        PutRecord(authority, Encode("test"), 6, 300, soa);
+      }
+      std::string reply(buf, 2);
+      PutU16(reply, 0x8180 | rcode);
+      PutU16(reply, 1);
+      PutU16(reply, an);
+      PutU16(reply, authority.empty() ? 0 : 1);
+      PutU16(reply, 0);
+      reply += question + answers + authority;
+      m_sock->sendTo(reply.data(), reply.size(), from);
+    }
+    m_sock->close();
+  }
+
+ private:
+  hx_sylar::Socket::ptr m_sock;
+  std::atomic<uint16_t> m_port{0};
+  std::atomic<bool> m_stop{false};
+  std::map<std::string, int> m_counts;
+};
+
+static void TestResolver() {
+  std::string hosts = "/tmp/test_dns.hosts." + std::to_string(getpid());
+  std::ofstream(hosts) << "192.168.7.7 myhost.test myhost # comment\n";
+
+  // 桩服务器的协程要在 IOManager 析构时跑完, 所以先构造
+  StubDns stub;
+  hx_sylar::IOManager iom(1, false, "dns");
+  stub.start(iom);
+  hx_sylar::Config::Lookup<std::string>("dns.hosts_file")->setValue(hosts);
+  hx_sylar::Config::Lookup<std::string>("dns.resolv_conf")
+      ->setValue("/nonexistent");
+  hx_sylar::Config::Lookup<std::vector<std::string> >("dns.nameservers")
+      ->setValue({"127.0.0.1:" + std::to_string(stub.port())});
+  auto resolver = hx_sylar::DnsMgr::GetInstance();
+  resolver->clearCache();
+
+  std::atomic<bool> done(false);
+  iom.schedule([&]() {
+    // 数字地址和 hosts 不发查询
+    auto addr = hx_sylar::Address::LookupAnyIPAddress("127.0.0.1:8080");
+    HX_ASSERT(addr && addr->toString() == "127.0.0.1:8080");
+    addr = hx_sylar::Address::LookupAnyIPAddress("MyHost.test:80");
+    HX_ASSERT(addr && addr->toString() == "192.168.7.7:80");
+    HX_ASSERT(resolver->getStats().queries == 0);
+
+    // 肯定缓存, TTL 1 秒后过期重新查
+    addr = hx_sylar::Address::LookupAnyIPAddress("a.test:80");
+    HX_ASSERT(addr && addr->toString() == "10.0.0.1:80");
+    addr = hx_sylar::Address::LookupAnyIPAddress("a.test:81");
+    HX_ASSERT(addr && addr->toString() == "10.0.0.1:81");
+    HX_ASSERT(stub.count("a.test/1") == 1);
+    usleep(1100 * 1000);
+    HX_ASSERT(hx_sylar::Address::LookupAnyIPAddress("a.test"));
+    HX_ASSERT(stub.count("a.test/1") == 2);
+
+    // 否定缓存: 名字存在但没有 AAAA, 以及名字不存在
+    for (int i = 0; i < 3; ++i) {
+      HX_ASSERT(!hx_sylar::Address::LookupAny("a.test", AF_INET6));
+      HX_ASSERT(!hx_sylar::Address::LookupAny("nx.test"));
+    }
+    HX_ASSERT(stub.count("a.test/28") == 1);
+    HX_ASSERT(stub.count("nx.test/1") == 1);
+    HX_ASSERT(resolver->getStats().negativeHits == 4);
+
+    std::vector<hx_sylar::Address::ptr> all;
+    HX_ASSERT(hx_sylar::Address::Lookup(all, "cname.test", AF_UNSPEC));
+    HX_ASSERT(all.size() == 1 && all[0]->toString() == "10.0.0.2:0");
+    done = true;
+  });
+  while (!done) {
+    usleep(10 * 1000);
+  }
+
+  // 同时解析同一个名字只发一次查询
+  const int kFibers = 10;
+  std::atomic<int> ok(0);
+  for (int i = 0; i < kFibers; ++i) {
+    iom.schedule([&ok]() {
+      auto addr = hx_sylar::Address::LookupAnyIPAddress("slow.test");
+      if (addr && addr->toString() == "10.0.0.3:0") {
+        ++ok;
+      }
+    });
+  }
+  while (ok < kFibers) {
+    usleep(10 * 1000);
+  }
+  HX_ASSERT(stub.count("slow.test/1") == 1);
+
+  // 不在协程里时阻塞等待应答
+  HX_ASSERT(!hx_sylar::Address::LookupAny("b.test"));
+  HX_ASSERT(stub.count("b.test/1") == 1);
+
+  auto stats = resolver->getStats();
+  HX_ASSERT(stats.collapsed == kFibers - 1);
+  HX_LOG_INFO(g_logger) << "dns queries=" << stats.queries
+                        << " cache_hits=" << stats.cacheHits
+                        << " negative_hits=" << stats.negativeHits
+                        << " collapsed=" << stats.collapsed
+                        << " timeouts=" << stats.timeouts;
+  stub.stop();
+  unlink(hosts.c_str());
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestResolver();
+  return 0;
+}
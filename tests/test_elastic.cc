@@ -0,0 +1,76 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static void Burn(uint64_t us) {
+  uint64_t start = hx_sylar::Clock::NowUS();
+  while (hx_sylar::Clock::NowUS() - start < us) {
+  }
+}
+
+/**
+ * 两轮突发的 1ms 任务: 排队超过阈值时扩容, 空闲过了冷却期后缩回下限,
+ * 第二轮在同一个槽位上重新启动线程
+ */
+void test_elastic(bool use_caller) {
+  const std::string name = use_caller ? "elastic_caller" : "elastic";
+  hx_sylar::Config::Lookup<std::map<std::string, uint32_t> >(
+      "scheduler.max_threads")
+      ->setValue({{name, 4}});
+  hx_sylar::Config::Lookup<uint32_t>("scheduler.elastic.grow_wait_us")
+      ->setValue(2000);
+  hx_sylar::Config::Lookup<uint32_t>("scheduler.elastic.cooldown_ms")
+      ->setValue(200);
+
+  std::atomic<int> done(0);
+  const int kTasks = 300;
+  hx_sylar::IOManager iom(use_caller ? 2 : 1, use_caller, name);
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < kTasks; ++i) {
+      iom.schedule([&done, i]() {
+        Burn(1000);
+        // 一部分任务在 worker 上再派生, 进入它的本地队列
+        if (i % 10 == 0) {
+          hx_sylar::Scheduler::GetThis()->schedule([&done]() { ++done; });
+        }
+        ++done;
+      });
+    }
+    int expect = (round + 1) * (kTasks + kTasks / 10);
+    while (done < expect) {
+      usleep(10 * 1000);
+    }
+    auto stats = iom.getElasticStats();
+    HX_LOG_INFO(g_logger) << name << " round=" << round
+                          << " grows=" << stats.grows << " peak=" << stats.peak
+                          << " threads=" << stats.threads;
+    HX_ASSERT(stats.grows > 0 && stats.peak <= 4 - (use_caller ? 2 : 1));
+    // 冷却期过后缩回去
+    uint64_t start = hx_sylar::Clock::NowMS();
+    while (iom.getElasticStats().threads > 0) {
+      HX_ASSERT(hx_sylar::Clock::NowMS() - start < 5000);
+      usleep(20 * 1000);
+    }
+    stats = iom.getElasticStats();
+    HX_ASSERT(stats.retires == stats.grows);
+    HX_LOG_INFO(g_logger) << name << " retired after "
+                          << hx_sylar::Clock::NowMS() - start
+                          << "ms retires=" << stats.retires;
+  }
+  iom.stop();
+  HX_ASSERT(done == 2 * (kTasks + kTasks / 10));
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::INFO);
+  test_elastic(false);
+  test_elastic(true);
+  return 0;
+}
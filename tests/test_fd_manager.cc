@@ -0,0 +1,122 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/fd_manager.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+// 关闭后查不到, 同号 fd 再打开时代数变化
+void test_reuse() {
+  auto* mgr = hx_sylar::FdMgr::GetInstance();
+  int fds[2];
+  HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  hx_sylar::FdCtx::ptr ctx = mgr->get(fds[0], true);
+  HX_ASSERT(ctx && ctx->isSocket() && !ctx->isClose());
+  HX_ASSERT(mgr->get(fds[0]) == ctx);
+  uint32_t gen = ctx->getGeneration();
+
+  mgr->del(fds[0]);
+  HX_ASSERT(!mgr->get(fds[0]));
+  HX_ASSERT(ctx->isClose());
+  HX_ASSERT(mgr->get(fds[0], true) == ctx);
+  HX_ASSERT(ctx->getGeneration() != gen && !ctx->isClose());
+
+  // 远处的 fd 所在的段按需分配
+  HX_ASSERT(!mgr->get(100000));
+  HX_ASSERT(!mgr->get(-1, true));
+  mgr->del(fds[0]);
+  mgr->del(fds[1]);
+  close(fds[0]);
+  close(fds[1]);
+  HX_LOG_INFO(g_logger) << "reuse ok";
+}
+
+// recv 挂起时 fd 被关闭, 同号 fd 又被别人打开, 醒来后不能读到新 fd 上的数据
+void test_close_while_parked() {
+  int fds[2];
+  int reused[2];
+  std::atomic<int> done(0);
+  hx_sylar::IOManager iom(1, false, "parked");
+  iom.schedule([&]() {
+    HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    iom.schedule([&]() {
+      close(fds[0]);
+      // 最小的空闲号就是刚关掉的 fds[0]
+      HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, reused) == 0);
+      HX_ASSERT(reused[0] == fds[0]);
+      HX_ASSERT(write(reused[1], "x", 1) == 1);
+      ++done;
+    });
+    char c = 0;
+    ssize_t n = recv(fds[0], &c, 1, 0);
+    HX_ASSERT(n == -1 && errno == EBADF);
+    // 新 fd 上的数据还在
+    HX_ASSERT(recv(reused[0], &c, 1, 0) == 1 && c == 'x');
+    close(reused[0]);
+    close(reused[1]);
+    close(fds[1]);
+    ++done;
+  });
+  while (done < 2) {
+    usleep(1000);
+  }
+  HX_LOG_INFO(g_logger) << "close while parked ok";
+}
+
+/**
+ * 多个线程同时查同一批 fd, 模拟每次 hook 的系统调用都要查一次 FdCtx
+ */
+void bench_lookup(int threads) {
+  auto* mgr = hx_sylar::FdMgr::GetInstance();
+  std::vector<int> fds;
+  for (int i = 0; i < 64; ++i) {
+    int sv[2];
+    HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    mgr->get(sv[0], true);
+    mgr->get(sv[1], true);
+    fds.push_back(sv[0]);
+    fds.push_back(sv[1]);
+  }
+
+  const int rounds = 2000000;
+  std::atomic<uint64_t> total_us(0);
+  std::vector<hx_sylar::Thread::ptr> ths;
+  for (int t = 0; t < threads; ++t) {
+    ths.push_back(std::make_shared<hx_sylar::Thread>(
+        [&fds, &total_us, mgr]() {
+          uint64_t start = hx_sylar::Clock::NowUS();
+          size_t found = 0;
+          for (int i = 0; i < rounds; ++i) {
+            auto ctx = mgr->get(fds[i % fds.size()]);
+            found += ctx && ctx->isSocket();
+          }
+          HX_ASSERT(found == rounds);
+          total_us += hx_sylar::Clock::NowUS() - start;
+        },
+        "lookup_" + std::to_string(t)));
+  }
+  for (auto& th : ths) {
+    th->join();
+  }
+  HX_LOG_INFO(g_logger) << "threads=" << threads << " lookup "
+                        << total_us * 1000.0 / threads / rounds << " ns";
+  for (int fd : fds) {
+    mgr->del(fd);
+    close(fd);
+  }
+}
+
+auto main(int argc, char** argv) -> int {
+  test_reuse();
+  test_close_while_parked();
+  bench_lookup(1);
+  bench_lookup(4);
+  return 0;
+}
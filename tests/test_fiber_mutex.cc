@@ -0,0 +1,152 @@
+#include <atomic>
+#include <deque>
+
+#include "../hx_sylar/fiber_mutex.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+// 临界区内让出协程, 用 Mutex 会把整个线程卡住
+static void TestMutex() {
+  hx_sylar::FiberMutex mutex;
+  int64_t count = 0;
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::IOManager iom(4, false, "mutex");
+    for (int i = 0; i < 100; ++i) {
+      iom.schedule([&mutex, &count]() {
+        for (int k = 0; k < 1000; ++k) {
+          hx_sylar::FiberMutex::Lock lock(mutex);
+          int64_t v = count;
+          if (k % 100 == 0) {
+            hx_sylar::Fiber::YieldToReady();
+          }
+          count = v + 1;
+        }
+      });
+    }
+  }
+  HX_ASSERT(count == 100 * 1000);
+  HX_LOG_INFO(g_logger) << "mutex count=" << count
+                        << " used=" << hx_sylar::GetCurrentUS() - start << "us";
+}
+
+static void TestRWMutex() {
+  hx_sylar::FiberRWMutex mutex;
+  std::atomic<int> readers(0);
+  int value = 0;
+  {
+    hx_sylar::IOManager iom(4, false, "rwmutex");
+    for (int i = 0; i < 50; ++i) {
+      iom.schedule([&]() {
+        for (int k = 0; k < 100; ++k) {
+          hx_sylar::FiberRWMutex::ReadLock lock(mutex);
+          ++readers;
+          int v = value;
+          hx_sylar::Fiber::YieldToReady();
+          HX_ASSERT(v == value);
+          --readers;
+        }
+      });
+      iom.schedule([&]() {
+        for (int k = 0; k < 100; ++k) {
+          hx_sylar::FiberRWMutex::WriteLock lock(mutex);
+          HX_ASSERT(readers == 0);
+          ++value;
+        }
+      });
+    }
+  }
+  HX_ASSERT(value == 50 * 100);
+  HX_LOG_INFO(g_logger) << "rwmutex value=" << value;
+}
+
+// 生产者/消费者
+static void TestCondition() {
+  hx_sylar::FiberMutex mutex;
+  hx_sylar::FiberCondition cond;
+  std::deque<int> queue;
+  int64_t sum = 0;
+  {
+    hx_sylar::IOManager iom(2, false, "cond");
+    for (int i = 0; i < 10; ++i) {
+      iom.schedule([&]() {
+        for (int k = 0; k < 1000; ++k) {
+          hx_sylar::FiberMutex::Lock lock(mutex);
+          while (queue.empty()) {
+            cond.wait(mutex);
+          }
+          sum += queue.front();
+          queue.pop_front();
+        }
+      });
+    }
+    iom.schedule([&]() {
+      for (int k = 0; k < 10 * 1000; ++k) {
+        hx_sylar::FiberMutex::Lock lock(mutex);
+        queue.push_back(k);
+        cond.notify();
+      }
+    });
+  }
+  HX_ASSERT(sum == 10000LL * 9999 / 2);
+  HX_LOG_INFO(g_logger) << "condition sum=" << sum;
+}
+
+// 信号量限制并发数
+static void TestSemaphore() {
+  hx_sylar::FiberSemaphore sem(3);
+  std::atomic<int> running(0);
+  std::atomic<int> max_running(0);
+  {
+    hx_sylar::IOManager iom(2, false, "sem");
+    for (int i = 0; i < 30; ++i) {
+      iom.schedule([&]() {
+        sem.wait();
+        int n = ++running;
+        int m = max_running;
+        while (n > m && !max_running.compare_exchange_weak(m, n)) {
+        }
+        usleep(1000);
+        --running;
+        sem.notify();
+      });
+    }
+  }
+  HX_ASSERT(max_running <= 3);
+  HX_ASSERT(sem.getCount() == 3);
+  HX_LOG_INFO(g_logger) << "semaphore max_running=" << max_running;
+}
+
+static void TestTimeout() {
+  hx_sylar::FiberMutex mutex;
+  hx_sylar::FiberSemaphore sem;
+  hx_sylar::IOManager iom(1, false, "timeout");
+  iom.schedule([&]() {
+    mutex.lock();
+    uint64_t start = hx_sylar::GetCurrentMS();
+    HX_ASSERT(!sem.waitFor(50));
+    uint64_t used = hx_sylar::GetCurrentMS() - start;
+    HX_ASSERT(used >= 50);
+    HX_LOG_INFO(g_logger) << "semaphore waitFor timeout used=" << used << "ms";
+    mutex.unlock();
+  });
+  iom.schedule([&]() {
+    // 同一线程上的另一个协程, 持锁方挂起时仍然可以运行
+    HX_ASSERT(!mutex.tryLockFor(20));
+    HX_ASSERT(mutex.tryLockFor(1000));
+    mutex.unlock();
+    HX_LOG_INFO(g_logger) << "mutex tryLockFor ok";
+  });
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestMutex();
+  TestRWMutex();
+  TestCondition();
+  TestSemaphore();
+  TestTimeout();
+  return 0;
+}
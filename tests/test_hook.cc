@@ -1,6 +1,9 @@
+#include "hx_sylar/clock.h"
+#include "hx_sylar/fd_manager.h"
 #include "hx_sylar/hook.h"
 #include "hx_sylar/iomanager.h"
 #include "hx_sylar/log.h"
+#include "hx_sylar/macro.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -60,7 +63,52 @@ void test_sock() {
   HX_LOG_INFO(g_logger) << buff;
 }
 
+/**
+ * 读超时要按时返回 ETIMEDOUT; 再在设了超时的 socketpair 上来回传一个字节,
+ * 每次 recv 都要挂超时, 统计往返速度
+ */
+void test_timeout() {
+  hx_sylar::IOManager iom(1, false);
+  iom.schedule([]() {
+    int fds[2];
+    HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    hx_sylar::FdMgr::GetInstance()->get(fds[0], true);
+    hx_sylar::FdMgr::GetInstance()->get(fds[1], true);
+    timeval tv{0, 50 * 1000};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char c = 0;
+    uint64_t start = hx_sylar::Clock::NowMS();
+    int rt = recv(fds[0], &c, 1, 0);
+    uint64_t elapsed = hx_sylar::Clock::NowMS() - start;
+    HX_ASSERT(rt == -1 && errno == ETIMEDOUT);
+    HX_ASSERT(elapsed >= 50 && elapsed < 200);
+    HX_LOG_INFO(g_logger) << "recv timeout after " << elapsed << "ms";
+
+    const int rounds = 100000;
+    hx_sylar::IOManager::GetThis()->schedule([fds]() {
+      char c = 0;
+      for (int i = 0; i < rounds; ++i) {
+        HX_ASSERT(recv(fds[1], &c, 1, 0) == 1);
+        HX_ASSERT(send(fds[1], &c, 1, 0) == 1);
+      }
+    });
+    uint64_t t0 = hx_sylar::Clock::NowUS();
+    for (int i = 0; i < rounds; ++i) {
+      HX_ASSERT(send(fds[0], &c, 1, 0) == 1);
+      HX_ASSERT(recv(fds[0], &c, 1, 0) == 1);
+    }
+    uint64_t t1 = hx_sylar::Clock::NowUS();
+    HX_LOG_INFO(g_logger) << "ping-pong with recv timeout "
+                          << rounds * 1000.0 / (t1 - t0 + 1) << " k/s";
+    close(fds[0]);
+    close(fds[1]);
+  });
+}
+
 int main() {
+  test_timeout();
 //  test_sock();
   hx_sylar::IOManager iom;
   iom.schedule(test_sock);
@@ -5,8 +5,13 @@
 
 #include <unistd.h>
 
+#include <atomic>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
+#include "../hx_sylar/affinity.h"
+#include "../hx_sylar/fd_manager.h"
 #include "../hx_sylar/hx_sylar.h"
 #include "../hx_sylar/iomanager.h"
 
@@ -72,7 +77,89 @@ void Test1() {
        true);
  }
 
+void TestAffinity() {
+  using hx_sylar::Affinity;
+  HX_ASSERT(Affinity::ParseCpuList("0-3,8,10-11,x,5-4") ==
+            std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  HX_ASSERT(Affinity::FormatCpuList({0, 1, 2, 3, 8, 10, 11}) == "0-3,8,10-11");
+  HX_ASSERT(Affinity::NodeCount() >= 1);
+  HX_ASSERT(!Affinity::NodeCpus(0).empty());
+  HX_LOG_INFO(g_logger) << "nodes=" << Affinity::NodeCount()
+                        << " node0 cpus="
+                        << Affinity::FormatCpuList(Affinity::NodeCpus(0));
+}
+
+/**
+ * 每个线程若干对 socketpair 来回传小包, 对比按名字配置了 scheduler.cpus
+ * 逐线程绑核和不绑时的吞吐
+ */
+void TestScaling(size_t threads, bool pinned) {
+  std::vector<int> all;
+  for (int node = 0; node < hx_sylar::Affinity::NodeCount(); ++node) {
+    auto cpus = hx_sylar::Affinity::NodeCpus(node);
+    all.insert(all.end(), cpus.begin(), cpus.end());
+  }
+  std::map<std::string, std::string> placement;
+  if (pinned) {
+    placement["scale"] = hx_sylar::Affinity::FormatCpuList(all);
+  }
+  hx_sylar::Config::Lookup<std::map<std::string, std::string> >(
+      "scheduler.cpus")
+      ->setValue(placement);
+
+  const int kPairs = 16;
+  const int kRounds = 2000;
+  std::atomic<int64_t> rounds(0);
+  std::string dump;
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::IOManager iom(threads, false, "scale");
+    for (size_t t = 0; t < threads * kPairs; ++t) {
+      iom.schedule([&rounds]() {
+        int sv[2];
+        HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        hx_sylar::FdMgr::GetInstance()->get(sv[0], true);
+        hx_sylar::FdMgr::GetInstance()->get(sv[1], true);
+        hx_sylar::IOManager::GetThis()->schedule([sv]() {
+          char buf[16];
+          while (read(sv[1], buf, sizeof(buf)) > 0) {
+            write(sv[1], buf, sizeof(buf));
+          }
+          close(sv[1]);
+        });
+        char buf[16] = "ping";
+        for (int i = 0; i < kRounds; ++i) {
+          HX_ASSERT(write(sv[0], buf, sizeof(buf)) == sizeof(buf));
+          HX_ASSERT(read(sv[0], buf, sizeof(buf)) == sizeof(buf));
+        }
+        rounds += kRounds;
+        close(sv[0]);
+      });
+    }
+    iom.stop();
+    std::stringstream ss;
+    iom.dump(ss);
+    dump = ss.str();
+  }
+  uint64_t used = hx_sylar::GetCurrentUS() - start;
+  HX_LOG_INFO(g_logger) << "threads=" << threads
+                        << (pinned ? " pinned" : " unpinned")
+                        << " round/s=" << rounds * 1000000 / (used + 1) << "\n"
+                        << dump;
+}
+
 auto main(int argc, char** argv) -> int {
+  // test_iomanager scaling: 比较绑核和不绑核
+  if (argc > 1 && std::string(argv[1]) == "scaling") {
+    HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+    TestAffinity();
+    size_t cores = std::max(2U, std::thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= cores; threads *= 2) {
+      TestScaling(threads, false);
+      TestScaling(threads, true);
+    }
+    return 0;
+  }
 //  Test1();
    TestTimer();
   return 0;
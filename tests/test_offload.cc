@@ -0,0 +1,99 @@
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/hook.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/offload_pool.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static const size_t kChunk = 1 << 20;
+static const int kChunks = 32;
+
+/**
+ * 写 32MB 再 fsync、读回. hooked 为 false 时直接调原始函数,
+ * 对比同一线程上另一个每 1ms 醒一次的协程在这期间能跑多少次
+ */
+static void BenchFile(bool hooked) {
+  std::string path = "/tmp/test_offload." + std::to_string(getpid());
+  std::atomic<bool> done(false);
+  std::atomic<int> ticks(0);
+  uint64_t cost = 0;
+  {
+    hx_sylar::IOManager iom(1, false, "file");
+    iom.schedule([&done, &ticks]() {
+      while (!done) {
+        usleep(1000);
+        ++ticks;
+      }
+    });
+    iom.schedule([&]() {
+      std::vector<char> buf(kChunk, 'x');
+      uint64_t start = hx_sylar::Clock::NowUS();
+      int fd = hooked ? open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644)
+                      : open_f(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+      HX_ASSERT(fd >= 0);
+      for (int i = 0; i < kChunks; ++i) {
+        buf[0] = static_cast<char>(i);
+        ssize_t n = hooked ? write(fd, buf.data(), kChunk)
+                           : write_f(fd, buf.data(), kChunk);
+        HX_ASSERT(n == static_cast<ssize_t>(kChunk));
+      }
+      HX_ASSERT((hooked ? fsync(fd) : fsync_f(fd)) == 0);
+      lseek(fd, 0, SEEK_SET);
+      for (int i = 0; i < kChunks; ++i) {
+        ssize_t n = hooked ? read(fd, buf.data(), kChunk)
+                           : read_f(fd, buf.data(), kChunk);
+        HX_ASSERT(n == static_cast<ssize_t>(kChunk));
+        HX_ASSERT(buf[0] == static_cast<char>(i) && buf[1] == 'x');
+      }
+      close(fd);
+      cost = hx_sylar::Clock::NowUS() - start;
+      unlink(path.c_str());
+      done = true;
+    });
+  }
+  HX_LOG_INFO(g_logger) << (hooked ? "offload" : "blocking")
+                        << " file io cost=" << cost / 1000
+                        << "ms ticks=" << ticks;
+}
+
+// 错误码要从线程池带回协程, getaddrinfo 也走线程池
+static void TestErrnoAndDns() {
+  hx_sylar::IOManager iom(1, false, "file");
+  iom.schedule([]() {
+    errno = 0;
+    HX_ASSERT(open("/nonexistent/offload", O_RDONLY) == -1);
+    HX_ASSERT(errno == ENOENT);
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    HX_ASSERT(getaddrinfo("localhost", "80", &hints, &res) == 0);
+    HX_ASSERT(res != nullptr);
+    freeaddrinfo(res);
+  });
+  iom.stop();
+  auto stats = hx_sylar::OffloadMgr::GetInstance()->getStats();
+  HX_ASSERT(stats.jobs >= 2);
+  HX_LOG_INFO(g_logger) << "offload jobs=" << stats.jobs
+                        << " inlined=" << stats.inlined
+                        << " max_queue=" << stats.maxQueueUs << "us";
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestErrnoAndDns();
+  BenchFile(false);
+  BenchFile(true);
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/fd_manager.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+/**
+ * 单线程 IOManager 上, 一个协程等 poll/select/epoll_wait,
+ * 另一个每 1ms 醒一次计数; 等待期间计数要涨, 说明只挂起了当前协程
+ */
+static void TestWait() {
+  std::atomic<bool> done(false);
+  std::atomic<int> ticks(0);
+  hx_sylar::IOManager iom(1, false, "poll");
+  iom.schedule([&done, &ticks]() {
+    while (!done) {
+      usleep(1000);
+      ++ticks;
+    }
+  });
+  iom.schedule([&]() {
+    int fds[2];
+    HX_ASSERT(pipe(fds) == 0);
+    auto ctx = hx_sylar::FdMgr::GetInstance()->get(fds[0]);
+    HX_ASSERT(ctx && ctx->isPipe() && !ctx->getUserNonblock());
+    // 用户看到的仍是阻塞的 fd
+    HX_ASSERT((fcntl(fds[0], F_GETFL) & O_NONBLOCK) == 0);
+
+    // poll 超时
+    pollfd pfd{fds[0], POLLIN, 0};
+    int before = ticks;
+    uint64_t start = hx_sylar::Clock::NowMS();
+    HX_ASSERT(poll(&pfd, 1, 50) == 0);
+    uint64_t cost = hx_sylar::Clock::NowMS() - start;
+    HX_ASSERT(cost >= 49 && cost < 500);
+    HX_ASSERT(ticks - before >= 10);
+
+    // 另一个协程写入后 poll 返回
+    hx_sylar::IOManager::GetThis()->addTimer(20, [fds]() {
+      HX_ASSERT(write(fds[1], "x", 1) == 1);
+    });
+    before = ticks;
+    HX_ASSERT(poll(&pfd, 1, -1) == 1 && (pfd.revents & POLLIN) != 0);
+    HX_ASSERT(ticks - before >= 5);
+
+    // 阻塞 read 有数据时直接返回, 没有数据时挂起
+    char c = 0;
+    HX_ASSERT(read(fds[0], &c, 1) == 1 && c == 'x');
+    hx_sylar::IOManager::GetThis()->addTimer(20, [fds]() {
+      HX_ASSERT(write(fds[1], "y", 1) == 1);
+    });
+    HX_ASSERT(read(fds[0], &c, 1) == 1 && c == 'y');
+
+    // select 超时会写回剩余时间
+    fd_set rset;
+    FD_ZERO(&rset);
+    FD_SET(fds[0], &rset);
+    timeval tv{0, 30 * 1000};
+    HX_ASSERT(select(fds[0] + 1, &rset, nullptr, nullptr, &tv) == 0);
+    HX_ASSERT(!FD_ISSET(fds[0], &rset) && tv.tv_sec == 0 && tv.tv_usec == 0);
+    HX_ASSERT(write(fds[1], "z", 1) == 1);
+    FD_SET(fds[0], &rset);
+    fd_set wset;
+    FD_ZERO(&wset);
+    FD_SET(fds[1], &wset);
+    tv = timeval{1, 0};
+    HX_ASSERT(select(fds[1] + 1, &rset, &wset, nullptr, &tv) == 2);
+    HX_ASSERT(FD_ISSET(fds[0], &rset) && FD_ISSET(fds[1], &wset));
+    HX_ASSERT(read(fds[0], &c, 1) == 1 && c == 'z');
+
+    // 用户自己的 epoll
+    int epfd = epoll_create1(0);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fds[0];
+    HX_ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev) == 0);
+    HX_ASSERT(epoll_wait(epfd, &ev, 1, 30) == 0);
+    hx_sylar::IOManager::GetThis()->addTimer(20, [fds]() {
+      HX_ASSERT(write(fds[1], "w", 1) == 1);
+    });
+    before = ticks;
+    HX_ASSERT(epoll_wait(epfd, &ev, 1, 1000) == 1 && ev.data.fd == fds[0]);
+    HX_ASSERT(ticks - before >= 5);
+    close(epfd);
+
+    // dup 继承超时, dup2 覆盖的 fd 先释放
+    ctx->setTimeout(SO_RCVTIMEO, 30);
+    int fd2 = dup(fds[0]);
+    auto ctx2 = hx_sylar::FdMgr::GetInstance()->get(fd2);
+    HX_ASSERT(ctx2 && ctx2->getTimeout(SO_RCVTIMEO) == 30);
+    HX_ASSERT(read(fd2, &c, 1) == 1 && c == 'w');
+    HX_ASSERT(read(fd2, &c, 1) == -1 && errno == ETIMEDOUT);
+    int fd3 = dup(fds[1]);
+    HX_ASSERT(dup2(fds[0], fd3) == fd3);
+    auto ctx3 = hx_sylar::FdMgr::GetInstance()->get(fd3);
+    HX_ASSERT(ctx3 && ctx3->getTimeout(SO_RCVTIMEO) == 30);
+    close(fd2);
+    close(fd3);
+    close(fds[0]);
+    close(fds[1]);
+
+    // socketpair 与 pipe2(O_NONBLOCK)
+    int sv[2];
+    HX_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    hx_sylar::IOManager::GetThis()->addTimer(20, [sv]() {
+      HX_ASSERT(send(sv[1], "s", 1, 0) == 1);
+    });
+    HX_ASSERT(recv(sv[0], &c, 1, 0) == 1 && c == 's');
+    close(sv[0]);
+    close(sv[1]);
+    HX_ASSERT(pipe2(fds, O_NONBLOCK) == 0);
+    HX_ASSERT(read(fds[0], &c, 1) == -1 && errno == EAGAIN);
+    close(fds[0]);
+    close(fds[1]);
+
+    HX_LOG_INFO(g_logger) << "poll ticks=" << ticks;
+    done = true;
+  });
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestWait();
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/scheduler.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static const char* kNames[] = {"HIGH", "NORMAL", "LOW"};
+
+static void Burn(uint64_t us) {
+  uint64_t start = hx_sylar::Clock::NowUS();
+  while (hx_sylar::Clock::NowUS() - start < us) {
+  }
+}
+
+// 同时排队的三种任务: HIGH 先跑完, LOW 也不会一直排在最后
+void test_order() {
+  hx_sylar::Scheduler sc(1, false, "prio");
+  sc.start();
+  std::atomic<bool> started(false);
+  std::atomic<bool> released(false);
+  // 普通 Scheduler 里 hook 的 usleep 不可用, 忙等占住线程直到全部任务入队
+  sc.schedule([&started, &released]() {
+    started = true;
+    while (!released) {
+    }
+  });
+  while (!started) {
+    usleep(1000);
+  }
+
+  const int kEach = 32;
+  hx_sylar::Mutex mutex;
+  std::vector<int> order;
+  for (int i = 0; i < kEach; ++i) {
+    for (auto prio : {hx_sylar::Scheduler::LOW, hx_sylar::Scheduler::NORMAL,
+                      hx_sylar::Scheduler::HIGH}) {
+      sc.schedule(
+          [&mutex, &order, prio]() {
+            hx_sylar::Mutex::Lock lock(mutex);
+            order.push_back(prio);
+          },
+          -1, prio);
+    }
+  }
+  released = true;
+  sc.stop();
+
+  HX_ASSERT(order.size() == kEach * 3);
+  HX_ASSERT(order[0] == hx_sylar::Scheduler::HIGH);
+  size_t last_high = 0;
+  size_t first_low = order.size();
+  size_t last_normal = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (order[i] == hx_sylar::Scheduler::HIGH) {
+      last_high = i;
+    } else if (order[i] == hx_sylar::Scheduler::LOW) {
+      first_low = std::min(first_low, i);
+    } else {
+      last_normal = i;
+    }
+  }
+  // HIGH 排满时 NORMAL 每 4 次分到 1 次, LOW 每 16 次分到 1 次
+  HX_ASSERT(last_high < last_normal);
+  HX_ASSERT(first_low < last_high);
+  auto low = sc.getPriorityStats(hx_sylar::Scheduler::LOW);
+  HX_ASSERT(low.depth == 0 && low.run == kEach);
+  HX_LOG_INFO(g_logger) << "order ok last_high=" << last_high
+                        << " first_low=" << first_low
+                        << " last_normal=" << last_normal;
+}
+
+/**
+ * 一个线程上压着 200us 一个的批处理任务, 外部每 2ms 投递一个探测任务,
+ * 对比探测任务和批处理同级, 以及探测 HIGH、批处理 LOW 时的排队时间
+ */
+void bench_probe(hx_sylar::Scheduler::Priority bulk,
+                 hx_sylar::Scheduler::Priority probe) {
+  const int kBulk = 2000;
+  const int kProbes = 100;
+  hx_sylar::Scheduler sc(1, false, "prio");
+  sc.start();
+  for (int i = 0; i < kBulk; ++i) {
+    sc.schedule([]() { Burn(200); }, -1, bulk);
+  }
+  for (int i = 0; i < kProbes; ++i) {
+    sc.schedule([]() {}, -1, probe);
+    usleep(2000);
+  }
+  sc.stop();
+  auto stats = sc.getPriorityStats(probe);
+  HX_ASSERT(stats.run == (bulk == probe ? kBulk + kProbes : kProbes));
+  HX_LOG_INFO(g_logger) << "bulk=" << kNames[bulk] << " probe=" << kNames[probe]
+                        << " avg_wait=" << stats.waitUs / stats.run
+                        << "us max_wait=" << stats.maxWaitUs << "us";
+}
+
+auto main(int argc, char** argv) -> int {
+  test_order();
+  bench_probe(hx_sylar::Scheduler::NORMAL, hx_sylar::Scheduler::NORMAL);
+  bench_probe(hx_sylar::Scheduler::LOW, hx_sylar::Scheduler::HIGH);
+  return 0;
+}
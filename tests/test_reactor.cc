@@ -0,0 +1,232 @@
+#include <atomic>
+#include <thread>
+
+#include "../hx_sylar/config.h"
+#include "../hx_sylar/fd_manager.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/socket.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static void Echo(hx_sylar::Socket::ptr client) {
+  char buf[64];
+  while (true) {
+    int n = client->recv(buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    if (client->send(buf, n) != n) {
+      break;
+    }
+  }
+}
+
+// epoll_et 表示 epoll 引擎加上 iomanager.persistent_et
+static void SetEngine(const std::string& engine) {
+  bool et = engine == "epoll_et";
+  hx_sylar::Config::Lookup<std::string>("iomanager.io_engine")
+      ->setValue(et ? "epoll" : engine);
+  hx_sylar::Config::Lookup<bool>("iomanager.persistent_et")->setValue(et);
+}
+
+// 回环上的小包 echo, 每个连接串行收发,
+// 对比共享 epoll 与每线程 epoll, 以及 epoll 与 io_uring 引擎
+static void BenchEcho(const std::string& engine, bool multi_reactor,
+                      size_t threads) {
+  const int kClients = 32;
+  const int kRounds = 1000;
+  hx_sylar::Config::Lookup<bool>("iomanager.multi_reactor")
+      ->setValue(multi_reactor);
+  SetEngine(engine);
+
+  std::atomic<int> clients(kClients);
+  std::atomic<int64_t> rounds(0);
+  std::pair<uint64_t, uint64_t> stats;
+  uint64_t ctls = 0;
+  std::pair<uint64_t, uint64_t> tickles;
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::IOManager iom(threads, false, "reactor");
+    HX_ASSERT(iom.isMultiReactor() == multi_reactor);
+    // socket 要在调度线程里创建, hook 才会接管
+    iom.schedule([&]() {
+      auto listener = hx_sylar::Socket::CreateTCPSocket();
+      HX_ASSERT(listener->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+      HX_ASSERT(listener->listen());
+      auto addr = listener->getLocalAddress();
+      for (int i = 0; i < kClients; ++i) {
+        iom.schedule([&, addr]() {
+          auto sock = hx_sylar::Socket::CreateTCPSocket();
+          HX_ASSERT(sock->connect(addr));
+          char req[32] = "ping";
+          char rsp[32];
+          for (int k = 0; k < kRounds; ++k) {
+            HX_ASSERT(sock->send(req, sizeof(req)) == sizeof(req));
+            size_t got = 0;
+            while (got < sizeof(rsp)) {
+              int n = sock->recv(rsp + got, sizeof(rsp) - got);
+              HX_ASSERT(n > 0);
+              got += n;
+            }
+            ++rounds;
+          }
+          sock->close();
+          if (--clients == 0) {
+            listener->close();
+          }
+        });
+      }
+      while (auto client = listener->accept()) {
+        iom.schedule([client]() { Echo(client); });
+      }
+    });
+    iom.stop();
+    stats = iom.getUringStats();
+    ctls = iom.getEpollCtlCount();
+    tickles = iom.getTickleStats();
+  }
+  uint64_t used = hx_sylar::GetCurrentUS() - start;
+  HX_ASSERT(rounds == kClients * kRounds);
+  HX_LOG_INFO(g_logger) << engine << (multi_reactor ? " multi " : " shared")
+                        << " reactor threads=" << threads
+                        << " rounds=" << rounds << " used=" << used << "us"
+                        << " req/s=" << rounds * 1000000 / (used + 1)
+                        << " io_uring_enter=" << stats.first
+                        << " sqes=" << stats.second
+                        << " epoll_ctl/req=" << ctls * 1.0 / rounds
+                        << " tickle sent=" << tickles.first
+                        << " suppressed=" << tickles.second;
+}
+
+// 接收超时、对端 close 和本端 close 都要能把挂起的 recv 唤醒
+static void TestTimeout(const std::string& engine) {
+  hx_sylar::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(false);
+  SetEngine(engine);
+  hx_sylar::IOManager iom(1, false, "timeout");
+  iom.schedule([&]() {
+    auto listener = hx_sylar::Socket::CreateTCPSocket();
+    HX_ASSERT(listener->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+    HX_ASSERT(listener->listen());
+    auto sock = hx_sylar::Socket::CreateTCPSocket();
+    HX_ASSERT(sock->connect(listener->getLocalAddress()));
+    auto peer = listener->accept();
+    HX_ASSERT(peer);
+
+    char buf[8];
+    sock->setRecvTimeout(100);
+    uint64_t start = hx_sylar::GetCurrentMS();
+    HX_ASSERT(sock->recv(buf, sizeof(buf)) == -1 && errno == ETIMEDOUT);
+    uint64_t used = hx_sylar::GetCurrentMS() - start;
+    HX_ASSERT1(used >= 90 && used < 1000, "used=" << used);
+
+    sock->setRecvTimeout(-1);
+    iom.schedule([peer]() { peer->close(); });
+    HX_ASSERT(sock->recv(buf, sizeof(buf)) == 0);
+
+    // 本端 close 取消挂起的 recv
+    auto sock2 = hx_sylar::Socket::CreateTCPSocket();
+    HX_ASSERT(sock2->connect(listener->getLocalAddress()));
+    auto peer2 = listener->accept();
+    iom.schedule([sock2]() { sock2->close(); });
+    HX_ASSERT(sock2->recv(buf, sizeof(buf)) == -1 && errno == EBADF);
+    listener->close();
+    HX_LOG_INFO(g_logger) << engine << " timeout ok, used=" << used << "ms";
+  });
+}
+
+// recvfrom/sendto 和 accept4 在各个引擎下都能用, io_uring 引擎下也走提交队列
+static void TestDatagram(const std::string& engine) {
+  hx_sylar::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(false);
+  SetEngine(engine);
+  std::pair<uint64_t, uint64_t> stats;
+  {
+    hx_sylar::IOManager iom(1, false, "datagram");
+    iom.schedule([&]() {
+      auto server = hx_sylar::Socket::CreateUDPSocket();
+      HX_ASSERT(server->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+      auto addr = server->getLocalAddress();
+      auto client = hx_sylar::Socket::CreateUDPSocket();
+      // recvFrom 先挂起, 再由 sendTo 唤醒
+      iom.schedule([client, addr]() {
+        HX_ASSERT(client->sendTo("ping", 4, addr) == 4);
+      });
+      char buf[16];
+      auto from = std::make_shared<hx_sylar::IPv4Address>();
+      HX_ASSERT(server->recvFrom(buf, sizeof(buf), from) == 4);
+      HX_ASSERT(std::string(buf, 4) == "ping");
+      // 客户端没有 bind, 本端地址是 0.0.0.0, 只比较端口
+      HX_ASSERT(from->getPort() ==
+                std::dynamic_pointer_cast<hx_sylar::IPv4Address>(
+                    client->getLocalAddress())
+                    ->getPort());
+
+      auto listener = hx_sylar::Socket::CreateTCPSocket();
+      HX_ASSERT(listener->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+      HX_ASSERT(listener->listen());
+      auto laddr = listener->getLocalAddress();
+      iom.schedule([laddr]() {
+        auto sock = hx_sylar::Socket::CreateTCPSocket();
+        HX_ASSERT(sock->connect(laddr));
+      });
+      int fd = accept4(listener->getSocket(), nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      HX_ASSERT(fd >= 0);
+      HX_ASSERT(hx_sylar::FdMgr::GetInstance()->get(fd)->getUserNonblock());
+      close(fd);
+      listener->close();
+    });
+    iom.stop();
+    stats = iom.getUringStats();
+  }
+  HX_LOG_INFO(g_logger) << engine << " datagram ok, sqes=" << stats.second;
+}
+
+// 外部线程成批投递小任务, 统计实际写 eventfd 和被合并掉的唤醒
+static void BenchWakeup(size_t threads) {
+  hx_sylar::Config::Lookup<bool>("iomanager.multi_reactor")->setValue(false);
+  SetEngine("epoll");
+  const int kBatches = 2000;
+  const int kBatch = 16;
+  std::atomic<int> done(0);
+  std::pair<uint64_t, uint64_t> tickles;
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::IOManager iom(threads, false, "wakeup");
+    for (int i = 0; i < kBatches; ++i) {
+      for (int k = 0; k < kBatch; ++k) {
+        iom.schedule([&done]() { ++done; });
+      }
+      // 让调度线程有机会睡回去
+      if (i % 10 == 9) {
+        usleep(1000);
+      }
+    }
+    while (done < kBatches * kBatch) {
+      usleep(1000);
+    }
+    tickles = iom.getTickleStats();
+  }
+  uint64_t used = hx_sylar::GetCurrentUS() - start;
+  HX_LOG_INFO(g_logger) << "wakeup threads=" << threads
+                        << " tasks=" << kBatches * kBatch << " used=" << used
+                        << "us tickle sent=" << tickles.first
+                        << " suppressed=" << tickles.second;
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  size_t cores = std::max(2U, std::thread::hardware_concurrency());
+  // 内核不支持 io_uring 时自动回退到 epoll
+  BenchWakeup(1);
+  BenchWakeup(cores);
+  for (const char* engine : {"epoll", "epoll_et", "io_uring"}) {
+    TestTimeout(engine);
+    TestDatagram(engine);
+    for (size_t threads : {static_cast<size_t>(1), cores}) {
+      BenchEcho(engine, false, threads);
+      BenchEcho(engine, true, threads);
+    }
+  }
+  return 0;
+}
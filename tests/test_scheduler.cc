@@ -1,7 +1,13 @@
+#include <atomic>
+#include <sstream>
+#include <thread>
+
 #include "../hx_sylar/hx_sylar.h"
 #include "../hx_sylar/scheduler.h"
 
 static hx_sylar::Logger::ptr g_logger = HX_LOG_NAME("system");
+/// 压测和 TestPinned 的结果, 不受 system 日志级别影响
+static hx_sylar::Logger::ptr g_result_logger = HX_LOG_ROOT();
 
 void TestFiber() {
   HX_LOG_INFO(g_logger) << "test in fiber ";
@@ -11,6 +17,65 @@ void TestFiber() {
     hx_sylar::Scheduler::GetThis()->schedule(&TestFiber);
   }
 }
+
+// 每个任务再派生子任务, 子任务进入本线程队列, 空闲线程靠窃取分担
+static void Spawn(std::atomic<int64_t>* done, int depth) {
+  if (depth > 0) {
+    auto* sc = hx_sylar::Scheduler::GetThis();
+    for (int i = 0; i < 4; ++i) {
+      sc->schedule([done, depth]() { Spawn(done, depth - 1); });
+    }
+  }
+  ++(*done);
+}
+
+static void BenchScaling(size_t threads) {
+  const int kRoots = 200;
+  const int kDepth = 5;  // 每个根任务 1 + 4 + ... + 4^5 = 1365 个任务
+  std::atomic<int64_t> done(0);
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::Scheduler sc(threads, false, "bench");
+    sc.start();
+    for (int i = 0; i < kRoots; ++i) {
+      sc.schedule([&done]() { Spawn(&done, kDepth); });
+    }
+    sc.stop();
+  }
+  uint64_t used = hx_sylar::GetCurrentUS() - start;
+  HX_ASSERT(done == kRoots * 1365);
+  HX_LOG_INFO(g_result_logger) << "threads=" << threads << " tasks=" << done
+                        << " used=" << used << "us"
+                        << " tasks/s=" << done * 1000000 / (used + 1);
+}
+
+// 指定线程的任务一定在该线程上执行
+static void TestPinned() {
+  hx_sylar::Scheduler sc(3, false, "pinned");
+  sc.start();
+  // 等线程都进入调度循环
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::stringstream ss;
+  sc.dump(ss);
+  HX_LOG_INFO(g_result_logger) << ss.str();
+  std::atomic<int> wrong(0);
+  std::atomic<int> count(0);
+  int target = sc.getThreadIds().back();
+  for (int i = 0; i < 1000; ++i) {
+    sc.schedule(
+        [&, target]() {
+          if (hx_sylar::GetThreadId() != target) {
+            ++wrong;
+          }
+          ++count;
+        },
+        target);
+  }
+  sc.stop();
+  HX_ASSERT(count == 1000 && wrong == 0);
+  HX_LOG_INFO(g_result_logger) << "pinned ok";
+}
+
 auto main() -> int {
   HX_LOG_INFO(g_logger) << " main start ";
   hx_sylar::Scheduler sc(3, true, "test");
@@ -19,5 +84,13 @@ auto main() -> int {
   HX_LOG_INFO(g_logger) << "scheduler ";
   sc.schedule(&TestFiber);
   sc.stop();
+
+  // 调度器每次唤醒都打日志, 压测时关掉
+  g_logger->setLevel(hx_sylar::LogLevel::ERROR);
+  TestPinned();
+  size_t cores = std::max(1U, std::thread::hardware_concurrency());
+  for (size_t n = 1; n <= cores * 2; n *= 2) {
+    BenchScaling(n);
+  }
   return 0;
 }
@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include <atomic>
+#include <fstream>
+#include <vector>
+
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static std::atomic<int> s_parked(0);
+static hx_sylar::Mutex s_mutex;
+static std::vector<hx_sylar::Fiber::ptr> s_fibers;
+
+// 常驻内存(KB)
+static auto GetRssKB() -> long {
+  std::ifstream ifs("/proc/self/statm");
+  long size = 0;
+  long rss = 0;
+  ifs >> size >> rss;
+  return rss * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+// 模拟处理请求时较深的调用栈
+static void __attribute__((noinline)) HandleRequest() {
+  char buf[32 * 1024];
+  memset(buf, 1, sizeof(buf));
+  HX_ASSERT(buf[sizeof(buf) - 1] == 1);
+}
+
+// 模拟一个空闲长连接: 处理完一个请求后挂起等待下一个
+static void IdleConn() {
+  HandleRequest();
+  char buf[2048];
+  memset(buf, 1, sizeof(buf));
+  {
+    hx_sylar::Mutex::Lock lock(s_mutex);
+    s_fibers.push_back(hx_sylar::Fiber::GetThis());
+  }
+  ++s_parked;
+  hx_sylar::Fiber::YieldToHold();
+  HX_ASSERT(buf[sizeof(buf) - 1] == 1);
+}
+
+static void BenchIdle(bool shared, int conns) {
+  s_parked = 0;
+  s_fibers.clear();
+  long before = GetRssKB();
+  hx_sylar::IOManager iom(1, false, shared ? "shared" : "private");
+  iom.setSharedStack(shared);
+  for (int i = 0; i < conns; ++i) {
+    iom.schedule(&IdleConn);
+  }
+  while (s_parked < conns) {
+    usleep(10 * 1000);
+  }
+  long after = GetRssKB();
+  HX_LOG_INFO(g_logger) << (shared ? "shared" : "private")
+                        << " conns=" << conns << " rss=" << after - before
+                        << "KB per_conn=" << (after - before) * 1024.0 / conns
+                        << "B";
+  iom.schedule(s_fibers.begin(), s_fibers.end());
+}
+
+static void BenchSwitch(bool shared, int rounds) {
+  uint64_t start = hx_sylar::GetCurrentUS();
+  {
+    hx_sylar::IOManager iom(1, false, shared ? "shared" : "private");
+    iom.setSharedStack(shared);
+    for (int i = 0; i < 2; ++i) {
+      iom.schedule([rounds]() {
+        char buf[1024];
+        memset(buf, 0, sizeof(buf));
+        for (int k = 0; k < rounds; ++k) {
+          hx_sylar::Fiber::YieldToReady();
+        }
+      });
+    }
+  }
+  HX_LOG_INFO(g_logger) << (shared ? "shared" : "private")
+                        << " yields=" << rounds * 2
+                        << " used=" << hx_sylar::GetCurrentUS() - start << "us";
+}
+
+auto main(int argc, char** argv) -> int {
+  int conns = argc > 1 ? atoi(argv[1]) : 10000;
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  HX_LOG_NAME("root")->setLevel(hx_sylar::LogLevel::INFO);
+  BenchIdle(false, conns);
+  BenchIdle(true, conns);
+  BenchSwitch(false, 10000);
+  BenchSwitch(true, 10000);
+  return 0;
+}
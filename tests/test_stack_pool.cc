@@ -0,0 +1,58 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "../hx_sylar/fiber.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/stack_pool.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+void test_reuse() {
+  size_t size = hx_sylar::StackPool::RoundSize(100 * 1024);
+  void* a = hx_sylar::StackPool::Alloc(size);
+  hx_sylar::StackPool::Dealloc(a, size);
+  void* b = hx_sylar::StackPool::Alloc(size);
+  HX_ASSERT(a == b);
+  hx_sylar::StackPool::Dealloc(b, size);
+  HX_LOG_INFO(g_logger) << "reuse size=" << size
+                        << " cached=" << hx_sylar::StackPool::CachedCount();
+}
+
+// 子进程写保护页, 应该收到 SIGSEGV
+void test_guard_page() {
+  size_t size = hx_sylar::StackPool::RoundSize(64 * 1024);
+  char* stack = static_cast<char*>(hx_sylar::StackPool::Alloc(size));
+  pid_t pid = fork();
+  if (pid == 0) {
+    stack[-1] = 1;
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  HX_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+  HX_LOG_INFO(g_logger) << "guard page ok";
+  hx_sylar::StackPool::Dealloc(stack, size);
+}
+
+void test_fiber_churn() {
+  hx_sylar::Fiber::GetThis();
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  uint64_t start = hx_sylar::GetCurrentUS();
+  for (int i = 0; i < 10000; ++i) {
+    hx_sylar::Fiber::ptr fiber(new hx_sylar::Fiber([]() {}, 0, true));
+    fiber->call();
+  }
+  HX_LOG_INFO(g_logger) << "create/destroy 10000 fibers used="
+                        << hx_sylar::GetCurrentUS() - start
+                        << "us cached=" << hx_sylar::StackPool::CachedCount();
+}
+
+auto main(int argc, char** argv) -> int {
+  test_reuse();
+  test_guard_page();
+  test_fiber_churn();
+  return 0;
+}
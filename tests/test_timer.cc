@@ -0,0 +1,231 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <vector>
+
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/timer.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+/// 不依赖 IOManager, 直接驱动定时器管理器
+class TestTimers : public hx_sylar::TimerManager {
+ public:
+  int fronts = 0;
+
+  /// 跑完所有到期的回调, 返回个数
+  auto run() -> size_t {
+    std::vector<std::function<void()> > cbs;
+    listExpiredCb(cbs);
+    for (auto& cb : cbs) {
+      cb();
+    }
+    return cbs.size();
+  }
+
+ protected:
+  void onTimerInsertedAtFront() override { ++fronts; }
+};
+
+void test_order() {
+  TestTimers tm;
+  std::vector<int> fired;
+  tm.addTimer(30, [&fired]() { fired.push_back(30); });
+  tm.addTimer(10, [&fired]() { fired.push_back(10); });
+  tm.addTimer(300, [&fired]() { fired.push_back(300); });
+  auto canceled = tm.addTimer(20, [&fired]() { fired.push_back(20); });
+  auto recurring = tm.addTimer(
+      50, [&fired]() { fired.push_back(50); }, true);
+  HX_ASSERT(canceled->cancel());
+  HX_ASSERT(!canceled->cancel());
+  HX_ASSERT(tm.getNextTimer() <= 10);
+
+  uint64_t start = hx_sylar::Clock::NowMS();
+  while (hx_sylar::Clock::NowMS() - start < 400) {
+    uint64_t next = tm.getNextTimer();
+    usleep(std::min<uint64_t>(next, 5) * 1000);
+    tm.run();
+  }
+  HX_ASSERT(recurring->cancel());
+  HX_ASSERT(!tm.hasTimer());
+
+  // 10 30 50 100 150 200 250 300 350 ..., 300 与同一刻的循环定时器先后不定
+  HX_ASSERT(fired.size() >= 9);
+  HX_ASSERT(fired[0] == 10 && fired[1] == 30 && fired[2] == 50);
+  int count300 = 0;
+  for (int v : fired) {
+    HX_ASSERT(v == 10 || v == 30 || v == 50 || v == 300);
+    count300 += v == 300;
+  }
+  HX_ASSERT(count300 == 1);
+  HX_LOG_INFO(g_logger) << "order ok fired=" << fired.size()
+                        << " fronts=" << tm.fronts;
+}
+
+void test_reset() {
+  TestTimers tm;
+  int fired = 0;
+  auto timer = tm.addTimer(1000 * 1000, [&fired]() { ++fired; });
+  // 落在高层的定时器也能被取消和重置
+  HX_ASSERT(tm.getNextTimer() <= 1000 * 1000);
+  HX_ASSERT(timer->reset(20, true));
+  usleep(30 * 1000);
+  HX_ASSERT(tm.run() == 1);
+  HX_ASSERT(fired == 1);
+  HX_ASSERT(!timer->refresh());
+  HX_ASSERT(tm.getNextTimer() == ~0ull);
+  HX_LOG_INFO(g_logger) << "reset ok";
+}
+
+// 跨越第 0/1 层边界的随机定时器: 不能早到, 也不能晚太多
+void test_accuracy() {
+  TestTimers tm;
+  std::mt19937 rng(2);
+  std::vector<hx_sylar::Timer::ptr> timers;
+  int fired = 0;
+  int canceled = 0;
+  uint64_t max_late = 0;
+  for (int i = 0; i < 2000; ++i) {
+    uint64_t ms = rng() % 1500;
+    uint64_t deadline = hx_sylar::Clock::NowMS() + ms;
+    timers.push_back(tm.addTimer(ms, [&, deadline]() {
+      uint64_t now = hx_sylar::Clock::NowMS();
+      HX_ASSERT(now >= deadline);
+      max_late = std::max(max_late, now - deadline);
+      ++fired;
+    }));
+  }
+  for (size_t i = 0; i < timers.size(); i += 3) {
+    canceled += timers[i]->cancel();
+  }
+  while (tm.hasTimer()) {
+    usleep(std::min<uint64_t>(tm.getNextTimer(), 10) * 1000);
+    tm.run();
+  }
+  HX_ASSERT(fired + canceled == 2000);
+  HX_ASSERT(max_late < 50);
+  HX_LOG_INFO(g_logger) << "accuracy ok fired=" << fired
+                        << " max_late=" << max_late << "ms";
+}
+
+/**
+ * 在 IOManager 里连续睡 300us, 统计平均晚到多少.
+ * ms 精度下 epoll_wait 向上取整到 1ms, us 精度下由 epoll_pwait2 按微秒唤醒
+ */
+void test_precision(const std::string& precision) {
+  hx_sylar::Config::Lookup<std::string>("iomanager.timer_precision")
+      ->setValue(precision);
+  const int rounds = 200;
+  uint64_t total_late = 0;
+  {
+    hx_sylar::IOManager iom(1, false);
+    iom.schedule([&total_late]() {
+      for (int i = 0; i < rounds; ++i) {
+        uint64_t start = hx_sylar::Clock::NowUS();
+        usleep(300);
+        uint64_t elapsed = hx_sylar::Clock::NowUS() - start;
+        HX_ASSERT(elapsed >= 300 && elapsed < 100 * 1000);
+        uint64_t late = elapsed - 300;
+        total_late += late;
+      }
+    });
+  }
+  HX_LOG_INFO(g_logger) << "precision=" << precision
+                        << " avg late=" << total_late / rounds << "us";
+  hx_sylar::Config::Lookup<std::string>("iomanager.timer_precision")
+      ->setValue("ms");
+}
+
+/**
+ * 2000 个 200ms 的超时, 起点在约 200ms 内陆续产生, 模拟不断建立的连接.
+ * 统计 IOManager 因为超时醒来的次数和到期处理的耗时
+ */
+void test_slack(uint64_t slack_ms) {
+  std::atomic<int> fired(0);
+  std::pair<uint64_t, uint64_t> wakeups;
+  hx_sylar::TimerManager::Stats stats;
+  {
+    hx_sylar::IOManager iom(1, false);
+    for (int i = 0; i < 2000; ++i) {
+      iom.addTimer(200, [&fired]() { ++fired; }, false, slack_ms);
+      if (i % 10 == 9) {
+        usleep(1000);
+      }
+    }
+    while (fired < 2000) {
+      usleep(10 * 1000);
+    }
+    wakeups = iom.getWakeupStats();
+    stats = iom.getStats();
+  }
+  HX_LOG_INFO(g_logger) << "slack=" << slack_ms << "ms wakeups=" << wakeups.first
+                        << " timeout_wakeups=" << wakeups.second
+                        << " passes=" << stats.passes
+                        << " expired=" << stats.expired
+                        << " expire_cost=" << stats.expireUs << "us";
+}
+
+/**
+ * 1M 个未到期的定时器 (1s~60s) 常驻, 再反复添加并取消,
+ * 模拟 do_io 每次 EAGAIN 都挂一个超时又马上撤掉
+ */
+void bench_churn(size_t outstanding, size_t churn) {
+  TestTimers tm;
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<uint64_t> dist(1000, 60 * 1000);
+  std::vector<hx_sylar::Timer::ptr> timers;
+  timers.reserve(outstanding);
+
+  uint64_t t0 = hx_sylar::Clock::NowUS();
+  for (size_t i = 0; i < outstanding; ++i) {
+    timers.push_back(tm.addTimer(dist(rng), []() {}));
+  }
+  uint64_t t1 = hx_sylar::Clock::NowUS();
+  for (size_t i = 0; i < churn; ++i) {
+    auto timer = tm.addTimer(dist(rng), []() {});
+    timer->cancel();
+  }
+  uint64_t t2 = hx_sylar::Clock::NowUS();
+  for (size_t i = 0; i < churn; ++i) {
+    size_t idx = rng() % outstanding;
+    timers[idx]->cancel();
+    timers[idx] = tm.addTimer(dist(rng), []() {});
+  }
+  uint64_t t3 = hx_sylar::Clock::NowUS();
+  size_t polls = 0;
+  for (size_t i = 0; i < churn / 100; ++i) {
+    tm.getNextTimer();
+    polls += tm.run();
+  }
+  uint64_t t4 = hx_sylar::Clock::NowUS();
+  for (auto& timer : timers) {
+    timer->cancel();
+  }
+  uint64_t t5 = hx_sylar::Clock::NowUS();
+  HX_ASSERT(!tm.hasTimer());
+
+  auto rate = [](size_t n, uint64_t us) { return n * 1000.0 / (us + 1); };
+  HX_LOG_INFO(g_logger) << "outstanding=" << outstanding << " insert "
+                        << rate(outstanding, t1 - t0) << " k/s";
+  HX_LOG_INFO(g_logger) << "add+cancel churn " << rate(churn, t2 - t1)
+                        << " k/s, cancel+re-add " << rate(churn, t3 - t2)
+                        << " k/s";
+  HX_LOG_INFO(g_logger) << "poll " << (t4 - t3) * 100.0 / churn
+                        << " us/call fired=" << polls << ", cancel all "
+                        << rate(outstanding, t5 - t4) << " k/s";
+}
+
+auto main(int argc, char** argv) -> int {
+  test_order();
+  test_reset();
+  test_accuracy();
+  test_precision("ms");
+  test_precision("us");
+  test_slack(0);
+  test_slack(50);
+  size_t outstanding = argc > 1 ? atoi(argv[1]) : 1000 * 1000;
+  bench_churn(outstanding, 1000 * 1000);
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include <atomic>
+#include <string>
+
+#include "../hx_sylar/bytearray.h"
+#include "../hx_sylar/clock.h"
+#include "../hx_sylar/datagram.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/socket.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static const size_t kBurst = 32;
+static const size_t kPayload = 64;
+static const int kRounds = 3000;
+
+enum Mode { SINGLE, BATCH, GSO };
+
+static auto Bind(hx_sylar::Socket::ptr sock) -> hx_sylar::Address::ptr {
+  HX_ASSERT(sock->bind(hx_sylar::IPv4Address::Create("127.0.0.1", 0)));
+  return sock->getLocalAddress();
+}
+
+/**
+ * 每轮发 kBurst 个数据报再全部收回来, 不会超过接收缓冲区而丢包.
+ * SINGLE 每个数据报一次 sendto/recvfrom, BATCH 每轮一次 sendmmsg/recvmmsg,
+ * GSO 每轮一次 sendmsg 由内核切分, 接收端打开 GRO
+ */
+static void Bench(Mode mode) {
+  auto tx = hx_sylar::Socket::CreateUDPSocket();
+  auto rx = hx_sylar::Socket::CreateUDPSocket();
+  Bind(tx);
+  auto to = Bind(rx);
+  bool gro = mode == GSO && rx->setUdpGro(true);
+
+  std::string payload(kPayload, 'p');
+  hx_sylar::DatagramBatch out(kBurst, kPayload * kBurst);
+  hx_sylar::DatagramBatch in(kBurst, 65536);
+  if (mode == BATCH) {
+    for (size_t i = 0; i < kBurst; ++i) {
+      HX_ASSERT(out.add(payload.data(), payload.size(), to));
+    }
+  } else if (mode == GSO) {
+    std::string burst(kPayload * kBurst, 'g');
+    HX_ASSERT(out.add(burst.data(), burst.size(), to, kPayload));
+  }
+
+  char buf[kPayload];
+  auto from = std::make_shared<hx_sylar::IPv4Address>();
+  uint64_t calls = 0;
+  uint64_t start = hx_sylar::Clock::NowUS();
+  for (int r = 0; r < kRounds; ++r) {
+    if (mode == SINGLE) {
+      for (size_t i = 0; i < kBurst; ++i) {
+        HX_ASSERT(tx->sendTo(payload.data(), payload.size(), to) ==
+                  static_cast<int>(kPayload));
+      }
+      calls += kBurst;
+    } else {
+      int n = tx->sendBatch(out);
+      if (n < 0 && mode == GSO && r == 0) {
+        HX_LOG_INFO(g_logger) << "udp gso not supported, skip";
+        return;
+      }
+      HX_ASSERT(n == static_cast<int>(out.size()));
+      ++calls;
+    }
+    size_t got = 0;
+    while (got < kBurst) {
+      if (mode == SINGLE) {
+        HX_ASSERT(rx->recvFrom(buf, sizeof(buf), from) ==
+                  static_cast<int>(kPayload));
+        ++got;
+      } else {
+        int n = rx->recvBatch(in);
+        HX_ASSERT(n > 0);
+        for (int i = 0; i < n; ++i) {
+          got += in.segments(i);
+        }
+      }
+      ++calls;
+    }
+    HX_ASSERT(got == kBurst);
+  }
+  uint64_t cost = hx_sylar::Clock::NowUS() - start;
+  static const char* kNames[] = {"single", "batch", "gso"};
+  HX_LOG_INFO(g_logger) << kNames[mode] << (gro ? "+gro" : "")
+                        << " datagrams=" << kBurst * kRounds
+                        << " syscalls=" << calls << " cost=" << cost / 1000
+                        << "ms pps=" << kBurst * kRounds * 1000000 / cost;
+}
+
+// 协程里 recvBatch 没有数据时挂起, 不占住线程
+static void TestFiber() {
+  hx_sylar::IOManager iom(1, false, "udp");
+  iom.schedule([]() {
+    auto tx = hx_sylar::Socket::CreateUDPSocket();
+    auto rx = hx_sylar::Socket::CreateUDPSocket();
+    auto txaddr = Bind(tx);
+    auto to = Bind(rx);
+    std::atomic<int> ticks(0);
+    hx_sylar::IOManager::GetThis()->schedule([tx, to, &ticks]() {
+      usleep(20 * 1000);
+      ticks = 1;
+      // ByteArray 零拷贝发送, 位置不变
+      auto ba = std::make_shared<hx_sylar::ByteArray>(8);
+      ba->writeStringWithoutLength("hello udp batch");
+      ba->setPosition(0);
+      hx_sylar::DatagramBatch out(4, 16);
+      HX_ASSERT(out.add(ba, to));
+      HX_ASSERT(out.add("x", 1, to));
+      HX_ASSERT(!out.add(std::string(17, 'y').data(), 17, to));
+      HX_ASSERT(tx->sendBatch(out) == 2);
+      HX_ASSERT(ba->getPosition() == 0);
+    });
+    hx_sylar::DatagramBatch in(8, 1500);
+    size_t got = 0;
+    while (got < 2) {
+      int n = rx->recvBatch(in);
+      HX_ASSERT(n > 0 && ticks == 1);
+      for (int i = 0; i < n; ++i, ++got) {
+        HX_ASSERT(in.address(i)->toString() == txaddr->toString());
+        if (got == 0) {
+          auto ba = std::make_shared<hx_sylar::ByteArray>();
+          in.read(i, ba);
+          ba->setPosition(0);
+          HX_ASSERT(ba->toString() == "hello udp batch");
+        } else {
+          HX_ASSERT(in.length(i) == 1 && in.data(i)[0] == 'x');
+        }
+      }
+    }
+    // 接收超时
+    rx->setRecvTimeout(20);
+    HX_ASSERT(rx->recvBatch(in) == -1 && errno == ETIMEDOUT && in.empty());
+  });
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestFiber();
+  hx_sylar::IOManager iom(1, false, "bench");
+  iom.schedule([]() {
+    Bench(SINGLE);
+    Bench(BATCH);
+    Bench(GSO);
+  });
+  return 0;
+}
@@ -0,0 +1,137 @@
+#include <ctype.h>
+
+#include <atomic>
+#include <set>
+#include <string>
+
+#include "../hx_sylar/config.h"
+#include "../hx_sylar/http/udp_server.h"
+#include "../hx_sylar/hx_sylar.h"
+#include "../hx_sylar/iomanager.h"
+#include "../hx_sylar/socket.h"
+
+static hx_sylar::Logger::ptr g_logger = HX_LOG_ROOT();
+
+static hx_sylar::ConfigVar<std::vector<hx_sylar::UdpServerConf> >::ptr
+    g_udp_servers = hx_sylar::Config::Lookup(
+        "udp_servers", std::vector<hx_sylar::UdpServerConf>(), "udp servers");
+
+/// 把收到的内容转成大写发回去, 记下是哪个分片收到的
+class EchoServer : public hx_sylar::UdpServer {
+ public:
+  using ptr = std::shared_ptr<EchoServer>;
+  EchoServer(hx_sylar::IOManager* worker, hx_sylar::IOManager* io_worker)
+      : UdpServer(worker, io_worker) {}
+
+  std::atomic<int> handled{0};
+  hx_sylar::Mutex mutex;
+  std::set<int> shards;
+
+ protected:
+  void handleDatagram(Datagram::ptr dgram) override {
+    std::string s(dgram->data(), dgram->size());
+    for (auto& c : s) {
+      c = toupper(c);
+    }
+    HX_ASSERT(reply(dgram, s.data(), s.size()) == static_cast<int>(s.size()));
+    {
+      hx_sylar::Mutex::Lock lock(mutex);
+      shards.insert(dgram->sock->getSocket());
+    }
+    ++handled;
+  }
+};
+
+static void TestServer() {
+  YAML::Node root = YAML::Load(
+      "udp_servers:\n"
+      "  - address: [\"127.0.0.1:0\"]\n"
+      "    name: echo\n"
+      "    shards: 4\n"
+      "    batch: 16\n"
+      "    buffer_size: 512\n"
+      "    pool_size: 64\n");
+  hx_sylar::Config::LoadFromYaml(root);
+  HX_ASSERT(g_udp_servers->getValue().size() == 1);
+  auto conf = g_udp_servers->getValue()[0];
+  HX_ASSERT(conf.shards == 4 && conf.batch == 16 && conf.gro == 0);
+
+  hx_sylar::IOManager io(2, false, "udp_io");
+  hx_sylar::IOManager worker(1, false, "udp_worker");
+  auto server = std::make_shared<EchoServer>(&worker, &io);
+  server->setConf(conf);
+  auto addr = hx_sylar::Address::LookupAnyIPAddress(conf.address[0]);
+  HX_ASSERT(server->bind(addr));
+  auto socks = server->getSocks();
+  HX_ASSERT(socks.size() == 4);
+  auto local = socks[0]->getLocalAddress();
+  for (auto& s : socks) {
+    HX_ASSERT(s->getLocalAddress()->toString() == local->toString());
+  }
+  HX_ASSERT(server->start());
+  HX_LOG_INFO(g_logger) << server->toString("");
+
+  // 多个客户端 socket, 源端口不同, 内核按四元组分到各个分片
+  const int kClients = 16;
+  const int kPerClient = 50;
+  std::atomic<int> replies(0);
+  for (int c = 0; c < kClients; ++c) {
+    worker.schedule([c, local, &replies]() {
+      auto sock = hx_sylar::Socket::CreateUDPSocket();
+      sock->setRecvTimeout(1000);
+      auto from = std::make_shared<hx_sylar::IPv4Address>();
+      char buf[64];
+      for (int i = 0; i < kPerClient; ++i) {
+        std::string msg = "client" + std::to_string(c) + "-" +
+                          std::to_string(i);
+        HX_ASSERT(sock->sendTo(msg.data(), msg.size(), local) ==
+                  static_cast<int>(msg.size()));
+        int n = sock->recvFrom(buf, sizeof(buf), from);
+        HX_ASSERT(n == static_cast<int>(msg.size()));
+        HX_ASSERT(std::string(buf, n) == "CLIENT" + std::to_string(c) + "-" +
+                                             std::to_string(i));
+        HX_ASSERT(from->toString() == local->toString());
+        ++replies;
+      }
+    });
+  }
+  while (replies < kClients * kPerClient) {
+    usleep(10 * 1000);
+  }
+
+  // 超过 buffer_size 的数据报丢弃, 不回复半截内容
+  std::atomic<bool> done(false);
+  worker.schedule([local, &done]() {
+    auto sock = hx_sylar::Socket::CreateUDPSocket();
+    sock->setRecvTimeout(1000);
+    auto from = std::make_shared<hx_sylar::IPv4Address>();
+    std::string big(600, 'x');
+    HX_ASSERT(sock->sendTo(big.data(), big.size(), local) ==
+              static_cast<int>(big.size()));
+    HX_ASSERT(sock->sendTo("after", 5, local) == 5);
+    char buf[1024];
+    int n = sock->recvFrom(buf, sizeof(buf), from);
+    HX_ASSERT(n == 5 && std::string(buf, n) == "AFTER");
+    done = true;
+  });
+  while (!done) {
+    usleep(10 * 1000);
+  }
+  auto stats = server->getStats();
+  HX_ASSERT(stats.datagrams ==
+            static_cast<uint64_t>(kClients * kPerClient + 1));
+  HX_ASSERT(stats.truncated == 1);
+  HX_ASSERT(stats.poolHits > 0);
+  HX_LOG_INFO(g_logger) << "udp server datagrams=" << stats.datagrams
+                        << " batches=" << stats.batches
+                        << " pool_hits=" << stats.poolHits
+                        << " truncated=" << stats.truncated
+                        << " shards_used=" << server->shards.size();
+  server->stop();
+}
+
+auto main(int argc, char** argv) -> int {
+  HX_LOG_NAME("system")->setLevel(hx_sylar::LogLevel::ERROR);
+  TestServer();
+  return 0;
+}